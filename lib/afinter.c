@@ -30,8 +30,25 @@
 
 typedef struct _AFInterSource AFInterSource;
 
+/* the number of messages processed by a single afinter_source_post() call */
+#define INTERNAL_MSG_POST_BATCH 256
+
+typedef struct _InternalMsgQueueCell
+{
+  /* position the cell is available for: pos when free for the producer
+   * posting into pos, pos + 1 when filled */
+  volatile gint seq;
+  LogMessage *msg;
+} InternalMsgQueueCell;
+
+/* bounded multi-producer single-consumer ring buffer, see below */
+static InternalMsgQueueCell internal_msg_queue[INTERNAL_MSG_QUEUE_SIZE];
+static volatile gint internal_msg_queue_tail;
+static guint internal_msg_queue_head;
+static volatile gint internal_msg_wakeup_pending;
+static StatsCounterItem *internal_msg_dropped;
+
 static GStaticMutex internal_msg_lock = G_STATIC_MUTEX_INIT;
-static GQueue *internal_msg_queue;
 static AFInterSource *current_internal_source;
 
 /* the expiration timer of the next MARK message */
@@ -54,15 +71,21 @@ static GStaticMutex internal_mark_target_lock = G_STATIC_MUTEX_INIT;
  * This is how it works:
  *
  * Whenever a thread decides to send a message using the msg_() API, it puts
- * an entry into the internal_msg_queue under the protection of
- * "internal_msg_lock".
+ * an entry into internal_msg_queue.  This is a bounded ring buffer where
+ * producers reserve a slot by advancing internal_msg_queue_tail with an
+ * atomic compare-and-exchange, and publish the message by setting the
+ * sequence number of the slot, thus error storms where all threads log
+ * don't contend on a lock.  If the ring is full, the message is dropped
+ * and counted.
  *
  * The receiving side of this queue is in the main thread, where the
  * internal() source is operating.  This object will publish a pointer to
  * itself into current_internal_source.  This pointer will be set under the
  * protection of the internal_msg_lock.  The internal source will define an
  * ivykis event, a post is submitted to this event whenever a new message is
- * added to the queue.
+ * added to the queue.  Only the producer that sets
+ * internal_msg_wakeup_pending takes the lock to post the event, the flag
+ * is cleared by the main thread before it starts draining the queue.
  *
  * Once the event arrives to the main loop, it wakes up and feeds all
  * internal messages into the log path.
@@ -97,23 +120,95 @@ struct _AFInterSource
 
 static void afinter_source_update_watches(AFInterSource *self);
 
+static void
+internal_msg_queue_init(void)
+{
+  gint i;
+
+  for (i = 0; i < INTERNAL_MSG_QUEUE_SIZE; i++)
+    internal_msg_queue[i].seq = i;
+}
+
+/* can be called from any thread, returns FALSE if the queue is full */
+static gboolean
+internal_msg_queue_push(LogMessage *msg)
+{
+  InternalMsgQueueCell *cell;
+  guint pos;
+  gint diff;
+
+  pos = (guint) g_atomic_int_get(&internal_msg_queue_tail);
+  while (1)
+    {
+      cell = &internal_msg_queue[pos & (INTERNAL_MSG_QUEUE_SIZE - 1)];
+      diff = (gint) ((guint) g_atomic_int_get(&cell->seq) - pos);
+      if (diff == 0)
+        {
+          /* the cell is free, try to reserve it */
+          if (g_atomic_int_compare_and_exchange(&internal_msg_queue_tail, (gint) pos, (gint) (pos + 1)))
+            break;
+        }
+      else if (diff < 0)
+        {
+          /* the cell still holds a message from the previous round */
+          return FALSE;
+        }
+      pos = (guint) g_atomic_int_get(&internal_msg_queue_tail);
+    }
+  cell->msg = msg;
+  g_atomic_int_set(&cell->seq, (gint) (pos + 1));
+  return TRUE;
+}
+
+/* main thread only */
+static LogMessage *
+internal_msg_queue_pop(void)
+{
+  InternalMsgQueueCell *cell;
+  LogMessage *msg;
+  guint pos = internal_msg_queue_head;
+
+  cell = &internal_msg_queue[pos & (INTERNAL_MSG_QUEUE_SIZE - 1)];
+  if ((guint) g_atomic_int_get(&cell->seq) != pos + 1)
+    return NULL;
+
+  msg = cell->msg;
+  cell->msg = NULL;
+  g_atomic_int_set(&cell->seq, (gint) (pos + INTERNAL_MSG_QUEUE_SIZE));
+  internal_msg_queue_head = pos + 1;
+  return msg;
+}
+
+/* main thread only */
+static gboolean
+internal_msg_queue_is_empty(void)
+{
+  guint pos = internal_msg_queue_head;
+
+  return (guint) g_atomic_int_get(&internal_msg_queue[pos & (INTERNAL_MSG_QUEUE_SIZE - 1)].seq) != pos + 1;
+}
+
 static void
 afinter_source_post(gpointer s)
 {
   AFInterSource *self = (AFInterSource *) s;
   LogMessage *msg;
   LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gint i;
+
+  /* messages posted from now on need a new wakeup */
+  g_atomic_int_set(&internal_msg_wakeup_pending, 0);
 
-  while (log_source_free_to_send(&self->super))
+  for (i = 0; i < INTERNAL_MSG_POST_BATCH && log_source_free_to_send(&self->super); i++)
     {
-      g_static_mutex_lock(&internal_msg_lock);
-      msg = g_queue_pop_head(internal_msg_queue);
-      g_static_mutex_unlock(&internal_msg_lock);
+      msg = internal_msg_queue_pop();
       if (!msg)
         break;
 
       log_pipe_queue(&self->super.super, msg, &path_options);
     }
+
+  /* if the batch was not enough, update_watches reschedules us using restart_task */
   afinter_source_update_watches(self);
 }
 
@@ -201,7 +296,7 @@ afinter_source_update_watches(AFInterSource *self)
     {
       /* ok, we go to sleep now. let's disable the post event by setting
        * current_internal_source to NULL.  Messages get accumulated into
-       * internal_msg_queue.  */
+       * internal_msg_queue, until it fills up.  */
       g_static_mutex_lock(&internal_msg_lock);
       current_internal_source = NULL;
       g_static_mutex_unlock(&internal_msg_lock);
@@ -245,7 +340,7 @@ afinter_source_update_watches(AFInterSource *self)
        */
 
       g_static_mutex_lock(&internal_msg_lock);
-      if (internal_msg_queue && g_queue_get_length(internal_msg_queue) > 0)
+      if (!internal_msg_queue_is_empty())
         iv_task_register(&self->restart_task);
       current_internal_source = self;
       g_static_mutex_unlock(&internal_msg_lock);
@@ -398,28 +493,49 @@ afinter_postpone_mark(gint mark_freq)
     }
 }
 
+/* NOTE: only used by the unit test program to drain the queue without
+ * an internal() source, must be called from a single thread */
+LogMessage *
+afinter_message_pop(void)
+{
+  return internal_msg_queue_pop();
+}
+
 void
 afinter_message_posted(LogMessage *msg)
 {
-  g_static_mutex_lock(&internal_msg_lock);
-  if (!internal_msg_queue)
+  if (!internal_msg_queue_push(msg))
     {
-      internal_msg_queue = g_queue_new();
+      stats_counter_inc(internal_msg_dropped);
+      log_msg_unref(msg);
+      return;
+    }
+
+  /* only the first message after the last drain needs to wake up the
+   * main thread */
+  if (g_atomic_int_compare_and_exchange(&internal_msg_wakeup_pending, 0, 1))
+    {
+      g_static_mutex_lock(&internal_msg_lock);
+      if (current_internal_source)
+        iv_event_post(&current_internal_source->post);
+      else
+        g_atomic_int_set(&internal_msg_wakeup_pending, 0);
+      g_static_mutex_unlock(&internal_msg_lock);
     }
-  g_queue_push_tail(internal_msg_queue, msg);
-  if (current_internal_source)
-    iv_event_post(&current_internal_source->post);
-  g_static_mutex_unlock(&internal_msg_lock);
 }
 
 static void
 afinter_register_posted_hook(gint hook_type, gpointer user_data)
 {
+  stats_lock();
+  stats_register_counter(0, SCS_GLOBAL, "internal_queue", NULL, SC_TYPE_DROPPED, &internal_msg_dropped);
+  stats_unlock();
   msg_set_post_func(afinter_message_posted);
 }
 
 void
 afinter_global_init(void)
 {
+  internal_msg_queue_init();
   register_application_hook(AH_POST_CONFIG_LOADED, afinter_register_posted_hook, NULL);
 }
@@ -28,6 +28,10 @@
 #include "driver.h"
 #include "logsource.h"
 
+/* the number of internal messages waiting for the internal() source,
+ * messages are dropped above this, must be a power of 2 */
+#define INTERNAL_MSG_QUEUE_SIZE 16384
+
 /*
  * This is the actual source driver, linked into the configuration tree.
  */
@@ -39,6 +43,8 @@ typedef struct _AFInterSourceDriver
 } AFInterSourceDriver;
 
 void afinter_postpone_mark(gint mark_freq);
+void afinter_message_posted(LogMessage *msg);
+LogMessage *afinter_message_pop(void);
 LogDriver *afinter_sd_new(void);
 void afinter_global_init(void);
 
@@ -26,8 +26,10 @@
 #include "messages.h"
 #include "children.h"
 #include "dnscache.h"
+#include "dnsresolver.h"
 #include "alarms.h"
 #include "stats.h"
+#include "memaccount.h"
 #include "tags.h"
 #include "logmsg.h"
 #include "logparser.h"
@@ -112,13 +114,13 @@ app_startup(void)
   g_thread_init(NULL);
   afinter_global_init();
   child_manager_init();
-  dns_cache_init();
   alarm_init();
   stats_init();
+  mem_account_init();
+  dns_cache_init();
   tzset();
   log_msg_global_init();
   log_tags_init();
-  log_source_global_init();
   log_template_global_init();
 }
 
@@ -145,7 +147,9 @@ app_shutdown(void)
 {
   run_application_hook(AH_SHUTDOWN);
   log_tags_deinit();
+  mem_account_deinit();
   stats_destroy();
+  dns_resolver_destroy();
   dns_cache_destroy();
   child_manager_deinit();
   g_list_foreach(application_hooks, (GFunc) g_free, NULL);
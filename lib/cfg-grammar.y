@@ -165,6 +165,7 @@ extern struct _LogDriver *last_driver;
 %token KW_LOG_MSG_SIZE                10077
 %token KW_FILE_TEMPLATE               10078
 %token KW_PROTO_TEMPLATE              10079
+%token KW_MEMORY_WATERMARK            10080
 
 %token KW_CHAIN_HOSTNAMES             10090
 %token KW_NORMALIZE_HOSTNAMES         10091
@@ -183,8 +184,11 @@ extern struct _LogDriver *last_driver;
 %token KW_DNS_CACHE_EXPIRE            10130
 %token KW_DNS_CACHE_EXPIRE_FAILED     10131
 %token KW_DNS_CACHE_HOSTS             10132
+%token KW_DNS_RESOLVER_THREADS        10133
+%token KW_DNS_RESOLVER_WAIT           10134
 
 %token KW_PERSIST_ONLY                10140
+%token KW_PERSIST_FLUSH_FREQ          10141
 
 %token KW_TZ_CONVERT                  10150
 %token KW_TS_FORMAT                   10151
@@ -196,6 +200,7 @@ extern struct _LogDriver *last_driver;
 %token KW_LOG_PREFIX                  10164
 %token KW_PROGRAM_OVERRIDE            10165
 %token KW_HOST_OVERRIDE               10166
+%token KW_LOG_IW_RESUME               10167
 
 %token KW_THROTTLE                    10170
 %token KW_THREADED                    10171
@@ -312,6 +317,7 @@ extern struct _LogDriver *last_driver;
 #include "plugin.h"
 #include "logwriter.h"
 #include "messages.h"
+#include "memaccount.h"
 
 #include "syslog-names.h"
 
@@ -411,11 +417,12 @@ stmts
 stmt
         : expr_stmt
           {
+            ((LogExprNode *) $1)->definition = cfg_lexer_take_captured_text(lexer);
             CHECK_ERROR(cfg_tree_add_object(&configuration->tree, $1) || cfg_allow_config_dups(configuration), @1, "duplicate %s definition", log_expr_node_get_content_name(((LogExprNode *) $1)->content));
           }
-	| template_stmt
-	| options_stmt
-	| block_stmt
+	| template_stmt				{ cfg_tree_add_global_definition(&configuration->tree, cfg_lexer_take_captured_text(lexer)); }
+	| options_stmt				{ cfg_tree_add_global_definition(&configuration->tree, cfg_lexer_take_captured_text(lexer)); }
+	| block_stmt				{ cfg_tree_add_global_definition(&configuration->tree, cfg_lexer_take_captured_text(lexer)); }
 	;
 
 expr_stmt
@@ -753,6 +760,15 @@ options_item
 	: KW_MARK_FREQ '(' LL_NUMBER ')'		{ configuration->mark_freq = $3; }
 	| KW_STATS_FREQ '(' LL_NUMBER ')'          { configuration->stats_freq = $3; }
 	| KW_STATS_LEVEL '(' LL_NUMBER ')'         { configuration->stats_level = $3; }
+	| KW_PERSIST_FLUSH_FREQ '(' LL_NUMBER ')'  { configuration->persist_flush_freq = $3; }
+	| KW_MEMORY_WATERMARK '(' string LL_NUMBER ')'
+	  {
+	    gint category = mem_account_lookup_category($3);
+
+	    CHECK_ERROR(category >= 0, @3, "unknown memory accounting category %s", $3);
+	    configuration->memory_watermarks[category] = $4;
+	    free($3);
+	  }
 	| KW_FLUSH_LINES '(' LL_NUMBER ')'		{ configuration->flush_lines = $3; }
 	| KW_FLUSH_TIMEOUT '(' LL_NUMBER ')'	{ configuration->flush_timeout = $3; }
 	| KW_CHAIN_HOSTNAMES '(' yesno ')'	{ configuration->chain_hostnames = $3; }
@@ -793,6 +809,8 @@ options_item
 	| KW_DNS_CACHE_EXPIRE_FAILED '(' LL_NUMBER ')'
 	  			{ configuration->dns_cache_expire_failed = $3; }
 	| KW_DNS_CACHE_HOSTS '(' string ')'     { configuration->dns_cache_hosts = g_strdup($3); free($3); }
+	| KW_DNS_RESOLVER_THREADS '(' LL_NUMBER ')' { configuration->dns_resolver_threads = $3; }
+	| KW_DNS_RESOLVER_WAIT '(' LL_NUMBER ')' { configuration->dns_resolver_wait = $3; }
 	| KW_FILE_TEMPLATE '(' string ')'	{ configuration->file_template_name = g_strdup($3); free($3); }
 	| KW_PROTO_TEMPLATE '(' string ')'	{ configuration->proto_template_name = g_strdup($3); free($3); }
 	| KW_RECV_TIME_ZONE '(' string ')'      { configuration->recv_time_zone = g_strdup($3); free($3); }
@@ -871,6 +889,7 @@ regexp_option_flags
 source_option
         /* NOTE: plugins need to set "last_source_options" in order to incorporate this rule in their grammar */
 	: KW_LOG_IW_SIZE '(' LL_NUMBER ')'	{ last_source_options->init_window_size = $3; }
+	| KW_LOG_IW_RESUME '(' LL_NUMBER ')'	{ last_source_options->window_resume = $3; }
 	| KW_CHAIN_HOSTNAMES '(' yesno ')'	{ last_source_options->chain_hostnames = $3; }
 	| KW_NORMALIZE_HOSTNAMES '(' yesno ')'	{ last_source_options->normalize_hostnames = $3; }
 	| KW_KEEP_HOSTNAME '(' yesno ')'	{ last_source_options->keep_hostname = $3; }
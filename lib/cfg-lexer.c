@@ -731,11 +731,41 @@ cfg_lexer_lex(CfgLexer *self, YYSTYPE *yylval, YYLTYPE *yylloc)
         {
           if (self->preprocess_output)
             fprintf(self->preprocess_output, "%s", self->token_text->str);
+          g_string_append_len(self->captured_text, self->token_text->str, self->token_text->len);
+          g_string_append_c(self->captured_text, ' ');
         }
     }
   return tok;
 }
 
+/*
+ * Return the text of the tokens returned since the last call, with
+ * include files, blocks and backtick substitutions already expanded.
+ * Whitespace and comments are not included, neither the semicolons at
+ * the two ends, so the result only depends on the statement, not on how
+ * it is formatted or on the statements around it.  This is used to
+ * detect which statements were changed when the configuration is
+ * reloaded.
+ *
+ * NOTE: returns an allocated string, the caller must free it.
+ */
+gchar *
+cfg_lexer_take_captured_text(CfgLexer *self)
+{
+  gchar *text, *start, *end;
+
+  start = self->captured_text->str;
+  end = start + self->captured_text->len;
+  while (start < end && (*start == ';' || g_ascii_isspace(*start)))
+    start++;
+  while (end > start && (*(end - 1) == ';' || g_ascii_isspace(*(end - 1))))
+    end--;
+
+  text = g_strndup(start, end - start);
+  g_string_truncate(self->captured_text, 0);
+  return text;
+}
+
 static void
 cfg_lexer_init(CfgLexer *self)
 {
@@ -746,6 +776,7 @@ cfg_lexer_init(CfgLexer *self)
   self->string_buffer = g_string_sized_new(32);
   self->token_text = g_string_sized_new(32);
   self->token_pretext = g_string_sized_new(32);
+  self->captured_text = g_string_sized_new(1024);
 
   level = &self->include_stack[0];
   level->lloc.first_line = level->lloc.last_line = 1;
@@ -831,6 +862,7 @@ cfg_lexer_free(CfgLexer *self)
     g_string_free(self->token_text, TRUE);
   if (self->token_pretext)
     g_string_free(self->token_pretext, TRUE);
+  g_string_free(self->captured_text, TRUE);
   if (self->preprocess_output)
     fclose(self->preprocess_output);
 
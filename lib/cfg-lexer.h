@@ -141,6 +141,8 @@ struct _CfgLexer
   gint preprocess_suppress_tokens;
   GString *token_pretext;
   GString *token_text;
+  /* text of the tokens since the last cfg_lexer_take_captured_text() */
+  GString *captured_text;
   CfgArgs *globals;
 };
 
@@ -179,6 +181,7 @@ gboolean cfg_lexer_register_block_generator(CfgLexer *self, gint context, const
 
 
 int cfg_lexer_lex(CfgLexer *self, YYSTYPE *yylval, YYLTYPE *yylloc);
+gchar *cfg_lexer_take_captured_text(CfgLexer *self);
 
 CfgLexer *cfg_lexer_new(FILE *file, const gchar *filename, const gchar *preprocess_into);
 CfgLexer *cfg_lexer_new_buffer(const gchar *buffer, gsize length);
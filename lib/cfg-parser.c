@@ -74,6 +74,8 @@ static CfgLexerKeyword main_keywords[] = {
   { "stats_freq",         KW_STATS_FREQ },
   { "stats_level",        KW_STATS_LEVEL },
   { "stats",              KW_STATS_FREQ, 0, KWS_OBSOLETE, "stats_freq" },
+  { "persist_flush_freq", KW_PERSIST_FLUSH_FREQ },
+  { "memory_watermark",   KW_MEMORY_WATERMARK },
   { "flush_lines",        KW_FLUSH_LINES },
   { "flush_timeout",      KW_FLUSH_TIMEOUT },
   { "suppress",           KW_SUPPRESS },
@@ -112,6 +114,7 @@ static CfgLexerKeyword main_keywords[] = {
   { "log_fifo_size",      KW_LOG_FIFO_SIZE },
   { "log_fetch_limit",    KW_LOG_FETCH_LIMIT },
   { "log_iw_size",        KW_LOG_IW_SIZE },
+  { "log_iw_resume",      KW_LOG_IW_RESUME },
   { "log_msg_size",       KW_LOG_MSG_SIZE },
   { "log_prefix",         KW_LOG_PREFIX, 0, KWS_OBSOLETE, "program_override" },
   { "program_override",   KW_PROGRAM_OVERRIDE, 0x0300 },
@@ -135,6 +138,8 @@ static CfgLexerKeyword main_keywords[] = {
   { "dns_cache_size",     KW_DNS_CACHE_SIZE },
   { "dns_cache_expire",   KW_DNS_CACHE_EXPIRE },
   { "dns_cache_expire_failed", KW_DNS_CACHE_EXPIRE_FAILED },
+  { "dns_resolver_threads", KW_DNS_RESOLVER_THREADS },
+  { "dns_resolver_wait",  KW_DNS_RESOLVER_WAIT },
 
   /* filter items */
   { "type",               KW_TYPE, 0x0300 },
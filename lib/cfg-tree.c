@@ -28,8 +28,10 @@
 #include "afinter.h"
 #include "logparser.h"
 #include "logmpx.h"
+#include "timeutils.h"
 
 #include <string.h>
+#include <unistd.h>
 
 /*
  * Return the textual representation of a node content type.
@@ -152,7 +154,7 @@ log_expr_node_format_location(LogExprNode *self, gchar *buf, gsize buf_len)
       node = node->parent;
     }
   if (!node)
-    strncpy(buf, "#unknown", sizeof(buf));
+    g_strlcpy(buf, "#unknown", buf_len);
   return buf;
 }
 
@@ -264,6 +266,7 @@ log_expr_node_free(LogExprNode *self)
     self->aux_destroy(self->aux);
   g_free(self->name);
   g_free(self->filename);
+  g_free(self->definition);
   g_free(self);
 }
 
@@ -805,7 +808,11 @@ cfg_tree_compile_junction(CfgTree *self,
             }
         }
 
-      if (sub_pipe_tail && outer_pipe_tail)
+      /* destination drivers kept running over a reload have already
+       * linked their own pipe_next (e.g. the LogWriter), see
+       * cfg_tree_carry_over() */
+      if (sub_pipe_tail && outer_pipe_tail &&
+          (sub_pipe_tail->flags & (PIF_SOURCE | PIF_INITIALIZED)) != PIF_INITIALIZED)
         {
           if (!join_pipe)
             {
@@ -976,6 +983,18 @@ cfg_tree_check_inline_template(CfgTree *self, const gchar *template_or_name, GEr
   return template;
 }
 
+/*
+ * Record the text of a statement that is not a rule, @definition is
+ * freed by this function.
+ */
+void
+cfg_tree_add_global_definition(CfgTree *self, gchar *definition)
+{
+  g_string_append(self->global_definitions, definition);
+  g_string_append_c(self->global_definitions, ';');
+  g_free(definition);
+}
+
 gboolean
 cfg_tree_compile(CfgTree *self)
 {
@@ -1003,14 +1022,160 @@ cfg_tree_compile(CfgTree *self)
   return TRUE;
 }
 
+/* pipes initializing slower than this are listed in the startup report */
+#define CFG_TREE_SLOW_INIT_USEC 1000
+
+typedef struct _CfgTreeStartupItem
+{
+  LogPipe *pipe;
+  gboolean success;
+  glong pre_init_time;
+  glong init_time;
+} CfgTreeStartupItem;
+
+static void
+cfg_tree_pre_init_pipe(gpointer data, gpointer user_data)
+{
+  CfgTreeStartupItem *item = (CfgTreeStartupItem *) data;
+  GTimeVal start, end;
+
+  g_get_current_time(&start);
+  item->success = item->pipe->pre_init(item->pipe);
+  g_get_current_time(&end);
+  item->pre_init_time = g_time_val_diff(&end, &start);
+}
+
+/*
+ * Run the pre_init() methods of the pipes in parallel, as those
+ * do not depend on each other, nor on the main loop. Returns the
+ * number of pre_init() calls that failed.
+ */
+static gint
+cfg_tree_pre_init_pipes(CfgTree *self, CfgTreeStartupItem *items, gint num_items)
+{
+  GThreadPool *pool = NULL;
+  GError *error = NULL;
+  gint num_pending = 0, num_threads = 1, num_failed = 0;
+  gint i;
+
+  for (i = 0; i < num_items; i++)
+    {
+      if (items[i].pipe->pre_init && !(items[i].pipe->flags & PIF_INITIALIZED))
+        num_pending++;
+    }
+  if (num_pending == 0)
+    return 0;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  num_threads = MIN(MAX(1, sysconf(_SC_NPROCESSORS_ONLN)), num_pending);
+#endif
+  if (num_threads > 1)
+    {
+      pool = g_thread_pool_new(cfg_tree_pre_init_pipe, NULL, num_threads, TRUE, &error);
+      if (!pool)
+        {
+          msg_debug("Error starting startup threads, initializing pipes sequentially",
+                    evt_tag_str("error", error->message),
+                    NULL);
+          g_clear_error(&error);
+        }
+    }
+
+  for (i = 0; i < num_items; i++)
+    {
+      LogPipe *pipe = items[i].pipe;
+
+      if (!pipe->pre_init || (pipe->flags & PIF_INITIALIZED))
+        continue;
+
+      pipe->cfg = self->cfg;
+      if (pool)
+        g_thread_pool_push(pool, &items[i], NULL);
+      else
+        cfg_tree_pre_init_pipe(&items[i], NULL);
+    }
+  if (pool)
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+  for (i = 0; i < num_items; i++)
+    {
+      if (items[i].pipe->pre_init && !(items[i].pipe->flags & PIF_INITIALIZED) && !items[i].success)
+        num_failed++;
+    }
+  return num_failed;
+}
+
+static const gchar *
+cfg_tree_format_pipe_name(LogPipe *pipe)
+{
+  LogExprNode *node;
+  const gchar *name = NULL;
+
+  for (node = pipe->expr_node; node; node = node->parent)
+    {
+      if (node->name)
+        name = node->name;
+    }
+  return name ? : "#anon";
+}
+
+static void
+cfg_tree_report_startup(CfgTree *self, CfgTreeStartupItem *items, gint num_items, glong total_time)
+{
+  gint i;
+
+  for (i = 0; i < num_items; i++)
+    {
+      LogPipe *pipe = items[i].pipe;
+      gchar buf[128];
+
+      if (!pipe->pre_init && items[i].init_time < CFG_TREE_SLOW_INIT_USEC)
+        continue;
+
+      msg_verbose("Startup time of configuration object",
+                  evt_tag_str("rule", cfg_tree_format_pipe_name(pipe)),
+                  evt_tag_str("location", pipe->expr_node ? log_expr_node_format_location(pipe->expr_node, buf, sizeof(buf)) : "#unknown"),
+                  evt_tag_int("pre_init_usec", items[i].pre_init_time),
+                  evt_tag_int("init_usec", items[i].init_time),
+                  NULL);
+    }
+  msg_verbose("Configuration started",
+              evt_tag_int("pipes", num_items),
+              evt_tag_int("total_usec", total_time),
+              NULL);
+}
+
+/*
+ * Initialization of the pipes happens in two phases: first the
+ * pre_init() methods are called in parallel, these do the heavy
+ * lifting (e.g. loading pattern databases) that doesn't need the main
+ * loop. Then init() is called sequentially in the main thread, in the
+ * order the pipes were compiled into the tree.
+ */
 gboolean
 cfg_tree_start(CfgTree *self)
 {
-  gint i;
+  CfgTreeStartupItem *items;
+  GTimeVal start, end, init_start, init_end;
+  gint i, num_items;
+  gboolean success = FALSE;
 
+  g_get_current_time(&start);
   if (!cfg_tree_compile(self))
     return FALSE;
 
+  num_items = self->initialized_pipes->len;
+  items = g_new0(CfgTreeStartupItem, num_items);
+  for (i = 0; i < num_items; i++)
+    items[i].pipe = g_ptr_array_index(self->initialized_pipes, i);
+
+  if (cfg_tree_pre_init_pipes(self, items, num_items) > 0)
+    {
+      msg_error("Error initializing message pipeline",
+                NULL);
+      goto exit;
+    }
+
   /*
    *   As there are pipes that are dynamically created during init, these
    *   pipes must be deinited before destroying the configuration, otherwise
@@ -1019,14 +1184,24 @@ cfg_tree_start(CfgTree *self)
    */
   for (i = 0; i < self->initialized_pipes->len; i++)
     {
+      g_get_current_time(&init_start);
       if (!log_pipe_init(g_ptr_array_index(self->initialized_pipes, i), self->cfg))
         {
           msg_error("Error initializing message pipeline",
                     NULL);
-          return FALSE;
+          goto exit;
         }
+      g_get_current_time(&init_end);
+      if (i < num_items)
+        items[i].init_time = g_time_val_diff(&init_end, &init_start);
     }
-  return TRUE;
+  g_get_current_time(&end);
+  cfg_tree_report_startup(self, items, num_items, g_time_val_diff(&end, &start));
+  success = TRUE;
+
+ exit:
+  g_free(items);
+  return success;
 }
 
 gboolean
@@ -1044,6 +1219,240 @@ cfg_tree_stop(CfgTree *self)
   return success;
 }
 
+void
+cfg_tree_profile_reset(CfgTree *self)
+{
+  gint i;
+
+  for (i = 0; i < self->initialized_pipes->len; i++)
+    {
+      LogPipe *pipe = g_ptr_array_index(self->initialized_pipes, i);
+
+      pipe->profile_ticks = 0;
+      pipe->profile_calls = 0;
+    }
+}
+
+static gint
+cfg_tree_profile_compare(gconstpointer a, gconstpointer b)
+{
+  LogPipe *pa = *(LogPipe **) a;
+  LogPipe *pb = *(LogPipe **) b;
+
+  if (pa->profile_ticks == pb->profile_ticks)
+    return 0;
+  return pa->profile_ticks > pb->profile_ticks ? -1 : 1;
+}
+
+/*
+ * Formats the @top_n pipes with the most time spent in them since the
+ * last cfg_tree_profile_reset(), one per line in the form of:
+ *
+ *   rule;location;calls;ticks;usec;percent
+ *
+ * The time is only collected while log_pipe_profiling is set, see
+ * log_pipe_queue_profiled().
+ */
+gchar *
+cfg_tree_format_profile(CfgTree *self, gint top_n)
+{
+  GPtrArray *pipes = g_ptr_array_sized_new(self->initialized_pipes->len);
+  GString *result = g_string_sized_new(1024);
+  guint64 total_ticks = 0, ticks_per_sec = log_pipe_profile_ticks_per_sec();
+  gint i;
+
+  for (i = 0; i < self->initialized_pipes->len; i++)
+    {
+      LogPipe *pipe = g_ptr_array_index(self->initialized_pipes, i);
+
+      if (!pipe->expr_node || !pipe->profile_calls)
+        continue;
+      g_ptr_array_add(pipes, pipe);
+      total_ticks += pipe->profile_ticks;
+    }
+  g_ptr_array_sort(pipes, cfg_tree_profile_compare);
+
+  g_string_append(result, "Rule;Location;Calls;Ticks;Usec;Percent\n");
+  for (i = 0; i < pipes->len && (top_n <= 0 || i < top_n); i++)
+    {
+      LogPipe *pipe = g_ptr_array_index(pipes, i);
+      gchar buf[128];
+
+      g_string_append_printf(result, "%s;%s;%u;%" G_GUINT64_FORMAT ";%" G_GUINT64_FORMAT ";%.2f\n",
+                             cfg_tree_format_pipe_name(pipe),
+                             log_expr_node_format_location(pipe->expr_node, buf, sizeof(buf)),
+                             pipe->profile_calls,
+                             pipe->profile_ticks,
+                             ticks_per_sec ? (guint64) ((gdouble) pipe->profile_ticks * G_USEC_PER_SEC / ticks_per_sec) : 0,
+                             total_ticks ? (gdouble) pipe->profile_ticks * 100 / total_ticks : 0.0);
+    }
+  g_ptr_array_free(pipes, TRUE);
+  return g_string_free(result, FALSE);
+}
+
+/*
+ * Incremental reload
+ * ==================
+ *
+ * When the configuration is reloaded, named source and destination
+ * statements that are defined the same way in the new configuration as
+ * in the running one keep running: their drivers are carried over to
+ * the new configuration together with their queues, connections and
+ * threads, instead of being deinitialized and initialized again.  The
+ * rest of the processing graph (filters, parsers, rewrite rules, log
+ * statements and the LogPipes connecting them) is compiled from scratch.
+ *
+ * Statements are compared using their text as captured by the lexer,
+ * e.g. include files, blocks and backtick substitutions are already
+ * expanded.  Drivers also depend on global options and templates, so if
+ * any of those changed, nothing is carried over.
+ *
+ * Drivers need to opt in by setting PIF_KEEP_ON_RELOAD, e.g. file
+ * destinations don't, as reload is expected to reopen them.
+ */
+
+/* flags set by cfg_tree_compile_*(), these are recalculated in the new tree */
+#define PIF_COMPILE_FLAGS (PIF_INLINED | PIF_BRANCH_FINAL | PIF_BRANCH_FALLBACK | PIF_HARD_FLOW_CONTROL)
+
+static gboolean
+log_expr_node_can_carry_over(LogExprNode *old_node, LogExprNode *new_node)
+{
+  LogExprNode *old_child, *new_child;
+
+  if (old_node->layout != new_node->layout || old_node->content != new_node->content)
+    return FALSE;
+
+  if (old_node->layout == ENL_SINGLE)
+    {
+      LogPipe *pipe = (LogPipe *) old_node->object;
+
+      /* pipes of rules that were never referenced are not initialized */
+      return (pipe->flags & (PIF_INITIALIZED | PIF_KEEP_ON_RELOAD)) == (PIF_INITIALIZED | PIF_KEEP_ON_RELOAD);
+    }
+
+  for (old_child = old_node->children, new_child = new_node->children;
+       old_child && new_child;
+       old_child = old_child->next, new_child = new_child->next)
+    {
+      if (!log_expr_node_can_carry_over(old_child, new_child))
+        return FALSE;
+    }
+  return old_child == NULL && new_child == NULL;
+}
+
+static void
+log_expr_node_carry_over(LogExprNode *old_node, LogExprNode *new_node, CfgTree *self, CfgTree *old, GPtrArray *carried_over)
+{
+  LogExprNode *old_child, *new_child;
+  LogPipe *pipe;
+
+  if (old_node->layout != ENL_SINGLE)
+    {
+      for (old_child = old_node->children, new_child = new_node->children;
+           old_child && new_child;
+           old_child = old_child->next, new_child = new_child->next)
+        log_expr_node_carry_over(old_child, new_child, self, old, carried_over);
+      return;
+    }
+
+  pipe = (LogPipe *) old_node->object;
+
+  /* the reference held by the initialized_pipes array of the old tree
+   * is moved to @carried_over, so that cfg_tree_stop() leaves it alone */
+  g_ptr_array_remove(old->initialized_pipes, pipe);
+  g_ptr_array_add(carried_over, pipe);
+
+  pipe->flags &= ~PIF_COMPILE_FLAGS;
+  /* sources are linked into the new graph when it is compiled, while
+   * destination drivers point to their own downstream (e.g. their
+   * LogWriter or balancer), which keeps running with them */
+  if (pipe->flags & PIF_SOURCE)
+    pipe->pipe_next = NULL;
+  pipe->cfg = self->cfg;
+
+  /* the freshly parsed instance was never initialized, replace it with the running one */
+  if (new_node->object && new_node->object_destroy)
+    new_node->object_destroy(new_node->object);
+  log_expr_node_set_object(new_node, log_pipe_ref(pipe), (GDestroyNotify) log_pipe_unref);
+}
+
+/*
+ * cfg_tree_carry_over:
+ * @self: the new configuration, not yet started
+ * @old: the running configuration, not yet stopped
+ *
+ * Move the drivers of unchanged source and destination statements from
+ * @old to @self.  Must be called while the I/O workers are stopped.
+ *
+ * Returns the array of the pipes carried over, holding a reference to
+ * each.  These are still referenced by the nodes of @old, which need to
+ * be kept around as long as the pipes are used, see
+ * cfg_free_previous().
+ */
+GPtrArray *
+cfg_tree_carry_over(CfgTree *self, CfgTree *old)
+{
+  GPtrArray *carried_over = g_ptr_array_new();
+  GHashTableIter iter;
+  gpointer key, value;
+
+  if (strcmp(self->global_definitions->str, old->global_definitions->str) != 0)
+    {
+      msg_verbose("Global options or templates changed, restarting all drivers", NULL);
+      return carried_over;
+    }
+
+  g_hash_table_iter_init(&iter, self->objects);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+      LogExprNode *rule = (LogExprNode *) value;
+      LogExprNode *old_rule;
+
+      if (rule->content != ENC_SOURCE && rule->content != ENC_DESTINATION)
+        continue;
+
+      old_rule = cfg_tree_get_object(old, rule->content, rule->name);
+      if (!old_rule || !old_rule->definition || !rule->definition ||
+          strcmp(old_rule->definition, rule->definition) != 0 ||
+          !log_expr_node_can_carry_over(old_rule, rule))
+        continue;
+
+      log_expr_node_carry_over(old_rule, rule, self, old, carried_over);
+      msg_debug("Keeping unchanged statement running over reload",
+                evt_tag_str("content", log_expr_node_get_content_name(rule->content)),
+                evt_tag_str("name", rule->name),
+                NULL);
+    }
+  return carried_over;
+}
+
+/*
+ * cfg_tree_revert_carry_over:
+ * @self: the new configuration that failed to start, already stopped
+ * @old: the previous configuration, which is about to be restarted
+ * @carried_over: the array returned by cfg_tree_carry_over()
+ *
+ * Hand the pipes carried over back to @old.  Pipes that were not reached
+ * while starting @self are still running, these need to point to the
+ * configuration they are used by again, as @self is going to be freed.
+ */
+void
+cfg_tree_revert_carry_over(CfgTree *self, CfgTree *old, GPtrArray *carried_over)
+{
+  gint i;
+
+  for (i = 0; i < carried_over->len; i++)
+    {
+      LogPipe *pipe = (LogPipe *) g_ptr_array_index(carried_over, i);
+
+      if (pipe->flags & PIF_INITIALIZED)
+        pipe->cfg = old->cfg;
+      if (pipe->flags & PIF_SOURCE)
+        pipe->pipe_next = NULL;
+      g_ptr_array_add(old->initialized_pipes, log_pipe_ref(pipe));
+    }
+}
+
 void
 cfg_tree_init_instance(CfgTree *self, GlobalConfig *cfg)
 {
@@ -1051,6 +1460,7 @@ cfg_tree_init_instance(CfgTree *self, GlobalConfig *cfg)
   self->objects = g_hash_table_new_full(cfg_tree_objects_hash, cfg_tree_objects_equal, NULL, (GDestroyNotify) log_expr_node_free);
   self->templates = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) log_template_unref);
   self->rules = g_ptr_array_new();
+  self->global_definitions = g_string_sized_new(256);
   self->cfg = cfg;
 }
 
@@ -1064,5 +1474,6 @@ cfg_tree_free_instance(CfgTree *self)
   g_ptr_array_free(self->rules, TRUE);
 
   g_hash_table_destroy(self->templates);
+  g_string_free(self->global_definitions, TRUE);
   self->cfg = NULL;
 }
@@ -119,6 +119,8 @@ struct _LogExprNode
   gchar *filename;
   gint line, column;
   gint child_id;
+  /* the text of the statement for top-level rules, see cfg_lexer_take_captured_text() */
+  gchar *definition;
 };
 
 gint log_expr_node_lookup_flag(const gchar *flag);
@@ -155,6 +157,8 @@ typedef struct _CfgTree
   /* list of top-level rules */
   GPtrArray *rules;
   GHashTable *templates;
+  /* the text of the statements that are not rules (options, templates, blocks) */
+  GString *global_definitions;
 } CfgTree;
 
 gboolean cfg_tree_add_object(CfgTree *self, LogExprNode *rule);
@@ -167,8 +171,15 @@ LogTemplate *cfg_tree_check_inline_template(CfgTree *self, const gchar *template
 gchar *cfg_tree_get_rule_name(CfgTree *self, gint content, LogExprNode *node);
 gchar *cfg_tree_get_child_id(CfgTree *self, gint content, LogExprNode *node);
 
+void cfg_tree_add_global_definition(CfgTree *self, gchar *definition);
+
 gboolean cfg_tree_start(CfgTree *self);
 gboolean cfg_tree_stop(CfgTree *self);
+GPtrArray *cfg_tree_carry_over(CfgTree *self, CfgTree *old);
+void cfg_tree_revert_carry_over(CfgTree *self, CfgTree *old, GPtrArray *carried_over);
+
+void cfg_tree_profile_reset(CfgTree *self);
+gchar *cfg_tree_format_profile(CfgTree *self, gint top_n);
 
 void cfg_tree_init_instance(CfgTree *self, GlobalConfig *cfg);
 void cfg_tree_free_instance(CfgTree *self);
@@ -30,6 +30,7 @@
 #include "misc.h"
 #include "logmsg.h"
 #include "dnscache.h"
+#include "dnsresolver.h"
 #include "logparser.h"
 #include "serialize.h"
 #include "plugin.h"
@@ -162,7 +163,7 @@ cfg_bad_hostname_set(GlobalConfig *self, gchar *bad_hostname_re)
 gboolean
 cfg_init(GlobalConfig *cfg)
 {
-  gint regerr;
+  gint regerr, i;
   
   if (cfg->file_template_name && !(cfg->file_template = cfg_tree_lookup_template(&cfg->tree, cfg->file_template_name)))
     msg_error("Error resolving file template",
@@ -173,6 +174,8 @@ cfg_init(GlobalConfig *cfg)
                evt_tag_str("name", cfg->proto_template_name),
                NULL);
   stats_reinit(cfg);
+  for (i = 0; i < MA_MAX; i++)
+    mem_account_set_watermark(i, cfg->memory_watermarks[i]);
 
   if (cfg->bad_hostname_re)
     {
@@ -191,6 +194,7 @@ cfg_init(GlobalConfig *cfg)
         }
     }
   dns_cache_set_params(cfg->dns_cache_size, cfg->dns_cache_expire, cfg->dns_cache_expire_failed, cfg->dns_cache_hosts);
+  dns_resolver_set_params(cfg->dns_resolver_threads, cfg->dns_resolver_wait, cfg->dns_cache_size, cfg->dns_cache_expire, cfg->dns_cache_expire_failed);
   return cfg_tree_start(&cfg->tree);
 }
 
@@ -275,6 +279,7 @@ cfg_new(gint version)
   self->flush_timeout = 10000;  /* 10 seconds */
   self->mark_freq = 1200;	/* 20 minutes */
   self->stats_freq = 600;
+  self->persist_flush_freq = 60;
   self->chain_hostnames = 0;
   self->use_fqdn = 0;
   self->use_dns = 1;
@@ -296,6 +301,8 @@ cfg_new(gint version)
   self->dns_cache_size = 1007;
   self->dns_cache_expire = 3600;
   self->dns_cache_expire_failed = 60;
+  self->dns_resolver_threads = 0;
+  self->dns_resolver_wait = 0;
   self->threaded = FALSE;
   
   log_template_options_defaults(&self->template_options);
@@ -384,9 +391,64 @@ cfg_free(GlobalConfig *self)
   g_free(self->dns_cache_hosts);
   g_list_free(self->plugins);
   cfg_tree_free_instance(&self->tree);
+  if (self->pipe_origins)
+    g_hash_table_destroy(self->pipe_origins);
+  g_list_foreach(self->retained_configs, (GFunc) cfg_free, NULL);
+  g_list_free(self->retained_configs);
   g_free(self);
 }
 
+/*
+ * Free the configuration @old that was replaced by @self on reload,
+ * unless @self still uses pipes created by it, see cfg_tree_carry_over().
+ *
+ * The pipes in @carried_over may have been created by a configuration
+ * @old retained itself, those are only kept as long as they are needed.
+ */
+void
+cfg_free_previous(GlobalConfig *self, GlobalConfig *old, GPtrArray *carried_over)
+{
+  GList *candidates, *l;
+  gint i;
+
+  for (i = 0; i < carried_over->len; i++)
+    {
+      LogPipe *pipe = (LogPipe *) g_ptr_array_index(carried_over, i);
+      GlobalConfig *origin = NULL;
+
+      if (old->pipe_origins)
+        origin = g_hash_table_lookup(old->pipe_origins, pipe);
+
+      if (!self->pipe_origins)
+        self->pipe_origins = g_hash_table_new(g_direct_hash, g_direct_equal);
+      g_hash_table_insert(self->pipe_origins, pipe, origin ? origin : old);
+    }
+
+  candidates = g_list_prepend(old->retained_configs, old);
+  old->retained_configs = NULL;
+
+  for (l = candidates; l; l = l->next)
+    {
+      GlobalConfig *candidate = (GlobalConfig *) l->data;
+      GHashTableIter iter;
+      gpointer pipe, origin;
+      gboolean used = FALSE;
+
+      if (self->pipe_origins)
+        {
+          g_hash_table_iter_init(&iter, self->pipe_origins);
+          while (!used && g_hash_table_iter_next(&iter, &pipe, &origin))
+            used = (origin == candidate);
+        }
+
+      if (used)
+        self->retained_configs = g_list_prepend(self->retained_configs, candidate);
+      else
+        cfg_free(candidate);
+    }
+  g_list_free(candidates);
+}
+
 void
 cfg_persist_config_move(GlobalConfig *src, GlobalConfig *dest)
 {
@@ -431,6 +493,23 @@ cfg_persist_config_add(GlobalConfig *cfg, gchar *name, gpointer value, GDestroyN
   return;
 }
 
+/*
+ * Looks up a persisted value without taking it over, the entry stays
+ * in the persist config. As nothing modifies the persist config while
+ * a configuration is being started, this may also be called from the
+ * pre_init() methods running in the startup threads.
+ */
+gpointer
+cfg_persist_config_peek(GlobalConfig *cfg, gchar *name)
+{
+  PersistConfigEntry *p;
+
+  if (!cfg->persist)
+    return NULL;
+  p = (PersistConfigEntry *) g_hash_table_lookup(cfg->persist->keys, name);
+  return p ? p->value : NULL;
+}
+
 gpointer
 cfg_persist_config_fetch(GlobalConfig *cfg, gchar *name)
 {
@@ -31,6 +31,7 @@
 #include "cfg-parser.h"
 #include "persist-state.h"
 #include "templates.h"
+#include "memaccount.h"
 
 #include <sys/types.h>
 #include <regex.h>
@@ -55,6 +56,9 @@ struct _GlobalConfig
   gint stats_freq;
   gint stats_level;
   gint mark_freq;
+  gint persist_flush_freq;
+  /* in kilobytes, indexed by MemAccountCategory, 0 if disabled */
+  gint64 memory_watermarks[MA_MAX];
   gint flush_lines;
   gint flush_timeout;
   gboolean threaded;
@@ -70,6 +74,7 @@ struct _GlobalConfig
   gboolean use_dns_cache;
   gint dns_cache_size, dns_cache_expire, dns_cache_expire_failed;
   gchar *dns_cache_hosts;
+  gint dns_resolver_threads, dns_resolver_wait;
   gint time_reopen;
   gint time_reap;
   gint suppress;
@@ -103,6 +108,12 @@ struct _GlobalConfig
   
   CfgTree tree;
 
+  /* pipes carried over from previous configurations by a reload, mapped
+   * to the configuration that created them, and those configurations
+   * themselves, which are kept around as long as their pipes are used */
+  GHashTable *pipe_origins;
+  GList *retained_configs;
+
 };
 
 gboolean cfg_allow_config_dups(GlobalConfig *self);
@@ -123,6 +134,7 @@ GlobalConfig *cfg_new(gint version);
 gboolean cfg_run_parser(GlobalConfig *self, CfgLexer *lexer, CfgParser *parser, gpointer *result, gpointer arg);
 gboolean cfg_read_config(GlobalConfig *cfg, gchar *fname, gboolean syntax_only, gchar *preprocess_into);
 void cfg_free(GlobalConfig *self);
+void cfg_free_previous(GlobalConfig *self, GlobalConfig *old, GPtrArray *carried_over);
 gboolean cfg_init(GlobalConfig *cfg);
 gboolean cfg_deinit(GlobalConfig *cfg);
 
@@ -132,6 +144,7 @@ void persist_config_free(PersistConfig *self);
 void cfg_persist_config_move(GlobalConfig *src, GlobalConfig *dest);
 void cfg_persist_config_add(GlobalConfig *cfg, gchar *name, gpointer value, GDestroyNotify destroy, gboolean force);
 gpointer cfg_persist_config_fetch(GlobalConfig *cfg, gchar *name);
+gpointer cfg_persist_config_peek(GlobalConfig *cfg, gchar *name);
 
 static inline gboolean 
 cfg_check_current_config_version(gint req)
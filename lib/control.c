@@ -28,10 +28,14 @@
 #include "stats.h"
 #include "misc.h"
 #include "mainloop.h"
+#include "timeutils.h"
+#include "cfg.h"
+#include "logpipe.h"
 
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <iv.h>
 
 #define MAX_CONTROL_LINE_LENGTH 4096
@@ -45,6 +49,11 @@ typedef struct _ControlConnection
   GString *input_buffer;
   GString *output_buffer;
   gsize pos;
+
+  /* STATS SUBSCRIBE state */
+  StatsSubscription *subscription;
+  struct iv_timer subscription_timer;
+  gint subscription_interval;
 } ControlConnection;
 
 static void control_connection_update_watches(ControlConnection *self);
@@ -99,6 +108,102 @@ control_connection_send_stats(ControlConnection *self, GString *command)
   control_connection_send_reply(self, stats_generate_csv(), TRUE);
 }
 
+static void
+control_connection_subscription_rearm(ControlConnection *self)
+{
+  iv_validate_now();
+  self->subscription_timer.expires = iv_now;
+  timespec_add_msec(&self->subscription_timer.expires, self->subscription_interval * 1000);
+  iv_timer_register(&self->subscription_timer);
+}
+
+static void
+control_connection_subscription_elapsed(gpointer s)
+{
+  ControlConnection *self = (ControlConnection *) s;
+
+  /* if the previous batch was not consumed yet, skip this one, the
+   * next batch includes the changes anyway */
+  if (self->output_buffer->len <= self->pos)
+    {
+      GString *batch = g_string_sized_new(256);
+
+      if (stats_subscription_query(self->subscription, batch) > 0)
+        control_connection_send_reply(self, batch->str, FALSE);
+      g_string_free(batch, TRUE);
+    }
+  control_connection_subscription_rearm(self);
+}
+
+static void
+control_connection_subscription_start(ControlConnection *self)
+{
+  GString *batch = g_string_sized_new(1024);
+
+  /* the first batch is always sent, it contains all matching counters */
+  g_string_append(batch, "SourceName;SourceId;SourceInstance;Type;Number;Delta\n");
+  stats_subscription_query(self->subscription, batch);
+  control_connection_send_reply(self, batch->str, FALSE);
+  g_string_free(batch, TRUE);
+
+  IV_TIMER_INIT(&self->subscription_timer);
+  self->subscription_timer.cookie = self;
+  self->subscription_timer.handler = control_connection_subscription_elapsed;
+  control_connection_subscription_rearm(self);
+}
+
+static void
+control_connection_unsubscribe(ControlConnection *self)
+{
+  if (!self->subscription)
+    return;
+
+  if (iv_timer_registered(&self->subscription_timer))
+    iv_timer_unregister(&self->subscription_timer);
+  stats_subscription_free(self->subscription);
+  self->subscription = NULL;
+}
+
+/*
+ * STATS SUBSCRIBE <interval> [<filter>]
+ *
+ * Sends the counters that changed every <interval> seconds, each batch
+ * terminated by a "." line, until STATS UNSUBSCRIBE is sent or the
+ * connection is closed. <filter> is a shell-style pattern matched
+ * against the id of the counters, e.g. the name of the source or
+ * destination.
+ */
+static void
+control_connection_stats_subscribe(ControlConnection *self, GString *command)
+{
+  gchar **cmds = g_strsplit(command->str, " ", 4);
+  gchar *end = NULL;
+  gint interval = 0;
+
+  if (cmds[2])
+    interval = strtol(cmds[2], &end, 10);
+  if (interval <= 0 || *end != 0)
+    {
+      control_connection_send_reply(self, "Invalid arguments received, expected an interval in seconds", FALSE);
+      goto exit;
+    }
+
+  control_connection_unsubscribe(self);
+  self->subscription = stats_subscription_new(cmds[3]);
+  self->subscription_interval = interval;
+  control_connection_subscription_start(self);
+
+exit:
+  g_strfreev(cmds);
+}
+
+static void
+control_connection_stats_unsubscribe(ControlConnection *self, GString *command)
+{
+  control_connection_unsubscribe(self);
+  control_connection_send_reply(self, "OK", FALSE);
+}
+
 static void
 control_connection_message_log(ControlConnection *self, GString *command)
 {
@@ -151,6 +256,67 @@ control_connection_reload(ControlConnection *self, GString *command)
   control_connection_send_reply(self, "OK Config reload initiated", FALSE);
 }
 
+/*
+ * PROFILE START|STOP|SHOW [<n>]
+ *
+ * START clears the collected times and starts measuring the time spent
+ * in each source, filter, parser, rewrite rule and destination, STOP
+ * stops measuring, SHOW lists the <n> (default 20) most expensive ones
+ * in descending order.
+ *
+ * Returns the reply to be sent to the client, which must be freed by
+ * the caller.
+ */
+gchar *
+control_process_profile(GlobalConfig *cfg, const gchar *command)
+{
+  gchar **cmds = g_strsplit(command, " ", 3);
+  gchar *reply;
+
+  if (!cmds[1])
+    {
+      reply = g_strdup("Invalid arguments received, expected START, STOP or SHOW");
+    }
+  else if (g_str_equal(cmds[1], "START"))
+    {
+      cfg_tree_profile_reset(&cfg->tree);
+      log_pipe_profile_start();
+      msg_info("Pipeline profiling started", NULL);
+      reply = g_strdup("OK");
+    }
+  else if (g_str_equal(cmds[1], "STOP"))
+    {
+      log_pipe_profile_stop();
+      msg_info("Pipeline profiling stopped", NULL);
+      reply = g_strdup("OK");
+    }
+  else if (g_str_equal(cmds[1], "SHOW"))
+    {
+      gchar *end = NULL;
+      gint top_n = 20;
+
+      if (cmds[2])
+        top_n = strtol(cmds[2], &end, 10);
+      if (top_n <= 0 || (end && *end != 0))
+        reply = g_strdup("Invalid arguments received, expected the number of rules to show");
+      else
+        reply = cfg_tree_format_profile(&cfg->tree, top_n);
+    }
+  else
+    {
+      reply = g_strdup("Invalid arguments received");
+    }
+
+  g_strfreev(cmds);
+  return reply;
+}
+
+static void
+control_connection_profile(ControlConnection *self, GString *command)
+{
+  control_connection_send_reply(self, control_process_profile(main_loop_get_current_config(), command->str), TRUE);
+}
+
 static struct
 {
   const gchar *command;
@@ -158,9 +324,13 @@ static struct
   void (*func)(ControlConnection *self, GString *command);
 } commands[] = 
 {
+  /* longer prefixes first, as commands are matched by prefix */
+  { "STATS SUBSCRIBE", NULL, control_connection_stats_subscribe },
+  { "STATS UNSUBSCRIBE", NULL, control_connection_stats_unsubscribe },
   { "STATS", NULL, control_connection_send_stats },
   { "LOG", NULL, control_connection_message_log },
   { "RELOAD", NULL, control_connection_reload },
+  { "PROFILE", NULL, control_connection_profile },
   { NULL, NULL, NULL },
 };
 
@@ -273,6 +443,7 @@ static void
 control_connection_stop_watches(ControlConnection *self)
 {
   iv_fd_unregister(&self->control_io);
+  control_connection_unsubscribe(self);
 }
 
 static void
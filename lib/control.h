@@ -30,4 +30,6 @@
 void  control_init(const gchar *control_name);
 void control_destroy(void);
 
+gchar *control_process_profile(GlobalConfig *cfg, const gchar *command);
+
 #endif
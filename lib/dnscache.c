@@ -25,7 +25,8 @@
 #include "dnscache.h"
 #include "messages.h"
 #include "timeutils.h"
-#include "tls-support.h"
+#include "stats.h"
+#include "memaccount.h"
 
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -38,19 +39,6 @@
 #include <time.h>
 
 typedef struct _DNSCacheEntry DNSCacheEntry;
-typedef struct _DNSCacheKey DNSCacheKey;
-
-struct _DNSCacheKey
-{
-  gint family;
-  union
-  {
-    struct in_addr ip;
-#if ENABLE_IPV6
-    struct in6_addr ip6;
-#endif
-  } addr;
-};
 
 struct _DNSCacheEntry
 {
@@ -62,32 +50,48 @@ struct _DNSCacheEntry
   gboolean positive;
 };
 
+/*
+ * The cache is shared by all threads.  To keep I/O workers resolving
+ * different addresses from contending on a single lock, it is split
+ * into shards based on the hash of the address, each with its own
+ * lock, hash table and LRU list.  The size limit is divided evenly
+ * between the shards.
+ *
+ * The entries coming from the hosts file are not subject to expiry or
+ * the size limit, they are kept in a separate table, which is replaced
+ * as a whole when the file changes and is read-locked by the lookups.
+ */
+#define DNS_CACHE_SHARDS 16
 
-TLS_BLOCK_START
+typedef struct _DNSCacheShard
 {
+  GStaticMutex lock;
   GHashTable *cache;
+  /* least recently used entries come first */
   DNSCacheEntry cache_first;
   DNSCacheEntry cache_last;
-  DNSCacheEntry persist_first;
-  DNSCacheEntry persist_last;
-}
-TLS_BLOCK_END;
+} DNSCacheShard;
+
+static DNSCacheShard dns_cache_shards[DNS_CACHE_SHARDS];
 
-#define cache  __tls_deref(cache)
-#define cache_first __tls_deref(cache_first)
-#define cache_last __tls_deref(cache_last)
-#define persist_first __tls_deref(persist_first)
-#define persist_last __tls_deref(persist_last)
+static GStaticRWLock dns_cache_persist_lock = G_STATIC_RW_LOCK_INIT;
+static GHashTable *dns_cache_persist;
+
+/* protects the hosts file parameters below, held while checking the file */
+static GStaticMutex dns_cache_hosts_lock = G_STATIC_MUTEX_INIT;
 
 static gint dns_cache_size = 1007;
 static gint dns_cache_expire = 3600;
 static gint dns_cache_expire_failed = 60;
-static gint dns_cache_persistent_count = 0;
 static gchar *dns_cache_hosts = NULL;
 static time_t dns_cache_hosts_mtime = -1;
 static time_t dns_cache_hosts_checktime = 0;
 
-static gboolean 
+static StatsCounterItem *dns_cache_hits;
+static StatsCounterItem *dns_cache_misses;
+static StatsCounterItem *dns_cache_evictions;
+
+gboolean
 dns_cache_key_equal(DNSCacheKey *e1, DNSCacheKey *e2)
 {
   if (e1->family == e2->family)
@@ -102,7 +106,7 @@ dns_cache_key_equal(DNSCacheKey *e1, DNSCacheKey *e2)
   return FALSE;
 }
 
-static guint
+guint
 dns_cache_key_hash(DNSCacheKey *e)
 {
   if (e->family == AF_INET)
@@ -132,17 +136,84 @@ dns_cache_entry_insert_before(DNSCacheEntry *elem, DNSCacheEntry *new_elem)
   elem->prev = new_elem;
 }
 
-static void
-dns_cache_entry_free(DNSCacheEntry *e)
+static inline void
+dns_cache_entry_unlink(DNSCacheEntry *e)
 {
   e->prev->next = e->next;
   e->next->prev = e->prev;
-  
+}
+
+static inline gsize
+dns_cache_entry_get_size(DNSCacheEntry *e)
+{
+  return sizeof(*e) + (e->hostname ? strlen(e->hostname) + 1 : 0);
+}
+
+static DNSCacheEntry *
+dns_cache_entry_new(gint family, void *addr, const gchar *hostname, gboolean positive)
+{
+  DNSCacheEntry *entry;
+
+  entry = g_new0(DNSCacheEntry, 1);
+  dns_cache_fill_key(&entry->key, family, addr);
+  entry->hostname = hostname ? g_strdup(hostname) : NULL;
+  entry->positive = positive;
+  mem_account_alloc(MA_DNS_CACHE, dns_cache_entry_get_size(entry));
+  return entry;
+}
+
+static void
+dns_cache_entry_free(DNSCacheEntry *e)
+{
+  /* persistent entries are not linked into an LRU list */
+  if (e->prev)
+    dns_cache_entry_unlink(e);
+
+  mem_account_free(MA_DNS_CACHE, dns_cache_entry_get_size(e));
   g_free(e->hostname);
   g_free(e);
 }
 
-static inline void
+static void
+dns_cache_entry_copy_result(DNSCacheEntry *e, gchar *hostname, gsize hostname_len, gboolean *positive)
+{
+  if (e->hostname)
+    g_strlcpy(hostname, e->hostname, hostname_len);
+  else
+    hostname[0] = 0;
+  *positive = e->positive;
+}
+
+static inline gboolean
+dns_cache_entry_is_expired(DNSCacheEntry *e, time_t now)
+{
+  return (e->positive && e->resolved < now - dns_cache_expire) ||
+         (!e->positive && e->resolved < now - dns_cache_expire_failed);
+}
+
+static GHashTable *
+dns_cache_persist_new(void)
+{
+  return g_hash_table_new_full((GHashFunc) dns_cache_key_hash, (GEqualFunc) dns_cache_key_equal, NULL, (GDestroyNotify) dns_cache_entry_free);
+}
+
+static inline DNSCacheShard *
+dns_cache_get_shard(DNSCacheKey *key)
+{
+  guint hash = dns_cache_key_hash(key);
+
+  /* mix the upper bits in, the lower ones are often the same for the
+   * addresses of a network */
+  return &dns_cache_shards[(hash ^ (hash >> 16)) % DNS_CACHE_SHARDS];
+}
+
+static inline gint
+dns_cache_shard_size(void)
+{
+  return MAX((dns_cache_size + DNS_CACHE_SHARDS - 1) / DNS_CACHE_SHARDS, 1);
+}
+
+void
 dns_cache_fill_key(DNSCacheKey *key, gint family, void *addr)
 {
   key->family = family;
@@ -162,129 +233,178 @@ dns_cache_fill_key(DNSCacheKey *key, gint family, void *addr)
     }
 }
 
+/* replace the persistent entries with @persist, which may be NULL */
 static void
-dns_cache_cleanup_persistent_hosts(void)
+dns_cache_replace_persistent_hosts(GHashTable *persist)
 {
-  while (persist_first.next != &persist_last)
+  GHashTable *old;
+
+  g_static_rw_lock_writer_lock(&dns_cache_persist_lock);
+  old = dns_cache_persist;
+  dns_cache_persist = persist;
+  g_static_rw_lock_writer_unlock(&dns_cache_persist_lock);
+
+  if (old)
+    g_hash_table_destroy(old);
+}
+
+static GHashTable *
+dns_cache_load_hosts(void)
+{
+  GHashTable *persist;
+  FILE *hosts;
+
+  persist = dns_cache_persist_new();
+  hosts = fopen(dns_cache_hosts, "r");
+  if (hosts)
     {
-      g_hash_table_remove(cache, &persist_first.next->key);
-      dns_cache_persistent_count--;
+      gchar buf[4096];
+
+      while (fgets(buf, sizeof(buf), hosts))
+        {
+          DNSCacheEntry *entry;
+          gchar *p, *ip;
+          gint len;
+          gint family;
+          union
+          {
+            struct in_addr ip4;
+#if ENABLE_IPV6
+            struct in6_addr ip6;
+#endif
+          } ia;
+
+          if (buf[0] == 0 || buf[0] == '\n' || buf[0] == '#')
+            continue;
+
+          len = strlen(buf);
+          if (buf[len - 1] == '\n')
+            buf[len-1] = 0;
+
+          p = strtok(buf, " \t");
+          if (!p)
+            continue;
+          ip = p;
+
+#if ENABLE_IPV6
+          if (strchr(ip, ':') != NULL)
+            family = AF_INET6;
+          else
+#endif
+          family = AF_INET;
+
+          p = strtok(NULL, " \t");
+          if (!p)
+            continue;
+          inet_pton(family, ip, &ia);
+          entry = dns_cache_entry_new(family, &ia, p, TRUE);
+          g_hash_table_replace(persist, &entry->key, entry);
+        }
+      fclose(hosts);
+    }
+  else
+    {
+      msg_error("Error loading dns cache hosts file",
+                evt_tag_str("filename", dns_cache_hosts),
+                evt_tag_errno("error", errno),
+                NULL);
     }
+  return persist;
 }
 
 static void
-dns_cache_check_hosts(glong t)
+dns_cache_check_hosts(time_t t)
 {
   struct stat st;
 
   if (G_LIKELY(dns_cache_hosts_checktime == t))
     return;
 
-  dns_cache_hosts_checktime = t;
-  
-  if (!dns_cache_hosts || stat(dns_cache_hosts, &st) < 0)
-    {
-      dns_cache_cleanup_persistent_hosts();
-      return;
-    }
-    
-  if (dns_cache_hosts_mtime == -1 || st.st_mtime > dns_cache_hosts_mtime)
+  /* a single thread is enough to check the file, the others go on using
+   * the current contents */
+  if (!g_static_mutex_trylock(&dns_cache_hosts_lock))
+    return;
+
+  if (dns_cache_hosts_checktime != t)
     {
-      FILE *hosts;
-      
-      dns_cache_hosts_mtime = st.st_mtime;
-      dns_cache_cleanup_persistent_hosts();
-      hosts = fopen(dns_cache_hosts, "r");
-      if (hosts)
-        {
-          gchar buf[4096];
-          
-          while (fgets(buf, sizeof(buf), hosts))
-            {
-              gchar *p, *ip;
-              gint len;
-              gint family;
-              union 
-              {
-                struct in_addr ip4;
-#if ENABLE_IPV6
-                struct in6_addr ip6;
-#endif
-              } ia;
-              
-              if (buf[0] == 0 || buf[0] == '\n' || buf[0] == '#')
-                continue;
-                
-              len = strlen(buf);
-              if (buf[len - 1] == '\n')
-                buf[len-1] = 0;
-                
-              p = strtok(buf, " \t");
-              if (!p)
-                continue;
-              ip = p;
+      dns_cache_hosts_checktime = t;
 
-#if ENABLE_IPV6
-              if (strchr(ip, ':') != NULL)
-                family = AF_INET6;
-              else
-#endif
-              family = AF_INET;
-                
-              p = strtok(NULL, " \t");
-              if (!p)
-                continue;
-              inet_pton(family, ip, &ia);
-              dns_cache_store(TRUE, family, &ia, p, TRUE);
-            }
-          fclose(hosts);
+      if (!dns_cache_hosts || stat(dns_cache_hosts, &st) < 0)
+        {
+          if (dns_cache_persist)
+            dns_cache_replace_persistent_hosts(NULL);
+          dns_cache_hosts_mtime = -1;
         }
-      else
+      else if (dns_cache_hosts_mtime == -1 || st.st_mtime > dns_cache_hosts_mtime)
         {
-          msg_error("Error loading dns cache hosts file", 
-                    evt_tag_str("filename", dns_cache_hosts), 
-                    evt_tag_errno("error", errno),
-                    NULL);
+          dns_cache_hosts_mtime = st.st_mtime;
+          dns_cache_replace_persistent_hosts(dns_cache_load_hosts());
         }
-        
     }
+  g_static_mutex_unlock(&dns_cache_hosts_lock);
 }
 
 /*
- * @hostname        is set to the stored hostname,
+ * @hostname        the stored hostname is copied here, it is set to an
+ *                  empty string if the entry has no hostname
  * @positive        is set whether the match was a DNS match or failure
  *
  * Returns TRUE if the cache was able to serve the request (e.g. had a
  * matching entry at all).
  */
 gboolean
-dns_cache_lookup(gint family, void *addr, const gchar **hostname, gboolean *positive)
+dns_cache_lookup(gint family, void *addr, gchar *hostname, gsize hostname_len, gboolean *positive)
 {
   DNSCacheKey key;
   DNSCacheEntry *entry;
+  DNSCacheShard *shard;
+  gboolean found = FALSE;
   time_t now;
-  
+
   now = cached_g_current_time_sec();
   dns_cache_check_hosts(now);
-  
+
   dns_cache_fill_key(&key, family, addr);
-  entry = g_hash_table_lookup(cache, &key);
-  if (entry)
+
+  g_static_rw_lock_reader_lock(&dns_cache_persist_lock);
+  if (dns_cache_persist && (entry = g_hash_table_lookup(dns_cache_persist, &key)))
     {
-      if (entry->resolved && 
-          ((entry->positive && entry->resolved < now - dns_cache_expire) ||
-           (!entry->positive && entry->resolved < now - dns_cache_expire_failed)))
-        {
-          /* the entry is not persistent and is too old */
-        }
-      else
+      dns_cache_entry_copy_result(entry, hostname, hostname_len, positive);
+      found = TRUE;
+    }
+  g_static_rw_lock_reader_unlock(&dns_cache_persist_lock);
+
+  if (!found)
+    {
+      shard = dns_cache_get_shard(&key);
+      g_static_mutex_lock(&shard->lock);
+      entry = g_hash_table_lookup(shard->cache, &key);
+      if (entry)
         {
-          *hostname = entry->hostname;
-          *positive = entry->positive;
-          return TRUE;
+          if (dns_cache_entry_is_expired(entry, now))
+            {
+              g_hash_table_remove(shard->cache, &key);
+              stats_counter_inc(dns_cache_evictions);
+            }
+          else
+            {
+              dns_cache_entry_copy_result(entry, hostname, hostname_len, positive);
+              dns_cache_entry_unlink(entry);
+              dns_cache_entry_insert_before(&shard->cache_last, entry);
+              found = TRUE;
+            }
         }
+      g_static_mutex_unlock(&shard->lock);
     }
-  *hostname = NULL;
+
+  if (found)
+    {
+      stats_counter_inc(dns_cache_hits);
+      return TRUE;
+    }
+
+  stats_counter_inc(dns_cache_misses);
+  hostname[0] = 0;
   *positive = FALSE;
   return FALSE;
 }
@@ -293,74 +413,92 @@ void
 dns_cache_store(gboolean persistent, gint family, void *addr, const gchar *hostname, gboolean positive)
 {
   DNSCacheEntry *entry;
-  guint hash_size;
-  
-  entry = g_new(DNSCacheEntry, 1);
+  DNSCacheShard *shard;
 
-  dns_cache_fill_key(&entry->key, family, addr);
-  entry->hostname = hostname ? g_strdup(hostname) : NULL;
-  entry->positive = positive;
-  if (!persistent)
-    {
-      entry->resolved = cached_g_current_time_sec();
-      dns_cache_entry_insert_before(&cache_last, entry);
-    }
-  else
+  entry = dns_cache_entry_new(family, addr, hostname, positive);
+  if (persistent)
     {
-      entry->resolved = 0;
-      dns_cache_entry_insert_before(&persist_last, entry);
+      g_static_rw_lock_writer_lock(&dns_cache_persist_lock);
+      if (!dns_cache_persist)
+        dns_cache_persist = dns_cache_persist_new();
+      g_hash_table_replace(dns_cache_persist, &entry->key, entry);
+      g_static_rw_lock_writer_unlock(&dns_cache_persist_lock);
+      return;
     }
-  hash_size = g_hash_table_size(cache);
-  g_hash_table_replace(cache, &entry->key, entry);
-
-  if (persistent && hash_size != g_hash_table_size(cache))
-    dns_cache_persistent_count++;
-  
-  /* persistent elements are not counted */
-  if ((gint) (g_hash_table_size(cache) - dns_cache_persistent_count) > dns_cache_size)
+
+  entry->resolved = cached_g_current_time_sec();
+  shard = dns_cache_get_shard(&entry->key);
+
+  g_static_mutex_lock(&shard->lock);
+  dns_cache_entry_insert_before(&shard->cache_last, entry);
+  g_hash_table_replace(shard->cache, &entry->key, entry);
+
+  if ((gint) g_hash_table_size(shard->cache) > dns_cache_shard_size())
     {
-      /* remove oldest element */
-      g_hash_table_remove(cache, &cache_first.next->key);
+      /* remove the least recently used element */
+      g_hash_table_remove(shard->cache, &shard->cache_first.next->key);
+      stats_counter_inc(dns_cache_evictions);
     }
+  g_static_mutex_unlock(&shard->lock);
 }
 
 void
 dns_cache_set_params(gint cache_size, gint expire, gint expire_failed, const gchar *hosts)
 {
+  g_static_mutex_lock(&dns_cache_hosts_lock);
   if (dns_cache_hosts)
     g_free(dns_cache_hosts);
-    
+
   dns_cache_size = cache_size;
   dns_cache_expire = expire;
   dns_cache_expire_failed = expire_failed;
   dns_cache_hosts = g_strdup(hosts);
   dns_cache_hosts_mtime = -1;
   dns_cache_hosts_checktime = 0;
+  g_static_mutex_unlock(&dns_cache_hosts_lock);
 }
 
 void
 dns_cache_init(void)
 {
-  cache = g_hash_table_new_full((GHashFunc) dns_cache_key_hash, (GEqualFunc) dns_cache_key_equal, NULL, (GDestroyNotify) dns_cache_entry_free);
-  cache_first.next = &cache_last;
-  cache_first.prev = NULL;
-  cache_last.prev = &cache_first;
-  cache_last.next = NULL;
-
-  persist_first.next = &persist_last;
-  persist_first.prev = NULL;
-  persist_last.prev = &persist_first;
-  persist_last.next = NULL;
+  gint i;
+
+  for (i = 0; i < DNS_CACHE_SHARDS; i++)
+    {
+      DNSCacheShard *shard = &dns_cache_shards[i];
+
+      g_static_mutex_init(&shard->lock);
+      shard->cache = g_hash_table_new_full((GHashFunc) dns_cache_key_hash, (GEqualFunc) dns_cache_key_equal, NULL, (GDestroyNotify) dns_cache_entry_free);
+      shard->cache_first.next = &shard->cache_last;
+      shard->cache_first.prev = NULL;
+      shard->cache_last.prev = &shard->cache_first;
+      shard->cache_last.next = NULL;
+    }
+
+  stats_lock();
+  stats_register_counter(0, SCS_GLOBAL, "dns_cache", "hits", SC_TYPE_PROCESSED, &dns_cache_hits);
+  stats_register_counter(0, SCS_GLOBAL, "dns_cache", "misses", SC_TYPE_PROCESSED, &dns_cache_misses);
+  stats_register_counter(0, SCS_GLOBAL, "dns_cache", "evictions", SC_TYPE_PROCESSED, &dns_cache_evictions);
+  stats_unlock();
 }
 
 void
 dns_cache_destroy(void)
 {
-  g_hash_table_destroy(cache);
-  cache_first.next = NULL;
-  cache_last.prev = NULL;
-  persist_first.next = NULL;
-  persist_last.prev = NULL;
+  gint i;
+
+  for (i = 0; i < DNS_CACHE_SHARDS; i++)
+    {
+      DNSCacheShard *shard = &dns_cache_shards[i];
+
+      g_hash_table_destroy(shard->cache);
+      shard->cache = NULL;
+      shard->cache_first.next = NULL;
+      shard->cache_last.prev = NULL;
+      g_static_mutex_free(&shard->lock);
+    }
+  dns_cache_replace_persistent_hosts(NULL);
   if (dns_cache_hosts)
     g_free(dns_cache_hosts);
+  dns_cache_hosts = NULL;
 }
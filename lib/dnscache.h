@@ -28,7 +28,25 @@
 
 #include "syslog-ng.h"
 
-gboolean dns_cache_lookup(gint family, void *addr, const gchar **hostname, gboolean *positive);
+#include <netinet/in.h>
+
+typedef struct _DNSCacheKey
+{
+  gint family;
+  union
+  {
+    struct in_addr ip;
+#if ENABLE_IPV6
+    struct in6_addr ip6;
+#endif
+  } addr;
+} DNSCacheKey;
+
+void dns_cache_fill_key(DNSCacheKey *key, gint family, void *addr);
+guint dns_cache_key_hash(DNSCacheKey *e);
+gboolean dns_cache_key_equal(DNSCacheKey *e1, DNSCacheKey *e2);
+
+gboolean dns_cache_lookup(gint family, void *addr, gchar *hostname, gsize hostname_len, gboolean *positive);
 void dns_cache_store(gboolean persistent, gint family, void *addr, const gchar *hostname, gboolean positive);
 
 void dns_cache_set_params(gint cache_size, gint expire, gint expire_failed, const gchar *hosts);
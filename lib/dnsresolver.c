@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2002-2011 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2011 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "dnsresolver.h"
+#include "dnscache.h"
+#include "timeutils.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <string.h>
+
+/*
+ * Asynchronous reverse DNS resolution.
+ *
+ * On a DNS cache miss, resolve_sockaddr() used to resolve the address
+ * right from the I/O worker, so a slow or unreachable DNS server
+ * stalled every source that worker was serving.
+ *
+ * When dns_resolver_threads() is set, the lookups are performed by a
+ * small thread pool instead.  The results are collected in a table
+ * shared by all threads, which the I/O workers consult when the DNS
+ * cache misses:
+ *
+ *   - if the table has no entry for the address, a pending entry is
+ *     added and the lookup is pushed to the thread pool.  Further misses
+ *     for the same address find the pending entry, so a burst of
+ *     messages from a new address results in a single lookup.
+ *
+ *   - while the lookup is in progress, the I/O worker waits at most
+ *     dns_resolver_wait() milliseconds, then uses the address as the
+ *     hostname without putting it into its cache
+ *
+ *   - failed lookups are recorded as negative entries, they expire
+ *     after dns_cache_expire_failed() seconds, successful ones after
+ *     dns_cache_expire()
+ */
+
+typedef struct _DNSResolverEntry
+{
+  DNSCacheKey key;
+  gchar *hostname;
+  gboolean positive;
+  /* zero while the lookup is in progress */
+  time_t resolved;
+} DNSResolverEntry;
+
+static GStaticMutex dns_resolver_lock = G_STATIC_MUTEX_INIT;
+static GCond *dns_resolver_cond;
+static GHashTable *dns_resolver_entries;
+static GThreadPool *dns_resolver_pool;
+static DNSResolveFunc dns_resolver_resolve_func;
+static gint dns_resolver_threads = 0;
+static gint dns_resolver_wait = 0;
+static gint dns_resolver_cache_size = 1007;
+static gint dns_resolver_expire = 3600;
+static gint dns_resolver_expire_failed = 60;
+static volatile gboolean dns_resolver_shutting_down;
+
+static gboolean
+dns_resolver_getnameinfo(gint family, void *addr, gchar *hostname, gsize hostname_len)
+{
+  union
+  {
+    struct sockaddr sa;
+    struct sockaddr_in sin;
+#if ENABLE_IPV6
+    struct sockaddr_in6 sin6;
+#endif
+  } sa;
+  socklen_t salen;
+
+  memset(&sa, 0, sizeof(sa));
+  switch (family)
+    {
+    case AF_INET:
+      sa.sin.sin_family = AF_INET;
+      sa.sin.sin_addr = *(struct in_addr *) addr;
+      salen = sizeof(sa.sin);
+      break;
+#if ENABLE_IPV6
+    case AF_INET6:
+      sa.sin6.sin6_family = AF_INET6;
+      sa.sin6.sin6_addr = *(struct in6_addr *) addr;
+      salen = sizeof(sa.sin6);
+      break;
+#endif
+    default:
+      g_assert_not_reached();
+      return FALSE;
+    }
+
+  /* contrary to gethostbyaddr(), getnameinfo() is thread-safe */
+  return getnameinfo(&sa.sa, salen, hostname, hostname_len, NULL, 0, NI_NAMEREQD) == 0;
+}
+
+static void
+dns_resolver_entry_free(DNSResolverEntry *entry)
+{
+  g_free(entry->hostname);
+  g_free(entry);
+}
+
+static inline gboolean
+dns_resolver_entry_is_expired(DNSResolverEntry *entry, time_t now)
+{
+  return entry->resolved &&
+    ((entry->positive && entry->resolved < now - dns_resolver_expire) ||
+     (!entry->positive && entry->resolved < now - dns_resolver_expire_failed));
+}
+
+/* positive results have been copied to the DNS cache by the I/O workers
+ * that asked for them, negative ones are kept until they expire, so
+ * that failing lookups are not repeated right away */
+static gboolean
+dns_resolver_entry_is_evictable(gpointer key, gpointer value, gpointer user_data)
+{
+  DNSResolverEntry *entry = (DNSResolverEntry *) value;
+  time_t now = GPOINTER_TO_UINT(user_data);
+
+  return entry->resolved && (entry->positive || dns_resolver_entry_is_expired(entry, now));
+}
+
+/* runs in the resolver threads */
+static void
+dns_resolver_resolve(gpointer data, gpointer user_data)
+{
+  DNSCacheKey *key = (DNSCacheKey *) data;
+  DNSResolverEntry *entry;
+  gchar hostname[NI_MAXHOST];
+  gboolean positive;
+
+  /* lookups still queued at shutdown are dropped */
+  if (dns_resolver_shutting_down)
+    {
+      g_free(key);
+      return;
+    }
+
+  positive = dns_resolver_resolve_func(key->family, &key->addr, hostname, sizeof(hostname));
+
+  g_static_mutex_lock(&dns_resolver_lock);
+  entry = g_hash_table_lookup(dns_resolver_entries, key);
+  if (entry && !entry->resolved)
+    {
+      entry->hostname = positive ? g_strdup(hostname) : NULL;
+      entry->positive = positive;
+      entry->resolved = cached_g_current_time_sec();
+    }
+  g_cond_broadcast(dns_resolver_cond);
+  g_static_mutex_unlock(&dns_resolver_lock);
+  g_free(key);
+}
+
+/* must be called with dns_resolver_lock held */
+static DNSResolverEntry *
+dns_resolver_start_lookup(DNSCacheKey *key)
+{
+  DNSResolverEntry *entry;
+
+  if (g_hash_table_size(dns_resolver_entries) >= dns_resolver_cache_size)
+    g_hash_table_foreach_remove(dns_resolver_entries, dns_resolver_entry_is_evictable,
+                                GUINT_TO_POINTER(cached_g_current_time_sec()));
+
+  entry = g_new0(DNSResolverEntry, 1);
+  entry->key = *key;
+  g_hash_table_insert(dns_resolver_entries, &entry->key, entry);
+  g_thread_pool_push(dns_resolver_pool, g_memdup(key, sizeof(*key)), NULL);
+  return entry;
+}
+
+gboolean
+dns_resolver_is_async(void)
+{
+  return dns_resolver_threads > 0;
+}
+
+/*
+ * Look up the name of an address without blocking for longer than
+ * dns_resolver_wait() milliseconds.
+ *
+ * Returns TRUE if the result of the lookup is available: @positive is
+ * set to whether it was successful and the name is copied to
+ * @hostname if it was.  Returns FALSE if the lookup is still in
+ * progress.
+ */
+gboolean
+dns_resolver_lookup(gint family, void *addr, gchar *hostname, gsize hostname_len, gboolean *positive)
+{
+  DNSCacheKey key;
+  DNSResolverEntry *entry;
+  gboolean found = FALSE;
+
+  dns_cache_fill_key(&key, family, addr);
+
+  g_static_mutex_lock(&dns_resolver_lock);
+  entry = g_hash_table_lookup(dns_resolver_entries, &key);
+  if (entry && dns_resolver_entry_is_expired(entry, cached_g_current_time_sec()))
+    {
+      g_hash_table_remove(dns_resolver_entries, &key);
+      entry = NULL;
+    }
+  if (!entry)
+    entry = dns_resolver_start_lookup(&key);
+
+  if (!entry->resolved && dns_resolver_wait > 0)
+    {
+      GTimeVal deadline;
+
+      g_get_current_time(&deadline);
+      g_time_val_add(&deadline, dns_resolver_wait * 1000);
+
+      /* the entry may be freed while we are waiting, look it up again after each wakeup */
+      do
+        {
+          if (!g_cond_timed_wait(dns_resolver_cond, g_static_mutex_get_mutex(&dns_resolver_lock), &deadline))
+            break;
+          entry = g_hash_table_lookup(dns_resolver_entries, &key);
+        }
+      while (entry && !entry->resolved);
+      entry = g_hash_table_lookup(dns_resolver_entries, &key);
+    }
+
+  if (entry && entry->resolved)
+    {
+      if (entry->positive)
+        g_strlcpy(hostname, entry->hostname, hostname_len);
+      *positive = entry->positive;
+      found = TRUE;
+    }
+  g_static_mutex_unlock(&dns_resolver_lock);
+  return found;
+}
+
+void
+dns_resolver_set_resolve_func(DNSResolveFunc resolve)
+{
+  dns_resolver_resolve_func = resolve ? resolve : dns_resolver_getnameinfo;
+}
+
+void
+dns_resolver_set_params(gint threads, gint wait, gint cache_size, gint expire, gint expire_failed)
+{
+  g_static_mutex_lock(&dns_resolver_lock);
+  dns_resolver_threads = threads;
+  dns_resolver_wait = wait;
+  dns_resolver_cache_size = cache_size;
+  dns_resolver_expire = expire;
+  dns_resolver_expire_failed = expire_failed;
+
+  if (!dns_resolver_resolve_func)
+    dns_resolver_resolve_func = dns_resolver_getnameinfo;
+
+  if (threads > 0)
+    {
+      if (!dns_resolver_pool)
+        {
+          dns_resolver_cond = g_cond_new();
+          dns_resolver_entries = g_hash_table_new_full((GHashFunc) dns_cache_key_hash, (GEqualFunc) dns_cache_key_equal, NULL, (GDestroyNotify) dns_resolver_entry_free);
+          dns_resolver_pool = g_thread_pool_new(dns_resolver_resolve, NULL, threads, FALSE, NULL);
+        }
+      else
+        {
+          g_thread_pool_set_max_threads(dns_resolver_pool, threads, NULL);
+        }
+    }
+  g_static_mutex_unlock(&dns_resolver_lock);
+}
+
+void
+dns_resolver_destroy(void)
+{
+  if (!dns_resolver_pool)
+    return;
+
+  /* lookups that haven't been started yet are dropped (but their keys
+   * are still freed by dns_resolver_resolve()), running ones are waited
+   * for */
+  dns_resolver_shutting_down = TRUE;
+  g_thread_pool_free(dns_resolver_pool, FALSE, TRUE);
+  dns_resolver_shutting_down = FALSE;
+  dns_resolver_pool = NULL;
+  g_hash_table_destroy(dns_resolver_entries);
+  dns_resolver_entries = NULL;
+  g_cond_free(dns_resolver_cond);
+  dns_resolver_cond = NULL;
+  dns_resolver_threads = 0;
+}
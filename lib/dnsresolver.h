@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2002-2011 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2011 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef DNSRESOLVER_H_INCLUDED
+#define DNSRESOLVER_H_INCLUDED
+
+#include "syslog-ng.h"
+
+typedef gboolean (*DNSResolveFunc)(gint family, void *addr, gchar *hostname, gsize hostname_len);
+
+gboolean dns_resolver_is_async(void);
+gboolean dns_resolver_lookup(gint family, void *addr, gchar *hostname, gsize hostname_len, gboolean *positive);
+
+void dns_resolver_set_resolve_func(DNSResolveFunc resolve);
+void dns_resolver_set_params(gint threads, gint wait, gint cache_size, gint expire, gint expire_failed);
+void dns_resolver_destroy(void);
+
+#endif
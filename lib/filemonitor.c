@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2002-2010 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2010 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "filemonitor.h"
+#include "messages.h"
+#include "misc.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <iv.h>
+
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#endif
+
+struct _FileMonitor
+{
+  gchar *filename;
+  gchar *dirname;
+  gchar *basename;
+  gint wd;
+  FileMonitorCallback callback;
+  /* set if the whole directory is monitored, basename is NULL in this case */
+  FileMonitorDirectoryCallback dir_callback;
+  gpointer user_data;
+};
+
+#if HAVE_SYS_INOTIFY_H
+
+/* filesystems where modifications done by other hosts are not reported
+ * through inotify, these are followed by polling instead */
+#define NFS_SUPER_MAGIC   0x6969
+#define SMB_SUPER_MAGIC   0x517B
+#define CIFS_SUPER_MAGIC  0xFF534D42
+#define FUSE_SUPER_MAGIC  0x65735546
+
+#define FILE_MONITOR_DIR_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*
+ * The state below is shared by all FileMonitor instances, a single
+ * inotify instance is used for the whole process, registered into the main
+ * loop whenever there's at least one active watch.
+ *
+ * Monitors of the same directory share a single inotify watch.
+ * file_monitor_watches maps a watch descriptor to a FileMonitorWatch,
+ * which indexes the monitors following single files by their basename,
+ * so that an event is dispatched with a hash lookup, no matter how many
+ * files of the directory are followed.
+ */
+typedef struct _FileMonitorWatch
+{
+  /* basename -> GList of FileMonitor instances */
+  GHashTable *files;
+  /* monitors of the whole directory */
+  GList *directories;
+  gint count;
+} FileMonitorWatch;
+
+static struct iv_fd file_monitor_fd;
+static GHashTable *file_monitor_watches;
+/* incremented whenever the inotify instance is (re)opened */
+static gint file_monitor_generation;
+
+static void file_monitor_global_deinit(void);
+
+static void
+file_monitor_watch_free_files(gpointer key, gpointer value, gpointer user_data)
+{
+  g_list_free((GList *) value);
+}
+
+static void
+file_monitor_watch_free(FileMonitorWatch *watch)
+{
+  g_hash_table_foreach(watch->files, file_monitor_watch_free_files, NULL);
+  g_hash_table_destroy(watch->files);
+  g_list_free(watch->directories);
+  g_free(watch);
+}
+
+static void
+file_monitor_watch_add(gint wd, FileMonitor *self)
+{
+  FileMonitorWatch *watch = g_hash_table_lookup(file_monitor_watches, GINT_TO_POINTER(wd));
+
+  if (!watch)
+    {
+      watch = g_new0(FileMonitorWatch, 1);
+      watch->files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+      g_hash_table_insert(file_monitor_watches, GINT_TO_POINTER(wd), watch);
+    }
+
+  if (self->basename)
+    {
+      GList *monitors = g_hash_table_lookup(watch->files, self->basename);
+
+      g_hash_table_insert(watch->files, g_strdup(self->basename), g_list_prepend(monitors, self));
+    }
+  else
+    {
+      watch->directories = g_list_prepend(watch->directories, self);
+    }
+  watch->count++;
+}
+
+/* returns TRUE if @self was the last user of the watch, which is freed */
+static gboolean
+file_monitor_watch_remove(gint wd, FileMonitor *self)
+{
+  FileMonitorWatch *watch = g_hash_table_lookup(file_monitor_watches, GINT_TO_POINTER(wd));
+
+  if (self->basename)
+    {
+      GList *monitors = g_hash_table_lookup(watch->files, self->basename);
+
+      monitors = g_list_remove(monitors, self);
+      if (monitors)
+        g_hash_table_insert(watch->files, g_strdup(self->basename), monitors);
+      else
+        g_hash_table_remove(watch->files, self->basename);
+    }
+  else
+    {
+      watch->directories = g_list_remove(watch->directories, self);
+    }
+
+  if (--watch->count > 0)
+    return FALSE;
+  g_hash_table_remove(file_monitor_watches, GINT_TO_POINTER(wd));
+  return TRUE;
+}
+
+static gboolean
+file_monitor_watch_contains(gint wd, FileMonitor *self)
+{
+  FileMonitorWatch *watch;
+
+  if (!file_monitor_watches)
+    return FALSE;
+  watch = g_hash_table_lookup(file_monitor_watches, GINT_TO_POINTER(wd));
+  if (!watch)
+    return FALSE;
+  if (self->basename)
+    return g_list_find(g_hash_table_lookup(watch->files, self->basename), self) != NULL;
+  return g_list_find(watch->directories, self) != NULL;
+}
+
+static void
+file_monitor_watch_collect_files(gpointer key, gpointer value, gpointer user_data)
+{
+  GList **monitors = (GList **) user_data;
+
+  *monitors = g_list_concat(g_list_copy((GList *) value), *monitors);
+}
+
+/* returns a copy of the monitors interested in @name, or all of them if @name is NULL */
+static GList *
+file_monitor_watch_collect(gint wd, const gchar *name)
+{
+  FileMonitorWatch *watch = g_hash_table_lookup(file_monitor_watches, GINT_TO_POINTER(wd));
+  GList *monitors = NULL;
+
+  if (!watch)
+    return NULL;
+
+  if (name)
+    monitors = g_list_copy(g_hash_table_lookup(watch->files, name));
+  else
+    g_hash_table_foreach(watch->files, file_monitor_watch_collect_files, &monitors);
+  return g_list_concat(monitors, g_list_copy(watch->directories));
+}
+
+static gboolean
+file_monitor_is_remote_fs(const gchar *dirname)
+{
+  struct statfs st;
+
+  if (statfs(dirname, &st) < 0)
+    return FALSE;
+
+  switch ((guint32) st.f_type)
+    {
+    case NFS_SUPER_MAGIC:
+    case SMB_SUPER_MAGIC:
+    case CIFS_SUPER_MAGIC:
+    case FUSE_SUPER_MAGIC:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static void
+file_monitor_notify(FileMonitor *self, const gchar *name)
+{
+  if (self->dir_callback)
+    self->dir_callback(name, self->user_data);
+  else
+    self->callback(self->user_data);
+}
+
+/*
+ * Notifies the monitors using the watch @wd about a change of @name, or
+ * all of them if @name is NULL.  The callbacks may start, stop or free
+ * any of the monitors (not just their own), thus a copy is iterated and
+ * each monitor is checked to be still using the watch right before it
+ * is notified.
+ */
+static void
+file_monitor_notify_watch(gint wd, const gchar *name)
+{
+  gint generation = file_monitor_generation;
+  GList *monitors, *l;
+
+  monitors = file_monitor_watch_collect(wd, name);
+  for (l = monitors; l; l = l->next)
+    {
+      FileMonitor *self = (FileMonitor *) l->data;
+
+      /* the inotify instance was closed (and maybe reopened) by a callback */
+      if (!file_monitor_watches || generation != file_monitor_generation)
+        break;
+      if (!file_monitor_watch_contains(wd, self))
+        continue;
+
+      file_monitor_notify(self, name);
+    }
+  g_list_free(monitors);
+}
+
+static void
+file_monitor_collect_watch(gpointer key, gpointer value, gpointer user_data)
+{
+  GList **wds = (GList **) user_data;
+
+  *wds = g_list_prepend(*wds, key);
+}
+
+static void
+file_monitor_notify_all(void)
+{
+  gint generation = file_monitor_generation;
+  GList *wds = NULL, *l;
+
+  /* the callbacks may change the table, we can't iterate it directly */
+  g_hash_table_foreach(file_monitor_watches, file_monitor_collect_watch, &wds);
+  for (l = wds; l && file_monitor_watches && generation == file_monitor_generation; l = l->next)
+    file_monitor_notify_watch(GPOINTER_TO_INT(l->data), NULL);
+  g_list_free(wds);
+}
+
+static void
+file_monitor_process_event(struct inotify_event *event)
+{
+  GList *monitors, *l;
+
+  if (!g_hash_table_lookup(file_monitor_watches, GINT_TO_POINTER(event->wd)))
+    return;
+
+  if (event->mask & IN_IGNORED)
+    {
+      gint generation = file_monitor_generation;
+
+      /* the directory itself went away, the kernel has removed the
+       * watch. Let the users know, they fall back to polling from now on. */
+
+      monitors = file_monitor_watch_collect(event->wd, NULL);
+      for (l = monitors; l && file_monitor_watches && generation == file_monitor_generation; l = l->next)
+        {
+          FileMonitor *self = (FileMonitor *) l->data;
+
+          /* stopped or freed by an earlier callback */
+          if (!file_monitor_watch_contains(event->wd, self))
+            continue;
+
+          file_monitor_watch_remove(event->wd, self);
+          self->wd = -1;
+          file_monitor_notify(self, NULL);
+        }
+      g_list_free(monitors);
+
+      /* tear down the inotify instance unless the callbacks have started
+       * new watches */
+      if (file_monitor_watches && generation == file_monitor_generation &&
+          g_hash_table_size(file_monitor_watches) == 0)
+        file_monitor_global_deinit();
+      return;
+    }
+
+  if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+    file_monitor_notify_watch(event->wd, NULL);
+  else if (event->len > 0)
+    file_monitor_notify_watch(event->wd, event->name);
+}
+
+static void
+file_monitor_handle_input(gpointer s)
+{
+  gchar buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  gint generation = file_monitor_generation;
+  gssize len;
+  gchar *p;
+
+  while ((len = read(file_monitor_fd.fd, buf, sizeof(buf))) > 0)
+    {
+      for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len)
+        {
+          struct inotify_event *event = (struct inotify_event *) p;
+
+          if (event->mask & IN_Q_OVERFLOW)
+            {
+              msg_verbose("inotify event queue overflowed, checking all monitored files", NULL);
+              file_monitor_notify_all();
+            }
+          else
+            {
+              file_monitor_process_event(event);
+            }
+
+          /* the inotify instance was closed (and maybe reopened) by a
+           * callback, the rest of the buffer refers to its old watches */
+          if (!file_monitor_watches || generation != file_monitor_generation)
+            return;
+        }
+    }
+  if (len < 0 && errno != EAGAIN && errno != EINTR)
+    {
+      msg_error("Error reading inotify events",
+                evt_tag_errno(EVT_TAG_OSERROR, errno),
+                NULL);
+    }
+}
+
+static gboolean
+file_monitor_global_init(void)
+{
+  gint fd;
+
+  if (file_monitor_watches)
+    return TRUE;
+
+  fd = inotify_init();
+  if (fd < 0)
+    {
+      msg_verbose("inotify is not available, falling back to polling followed files",
+                  evt_tag_errno(EVT_TAG_OSERROR, errno),
+                  NULL);
+      return FALSE;
+    }
+  g_fd_set_nonblock(fd, TRUE);
+  g_fd_set_cloexec(fd, TRUE);
+
+  IV_FD_INIT(&file_monitor_fd);
+  file_monitor_fd.fd = fd;
+  file_monitor_fd.handler_in = file_monitor_handle_input;
+  iv_fd_register(&file_monitor_fd);
+
+  file_monitor_watches = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) file_monitor_watch_free);
+  file_monitor_generation++;
+  return TRUE;
+}
+
+static void
+file_monitor_global_deinit(void)
+{
+  iv_fd_unregister(&file_monitor_fd);
+  close(file_monitor_fd.fd);
+  g_hash_table_destroy(file_monitor_watches);
+  file_monitor_watches = NULL;
+}
+
+/**
+ * file_monitor_start:
+ *
+ * Starts monitoring the file. Returns FALSE if change notifications are
+ * not available for this file, in which case the caller should resort to
+ * polling.
+ **/
+gboolean
+file_monitor_start(FileMonitor *self)
+{
+  if (self->wd >= 0)
+    return TRUE;
+
+  if (file_monitor_is_remote_fs(self->dirname))
+    {
+      msg_verbose("Followed file is on a remote filesystem, falling back to polling",
+                  evt_tag_str("filename", self->filename),
+                  NULL);
+      return FALSE;
+    }
+
+  if (!file_monitor_global_init())
+    return FALSE;
+
+  /* adding a watch for an already watched directory returns the existing one */
+  self->wd = inotify_add_watch(file_monitor_fd.fd, self->dirname, FILE_MONITOR_DIR_EVENTS);
+  if (self->wd < 0)
+    {
+      msg_verbose("Error adding inotify watch, falling back to polling",
+                  evt_tag_str("filename", self->filename),
+                  evt_tag_errno(EVT_TAG_OSERROR, errno),
+                  NULL);
+      if (g_hash_table_size(file_monitor_watches) == 0)
+        file_monitor_global_deinit();
+      return FALSE;
+    }
+
+  file_monitor_watch_add(self->wd, self);
+  return TRUE;
+}
+
+void
+file_monitor_stop(FileMonitor *self)
+{
+  if (self->wd < 0)
+    return;
+
+  /* remove the directory watch if we were its last user */
+  if (file_monitor_watch_remove(self->wd, self))
+    inotify_rm_watch(file_monitor_fd.fd, self->wd);
+  self->wd = -1;
+
+  if (g_hash_table_size(file_monitor_watches) == 0)
+    file_monitor_global_deinit();
+}
+
+#else
+
+gboolean
+file_monitor_start(FileMonitor *self)
+{
+  return FALSE;
+}
+
+void
+file_monitor_stop(FileMonitor *self)
+{
+}
+
+#endif
+
+gboolean
+file_monitor_is_active(FileMonitor *self)
+{
+  return self->wd >= 0;
+}
+
+FileMonitor *
+file_monitor_new(const gchar *filename, FileMonitorCallback callback, gpointer user_data)
+{
+  FileMonitor *self = g_new0(FileMonitor, 1);
+
+  self->filename = g_strdup(filename);
+  self->dirname = g_path_get_dirname(filename);
+  self->basename = g_path_get_basename(filename);
+  self->wd = -1;
+  self->callback = callback;
+  self->user_data = user_data;
+  return self;
+}
+
+FileMonitor *
+file_monitor_new_directory(const gchar *dirname, FileMonitorDirectoryCallback callback, gpointer user_data)
+{
+  FileMonitor *self = g_new0(FileMonitor, 1);
+
+  self->filename = g_strdup(dirname);
+  self->dirname = g_strdup(dirname);
+  self->basename = NULL;
+  self->wd = -1;
+  self->dir_callback = callback;
+  self->user_data = user_data;
+  return self;
+}
+
+void
+file_monitor_free(FileMonitor *self)
+{
+  file_monitor_stop(self);
+  g_free(self->filename);
+  g_free(self->dirname);
+  g_free(self->basename);
+  g_free(self);
+}
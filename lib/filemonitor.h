@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2002-2010 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2010 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef FILEMONITOR_H_INCLUDED
+#define FILEMONITOR_H_INCLUDED
+
+#include "syslog-ng.h"
+
+/*
+ * FileMonitor watches a single path for changes using the kernel's
+ * change notification mechanism (inotify) and calls back whenever the
+ * file named by the path was created, modified, moved or removed.
+ *
+ * Monitoring is performed through a watch on the containing directory, so
+ * rotation (rename + create) is noticed as well as the creation of files
+ * that did not exist when monitoring was started. Watches on the same
+ * directory are shared between FileMonitor instances.
+ *
+ * A FileMonitor can also watch a directory as a whole, in which case the
+ * callback receives the name of the changed entry, or NULL if the
+ * directory should be rescanned (e.g. events were lost, or the directory
+ * itself was removed).
+ *
+ * All functions must be called from the main thread, the callback is also
+ * invoked there.
+ */
+typedef struct _FileMonitor FileMonitor;
+typedef void (*FileMonitorCallback)(gpointer user_data);
+typedef void (*FileMonitorDirectoryCallback)(const gchar *name, gpointer user_data);
+
+gboolean file_monitor_start(FileMonitor *self);
+void file_monitor_stop(FileMonitor *self);
+gboolean file_monitor_is_active(FileMonitor *self);
+
+FileMonitor *file_monitor_new(const gchar *filename, FileMonitorCallback callback, gpointer user_data);
+FileMonitor *file_monitor_new_directory(const gchar *dirname, FileMonitorDirectoryCallback callback, gpointer user_data);
+void file_monitor_free(FileMonitor *self);
+
+#endif
@@ -32,6 +32,7 @@
 #include "stats.h"
 #include "templates.h"
 #include "tls-support.h"
+#include "memaccount.h"
 
 #include <sys/types.h>
 #include <time.h>
@@ -364,7 +365,9 @@ log_msg_init_queue_node(LogMessage *msg, LogMessageQueueNode *node, const LogPat
   INIT_LIST_HEAD(&node->list);
   node->ack_needed = path_options->ack_needed;
   node->msg = log_msg_ref(msg);
+  node->mem_size = log_msg_get_size(msg);
   msg->flags |= LF_STATE_REFERENCED;
+  mem_account_alloc(MA_QUEUE, node->mem_size);
 }
 
 /*
@@ -419,6 +422,7 @@ log_msg_alloc_dynamic_queue_node(LogMessage *msg, const LogPathOptions *path_opt
 void
 log_msg_free_queue_node(LogMessageQueueNode *node)
 {
+  mem_account_free(MA_QUEUE, node->mem_size);
   if (!node->embedded)
     g_slice_free(LogMessageQueueNode, node);
 }
@@ -440,7 +444,9 @@ log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *value, gssize
 
   if (!log_msg_chk_flag(self, LF_STATE_OWN_PAYLOAD))
     {
-      self->payload = nv_table_clone(self->payload, name_len + value_len + 2);
+      /* the payload is shared with the message we were cloned from,
+       * only record our changes on top of it */
+      self->payload = nv_table_new_overlay(self->payload, name_len + value_len + 2);
       log_msg_set_flag(self, LF_STATE_OWN_PAYLOAD);
     }
 
@@ -484,7 +490,7 @@ log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handl
 
   if (!log_msg_chk_flag(self, LF_STATE_OWN_PAYLOAD))
     {
-      self->payload = nv_table_clone(self->payload, name_len + 1);
+      self->payload = nv_table_new_overlay(self->payload, name_len + 1);
       log_msg_set_flag(self, LF_STATE_OWN_PAYLOAD);
     }
 
@@ -977,6 +983,7 @@ log_msg_alloc(gsize payload_size)
       alloc_size += payload_space;
     }
   msg = g_malloc(alloc_size);
+  mem_account_alloc(MA_LOGMSG, alloc_size);
 
   memset(msg, 0, sizeof(LogMessage));
 
@@ -984,6 +991,7 @@ log_msg_alloc(gsize payload_size)
     msg->payload = nv_table_init_borrowed(((gchar *) msg) + payload_ofs, payload_space, LM_V_MAX);
 
   msg->num_nodes = nodes;
+  msg->alloc_size = alloc_size;
   return msg;
 }
 
@@ -1045,6 +1053,7 @@ LogMessage *
 log_msg_clone_cow(LogMessage *msg, const LogPathOptions *path_options)
 {
   LogMessage *self = log_msg_alloc(0);
+  guint32 alloc_size = self->alloc_size;
 
   stats_counter_inc(count_msg_clones);
   if ((msg->flags & LF_STATE_OWN_MASK) == 0 || ((msg->flags & LF_STATE_OWN_MASK) == LF_STATE_OWN_TAGS && msg->num_tags == 0))
@@ -1058,6 +1067,7 @@ log_msg_clone_cow(LogMessage *msg, const LogPathOptions *path_options)
   msg->flags |= LF_STATE_REFERENCED;
 
   memcpy(self, msg, sizeof(*msg));
+  self->alloc_size = alloc_size;
 
   /* every field _must_ be initialized explicitly if its direct
    * copying would cause problems (like copying a pointer by value) */
@@ -1151,9 +1161,24 @@ log_msg_free(LogMessage *self)
   if (self->original)
     log_msg_unref(self->original);
 
+  mem_account_free(MA_LOGMSG, self->alloc_size);
   g_free(self);
 }
 
+/*
+ * Returns the amount of memory used by @self: its own allocation and
+ * its payload, unless the payload is shared with another message.
+ */
+gsize
+log_msg_get_size(LogMessage *self)
+{
+  gsize size = self->alloc_size;
+
+  if (log_msg_chk_flag(self, LF_STATE_OWN_PAYLOAD) && self->payload && !self->payload->borrowed)
+    size += nv_table_get_alloc_length(self->payload);
+  return size;
+}
+
 /**
  * log_msg_drop:
  * @msg: LogMessage instance
@@ -112,6 +112,8 @@ typedef struct _LogMessageQueueNode
   struct list_head list;
   LogMessage *msg;
   gboolean ack_needed:1, embedded:1;
+  /* the size of msg accounted to the queue, see log_msg_get_size() */
+  guint32 mem_size;
 } LogMessageQueueNode;
 
 
@@ -167,6 +169,9 @@ struct _LogMessage
 
   guint8 num_nodes;
   guint8 cur_node;
+  /* the size of the allocation holding this structure (including
+   * nodes and the initial payload), used for memory accounting */
+  guint32 alloc_size;
 
   /* preallocated LogQueueNodes used to insert this message into a LogQueue */
   LogMessageQueueNode nodes[0];
@@ -182,6 +187,7 @@ extern gint logmsg_node_max;
 LogMessage *log_msg_ref(LogMessage *m);
 void log_msg_unref(LogMessage *m);
 LogMessage *log_msg_clone_cow(LogMessage *m, const LogPathOptions *path_options);
+gsize log_msg_get_size(LogMessage *self);
 
 gboolean log_msg_write(LogMessage *self, SerializeArchive *sa);
 gboolean log_msg_read(LogMessage *self, SerializeArchive *sa);
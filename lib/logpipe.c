@@ -23,6 +23,41 @@
  */
   
 #include "logpipe.h"
+#include "tls-support.h"
+#include "timeutils.h"
+
+gboolean log_pipe_profiling;
+
+/* the tick source and the wall clock at the time profiling was
+ * started/stopped, used to convert ticks to real time */
+static guint64 profile_start_ticks, profile_stop_ticks;
+static GTimeVal profile_start_time, profile_stop_time;
+
+TLS_BLOCK_START
+{
+  /* ticks spent in profiled pipes called by the pipe currently being
+   * profiled on this thread, subtracted from its own time */
+  guint64 profile_child_ticks;
+}
+TLS_BLOCK_END;
+
+#define profile_child_ticks __tls_deref(profile_child_ticks)
+
+guint64
+log_pipe_profile_get_ticks(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+  guint32 lo, hi;
+
+  __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((guint64) hi << 32) | lo;
+#else
+  GTimeVal now;
+
+  g_get_current_time(&now);
+  return (guint64) now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+#endif
+}
 
 void
 log_pipe_init_instance(LogPipe *self)
@@ -84,3 +119,98 @@ log_pipe_forward_notify(LogPipe *self, LogPipe *sender, gint notify_code, gpoint
 {
   log_pipe_notify(self->pipe_next, self, notify_code, user_data);
 }
+
+/*
+ * Used by log_pipe_queue() instead of a direct dispatch while
+ * profiling is enabled. Only pipes that correspond to a configuration
+ * element (e.g. have an expr_node) are accounted, the time spent in
+ * the internal multiplexer and join pipes is added to the closest
+ * profiled pipe up the chain.
+ *
+ * As a pipe forwards the message synchronously, the time measured
+ * around the queue call includes the pipes that follow it, which is
+ * collected in profile_child_ticks and subtracted, so that each pipe
+ * is only charged for its own work.
+ */
+void
+log_pipe_queue_profiled(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  guint64 start, elapsed, saved_child_ticks;
+
+  if (!s->expr_node)
+    {
+      log_pipe_queue_dispatch(s, msg, path_options);
+      return;
+    }
+
+  saved_child_ticks = profile_child_ticks;
+  profile_child_ticks = 0;
+  start = log_pipe_profile_get_ticks();
+
+  log_pipe_queue_dispatch(s, msg, path_options);
+
+  elapsed = log_pipe_profile_get_ticks() - start;
+  if (elapsed > profile_child_ticks)
+    __sync_fetch_and_add(&s->profile_ticks, elapsed - profile_child_ticks);
+  __sync_fetch_and_add(&s->profile_calls, 1);
+  profile_child_ticks = saved_child_ticks + elapsed;
+}
+
+/*
+ * Charges the time elapsed since @start, as returned by
+ * log_pipe_profile_begin(), to @s. Only the time is added, the calls
+ * of a pipe are the messages it received via log_pipe_queue().
+ */
+void
+log_pipe_profile_end(LogPipe *s, guint64 start)
+{
+  guint64 elapsed;
+
+  if (!start || !s || !s->expr_node)
+    return;
+
+  elapsed = log_pipe_profile_get_ticks() - start;
+  __sync_fetch_and_add(&s->profile_ticks, elapsed);
+  /* not to be charged to a profiled pipe that called us synchronously */
+  profile_child_ticks += elapsed;
+}
+
+void
+log_pipe_profile_start(void)
+{
+  profile_start_ticks = log_pipe_profile_get_ticks();
+  g_get_current_time(&profile_start_time);
+  log_pipe_profiling = TRUE;
+}
+
+void
+log_pipe_profile_stop(void)
+{
+  log_pipe_profiling = FALSE;
+  profile_stop_ticks = log_pipe_profile_get_ticks();
+  g_get_current_time(&profile_stop_time);
+}
+
+/* calibrates the tick source against the wall clock over the
+ * profiling period, returns 0 if profiling was never started */
+guint64
+log_pipe_profile_ticks_per_sec(void)
+{
+  guint64 stop_ticks = profile_stop_ticks;
+  GTimeVal stop_time = profile_stop_time;
+  glong diff;
+
+  if (!profile_start_ticks)
+    return 0;
+
+  if (log_pipe_profiling)
+    {
+      stop_ticks = log_pipe_profile_get_ticks();
+      g_get_current_time(&stop_time);
+    }
+
+  diff = g_time_val_diff(&stop_time, &profile_start_time);
+  if (diff <= 0)
+    return 0;
+  return (guint64) ((gdouble) (stop_ticks - profile_start_ticks) * G_USEC_PER_SEC / diff);
+}
@@ -61,6 +61,11 @@
 
 #define PIF_SOURCE            0x0080
 
+/* this pipe can keep running over a configuration reload, if its
+ * definition didn't change, instead of being deinitialized and
+ * initialized again, see cfg_tree_carry_over() */
+#define PIF_KEEP_ON_RELOAD    0x0100
+
 /* private flags range, to be used by other LogPipe instances for their own purposes */
 
 #define PIF_PRIVATE(x)       ((x) << 16)
@@ -221,6 +226,15 @@ struct _LogPipe
   gboolean (*init)(LogPipe *self);
   gboolean (*deinit)(LogPipe *self);
 
+  /* optional, performs the expensive part of init() that does not
+   * depend on the main thread (loading databases, reading key files).
+   * It is called before init() from a startup thread pool, in parallel
+   * with the pre_init() of other pipes, so it may only touch the pipe
+   * itself: no ivykis registrations and no changes to the persist
+   * config (cfg_persist_config_peek() is fine).
+   */
+  gboolean (*pre_init)(LogPipe *self);
+
   /* clone this pipe when used in multiple locations in the processing
    * pipe-line. If it contains state, it should behave as if it was
    * the same instance, otherwise it can be a copy.
@@ -229,14 +243,48 @@ struct _LogPipe
 
   void (*free_fn)(LogPipe *self);
   void (*notify)(LogPipe *self, LogPipe *sender, gint notify_code, gpointer user_data);
+
+  /* time spent in this pipe (excluding the pipes it forwards to) and
+   * the number of messages it processed while profiling was enabled,
+   * only maintained for pipes with an expr_node, see
+   * log_pipe_queue_profiled() and log_pipe_profile_end() */
+  guint64 profile_ticks;
+  guint32 profile_calls;
 };
 
+extern gboolean log_pipe_profiling;
+
 
 LogPipe *log_pipe_ref(LogPipe *self);
 void log_pipe_unref(LogPipe *self);
 LogPipe *log_pipe_new(void);
 void log_pipe_init_instance(LogPipe *self);
 void log_pipe_forward_notify(LogPipe *self, LogPipe *sender, gint notify_code, gpointer user_data);
+void log_pipe_queue_profiled(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options);
+void log_pipe_profile_start(void);
+void log_pipe_profile_stop(void);
+guint64 log_pipe_profile_ticks_per_sec(void);
+guint64 log_pipe_profile_get_ticks(void);
+void log_pipe_profile_end(LogPipe *s, guint64 start);
+
+/*
+ * Time work done on behalf of a pipe outside of its queue method, e.g.
+ * formatting and writing messages in a destination's own thread:
+ *
+ *   start = log_pipe_profile_begin();
+ *   ...
+ *   log_pipe_profile_end(pipe, start);
+ *
+ * Returns 0 if profiling is not enabled, which log_pipe_profile_end()
+ * ignores.
+ */
+static inline guint64
+log_pipe_profile_begin(void)
+{
+  if (G_UNLIKELY(log_pipe_profiling))
+    return log_pipe_profile_get_ticks();
+  return 0;
+}
 
 
 static inline GlobalConfig *
@@ -296,9 +344,8 @@ log_pipe_forward_msg(LogPipe *self, LogMessage *msg, const LogPathOptions *path_
 }
 
 static inline void
-log_pipe_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options)
+log_pipe_queue_dispatch(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options)
 {
-  g_assert((s->flags & PIF_INITIALIZED) != 0);
   if (s->queue)
     {
       s->queue(s, msg, path_options, s->queue_data);
@@ -309,6 +356,19 @@ log_pipe_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options)
     }
 }
 
+static inline void
+log_pipe_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  g_assert((s->flags & PIF_INITIALIZED) != 0);
+
+  /* profiling is off unless requested over the control socket, so
+   * the only cost it adds otherwise is this predictable branch */
+  if (G_UNLIKELY(log_pipe_profiling))
+    log_pipe_queue_profiled(s, msg, path_options);
+  else
+    log_pipe_queue_dispatch(s, msg, path_options);
+}
+
 static inline LogPipe *
 log_pipe_clone(LogPipe *self)
 {
@@ -33,6 +33,7 @@
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
 #include <limits.h>
 
 gboolean
@@ -76,6 +77,11 @@ typedef struct _LogProtoTextClient
   LogProto super;
   guchar *partial;
   gsize partial_len, partial_pos;
+  /* messages are coalesced into this buffer of record_size bytes if
+   * record_size is non-zero, see log_proto_text_client_set_record_size() */
+  guchar *record;
+  gsize record_size, record_len;
+  gint record_lines, record_count;
 } LogProtoTextClient;
 
 static gboolean
@@ -89,13 +95,12 @@ log_proto_text_client_prepare(LogProto *s, gint *fd, GIOCondition *cond)
   /* if there's no pending I/O in the transport layer, then we want to do a write */
   if (*cond == 0)
     *cond = G_IO_OUT;
-  return !!self->partial;
+  return self->partial || self->record_len > 0;
 }
 
 static LogProtoStatus
-log_proto_text_client_flush(LogProto *s)
+log_proto_text_client_flush_partial(LogProtoTextClient *self)
 {
-  LogProtoTextClient *self = (LogProtoTextClient *) s;
   gint rc;
 
   /* attempt to flush previously buffered data */
@@ -132,6 +137,79 @@ log_proto_text_client_flush(LogProto *s)
   return LPS_SUCCESS;
 }
 
+/* hand over the coalesced record to the partial buffer, to be written as a whole */
+static void
+log_proto_text_client_submit_record(LogProtoTextClient *self)
+{
+  g_assert(self->partial == NULL);
+
+  self->partial = self->record;
+  self->partial_len = self->record_len;
+  self->partial_pos = 0;
+  self->record = NULL;
+  self->record_len = 0;
+  self->record_count = 0;
+}
+
+/*
+ * log_proto_text_client_coalesce:
+ * @data: data to be appended to the current record
+ * @data_len: length of @data
+ * @buffered: set to TRUE if @data was copied to the record
+ *
+ * Appends @data to the record being assembled, writing out the current
+ * record first if @data would not fit or if it already contains
+ * record_lines messages.  @buffered remains FALSE if a
+ * previous record could not be written out completely (the caller has to
+ * retry later) or if @data is larger than the record size (the caller has
+ * to write it on its own).
+ **/
+static LogProtoStatus
+log_proto_text_client_coalesce(LogProtoTextClient *self, const guchar *data, gsize data_len, gboolean *buffered)
+{
+  LogProtoStatus rc;
+
+  *buffered = FALSE;
+  rc = log_proto_text_client_flush_partial(self);
+  if (rc != LPS_SUCCESS || self->partial)
+    return rc;
+
+  if (self->record_len > 0 &&
+      (self->record_len + data_len > self->record_size ||
+       (self->record_lines > 0 && self->record_count >= self->record_lines)))
+    {
+      log_proto_text_client_submit_record(self);
+      rc = log_proto_text_client_flush_partial(self);
+      if (rc != LPS_SUCCESS || self->partial)
+        return rc;
+    }
+
+  if (data_len > self->record_size)
+    return LPS_SUCCESS;
+
+  if (!self->record)
+    self->record = g_malloc(self->record_size);
+  memcpy(self->record + self->record_len, data, data_len);
+  self->record_len += data_len;
+  *buffered = TRUE;
+  return LPS_SUCCESS;
+}
+
+static LogProtoStatus
+log_proto_text_client_flush(LogProto *s)
+{
+  LogProtoTextClient *self = (LogProtoTextClient *) s;
+  LogProtoStatus rc;
+
+  rc = log_proto_text_client_flush_partial(self);
+  if (rc != LPS_SUCCESS || self->partial || self->record_len == 0)
+    return rc;
+
+  /* write out the record even if it is not full */
+  log_proto_text_client_submit_record(self);
+  return log_proto_text_client_flush_partial(self);
+}
+
 /*
  * log_proto_text_client_post:
  * @msg: formatted log message to send (this might be consumed by this function)
@@ -153,7 +231,25 @@ log_proto_text_client_post(LogProto *s, guchar *msg, gsize msg_len, gboolean *co
   g_assert(self->super.convert == (GIConv) -1);
 
   *consumed = FALSE;
-  rc = log_proto_flush(s);
+  if (self->record_size)
+    {
+      gboolean buffered;
+
+      rc = log_proto_text_client_coalesce(self, msg, msg_len, &buffered);
+      if (rc == LPS_ERROR)
+        return rc;
+      if (buffered)
+        {
+          self->record_count++;
+          g_free(msg);
+          *consumed = TRUE;
+          return LPS_SUCCESS;
+        }
+      /* either the previous record is still pending or msg is too large
+       * to be coalesced, in which case we write it on its own below */
+    }
+
+  rc = log_proto_text_client_flush_partial(self);
   if (rc == LPS_ERROR)
     {
       goto write_error;
@@ -219,6 +315,38 @@ log_proto_text_client_post(LogProto *s, guchar *msg, gsize msg_len, gboolean *co
   return LPS_SUCCESS;
 }
 
+/*
+ * log_proto_text_client_set_record_size:
+ * @record_size: the number of bytes to coalesce, 0 to disable coalescing
+ * @record_lines: the maximum number of messages in a chunk, 0 for no limit
+ *
+ * Instructs the client to collect messages into chunks of at most
+ * @record_size bytes and @record_lines messages (the same way
+ * flush_lines() batches writes in the file writer) and to write each
+ * chunk out with a single write call.  This saves a syscall per message
+ * on stream sockets and a record per message with TLS.  The partially
+ * filled chunk is written out when the LogWriter flushes the protocol,
+ * e.g. once its queue becomes empty.
+ **/
+void
+log_proto_text_client_set_record_size(LogProto *s, gsize record_size, gint record_lines)
+{
+  LogProtoTextClient *self = (LogProtoTextClient *) s;
+
+  g_assert(self->record_len == 0);
+  self->record_size = record_size;
+  self->record_lines = record_lines;
+}
+
+static void
+log_proto_text_client_free(LogProto *s)
+{
+  LogProtoTextClient *self = (LogProtoTextClient *) s;
+
+  g_free(self->partial);
+  g_free(self->record);
+}
+
 LogProto *
 log_proto_text_client_new(LogTransport *transport)
 {
@@ -227,6 +355,7 @@ log_proto_text_client_new(LogTransport *transport)
   self->super.prepare = log_proto_text_client_prepare;
   self->super.flush = log_proto_text_client_flush;
   self->super.post = log_proto_text_client_post;
+  self->super.free_fn = log_proto_text_client_free;
   self->super.transport = transport;
   self->super.convert = (GIConv) -1;
   return &self->super;
@@ -439,6 +568,155 @@ log_proto_file_writer_new(LogTransport *transport, gint flush_lines)
   return &self->super;
 }
 
+typedef struct _LogProtoDgramClient
+{
+  LogProto super;
+  gint buf_size;
+  gint buf_count;
+  struct iovec *buffer;
+} LogProtoDgramClient;
+
+/* drops the first @count buffered datagrams */
+static void
+log_proto_dgram_client_drop(LogProtoDgramClient *self, gint count)
+{
+  gint i;
+
+  for (i = 0; i < count; i++)
+    g_free(self->buffer[i].iov_base);
+  memmove(&self->buffer[0], &self->buffer[count], sizeof(self->buffer[0]) * (self->buf_count - count));
+  self->buf_count -= count;
+}
+
+/*
+ * log_proto_dgram_client_flush:
+ *
+ * Sends out the buffered messages, each of them as a separate datagram,
+ * using a single call to the transport (e.g. sendmmsg()) if it supports
+ * that.  It is called from log_proto_dgram_client_post() when the buffer
+ * is full and from log_proto_flush() when the LogWriter runs out of
+ * messages.
+ **/
+static LogProtoStatus
+log_proto_dgram_client_flush(LogProto *s)
+{
+  LogProtoDgramClient *self = (LogProtoDgramClient *) s;
+  gint rc;
+
+  while (self->buf_count > 0)
+    {
+      rc = log_transport_write_datagrams(self->super.transport, self->buffer, self->buf_count);
+      if (rc < 0)
+        {
+          if (errno == EAGAIN)
+            break;
+
+          /* the messages have already been consumed, thus the datagram
+           * that caused the error is dropped, so that one that can never
+           * be sent (e.g. EMSGSIZE) doesn't block the rest */
+          msg_error("I/O error occurred while writing, dropping datagram",
+                    evt_tag_int("fd", self->super.transport->fd),
+                    evt_tag_int("buffered", self->buf_count - 1),
+                    evt_tag_errno(EVT_TAG_OSERROR, errno),
+                    NULL);
+          log_proto_dgram_client_drop(self, 1);
+          return LPS_ERROR;
+        }
+      if (rc == 0)
+        break;
+      log_proto_dgram_client_drop(self, rc);
+    }
+  return LPS_SUCCESS;
+}
+
+/*
+ * log_proto_dgram_client_post:
+ *
+ * Buffers @msg to be sent as a single datagram, the buffer is sent out
+ * when flush_lines() messages have been collected, or when the LogWriter
+ * flushes the protocol.
+ **/
+static LogProtoStatus
+log_proto_dgram_client_post(LogProto *s, guchar *msg, gsize msg_len, gboolean *consumed)
+{
+  LogProtoDgramClient *self = (LogProtoDgramClient *) s;
+  LogProtoStatus rc;
+
+  /* NOTE: the client does not support charset conversion for now */
+  g_assert(self->super.convert == (GIConv) -1);
+
+  *consumed = FALSE;
+  if (self->buf_count >= self->buf_size)
+    {
+      rc = log_proto_dgram_client_flush(s);
+      if (rc != LPS_SUCCESS || self->buf_count >= self->buf_size)
+        return rc;
+    }
+
+  /* NOTE: a full buffer is not sent right away, as in that case the
+   * message has already been consumed and an error could not be reported
+   * properly. It is sent by the next post or flush. */
+
+  self->buffer[self->buf_count].iov_base = (void *) msg;
+  self->buffer[self->buf_count].iov_len = msg_len;
+  self->buf_count++;
+  *consumed = TRUE;
+  return LPS_SUCCESS;
+}
+
+static gboolean
+log_proto_dgram_client_prepare(LogProto *s, gint *fd, GIOCondition *cond)
+{
+  LogProtoDgramClient *self = (LogProtoDgramClient *) s;
+
+  *fd = self->super.transport->fd;
+  *cond = self->super.transport->cond;
+
+  if (*cond == 0)
+    *cond = G_IO_OUT;
+  return self->buf_count > 0;
+}
+
+static void
+log_proto_dgram_client_free(LogProto *s)
+{
+  LogProtoDgramClient *self = (LogProtoDgramClient *) s;
+
+  /* the LogWriter has already acknowledged these, they are lost
+   * for good when the connection is closed or reopened */
+  if (self->buf_count > 0)
+    msg_error("Dropping buffered datagrams that could not be sent",
+              evt_tag_int("fd", self->super.transport->fd),
+              evt_tag_int("count", self->buf_count),
+              NULL);
+  log_proto_dgram_client_drop(self, self->buf_count);
+  g_free(self->buffer);
+}
+
+LogProto *
+log_proto_dgram_client_new(LogTransport *transport, gint flush_lines)
+{
+  LogProtoDgramClient *self = g_new0(LogProtoDgramClient, 1);
+
+  if (flush_lines == 0)
+    /* the flush-lines option has not been specified, use a default value */
+    flush_lines = LOG_PROTO_DGRAM_CLIENT_DEFAULT_BATCH;
+#ifdef IOV_MAX
+  if (flush_lines > IOV_MAX)
+    flush_lines = IOV_MAX;
+#endif
+
+  self->buf_size = flush_lines;
+  self->buffer = g_new0(struct iovec, flush_lines);
+  self->super.prepare = log_proto_dgram_client_prepare;
+  self->super.post = log_proto_dgram_client_post;
+  self->super.flush = log_proto_dgram_client_flush;
+  self->super.free_fn = log_proto_dgram_client_free;
+  self->super.transport = transport;
+  self->super.convert = (GIConv) -1;
+  return &self->super;
+}
+
 
 
 typedef struct _LogProtoBufferedServerState
@@ -1779,26 +2057,36 @@ log_proto_framed_client_post(LogProto *s, guchar *msg, gsize msg_len, gboolean *
       self->frame_hdr_pos = 0;
       self->state = LPFCS_FRAME_SEND;
     case LPFCS_FRAME_SEND:
-      rc = log_transport_write(s->transport, &self->frame_hdr_buf[self->frame_hdr_pos], self->frame_hdr_len - self->frame_hdr_pos);
-      if (rc < 0)
+      if (self->super.record_size)
         {
-          if (errno != EAGAIN)
-            {
-              msg_error("I/O error occurred while writing",
-                        evt_tag_int("fd", self->super.super.transport->fd),
-                        evt_tag_errno(EVT_TAG_OSERROR, errno),
-                        NULL);
-              return LPS_ERROR;
-            }
-          break;
+          gboolean buffered;
+
+          /* the frame header goes to the same record as the message, it
+           * is never larger than the record itself */
+          rc = log_proto_text_client_coalesce(&self->super, (guchar *) self->frame_hdr_buf, self->frame_hdr_len, &buffered);
+          if (!buffered)
+            return rc;
         }
       else
         {
+          rc = log_transport_write(s->transport, &self->frame_hdr_buf[self->frame_hdr_pos], self->frame_hdr_len - self->frame_hdr_pos);
+          if (rc < 0)
+            {
+              if (errno != EAGAIN)
+                {
+                  msg_error("I/O error occurred while writing",
+                            evt_tag_int("fd", self->super.super.transport->fd),
+                            evt_tag_errno(EVT_TAG_OSERROR, errno),
+                            NULL);
+                  return LPS_ERROR;
+                }
+              break;
+            }
           self->frame_hdr_pos += rc;
           if (self->frame_hdr_pos != self->frame_hdr_len)
             break;
-          self->state = LPFCS_MESSAGE_SEND;
         }
+      self->state = LPFCS_MESSAGE_SEND;
     case LPFCS_MESSAGE_SEND:
       rc = log_proto_text_client_post(s, msg, msg_len, consumed);
       
@@ -1825,6 +2113,7 @@ log_proto_framed_client_new(LogTransport *transport)
   self->super.super.prepare = log_proto_text_client_prepare;
   self->super.super.post = log_proto_framed_client_post;
   self->super.super.flush = log_proto_text_client_flush;
+  self->super.super.free_fn = log_proto_text_client_free;
   self->super.super.transport = transport;
   self->super.super.convert = (GIConv) -1;
   return &self->super.super;  
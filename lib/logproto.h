@@ -158,6 +158,17 @@ LogProto *log_proto_file_writer_new(LogTransport *transport, gint flush_lines);
  * LogProtoTextClient
  */
 LogProto *log_proto_text_client_new(LogTransport *transport);
+void log_proto_text_client_set_record_size(LogProto *s, gsize record_size, gint record_lines);
+
+/*
+ * LogProtoDgramClient
+ *
+ * Sends each message as a separate datagram, batching up to flush_lines
+ * messages into a single transport call (sendmmsg() on plain sockets).
+ */
+#define LOG_PROTO_DGRAM_CLIENT_DEFAULT_BATCH 64
+
+LogProto *log_proto_dgram_client_new(LogTransport *transport, gint flush_lines);
 
 /* framed */
 LogProto *log_proto_framed_client_new(LogTransport *transport);
@@ -157,6 +157,7 @@ log_queue_fifo_move_input_unlocked(LogQueueFifo *self, gint thread_id)
           self->qoverflow_input[thread_id].len--;
           path_options.ack_needed = node->ack_needed;
           stats_counter_inc(self->super.dropped_messages);
+          log_queue_memory_usage_sub(&self->super, node);
           log_msg_free_queue_node(node);
           log_msg_drop(msg, &path_options);
         }
@@ -239,6 +240,7 @@ log_queue_fifo_push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *pat
         }
 
       node = log_msg_alloc_queue_node(msg, path_options);
+      log_queue_memory_usage_add(&self->super, node);
       list_add_tail(&node->list, &self->qoverflow_input[thread_id].items);
       self->qoverflow_input[thread_id].len++;
       log_msg_unref(msg);
@@ -255,6 +257,7 @@ log_queue_fifo_push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *pat
   if (log_queue_fifo_get_length(s) < self->qoverflow_size)
     {
       node = log_msg_alloc_queue_node(msg, path_options);
+      log_queue_memory_usage_add(&self->super, node);
 
       list_add_tail(&node->list, &self->qoverflow_wait);
       self->qoverflow_wait_len++;
@@ -297,6 +300,7 @@ log_queue_fifo_push_head(LogQueue *s, LogMessage *msg, const LogPathOptions *pat
   log_queue_assert_output_thread(s);
 
   node = log_msg_alloc_dynamic_queue_node(msg, path_options);
+  log_queue_memory_usage_add(&self->super, node);
   list_add(&node->list, &self->qoverflow_output);
   self->qoverflow_output_len++;
 
@@ -339,6 +343,7 @@ log_queue_fifo_pop_head(LogQueue *s, LogMessage **msg, LogPathOptions *path_opti
       if (!push_to_backlog)
         {
           list_del(&node->list);
+          log_queue_memory_usage_sub(&self->super, node);
           log_msg_free_queue_node(node);
         }
       else
@@ -396,6 +401,7 @@ log_queue_fifo_ack_backlog(LogQueue *s, gint n)
       path_options.ack_needed = node->ack_needed;
 
       list_del(&node->list);
+      log_queue_memory_usage_sub(&self->super, node);
       log_msg_free_queue_node(node);
       self->qbacklog_len--;
 
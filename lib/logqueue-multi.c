@@ -0,0 +1,791 @@
+/*
+ * Copyright (c) 2002-2011 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2011 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "logqueue-multi.h"
+#include "logpipe.h"
+#include "messages.h"
+#include "stats.h"
+#include "mainloop.h"
+
+#include <string.h>
+
+/*
+ * LogQueueMulti is a queue implementation for destinations that are
+ * able to write in parallel (e.g. using several database connections).
+ * Contrary to LogQueueFifo, which assumes a single output thread, this
+ * one supports several concurrent consumers:
+ *
+ *   - input threads put their items on a per-thread, unlocked input
+ *     queue, which is moved to the shared pool once the input thread
+ *     finishes (just like in LogQueueFifo)
+ *
+ *   - the shared pool is protected by the lock of the LogQueueMulti
+ *     instance
+ *
+ *   - each consumer has its own LogQueue instance (returned by
+ *     log_queue_multi_get_consumer()), with a local batch of items that
+ *     it takes from the shared pool in one lock acquisition
+ *
+ *   - when the shared pool is depleted, an idle consumer steals half of
+ *     the local batch of the busiest consumer, taking items from the
+ *     tail, while the owner keeps consuming its head
+ *
+ *   - each consumer has its own backlog, so ack_backlog() and
+ *     rewind_backlog() only affect the items that were sent by that
+ *     consumer.  Rewound items are put back in front of its local batch,
+ *     where other consumers may steal them if the owner doesn't get to
+ *     them.
+ *
+ *   - a consumer that can't make progress (e.g. its connection failed)
+ *     gives all its items back to the front of the shared pool using
+ *     log_queue_multi_consumer_release()
+ *
+ * Threading assumptions:
+ *   - the tail of the queue is only manipulated from the input threads
+ *   - each consumer LogQueue is only used from a single output thread,
+ *     the local batch is protected by the consumer's own lock, which is
+ *     only contended when somebody is stealing from it
+ *   - the consumer lock and the lock of the shared pool are never held
+ *     at the same time, nor are the locks of two consumers
+ *
+ * The LogQueueMulti instance itself can also be used as a LogQueue, in
+ * which case the consumer side operations are forwarded to the first
+ * consumer.  This makes it possible to persist it across reloads and to
+ * use it from code that is unaware of multiple consumers.
+ */
+
+typedef struct _LogQueueMulti LogQueueMulti;
+
+typedef struct _LogQueueMultiConsumer
+{
+  LogQueue super;
+  LogQueueMulti *owner;
+
+  /* protected by super.lock */
+  struct list_head qlocal;
+  gint qlocal_len;
+
+  /* entries that were sent but not acked yet, only touched by the consumer */
+  struct list_head qbacklog;
+  gint qbacklog_len;
+} LogQueueMultiConsumer;
+
+struct _LogQueueMulti
+{
+  LogQueue super;
+
+  /* protected by super.lock */
+  struct list_head qpool;
+  gint qpool_len;
+  gint qoverflow_size; /* in number of elements */
+  gint local_batch;
+
+  gint num_consumers;
+  LogQueueMultiConsumer *consumers;
+
+  struct
+  {
+    struct list_head items;
+    MainLoopIOWorkerFinishCallback cb;
+    guint16 len;
+    guint16 finish_cb_registered;
+  } qinput[0];
+};
+
+/* move up to @n items from the head of @src to the tail of @dst */
+static gint
+log_queue_multi_move_head(struct list_head *src, struct list_head *dst, gint n)
+{
+  gint i;
+
+  for (i = 0; i < n && !list_empty(src); i++)
+    {
+      struct list_head *lh = src->next;
+
+      list_del(lh);
+      list_add_tail(lh, dst);
+    }
+  return i;
+}
+
+/* move up to @n items from the tail of @src to the tail of @dst, keeping their order */
+static gint
+log_queue_multi_move_tail(struct list_head *src, struct list_head *dst, gint n)
+{
+  struct list_head stolen;
+  gint i;
+
+  INIT_LIST_HEAD(&stolen);
+  for (i = 0; i < n && !list_empty(src); i++)
+    {
+      struct list_head *lh = src->prev;
+
+      list_del(lh);
+      list_add(lh, &stolen);
+    }
+  list_splice_tail_init(&stolen, dst);
+  return i;
+}
+
+static void
+log_queue_multi_free_queue(struct list_head *q)
+{
+  while (!list_empty(q))
+    {
+      LogMessageQueueNode *node;
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg;
+
+      node = list_entry(q->next, LogMessageQueueNode, list);
+      list_del(&node->list);
+
+      path_options.ack_needed = node->ack_needed;
+      msg = node->msg;
+      log_msg_free_queue_node(node);
+      log_msg_ack(msg, &path_options);
+      log_msg_unref(msg);
+    }
+}
+
+/*
+ * Consumer side
+ */
+
+/* the number of items log_queue_multi_consumer_steal() would take from @victim */
+static inline gint
+log_queue_multi_consumer_stealable(LogQueueMultiConsumer *victim)
+{
+  gint len = victim->qlocal_len;
+
+  return len > 1 ? len / 2 : 0;
+}
+
+/* NOTE: racy, same as log_queue_fifo_get_length(). Counts the items this
+ * consumer can get, including the ones it could steal from the others,
+ * so that it doesn't go idle while the others are busy. */
+static gint64
+log_queue_multi_consumer_get_length(LogQueue *s)
+{
+  LogQueueMultiConsumer *self = (LogQueueMultiConsumer *) s;
+  LogQueueMulti *owner = self->owner;
+  gint64 len = self->qlocal_len + owner->qpool_len;
+  gint i;
+
+  for (i = 0; i < owner->num_consumers; i++)
+    {
+      if (&owner->consumers[i] != self)
+        len += log_queue_multi_consumer_stealable(&owner->consumers[i]);
+    }
+  return len;
+}
+
+/* steal half of the local batch of the consumer that has the most items */
+static gint
+log_queue_multi_consumer_steal(LogQueueMultiConsumer *self, struct list_head *batch)
+{
+  LogQueueMulti *owner = self->owner;
+  LogQueueMultiConsumer *victim = NULL;
+  gint i, n = 0;
+
+  for (i = 0; i < owner->num_consumers; i++)
+    {
+      LogQueueMultiConsumer *c = &owner->consumers[i];
+
+      /* racy read, we only use it to pick a victim */
+      if (c != self && log_queue_multi_consumer_stealable(c) > 0 && (!victim || c->qlocal_len > victim->qlocal_len))
+        victim = c;
+    }
+
+  if (!victim)
+    return 0;
+
+  g_static_mutex_lock(&victim->super.lock);
+  if (log_queue_multi_consumer_stealable(victim) > 0)
+    {
+      n = log_queue_multi_move_tail(&victim->qlocal, batch, log_queue_multi_consumer_stealable(victim));
+      victim->qlocal_len -= n;
+    }
+  g_static_mutex_unlock(&victim->super.lock);
+  return n;
+}
+
+static void
+log_queue_multi_consumer_refill(LogQueueMultiConsumer *self)
+{
+  LogQueueMulti *owner = self->owner;
+  struct list_head batch;
+  gint n;
+
+  INIT_LIST_HEAD(&batch);
+
+  g_static_mutex_lock(&owner->super.lock);
+  n = log_queue_multi_move_head(&owner->qpool, &batch, owner->local_batch);
+  owner->qpool_len -= n;
+  g_static_mutex_unlock(&owner->super.lock);
+
+  if (n == 0)
+    n = log_queue_multi_consumer_steal(self, &batch);
+
+  if (n > 0)
+    {
+      g_static_mutex_lock(&self->super.lock);
+      list_splice_tail_init(&batch, &self->qlocal);
+      self->qlocal_len += n;
+      g_static_mutex_unlock(&self->super.lock);
+    }
+}
+
+/*
+ * Put an item back to the front of the local batch.
+ *
+ * This is assumed to be called only from the consumer's output thread.
+ */
+static void
+log_queue_multi_consumer_push_head(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogQueueMultiConsumer *self = (LogQueueMultiConsumer *) s;
+  LogMessageQueueNode *node;
+
+  log_queue_assert_output_thread(s);
+
+  node = log_msg_alloc_dynamic_queue_node(msg, path_options);
+  log_queue_memory_usage_add(&self->owner->super, node);
+  g_static_mutex_lock(&self->super.lock);
+  list_add(&node->list, &self->qlocal);
+  self->qlocal_len++;
+  g_static_mutex_unlock(&self->super.lock);
+
+  stats_counter_inc(self->owner->super.stored_messages);
+}
+
+/*
+ * Can only run from the consumer's output thread.
+ */
+static gboolean
+log_queue_multi_consumer_pop_head(LogQueue *s, LogMessage **msg, LogPathOptions *path_options, gboolean push_to_backlog, gboolean ignore_throttle)
+{
+  LogQueueMultiConsumer *self = (LogQueueMultiConsumer *) s;
+  LogMessageQueueNode *node = NULL;
+
+  log_queue_assert_output_thread(s);
+
+  if (!ignore_throttle && self->super.throttle && self->super.throttle_buckets == 0)
+    {
+      return FALSE;
+    }
+
+  if (self->qlocal_len == 0)
+    {
+      /* slow path, the local batch is empty, get some elements from the
+       * shared pool or from the other consumers */
+      log_queue_multi_consumer_refill(self);
+    }
+
+  g_static_mutex_lock(&self->super.lock);
+  if (self->qlocal_len > 0)
+    {
+      node = list_entry(self->qlocal.next, LogMessageQueueNode, list);
+      list_del_init(&node->list);
+      self->qlocal_len--;
+    }
+  g_static_mutex_unlock(&self->super.lock);
+
+  if (!node)
+    return FALSE;
+
+  *msg = node->msg;
+  path_options->ack_needed = node->ack_needed;
+  stats_counter_dec(self->owner->super.stored_messages);
+
+  if (push_to_backlog)
+    {
+      log_msg_ref(*msg);
+      list_add_tail(&node->list, &self->qbacklog);
+      self->qbacklog_len++;
+    }
+  else
+    {
+      log_queue_memory_usage_sub(&self->owner->super, node);
+      log_msg_free_queue_node(node);
+    }
+
+  if (!ignore_throttle)
+    {
+      self->super.throttle_buckets--;
+    }
+
+  return TRUE;
+}
+
+/*
+ * Can only run from the consumer's output thread.
+ */
+static void
+log_queue_multi_consumer_ack_backlog(LogQueue *s, gint n)
+{
+  LogQueueMultiConsumer *self = (LogQueueMultiConsumer *) s;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+  gint i;
+
+  log_queue_assert_output_thread(s);
+
+  for (i = 0; i < n && self->qbacklog_len > 0; i++)
+    {
+      LogMessageQueueNode *node;
+
+      node = list_entry(self->qbacklog.next, LogMessageQueueNode, list);
+      msg = node->msg;
+      path_options.ack_needed = node->ack_needed;
+
+      list_del(&node->list);
+      log_queue_memory_usage_sub(&self->owner->super, node);
+      log_msg_free_queue_node(node);
+      self->qbacklog_len--;
+
+      log_msg_ack(msg, &path_options);
+      log_msg_unref(msg);
+    }
+}
+
+/*
+ * Move items on the consumer's backlog to the front of its local batch.
+ *
+ * NOTE: this is assumed to be called from the consumer's output thread.
+ */
+static void
+log_queue_multi_consumer_rewind_backlog(LogQueue *s)
+{
+  LogQueueMultiConsumer *self = (LogQueueMultiConsumer *) s;
+
+  log_queue_assert_output_thread(s);
+
+  g_static_mutex_lock(&self->super.lock);
+  list_splice_init(&self->qbacklog, &self->qlocal);
+  self->qlocal_len += self->qbacklog_len;
+  g_static_mutex_unlock(&self->super.lock);
+
+  stats_counter_add(self->owner->super.stored_messages, self->qbacklog_len);
+  self->qbacklog_len = 0;
+}
+
+static void log_queue_multi_push_notify(LogQueueMulti *self);
+
+/*
+ * Give the items of a consumer that can't make progress (e.g. its
+ * database connection failed) back to the shared pool: its local batch
+ * and its backlog.  They are put in front of the pool, so they are the
+ * next ones taken, and the other consumers are woken up.
+ *
+ * NOTE: this is assumed to be called from the consumer's output thread.
+ */
+void
+log_queue_multi_consumer_release(LogQueue *s)
+{
+  LogQueueMultiConsumer *self = (LogQueueMultiConsumer *) s;
+  LogQueueMulti *owner = self->owner;
+  struct list_head batch;
+  gint n;
+
+  g_assert(log_queue_is_multi_consumer(s));
+
+  log_queue_rewind_backlog(s);
+
+  INIT_LIST_HEAD(&batch);
+  g_static_mutex_lock(&self->super.lock);
+  list_splice_init(&self->qlocal, &batch);
+  n = self->qlocal_len;
+  self->qlocal_len = 0;
+  g_static_mutex_unlock(&self->super.lock);
+
+  if (n == 0)
+    return;
+
+  g_static_mutex_lock(&owner->super.lock);
+  list_splice_init(&batch, &owner->qpool);
+  owner->qpool_len += n;
+  log_queue_multi_push_notify(owner);
+  g_static_mutex_unlock(&owner->super.lock);
+}
+
+static void
+log_queue_multi_consumer_push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogQueueMultiConsumer *self = (LogQueueMultiConsumer *) s;
+
+  log_queue_push_tail(&self->owner->super, msg, path_options);
+}
+
+/* consumers are embedded in their owner, releasing the last reference
+ * to a consumer only drops the reference it holds on the owner */
+static void
+log_queue_multi_consumer_free(LogQueue *s)
+{
+  LogQueueMultiConsumer *self = (LogQueueMultiConsumer *) s;
+
+  log_queue_unref(&self->owner->super);
+}
+
+static void
+log_queue_multi_consumer_init(LogQueueMultiConsumer *self, LogQueueMulti *owner)
+{
+  log_queue_init_instance(&self->super, NULL);
+  self->super.ref_cnt = 0;
+  self->super.get_length = log_queue_multi_consumer_get_length;
+  self->super.push_tail = log_queue_multi_consumer_push_tail;
+  self->super.push_head = log_queue_multi_consumer_push_head;
+  self->super.pop_head = log_queue_multi_consumer_pop_head;
+  self->super.ack_backlog = log_queue_multi_consumer_ack_backlog;
+  self->super.rewind_backlog = log_queue_multi_consumer_rewind_backlog;
+  self->super.free_fn = log_queue_multi_consumer_free;
+
+  self->owner = owner;
+  INIT_LIST_HEAD(&self->qlocal);
+  INIT_LIST_HEAD(&self->qbacklog);
+}
+
+/*
+ * Producer side
+ */
+
+/* NOTE: this is inherently racy, see log_queue_fifo_get_length() */
+static gint64
+log_queue_multi_get_length(LogQueue *s)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+  gint64 len = self->qpool_len;
+  gint i;
+
+  for (i = 0; i < self->num_consumers; i++)
+    len += self->consumers[i].qlocal_len;
+  return len;
+}
+
+/* NOTE: this is inherently racy, can only be called if log processing is suspended (e.g. reload time) */
+static gboolean
+log_queue_multi_keep_on_reload(LogQueue *s)
+{
+  return log_queue_multi_get_length(s) > 0;
+}
+
+/* wake up the owner and all consumers waiting for items, must be called
+ * with the lock of the shared pool held */
+static void
+log_queue_multi_push_notify(LogQueueMulti *self)
+{
+  gint i;
+
+  log_queue_push_notify(&self->super);
+  g_static_mutex_unlock(&self->super.lock);
+
+  for (i = 0; i < self->num_consumers; i++)
+    {
+      LogQueue *c = &self->consumers[i].super;
+
+      g_static_mutex_lock(&c->lock);
+      log_queue_push_notify(c);
+      g_static_mutex_unlock(&c->lock);
+    }
+  g_static_mutex_lock(&self->super.lock);
+}
+
+/* move items from the per-thread input queue to the shared pool, see
+ * log_queue_fifo_move_input_unlocked() for the treatment of overflows */
+static void
+log_queue_multi_move_input_unlocked(LogQueueMulti *self, gint thread_id)
+{
+  gint queue_len;
+
+  queue_len = log_queue_multi_get_length(&self->super);
+  if (queue_len + self->qinput[thread_id].len > self->qoverflow_size)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      gint i;
+      gint n;
+
+      n = self->qinput[thread_id].len - MAX(0, (self->qoverflow_size - queue_len));
+
+      for (i = 0; i < n; i++)
+        {
+          LogMessageQueueNode *node = list_entry(self->qinput[thread_id].items.next, LogMessageQueueNode, list);
+          LogMessage *msg = node->msg;
+
+          list_del(&node->list);
+          self->qinput[thread_id].len--;
+          path_options.ack_needed = node->ack_needed;
+          stats_counter_inc(self->super.dropped_messages);
+          log_queue_memory_usage_sub(&self->super, node);
+          log_msg_free_queue_node(node);
+          log_msg_drop(msg, &path_options);
+        }
+      msg_debug("Destination queue full, dropping messages",
+                evt_tag_int("queue_len", queue_len),
+                evt_tag_int("log_fifo_size", self->qoverflow_size),
+                evt_tag_int("count", n),
+                NULL);
+    }
+  stats_counter_add(self->super.stored_messages, self->qinput[thread_id].len);
+  list_splice_tail_init(&self->qinput[thread_id].items, &self->qpool);
+  self->qpool_len += self->qinput[thread_id].len;
+  self->qinput[thread_id].len = 0;
+}
+
+static gpointer
+log_queue_multi_move_input(gpointer user_data)
+{
+  LogQueueMulti *self = (LogQueueMulti *) user_data;
+  gint thread_id;
+
+  thread_id = main_loop_io_worker_thread_id();
+
+  g_assert(thread_id >= 0);
+
+  g_static_mutex_lock(&self->super.lock);
+  log_queue_multi_move_input_unlocked(self, thread_id);
+  log_queue_multi_push_notify(self);
+  g_static_mutex_unlock(&self->super.lock);
+  self->qinput[thread_id].finish_cb_registered = FALSE;
+  return NULL;
+}
+
+/*
+ * Assumed to be called from one of the input threads. If the thread_id
+ * cannot be determined, the item is put directly to the shared pool.
+ */
+static void
+log_queue_multi_push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+  gint thread_id;
+  LogMessageQueueNode *node;
+
+  thread_id = main_loop_io_worker_thread_id();
+
+  g_assert(thread_id < 0 || log_queue_max_threads > thread_id);
+
+  if (thread_id >= 0)
+    {
+      /* fastpath, use per-thread input FIFOs */
+      if (!self->qinput[thread_id].finish_cb_registered)
+        {
+          main_loop_io_worker_register_finish_callback(&self->qinput[thread_id].cb);
+          self->qinput[thread_id].finish_cb_registered = TRUE;
+        }
+
+      node = log_msg_alloc_queue_node(msg, path_options);
+      log_queue_memory_usage_add(&self->super, node);
+      list_add_tail(&node->list, &self->qinput[thread_id].items);
+      self->qinput[thread_id].len++;
+      log_msg_unref(msg);
+      return;
+    }
+
+  /* slow path, put the pending item directly to the shared pool */
+
+  g_static_mutex_lock(&self->super.lock);
+  if (log_queue_multi_get_length(s) < self->qoverflow_size)
+    {
+      node = log_msg_alloc_queue_node(msg, path_options);
+      log_queue_memory_usage_add(&self->super, node);
+
+      list_add_tail(&node->list, &self->qpool);
+      self->qpool_len++;
+      stats_counter_inc(self->super.stored_messages);
+      log_queue_multi_push_notify(self);
+      g_static_mutex_unlock(&self->super.lock);
+
+      log_msg_unref(msg);
+    }
+  else
+    {
+      stats_counter_inc(self->super.dropped_messages);
+      g_static_mutex_unlock(&self->super.lock);
+      log_msg_drop(msg, path_options);
+
+      msg_debug("Destination queue full, dropping message",
+                evt_tag_int("queue_len", log_queue_multi_get_length(&self->super)),
+                evt_tag_int("log_fifo_size", self->qoverflow_size),
+                NULL);
+    }
+}
+
+/* consumer side operations on the LogQueueMulti instance itself go to
+ * the first consumer */
+
+static void
+log_queue_multi_push_head(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+
+  log_queue_assert_output_thread(s);
+  log_queue_push_head(&self->consumers[0].super, msg, path_options);
+}
+
+static gboolean
+log_queue_multi_pop_head(LogQueue *s, LogMessage **msg, LogPathOptions *path_options, gboolean push_to_backlog, gboolean ignore_throttle)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+  LogQueueMultiConsumer *c = &self->consumers[0];
+
+  log_queue_assert_output_thread(s);
+
+  /* throttling is accounted on the instance that was used by the caller */
+  if (!ignore_throttle && self->super.throttle && self->super.throttle_buckets == 0)
+    return FALSE;
+
+  if (!log_queue_pop_head(&c->super, msg, path_options, push_to_backlog, TRUE))
+    return FALSE;
+
+  if (!ignore_throttle)
+    self->super.throttle_buckets--;
+  return TRUE;
+}
+
+static void
+log_queue_multi_ack_backlog(LogQueue *s, gint n)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+
+  log_queue_assert_output_thread(s);
+  log_queue_ack_backlog(&self->consumers[0].super, n);
+}
+
+static void
+log_queue_multi_rewind_backlog(LogQueue *s)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+
+  log_queue_assert_output_thread(s);
+  log_queue_rewind_backlog(&self->consumers[0].super);
+}
+
+static void
+log_queue_multi_free(LogQueue *s)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+  gint i;
+
+  for (i = 0; i < log_queue_max_threads; i++)
+    log_queue_multi_free_queue(&self->qinput[i].items);
+
+  log_queue_multi_free_queue(&self->qpool);
+  for (i = 0; i < self->num_consumers; i++)
+    {
+      g_assert(self->consumers[i].super.ref_cnt == 0);
+      log_queue_multi_free_queue(&self->consumers[i].qlocal);
+      log_queue_multi_free_queue(&self->consumers[i].qbacklog);
+    }
+  g_free(self->consumers);
+  log_queue_free_method(s);
+}
+
+/*
+ * Returns a LogQueue instance for the @consumer-th consumer with a new
+ * reference, which also keeps the LogQueueMulti instance alive.
+ */
+LogQueue *
+log_queue_multi_get_consumer(LogQueue *s, gint consumer)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+  LogQueueMultiConsumer *c;
+
+  g_assert(log_queue_is_multi(s));
+  g_assert(consumer >= 0 && consumer < self->num_consumers);
+
+  c = &self->consumers[consumer];
+  if (c->super.ref_cnt == 0)
+    {
+      /* the configured rate is shared between the consumers */
+      if (self->super.throttle)
+        log_queue_set_throttle(&c->super, MAX(1, self->super.throttle / self->num_consumers));
+      log_queue_ref(&self->super);
+    }
+  return log_queue_ref(&c->super);
+}
+
+gint
+log_queue_multi_get_num_consumers(LogQueue *s)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+
+  return self->num_consumers;
+}
+
+void
+log_queue_multi_set_local_batch(LogQueue *s, gint local_batch)
+{
+  LogQueueMulti *self = (LogQueueMulti *) s;
+
+  self->local_batch = MAX(local_batch, 1);
+}
+
+gboolean
+log_queue_is_multi(LogQueue *s)
+{
+  return s->push_tail == log_queue_multi_push_tail;
+}
+
+gboolean
+log_queue_is_multi_consumer(LogQueue *s)
+{
+  return s->push_tail == log_queue_multi_consumer_push_tail;
+}
+
+LogQueue *
+log_queue_multi_new(gint qoverflow_size, const gchar *persist_name, gint num_consumers)
+{
+  LogQueueMulti *self;
+  gint i;
+
+  self = g_malloc0(sizeof(LogQueueMulti) + log_queue_max_threads * sizeof(self->qinput[0]));
+
+  log_queue_init_instance(&self->super, persist_name);
+  self->super.get_length = log_queue_multi_get_length;
+  self->super.keep_on_reload = log_queue_multi_keep_on_reload;
+  self->super.push_tail = log_queue_multi_push_tail;
+  self->super.push_head = log_queue_multi_push_head;
+  self->super.pop_head = log_queue_multi_pop_head;
+  self->super.ack_backlog = log_queue_multi_ack_backlog;
+  self->super.rewind_backlog = log_queue_multi_rewind_backlog;
+
+  self->super.free_fn = log_queue_multi_free;
+
+  for (i = 0; i < log_queue_max_threads; i++)
+    {
+      INIT_LIST_HEAD(&self->qinput[i].items);
+      main_loop_io_worker_finish_callback_init(&self->qinput[i].cb);
+      self->qinput[i].cb.user_data = self;
+      self->qinput[i].cb.func = log_queue_multi_move_input;
+    }
+  INIT_LIST_HEAD(&self->qpool);
+
+  self->num_consumers = MAX(num_consumers, 1);
+  self->consumers = g_new0(LogQueueMultiConsumer, self->num_consumers);
+  for (i = 0; i < self->num_consumers; i++)
+    log_queue_multi_consumer_init(&self->consumers[i], self);
+
+  self->qoverflow_size = qoverflow_size;
+  self->local_batch = LOG_QUEUE_MULTI_DEFAULT_LOCAL_BATCH;
+  return &self->super;
+}
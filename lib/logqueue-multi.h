@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2002-2011 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2011 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef LOGQUEUE_MULTI_H_INCLUDED
+#define LOGQUEUE_MULTI_H_INCLUDED
+
+#include "logqueue.h"
+
+/* the number of items a consumer takes from the shared pool at once */
+#define LOG_QUEUE_MULTI_DEFAULT_LOCAL_BATCH 64
+
+LogQueue *log_queue_multi_new(gint qoverflow_size, const gchar *persist_name, gint num_consumers);
+LogQueue *log_queue_multi_get_consumer(LogQueue *s, gint consumer);
+gint log_queue_multi_get_num_consumers(LogQueue *s);
+void log_queue_multi_set_local_batch(LogQueue *s, gint local_batch);
+void log_queue_multi_consumer_release(LogQueue *s);
+gboolean log_queue_is_multi(LogQueue *s);
+gboolean log_queue_is_multi_consumer(LogQueue *s);
+
+#endif
@@ -179,6 +179,13 @@ log_queue_set_counters(LogQueue *self, StatsCounterItem *stored_messages, StatsC
   stats_counter_set(self->stored_messages, log_queue_get_length(self));
 }
 
+void
+log_queue_set_memory_counter(LogQueue *self, StatsCounterItem *memory_usage_counter)
+{
+  self->memory_usage_counter = memory_usage_counter;
+  stats_counter_set(self->memory_usage_counter, self->memory_usage >> 10);
+}
+
 void
 log_queue_init_instance(LogQueue *self, const gchar *persist_name)
 {
@@ -47,6 +47,11 @@ struct _LogQueue
   StatsCounterItem *stored_messages;
   StatsCounterItem *dropped_messages;
 
+  /* bytes of the messages held by the queue, including the backlog,
+   * updated from the input threads as well, thus atomically */
+  gssize memory_usage;
+  StatsCounterItem *memory_usage_counter;
+
   GStaticMutex lock;
   gint parallel_push_notify_limit;
   LogQueuePushNotifyFunc parallel_push_notify;
@@ -109,6 +114,24 @@ log_queue_ack_backlog(LogQueue *self, gint n)
   return self->ack_backlog(self, n);
 }
 
+/* called when @node is put into/removed from the queue for good (e.g.
+ * not when moving between the internal lists of the queue) */
+static inline void
+log_queue_memory_usage_add(LogQueue *self, LogMessageQueueNode *node)
+{
+  gssize usage = __sync_add_and_fetch(&self->memory_usage, (gssize) node->mem_size);
+
+  stats_counter_set(self->memory_usage_counter, usage >> 10);
+}
+
+static inline void
+log_queue_memory_usage_sub(LogQueue *self, LogMessageQueueNode *node)
+{
+  gssize usage = __sync_sub_and_fetch(&self->memory_usage, (gssize) node->mem_size);
+
+  stats_counter_set(self->memory_usage_counter, MAX(usage, 0) >> 10);
+}
+
 static inline LogQueue *
 log_queue_ref(LogQueue *self)
 {
@@ -151,6 +174,7 @@ void log_queue_reset_parallel_push(LogQueue *self);
 void log_queue_set_parallel_push(LogQueue *self, gint notify_limit, LogQueuePushNotifyFunc parallel_push_notify, gpointer user_data, GDestroyNotify user_data_destroy);
 gboolean log_queue_check_items(LogQueue *self, gint batch_items, gboolean *partial_batch, gint *timeout, LogQueuePushNotifyFunc parallel_push_notify, gpointer user_data, GDestroyNotify user_data_destroy);
 void log_queue_set_counters(LogQueue *self, StatsCounterItem *stored_messages, StatsCounterItem *dropped_messages);
+void log_queue_set_memory_counter(LogQueue *self, StatsCounterItem *memory_usage_counter);
 void log_queue_init_instance(LogQueue *self, const gchar *persist_name);
 void log_queue_free_method(LogQueue *self);
 
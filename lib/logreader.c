@@ -32,6 +32,7 @@
 #include "timeutils.h"
 #include "compat.h"
 #include "mainloop.h"
+#include "filemonitor.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -86,6 +87,9 @@ struct _LogReader
   gchar *follow_filename;
   ino_t inode;
   gint64 size;
+  /* change notifications for follow_filename, polling is used if NULL or inactive */
+  FileMonitor *monitor;
+  gboolean follow_pending;
 
   /* NOTE: these used to be LogReaderWatch members, which were merged into
    * LogReader with the multi-thread refactorization */
@@ -96,6 +100,7 @@ struct _LogReader
   struct iv_event schedule_wakeup;
   MainLoopIOWorkerJob io_job;
   gboolean suspended:1;
+  GTimeVal suspended_since;
   gint pollable_state;
   gint notify_code;
 };
@@ -193,8 +198,15 @@ log_reader_io_process_input(gpointer s)
     }
 }
 
+static inline gboolean
+log_reader_is_monitored(LogReader *self)
+{
+  return self->monitor && file_monitor_is_active(self->monitor);
+}
+
 /* follow timer callback. Check if the file has new content, or deleted or
- * moved.  Ran every follow_freq seconds.  */
+ * moved.  Ran every follow_freq seconds, or in response to change
+ * notifications if the file is monitored.  */
 static void
 log_reader_io_follow_file(gpointer s)
 {
@@ -202,7 +214,9 @@ log_reader_io_follow_file(gpointer s)
   struct stat st, followed_st;
   off_t pos = -1;
   gint fd = log_proto_get_fd(self->proto);
+  gboolean at_eof = FALSE;
 
+  self->follow_pending = FALSE;
   msg_trace("Checking if the followed file has new lines",
             evt_tag_str("follow_filename", self->follow_filename),
             NULL);
@@ -249,8 +263,9 @@ log_reader_io_follow_file(gpointer s)
         }
       else if (pos == st.st_size)
         {
-          /* we are at EOF */
-          log_pipe_notify(self->control, &self->super.super, NC_FILE_EOF, self);
+          /* we are at EOF, our control pipe is notified once we are
+           * done with the checks below */
+          at_eof = TRUE;
         }
       else if (pos > st.st_size)
         {
@@ -288,6 +303,35 @@ log_reader_io_follow_file(gpointer s)
     }
  reschedule:
   log_reader_update_watches(self);
+
+  /* this must be the last thing we do, the file source may close the
+   * reader in response */
+  if (at_eof)
+    log_pipe_notify(self->control, &self->super.super, NC_FILE_EOF, self);
+}
+
+/* FileMonitor callback, the followed file (or its directory) has changed */
+static void
+log_reader_follow_file_changed(gpointer s)
+{
+  LogReader *self = (LogReader *) s;
+
+  main_loop_assert_main_thread();
+
+  if (self->io_job.working || self->suspended)
+    {
+      /* the file is checked the next time our watches are updated */
+      self->follow_pending = TRUE;
+    }
+  else if (!file_monitor_is_active(self->monitor))
+    {
+      /* the watch is gone, go back to polling */
+      log_reader_update_watches(self);
+    }
+  else if (!iv_task_registered(&self->restart_task) && !iv_timer_registered(&self->follow_timer))
+    {
+      log_reader_io_follow_file(self);
+    }
 }
 
 static void
@@ -384,6 +428,8 @@ log_reader_update_watches(LogReader *self)
 
   main_loop_assert_main_thread();
   
+  if (self->suspended)
+    log_source_add_suspended_time(&self->super, &self->suspended_since);
   self->suspended = FALSE;
   free_to_send = log_source_free_to_send(&self->super);
   if (!free_to_send ||
@@ -397,6 +443,11 @@ log_reader_update_watches(LogReader *self)
        */
 
       self->immediate_check = FALSE;
+      if (log_reader_is_monitored(self))
+        {
+          /* make sure the file is checked again once we are done */
+          self->follow_pending = TRUE;
+        }
       if (iv_fd_registered(&self->fd_watch))
         {
           iv_fd_set_handler_in(&self->fd_watch, NULL);
@@ -432,7 +483,9 @@ log_reader_update_watches(LogReader *self)
         }
       else
         {
+          /* woken up by log_source_wakeup() once enough of the window is free */
           self->suspended = TRUE;
+          g_get_current_time(&self->suspended_since);
         }
       return;
     }
@@ -462,7 +515,19 @@ log_reader_update_watches(LogReader *self)
     }
   else
     {
-      if (self->options->follow_freq > 0)
+      if (log_reader_is_monitored(self))
+        {
+          /* the file is checked in response to change notifications,
+           * unless a notification arrived while we were busy */
+          if (self->follow_pending && !iv_timer_registered(&self->follow_timer) && !self->io_job.working)
+            {
+              self->follow_pending = FALSE;
+              iv_validate_now();
+              self->follow_timer.expires = iv_now;
+              iv_timer_register(&self->follow_timer);
+            }
+        }
+      else if (self->options->follow_freq > 0)
         {
           if (iv_timer_registered(&self->follow_timer))
             iv_timer_unregister(&self->follow_timer);
@@ -622,6 +687,14 @@ log_reader_init(LogPipe *s)
                 NULL);
       return FALSE;
     }
+  if (self->options->follow_freq > 0 && self->follow_filename)
+    {
+      /* prefer change notifications over polling, follow_freq() remains
+       * in effect if they are not available for this file */
+      if (!self->monitor)
+        self->monitor = file_monitor_new(self->follow_filename, log_reader_follow_file_changed, self);
+      file_monitor_start(self->monitor);
+    }
   if (!log_reader_start_watches(self))
     return FALSE;
   iv_event_register(&self->schedule_wakeup);
@@ -638,6 +711,8 @@ log_reader_deinit(LogPipe *s)
 
   iv_event_unregister(&self->schedule_wakeup);
   log_reader_stop_watches(self);
+  if (self->monitor)
+    file_monitor_stop(self->monitor);
   if (!log_source_deinit(s))
     return FALSE;
 
@@ -655,6 +730,8 @@ log_reader_free(LogPipe *s)
   log_pipe_unref(self->control);
   g_sockaddr_unref(self->peer_addr);
   g_free(self->follow_filename);
+  if (self->monitor)
+    file_monitor_free(self->monitor);
   log_source_free(s);
 }
 
@@ -705,6 +782,20 @@ log_reader_new(LogProto *proto)
   return &self->super.super;
 }
 
+/*
+ * Returns TRUE if the reader is not processing input right now, e.g. it
+ * can be deinitialized without waiting for a worker thread. Must be called
+ * from the main thread.
+ */
+gboolean
+log_reader_is_idle(LogPipe *s)
+{
+  LogReader *self = (LogReader *) s;
+
+  main_loop_assert_main_thread();
+  return !self->io_job.working;
+}
+
 void 
 log_reader_set_immediate_check(LogPipe *s)
 {
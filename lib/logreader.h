@@ -63,6 +63,7 @@ void log_reader_set_options(LogPipe *s, LogPipe *control, LogReaderOptions *opti
 void log_reader_set_follow_filename(LogPipe *self, const gchar *follow_filename);
 void log_reader_set_peer_addr(LogPipe *s, GSockAddr *peer_addr);
 void log_reader_set_immediate_check(LogPipe *s);
+gboolean log_reader_is_idle(LogPipe *s);
 
 LogPipe *log_reader_new(LogProto *proto);
 void log_reader_options_defaults(LogReaderOptions *options);
@@ -31,8 +31,6 @@
 
 #include <string.h>
 
-gboolean accurate_nanosleep = FALSE;
-
 void
 log_source_wakeup(LogSource *self)
 {
@@ -51,72 +49,21 @@ log_source_msg_ack(LogMessage *msg, gpointer user_data)
 {
   LogSource *self = (LogSource *) user_data;
   guint32 old_window_size;
-  guint32 cur_ack_count, last_ack_count;
   
   old_window_size = g_atomic_counter_exchange_and_add(&self->window_size, 1);
-  if (old_window_size == 0)
-    {
-      log_source_wakeup(self);
-    }
-  log_msg_unref(msg);
 
-  /* NOTE: this is racy. msg_ack may be executing in different writer
-   * threads. I don't want to lock, all we need is an approximate value of
-   * the ACK rate of the last couple of seconds.  */
+  /* A source that has filled its window stops reading and waits to be
+   * woken up.  Instead of waking it up as soon as a single slot is free
+   * (which would make it read a single message and stop again), we only
+   * wake it when window_resume_threshold slots have been freed.  The window
+   * passes each value one at a time, so exactly one ack crosses the
+   * threshold.  Wakeups of sources that are not suspended are harmless. */
 
-#ifdef HAVE_CLOCK_GETTIME
-  if (accurate_nanosleep && self->threaded)
+  if (old_window_size + 1 == self->window_resume_threshold)
     {
-      cur_ack_count = ++self->ack_count;
-      if ((cur_ack_count & 0x3FFF) == 0)
-        {
-          struct timespec now;
-          glong diff;
-
-          /* do this every once in a while, once in 16k messages should be fine */
-
-          last_ack_count = self->last_ack_count;
-
-          /* make sure that we have at least 16k messages to measure the rate
-           * for.  Because of the race we may have last_ack_count ==
-           * cur_ack_count if another thread already measured the same span */
-
-          if (last_ack_count < cur_ack_count - 16383)
-            {
-              clock_gettime(CLOCK_MONOTONIC, &now);
-              if (now.tv_sec > self->last_ack_rate_time.tv_sec + 6)
-                {
-                  /* last check was too far apart, this means the rate is quite slow. turn off sleeping. */
-                  self->window_full_sleep_nsec = 0;
-                  self->last_ack_rate_time = now;
-                }
-              else
-                {
-                  /* ok, we seem to have a close enough measurement, this means
-                   * we do have a high rate.  Calculate how much we should sleep
-                   * in case the window gets full */
-
-                  diff = timespec_diff_nsec(&now, &self->last_ack_rate_time);
-                  self->window_full_sleep_nsec = (diff / (cur_ack_count - last_ack_count));
-                  if (self->window_full_sleep_nsec > 1e6)
-                    {
-                      /* in case we'd be waiting for 1msec for another free slot in the window, let's go to background instead */
-                      self->window_full_sleep_nsec = 0;
-                    }
-                  else
-                    {
-                      /* otherwise let's wait for about 8 message to be emptied before going back to the loop, but clamp the maximum time to 0.1msec */
-                      self->window_full_sleep_nsec <<= 3;
-                      if (self->window_full_sleep_nsec > 1e5)
-                        self->window_full_sleep_nsec = 1e5;
-                    }
-                  self->last_ack_count = cur_ack_count;
-                  self->last_ack_rate_time = now;
-                }
-            }
-        }
+      log_source_wakeup(self);
     }
-#endif
+  log_msg_unref(msg);
   log_pipe_unref(&self->super);
 }
 
@@ -169,6 +116,19 @@ log_source_mangle_hostname(LogSource *self, LogMessage *msg)
     }
 }
 
+/*
+ * Called by the source when it resumes reading after having been suspended
+ * because of a full window, @suspended_since is the time it was suspended.
+ */
+void
+log_source_add_suspended_time(LogSource *self, GTimeVal *suspended_since)
+{
+  GTimeVal now;
+
+  g_get_current_time(&now);
+  stats_counter_add(self->suspended_time, g_time_val_diff(&now, suspended_since) / 1000);
+}
+
 gboolean
 log_source_init(LogPipe *s)
 {
@@ -177,6 +137,7 @@ log_source_init(LogPipe *s)
   stats_lock();
   stats_register_counter(self->stats_level, self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_PROCESSED, &self->recvd_messages);
   stats_register_counter(self->stats_level, self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_STAMP, &self->last_message_seen);
+  stats_register_counter(self->stats_level, self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_SUSPENDED, &self->suspended_time);
   stats_unlock();
   return TRUE;
 }
@@ -189,6 +150,7 @@ log_source_deinit(LogPipe *s)
   stats_lock();
   stats_unregister_counter(self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_PROCESSED, &self->recvd_messages);
   stats_unregister_counter(self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_STAMP, &self->last_message_seen);
+  stats_unregister_counter(self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_SUSPENDED, &self->suspended_time);
   stats_unlock();
   return TRUE;
 }
@@ -199,9 +161,6 @@ log_source_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options
 {
   LogSource *self = (LogSource *) s;
   LogPathOptions local_options = *path_options;
-  StatsCounterItem *processed_counter, *stamp;
-  gboolean new;
-  StatsCounter *handle;
   gint old_window_size;
   gint i;
   
@@ -245,22 +204,14 @@ log_source_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options
   /* stats counters */
   if (stats_check_level(2))
     {
-      stats_lock();
-
-      handle = stats_register_dynamic_counter(2, SCS_HOST | SCS_SOURCE, NULL, log_msg_get_value(msg, LM_V_HOST, NULL), SC_TYPE_PROCESSED, &processed_counter, &new);
-      stats_register_associated_counter(handle, SC_TYPE_STAMP, &stamp);
-      stats_counter_inc(processed_counter);
-      stats_counter_set(stamp, msg->timestamps[LM_TS_RECVD].tv_sec);
-      stats_unregister_dynamic_counter(handle, SC_TYPE_PROCESSED, &processed_counter);
-      stats_unregister_dynamic_counter(handle, SC_TYPE_STAMP, &stamp);
+      /* these are aggregated per-thread, no stats_lock() needed */
+      stats_aggregate_dynamic_counter(2, SCS_HOST | SCS_SOURCE, NULL, log_msg_get_value(msg, LM_V_HOST, NULL), msg->timestamps[LM_TS_RECVD].tv_sec);
 
       if (stats_check_level(3))
         {
-          stats_instant_inc_dynamic_counter(3, SCS_SENDER | SCS_SOURCE, NULL, log_msg_get_value(msg, LM_V_HOST_FROM, NULL), msg->timestamps[LM_TS_RECVD].tv_sec);
-          stats_instant_inc_dynamic_counter(3, SCS_PROGRAM | SCS_SOURCE, NULL, log_msg_get_value(msg, LM_V_PROGRAM, NULL), -1);
+          stats_aggregate_dynamic_counter(3, SCS_SENDER | SCS_SOURCE, NULL, log_msg_get_value(msg, LM_V_HOST_FROM, NULL), msg->timestamps[LM_TS_RECVD].tv_sec);
+          stats_aggregate_dynamic_counter(3, SCS_PROGRAM | SCS_SOURCE, NULL, log_msg_get_value(msg, LM_V_PROGRAM, NULL), -1);
         }
-
-      stats_unlock();
     }
   stats_counter_inc_pri(msg->pri);
 
@@ -290,17 +241,6 @@ log_source_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options
   log_pipe_forward_msg(s, msg, &local_options);
 
   msg_set_context(NULL);
-
-  if (accurate_nanosleep && self->threaded && self->window_full_sleep_nsec > 0 && !log_source_free_to_send(self))
-    {
-      struct timespec ts;
-
-      /* wait one 0.1msec in the hope that the buffer clears up */
-      ts.tv_sec = 0;
-      ts.tv_nsec = self->window_full_sleep_nsec;
-      nanosleep(&ts, NULL);
-    }
-
 }
 
 void
@@ -311,7 +251,10 @@ log_source_set_options(LogSource *self, LogSourceOptions *options, gint stats_le
    * connections will not have their window_size changed. */
   
   if (g_atomic_counter_get(&self->window_size) == -1)
-    g_atomic_counter_set(&self->window_size, options->init_window_size);
+    {
+      g_atomic_counter_set(&self->window_size, options->init_window_size);
+      self->window_resume_threshold = MAX(1, options->init_window_size * options->window_resume / 100);
+    }
   self->options = options;
   self->stats_level = stats_level;
   self->stats_source = stats_source;
@@ -349,6 +292,7 @@ void
 log_source_options_defaults(LogSourceOptions *options)
 {
   options->init_window_size = 100;
+  options->window_resume = LOG_SOURCE_DEFAULT_WINDOW_RESUME;
   options->keep_hostname = -1;
   options->chain_hostnames = -1;
   options->use_dns = -1;
@@ -422,6 +366,7 @@ log_source_options_init(LogSourceOptions *options, GlobalConfig *cfg, const gcha
     options->normalize_hostnames = cfg->normalize_hostnames;
   if (options->keep_timestamp == -1)
     options->keep_timestamp = cfg->keep_timestamp;
+  options->window_resume = CLAMP(options->window_resume, 0, 100);
   options->group_name = group_name;
 
   source_group_name = g_strdup_printf(".source.%s", group_name);
@@ -460,13 +405,3 @@ log_source_options_set_tags(LogSourceOptions *options, GList *tags)
       tags = g_list_delete_link(tags, tags);
     }
 }
-
-void
-log_source_global_init(void)
-{
-  accurate_nanosleep = check_nanosleep();
-  if (!accurate_nanosleep)
-    {
-      msg_debug("nanosleep() is not accurate enough to introduce minor stalls on the reader side, multi-threaded performance may be affected", NULL);
-    }
-}
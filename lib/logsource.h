@@ -29,9 +29,13 @@
 #include "stats.h"
 #include <iv_event.h>
 
+/* percentage of the window that has to be free before a suspended source is woken up */
+#define LOG_SOURCE_DEFAULT_WINDOW_RESUME 10
+
 typedef struct _LogSourceOptions
 {
   gint init_window_size;
+  gint window_resume;
   const gchar *group_name;
   gboolean keep_timestamp;
   gboolean keep_hostname;
@@ -68,12 +72,10 @@ struct _LogSource
   gchar *stats_id;
   gchar *stats_instance;
   GAtomicCounter window_size;
+  gint window_resume_threshold;
   StatsCounterItem *last_message_seen;
   StatsCounterItem *recvd_messages;
-  guint32 last_ack_count;
-  guint32 ack_count;
-  glong window_full_sleep_nsec;
-  struct timespec last_ack_rate_time;
+  StatsCounterItem *suspended_time;
 
   void (*wakeup)(LogSource *s);
 };
@@ -94,9 +96,8 @@ void log_source_options_defaults(LogSourceOptions *options);
 void log_source_options_init(LogSourceOptions *options, GlobalConfig *cfg, const gchar *group_name);
 void log_source_options_destroy(LogSourceOptions *options);
 void log_source_options_set_tags(LogSourceOptions *options, GList *tags);
+void log_source_add_suspended_time(LogSource *self, GTimeVal *suspended_since);
 void log_source_free(LogPipe *s);
 
-void log_source_global_init(void);
-
 
 #endif
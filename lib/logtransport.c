@@ -28,6 +28,9 @@
 
 #include <errno.h>
 #include <ctype.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 void
 log_transport_free_method(LogTransport *s)
@@ -56,6 +59,10 @@ typedef struct _LogTransportPlain LogTransportPlain;
 struct _LogTransportPlain
 {
   LogTransport super;
+#if HAVE_SENDMMSG
+  struct mmsghdr *msgs;
+  gint msgs_size;
+#endif
 };
 
 static gssize
@@ -173,6 +180,44 @@ log_transport_plain_write_method(LogTransport *s, const gpointer buf, gsize bufl
   return rc;
 }
 
+#if HAVE_SENDMMSG
+static gint
+log_transport_plain_write_datagrams_method(LogTransport *s, struct iovec *datagrams, gint count)
+{
+  LogTransportPlain *self = (LogTransportPlain *) s;
+  gint rc, i;
+
+  if (count > self->msgs_size)
+    {
+      self->msgs = g_renew(struct mmsghdr, self->msgs, count);
+      self->msgs_size = count;
+    }
+  memset(self->msgs, 0, sizeof(self->msgs[0]) * count);
+  for (i = 0; i < count; i++)
+    {
+      self->msgs[i].msg_hdr.msg_iov = &datagrams[i];
+      self->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+  do
+    {
+      rc = sendmmsg(self->super.fd, self->msgs, count, 0);
+    }
+  while (rc == -1 && errno == EINTR);
+  return rc;
+}
+#endif
+
+static void
+log_transport_plain_free_method(LogTransport *s)
+{
+#if HAVE_SENDMMSG
+  LogTransportPlain *self = (LogTransportPlain *) s;
+
+  g_free(self->msgs);
+#endif
+  log_transport_free_method(s);
+}
 
 LogTransport *
 log_transport_plain_new(gint fd, guint flags)
@@ -184,7 +229,10 @@ log_transport_plain_new(gint fd, guint flags)
   self->super.flags = flags;
   self->super.read = log_transport_plain_read_method;
   self->super.write = log_transport_plain_write_method;
-  self->super.free_fn = log_transport_free_method;
+#if HAVE_SENDMMSG
+  self->super.write_datagrams = log_transport_plain_write_datagrams_method;
+#endif
+  self->super.free_fn = log_transport_plain_free_method;
   return &self->super;
 }
 
@@ -28,6 +28,8 @@
 #include "syslog-ng.h"
 #include "gsockaddr.h"
 
+#include <sys/uio.h>
+
 /* don't close the underlying fd when LogTransport is destructed */
 #define LTF_DONTCLOSE 0x0001
 
@@ -59,6 +61,8 @@ struct _LogTransport
   gint timeout;
   gssize (*read)(LogTransport *self, gpointer buf, gsize count, GSockAddr **sa);
   gssize (*write)(LogTransport *self, const gpointer buf, gsize count);
+  /* optional, sends several datagrams at once */
+  gint (*write_datagrams)(LogTransport *self, struct iovec *datagrams, gint count);
   void (*free_fn)(LogTransport *self);
 };
 
@@ -68,6 +72,23 @@ log_transport_write(LogTransport *self, const gpointer buf, gsize count)
   return self->write(self, buf, count);
 }
 
+/*
+ * Sends the first @count items of @datagrams, each of them as a separate
+ * datagram. Returns the number of datagrams sent or -1 on error, with
+ * errno set.
+ */
+static inline gint
+log_transport_write_datagrams(LogTransport *self, struct iovec *datagrams, gint count)
+{
+  gssize rc;
+
+  if (self->write_datagrams)
+    return self->write_datagrams(self, datagrams, count);
+
+  rc = log_transport_write(self, datagrams[0].iov_base, datagrams[0].iov_len);
+  return rc < 0 ? -1 : 1;
+}
+
 static inline gssize
 log_transport_read(LogTransport *self, gpointer buf, gsize count, GSockAddr **sa)
 {
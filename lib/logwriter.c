@@ -61,6 +61,9 @@ struct _LogWriter
   StatsCounterItem *suppressed_messages;
   StatsCounterItem *processed_messages;
   StatsCounterItem *stored_messages;
+  StatsCounterItem *memory_usage;
+  /* time from reception until the message is handed over to the LogProto */
+  StatsHistogram *latency;
   LogPipe *control;
   LogWriterOptions *options;
   GStaticMutex suppress_lock;
@@ -963,6 +966,7 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
     {
       LogMessage *lm;
       LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      guint64 profile_start;
       gboolean consumed = FALSE;
       
       if (!log_queue_pop_head(self->queue, &lm, &path_options, FALSE, ignore_throttle))
@@ -974,6 +978,8 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
       log_msg_refcache_start_consumer(lm, &path_options);
       msg_set_context(lm);
 
+      /* formatting and posting is charged to the destination, see log_pipe_profile_begin() */
+      profile_start = log_pipe_profile_begin();
       log_writer_format_log(self, lm, self->line_buffer);
       
       if (self->line_buffer->len)
@@ -981,6 +987,7 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
           LogProtoStatus status;
 
           status = log_proto_post(proto, (guchar *) self->line_buffer->str, self->line_buffer->len, &consumed);
+          log_pipe_profile_end(self->control, profile_start);
           if (status == LPS_ERROR)
             {
               if ((self->options->options & LWO_IGNORE_ERRORS) == 0)
@@ -1003,8 +1010,13 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
               self->line_buffer->len = 0;
             }
         }
+      else
+        {
+          log_pipe_profile_end(self->control, profile_start);
+        }
       if (consumed)
         {
+          stats_histogram_record_latency(self->latency, lm->timestamps[LM_TS_RECVD].tv_sec, lm->timestamps[LM_TS_RECVD].tv_usec);
           if (lm->flags & LF_LOCAL)
             step_sequence_number(&self->seq_num);
           log_msg_ack(lm, &path_options);
@@ -1078,10 +1090,13 @@ log_writer_init(LogPipe *s)
       stats_register_counter(self->stats_level, self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_PROCESSED, &self->processed_messages);
       
       stats_register_counter(self->stats_level, self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_STORED, &self->stored_messages);
+      stats_register_counter(self->stats_level, self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_MEMORY, &self->memory_usage);
+      stats_register_histogram(self->stats_level, self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, &self->latency);
       stats_unlock();
     }
   self->suppress_timer_updated = TRUE;
   log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages);
+  log_queue_set_memory_counter(self->queue, self->memory_usage);
   if (self->proto)
     {
       LogProto *proto;
@@ -1113,12 +1128,15 @@ log_writer_deinit(LogPipe *s)
     iv_timer_unregister(&self->suppress_timer);
 
   log_queue_set_counters(self->queue, NULL, NULL);
+  log_queue_set_memory_counter(self->queue, NULL);
 
   stats_lock();
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_DROPPED, &self->dropped_messages);
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_SUPPRESSED, &self->suppressed_messages);
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_PROCESSED, &self->processed_messages);
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_STORED, &self->stored_messages);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_MEMORY, &self->memory_usage);
+  stats_unregister_histogram(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, &self->latency);
   stats_unlock();
   
   return TRUE;
@@ -30,9 +30,11 @@
 #include "misc.h"
 #include "control.h"
 #include "logqueue.h"
-#include "dnscache.h"
+#include "logpipe.h"
+#include "persist-state.h"
 #include "tls-support.h"
 #include "scratch-buffers.h"
+#include "memaccount.h"
 
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -211,6 +213,18 @@ main_loop_call_handler(gpointer user_data)
   g_static_mutex_unlock(&main_task_lock);
 }
 
+/*
+ * Runs the functions queued by main_loop_call() right away, for code in
+ * the main thread that waits for another thread which may be calling
+ * back into the main thread in the meantime.
+ */
+void
+main_loop_call_pending(void)
+{
+  main_loop_assert_main_thread();
+  main_loop_call_handler(NULL);
+}
+
 void
 main_loop_call_init(void)
 {
@@ -259,6 +273,44 @@ stats_timer_kickoff(GlobalConfig *cfg)
   stats_timer_rearm(cfg->stats_freq);
 }
 
+/************************************************************************************
+ * persist state flush timer
+ ************************************************************************************/
+
+static struct iv_timer persist_flush_timer;
+
+static void
+persist_flush_timer_rearm(gint persist_flush_freq)
+{
+  persist_flush_timer.cookie = GINT_TO_POINTER(persist_flush_freq);
+  if (persist_flush_freq > 0)
+    {
+      iv_validate_now();
+      persist_flush_timer.expires = iv_now;
+      timespec_add_msec(&persist_flush_timer.expires, persist_flush_freq * 1000);
+      iv_timer_register(&persist_flush_timer);
+    }
+}
+
+static void
+persist_flush_timer_elapsed(gpointer st)
+{
+  gint persist_flush_freq = GPOINTER_TO_INT(st);
+
+  if (current_configuration->state)
+    persist_state_flush(current_configuration->state);
+  persist_flush_timer_rearm(persist_flush_freq);
+}
+
+static void
+persist_flush_timer_kickoff(GlobalConfig *cfg)
+{
+  if (iv_timer_registered(&persist_flush_timer))
+    iv_timer_unregister(&persist_flush_timer);
+
+  persist_flush_timer_rearm(cfg->persist_flush_freq);
+}
+
 /************************************************************************************
  * I/O worker threads
  ************************************************************************************/
@@ -291,7 +343,6 @@ main_loop_io_worker_thread_start(void *cookie)
   gint id;
 
   g_static_mutex_lock(&main_loop_io_workers_idmap_lock);
-  dns_cache_init();
   /* NOTE: this algorithm limits the number of I/O worker threads to 64,
    * since the ID map is stored in a single 64 bit integer.  If we ever need
    * more threads than that, we can generalize this algorithm further. */
@@ -315,13 +366,14 @@ void
 main_loop_io_worker_thread_stop(void *cookie)
 {
   g_static_mutex_lock(&main_loop_io_workers_idmap_lock);
-  dns_cache_destroy();
+  stats_destroy_thread_cache();
   if (main_loop_io_worker_id)
     {
       main_loop_io_workers_idmap &= ~(1 << (main_loop_io_worker_id - 1));
       main_loop_io_worker_id = 0;
     }
   scratch_buffers_free ();
+  mem_account_flush_thread();
   g_static_mutex_unlock(&main_loop_io_workers_idmap_lock);
 }
 
@@ -374,6 +426,8 @@ main_loop_io_worker_job_start(MainLoopIOWorkerJob *self)
       list_del_init(&cb->list);
     }
   g_assert(list_empty(&self->finish_callbacks));
+  stats_flush_thread_cache();
+  mem_account_flush_thread();
   main_loop_current_job = NULL;
 }
 
@@ -490,21 +544,36 @@ main_loop_initialize_state(GlobalConfig *cfg, const gchar *persist_filename)
 static void
 main_loop_reload_config_apply(void)
 {
+  GPtrArray *carried_over;
+
   main_loop_old_config->persist = persist_config_new();
+
+  /* unchanged sources and destinations are moved to the new
+   * configuration as they are, only the rest is restarted */
+  carried_over = cfg_tree_carry_over(&main_loop_new_config->tree, &main_loop_old_config->tree);
   cfg_deinit(main_loop_old_config);
   cfg_persist_config_move(main_loop_old_config, main_loop_new_config);
 
   if (cfg_init(main_loop_new_config))
     {
-      msg_verbose("New configuration initialized", NULL);
+      msg_verbose("New configuration initialized",
+                  evt_tag_int("kept_running", carried_over->len),
+                  NULL);
       persist_config_free(main_loop_new_config->persist);
       main_loop_new_config->persist = NULL;
-      cfg_free(main_loop_old_config);
+      cfg_free_previous(main_loop_new_config, main_loop_old_config, carried_over);
       current_configuration = main_loop_new_config;
     }
   else
     {
       msg_error("Error initializing new configuration, reverting to old config", NULL);
+      if (carried_over->len > 0)
+        {
+          /* stop the pipes carried over, so that they store their state
+           * for the old configuration to pick up */
+          cfg_deinit(main_loop_new_config);
+          cfg_tree_revert_carry_over(&main_loop_new_config->tree, &main_loop_old_config->tree, carried_over);
+        }
       cfg_persist_config_move(main_loop_new_config, main_loop_old_config);
       if (!cfg_init(main_loop_old_config))
         {
@@ -534,7 +603,11 @@ main_loop_reload_config_apply(void)
 
   reset_cached_hostname();
 
+  g_ptr_array_foreach(carried_over, (GFunc) log_pipe_unref, NULL);
+  g_ptr_array_free(carried_over, TRUE);
+
   stats_timer_kickoff(current_configuration);
+  persist_flush_timer_kickoff(current_configuration);
   stats_cleanup_orphans();
   return;
 }
@@ -570,6 +643,12 @@ main_loop_reload_config_initiate(void)
   main_loop_io_worker_sync_call(main_loop_reload_config_apply);
 }
 
+GlobalConfig *
+main_loop_get_current_config(void)
+{
+  return current_configuration;
+}
+
 /************************************************************************************
  * syncronized exit
  ************************************************************************************/
@@ -697,6 +776,8 @@ main_loop_run(void)
 
   IV_TIMER_INIT(&stats_timer);
   stats_timer.handler = stats_timer_elapsed;
+  IV_TIMER_INIT(&persist_flush_timer);
+  persist_flush_timer.handler = persist_flush_timer_elapsed;
 
   control_init(ctlfilename);
 
@@ -726,6 +807,7 @@ main_loop_run(void)
   iv_signal_register(&sigint_poll);
 
   stats_timer_kickoff(current_configuration);
+  persist_flush_timer_kickoff(current_configuration);
 
   /* main loop */
   iv_main();
@@ -733,6 +815,8 @@ main_loop_run(void)
   control_destroy();
 
   cfg_deinit(current_configuration);
+  if (current_configuration->state)
+    persist_state_flush(current_configuration->state);
   cfg_free(current_configuration);
   current_configuration = NULL;
   return 0;
@@ -66,6 +66,7 @@ main_loop_io_worker_job_quit(void)
 }
 
 void main_loop_reload_config_initiate(void);
+GlobalConfig *main_loop_get_current_config(void);
 void main_loop_io_worker_set_thread_id(gint id);
 gint main_loop_io_worker_thread_id(void);
 void main_loop_io_worker_job_init(MainLoopIOWorkerJob *self);
@@ -88,6 +89,7 @@ main_loop_is_main_thread(void)
 }
 
 gpointer main_loop_call(MainLoopTaskFunc func, gpointer user_data, gboolean wait);
+void main_loop_call_pending(void);
 int main_loop_init(void);
 int  main_loop_run(void);
 
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2002-2011 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2011 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "memaccount.h"
+#include "stats.h"
+#include "messages.h"
+#include "tls-support.h"
+
+#include <string.h>
+
+typedef struct _MemAccountCounter
+{
+  gint64 bytes;
+  gint64 objects;
+  /* in kilobytes, 0 if disabled */
+  gint64 watermark;
+  gint above_watermark;
+  StatsCounterItem *memory_counter;
+  StatsCounterItem *objects_counter;
+} MemAccountCounter;
+
+static MemAccountCounter mem_account_counters[MA_MAX];
+
+static const gchar *mem_account_category_names[MA_MAX] =
+{
+  /* [MA_LOGMSG] = */ "logmsg",
+  /* [MA_QUEUE] = */ "queue",
+  /* [MA_TEMPLATE] = */ "templates",
+  /* [MA_CORRELATION] = */ "correlation",
+  /* [MA_DNS_CACHE] = */ "dns",
+  /* [MA_PERSIST] = */ "persist",
+};
+
+TLS_BLOCK_START
+{
+  /* changes not yet added to mem_account_counters */
+  gssize mem_account_pending_bytes[MA_MAX];
+  gint mem_account_pending_objects[MA_MAX];
+}
+TLS_BLOCK_END;
+
+#define mem_account_pending_bytes    __tls_deref(mem_account_pending_bytes)
+#define mem_account_pending_objects  __tls_deref(mem_account_pending_objects)
+
+static void
+mem_account_check_watermark(MemAccountCategory category, gint64 bytes)
+{
+  MemAccountCounter *self = &mem_account_counters[category];
+  gint64 watermark = self->watermark;
+  gint64 kbytes = bytes >> 10;
+
+  if (!watermark)
+    return;
+
+  if (kbytes >= watermark)
+    {
+      if (g_atomic_int_compare_and_exchange(&self->above_watermark, FALSE, TRUE))
+        msg_warning("Memory usage exceeded the configured watermark",
+                    evt_tag_str("category", mem_account_category_names[category]),
+                    evt_tag_printf("kbytes", "%" G_GINT64_FORMAT, kbytes),
+                    evt_tag_printf("watermark", "%" G_GINT64_FORMAT, watermark),
+                    NULL);
+    }
+  else if (kbytes < watermark - watermark / 10)
+    {
+      /* some hysteresis, so that hovering around the watermark doesn't flood the logs */
+      if (g_atomic_int_compare_and_exchange(&self->above_watermark, TRUE, FALSE))
+        msg_notice("Memory usage dropped below the configured watermark",
+                   evt_tag_str("category", mem_account_category_names[category]),
+                   evt_tag_printf("kbytes", "%" G_GINT64_FORMAT, kbytes),
+                   evt_tag_printf("watermark", "%" G_GINT64_FORMAT, watermark),
+                   NULL);
+    }
+}
+
+static void
+mem_account_flush_category(MemAccountCategory category)
+{
+  MemAccountCounter *self = &mem_account_counters[category];
+  gssize bytes = mem_account_pending_bytes[category];
+  gint objects = mem_account_pending_objects[category];
+  gint64 total_bytes, total_objects;
+
+  /* reset first, the warning below allocates memory itself */
+  mem_account_pending_bytes[category] = 0;
+  mem_account_pending_objects[category] = 0;
+
+  total_bytes = __sync_add_and_fetch(&self->bytes, (gint64) bytes);
+  total_objects = __sync_add_and_fetch(&self->objects, (gint64) objects);
+
+  stats_counter_set(self->memory_counter, MAX(total_bytes, 0) >> 10);
+  stats_counter_set(self->objects_counter, MAX(total_objects, 0));
+  mem_account_check_watermark(category, total_bytes);
+}
+
+void
+mem_account_add(MemAccountCategory category, gssize bytes, gint objects)
+{
+  gssize pending_bytes;
+  gint pending_objects;
+
+  pending_bytes = (mem_account_pending_bytes[category] += bytes);
+  pending_objects = (mem_account_pending_objects[category] += objects);
+
+  if (pending_bytes > MEM_ACCOUNT_FLUSH_BYTES || pending_bytes < -MEM_ACCOUNT_FLUSH_BYTES ||
+      pending_objects > MEM_ACCOUNT_FLUSH_OBJECTS || pending_objects < -MEM_ACCOUNT_FLUSH_OBJECTS)
+    mem_account_flush_category(category);
+}
+
+/* adds the changes made by the current thread to the totals */
+void
+mem_account_flush_thread(void)
+{
+  gint i;
+
+  for (i = 0; i < MA_MAX; i++)
+    {
+      if (mem_account_pending_bytes[i] || mem_account_pending_objects[i])
+        mem_account_flush_category(i);
+    }
+}
+
+gint64
+mem_account_get_bytes(MemAccountCategory category)
+{
+  return mem_account_counters[category].bytes;
+}
+
+gint64
+mem_account_get_objects(MemAccountCategory category)
+{
+  return mem_account_counters[category].objects;
+}
+
+const gchar *
+mem_account_get_category_name(MemAccountCategory category)
+{
+  return mem_account_category_names[category];
+}
+
+gint
+mem_account_lookup_category(const gchar *name)
+{
+  gint i;
+
+  for (i = 0; i < MA_MAX; i++)
+    {
+      if (strcmp(mem_account_category_names[i], name) == 0)
+        return i;
+    }
+  return -1;
+}
+
+void
+mem_account_set_watermark(MemAccountCategory category, gint64 kbytes)
+{
+  MemAccountCounter *self = &mem_account_counters[category];
+
+  if (self->watermark != kbytes)
+    {
+      self->watermark = kbytes;
+      g_atomic_int_set(&self->above_watermark, FALSE);
+    }
+}
+
+void
+mem_account_init(void)
+{
+  gint i;
+
+  stats_lock();
+  for (i = 0; i < MA_MAX; i++)
+    {
+      stats_register_counter(0, SCS_GLOBAL, "memory", mem_account_category_names[i], SC_TYPE_MEMORY, &mem_account_counters[i].memory_counter);
+      stats_register_counter(0, SCS_GLOBAL, "memory", mem_account_category_names[i], SC_TYPE_OBJECTS, &mem_account_counters[i].objects_counter);
+    }
+  stats_unlock();
+}
+
+void
+mem_account_deinit(void)
+{
+  gint i;
+
+  stats_lock();
+  for (i = 0; i < MA_MAX; i++)
+    {
+      stats_unregister_counter(SCS_GLOBAL, "memory", mem_account_category_names[i], SC_TYPE_MEMORY, &mem_account_counters[i].memory_counter);
+      stats_unregister_counter(SCS_GLOBAL, "memory", mem_account_category_names[i], SC_TYPE_OBJECTS, &mem_account_counters[i].objects_counter);
+    }
+  stats_unlock();
+}
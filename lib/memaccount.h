@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2002-2011 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2011 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef MEMACCOUNT_H_INCLUDED
+#define MEMACCOUNT_H_INCLUDED
+
+#include "syslog-ng.h"
+
+/*
+ * Memory accounting
+ *
+ * Always-on, approximate counters of the live bytes and objects that
+ * belong to the larger consumers of memory, published as
+ * global;memory;<category> counters in the statistics.  The
+ * categories are views and are not disjoint, e.g. the messages held
+ * by queues and correlation contexts are counted in "logmsg" too.
+ *
+ * Changes are collected in per-thread deltas and only added to the
+ * shared totals once they exceed MEM_ACCOUNT_FLUSH_BYTES or
+ * MEM_ACCOUNT_FLUSH_OBJECTS, or when the I/O worker finishes its job,
+ * so the totals may lag behind by that much per thread.
+ */
+typedef enum
+{
+  MA_LOGMSG,        /* LogMessage instances and their NVTable payloads, objects are messages */
+  MA_QUEUE,         /* messages held by destination queues, including the backlog */
+  MA_TEMPLATE,      /* per-thread scratch buffers used to format templates */
+  MA_CORRELATION,   /* patterndb correlation contexts and the messages they hold */
+  MA_DNS_CACHE,     /* DNS cache entries */
+  MA_PERSIST,       /* the mapped persist file */
+  MA_MAX
+} MemAccountCategory;
+
+#define MEM_ACCOUNT_FLUSH_BYTES   65536
+#define MEM_ACCOUNT_FLUSH_OBJECTS 64
+
+void mem_account_add(MemAccountCategory category, gssize bytes, gint objects);
+void mem_account_flush_thread(void);
+
+gint64 mem_account_get_bytes(MemAccountCategory category);
+gint64 mem_account_get_objects(MemAccountCategory category);
+const gchar *mem_account_get_category_name(MemAccountCategory category);
+gint mem_account_lookup_category(const gchar *name);
+
+void mem_account_set_watermark(MemAccountCategory category, gint64 kbytes);
+
+void mem_account_init(void);
+void mem_account_deinit(void);
+
+static inline void
+mem_account_alloc(MemAccountCategory category, gsize bytes)
+{
+  mem_account_add(category, bytes, 1);
+}
+
+static inline void
+mem_account_free(MemAccountCategory category, gsize bytes)
+{
+  mem_account_add(category, -(gssize) bytes, -1);
+}
+
+#endif
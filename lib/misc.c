@@ -24,6 +24,7 @@
   
 #include "misc.h"
 #include "dnscache.h"
+#include "dnsresolver.h"
 #include "messages.h"
 #include "gprocess.h"
 
@@ -182,7 +183,8 @@ resolve_sockaddr(gchar *result, gsize *result_len, GSockAddr *saddr, gboolean us
 {
   gchar *hname;
   gboolean positive;
-  gchar *p, buf[256];
+  gboolean lookup_pending = FALSE;
+  gchar *p, buf[256], resolved[256];
  
   if (saddr && saddr->sa.sa_family != AF_UNIX)
     {
@@ -211,12 +213,29 @@ resolve_sockaddr(gchar *result, gsize *result_len, GSockAddr *saddr, gboolean us
           hname = NULL;
           if (usedns)
             {
-              if ((!use_dns_cache || !dns_cache_lookup(saddr->sa.sa_family, addr, (const gchar **) &hname, &positive)) && usedns != 2)
+              if (use_dns_cache && dns_cache_lookup(saddr->sa.sa_family, addr, resolved, sizeof(resolved), &positive))
                 {
-                  struct hostent *hp;
-                      
-                  hp = gethostbyaddr(addr, addr_len, saddr->sa.sa_family);
-                  hname = (hp && hp->h_name) ? hp->h_name : NULL;
+                  hname = resolved[0] ? resolved : NULL;
+                }
+              else if (usedns != 2)
+                {
+                  if (dns_resolver_is_async())
+                    {
+                      /* don't block the I/O worker while the name server
+                       * responds, use the address until the lookup
+                       * completes */
+                      if (!dns_resolver_lookup(saddr->sa.sa_family, addr, resolved, sizeof(resolved), &positive))
+                        lookup_pending = TRUE;
+                      else if (positive)
+                        hname = resolved;
+                    }
+                  else
+                    {
+                      struct hostent *hp;
+
+                      hp = gethostbyaddr(addr, addr_len, saddr->sa.sa_family);
+                      hname = (hp && hp->h_name) ? hp->h_name : NULL;
+                    }
 
                   if (hname)
                     positive = TRUE;
@@ -233,7 +252,7 @@ resolve_sockaddr(gchar *result, gsize *result_len, GSockAddr *saddr, gboolean us
             {
               inet_ntop(saddr->sa.sa_family, addr, buf, sizeof(buf));
               hname = buf;
-              if (use_dns_cache)
+              if (use_dns_cache && !lookup_pending)
                 dns_cache_store(FALSE, saddr->sa.sa_family, addr, hname, FALSE);
             }
           else 
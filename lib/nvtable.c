@@ -23,6 +23,7 @@
  */
 #include "nvtable.h"
 #include "messages.h"
+#include "memaccount.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -235,6 +236,23 @@ nv_table_resolve_entry(NVTable *self, NVEntry *entry, gssize *length)
     return nv_table_resolve_indirect(self, entry, length);
 }
 
+/* slow path of nv_table_get_value(), called when an overlay has no entry for @handle */
+const gchar *
+nv_table_get_base_value(NVTable *self, NVHandle handle, gssize *length)
+{
+  return nv_table_get_value(self->base, handle, length);
+}
+
+static inline NVEntry *
+nv_table_get_base_entry(NVTable *self, NVHandle handle)
+{
+  guint32 *dyn_slot;
+
+  if (!self->base)
+    return NULL;
+  return nv_table_get_entry(self->base, handle, &dyn_slot);
+}
+
 NVEntry *
 nv_table_get_entry_slow(NVTable *self, NVHandle handle, guint32 **dyn_slot)
 {
@@ -387,12 +405,13 @@ nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name
   if (new_entry)
     *new_entry = FALSE;
   entry = nv_table_get_entry(self, handle, &dyn_slot);
-  if (G_UNLIKELY(!entry && !new_entry && value_len == 0))
+  if (G_UNLIKELY(!entry && !new_entry && value_len == 0 && !nv_table_get_base_entry(self, handle)))
     {
       /* we don't store zero length matches unless the caller is
        * interested in whether a new entry was created. It is used by
        * the SDATA support code to decide whether a previously
-       * not-present SDATA was set */
+       * not-present SDATA was set. In overlays the empty value has to
+       * be stored in order to shadow the value in the base. */
       return TRUE;
     }
   if (G_UNLIKELY(entry && !entry->indirect && entry->referenced))
@@ -434,7 +453,7 @@ nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name
       return TRUE;
     }
   else if (!entry && new_entry)
-    *new_entry = TRUE;
+    *new_entry = !nv_table_get_base_entry(self, handle);
 
   /* check if there's enough free space: size of the struct plus the
    * size needed for a dynamic table slot */
@@ -474,15 +493,17 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
   if (new_entry)
     *new_entry = FALSE;
   ref_entry = nv_table_get_entry(self, ref_handle, &dyn_slot);
-  if (ref_entry && ref_entry->indirect)
+  if ((ref_entry && ref_entry->indirect) || (!ref_entry && nv_table_get_base_entry(self, ref_handle)))
     {
       const gchar *ref_value;
       gssize ref_length;
 
       /* NOTE: uh-oh, the to-be-referenced value is already an indirect
-       * reference, this is not supported, copy the stuff */
+       * reference, this is not supported, copy the stuff. The same
+       * applies to values that live in the read-only base of an
+       * overlay, as we can't mark those referenced. */
 
-      ref_value = nv_table_resolve_indirect(self, ref_entry, &ref_length);
+      ref_value = nv_table_get_value(self, ref_handle, &ref_length);
 
       if (rofs > ref_length)
         {
@@ -497,7 +518,7 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
     }
 
   entry = nv_table_get_entry(self, handle, &dyn_slot);
-  if (!entry && !new_entry && (rlen == 0 || !ref_entry))
+  if (!entry && !new_entry && (rlen == 0 || !ref_entry) && !nv_table_get_base_entry(self, handle))
     {
       /* we don't store zero length matches unless the caller is
        * interested in whether a new entry was created. It is used by
@@ -538,7 +559,7 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
       return TRUE;
     }
   else if (!entry && new_entry)
-    *new_entry = TRUE;
+    *new_entry = !nv_table_get_base_entry(self, handle);
 
   if (!nv_table_reserve_table_entry(self, handle, &dyn_slot))
     return FALSE;
@@ -574,8 +595,14 @@ nv_table_call_foreach(NVHandle handle, NVEntry *entry, gpointer user_data)
   NVRegistry *registry = (NVRegistry *) ((gpointer *) user_data)[1];
   NVTableForeachFunc func = ((gpointer *) user_data)[2];
   gpointer func_data = ((gpointer *) user_data)[3];
+  NVTable *overlay = (NVTable *) ((gpointer *) user_data)[4];
   const gchar *value;
   gssize value_len;
+  guint32 *dyn_slot;
+
+  /* base entries shadowed by the overlay were already reported */
+  if (overlay && nv_table_get_entry(overlay, handle, &dyn_slot))
+    return FALSE;
 
   value = nv_table_resolve_entry(self, entry, &value_len);
   return func(handle, nv_registry_get_handle_name(registry, handle, NULL), value, value_len, func_data);
@@ -584,9 +611,18 @@ nv_table_call_foreach(NVHandle handle, NVEntry *entry, gpointer user_data)
 gboolean
 nv_table_foreach(NVTable *self, NVRegistry *registry, NVTableForeachFunc func, gpointer user_data)
 {
-  gpointer data[4] = { self, registry, func, user_data };
+  gpointer data[5] = { self, registry, func, user_data, NULL };
+
+  if (nv_table_foreach_entry(self, nv_table_call_foreach, data))
+    return TRUE;
 
-  return nv_table_foreach_entry(self, nv_table_call_foreach, data);
+  if (self->base)
+    {
+      data[0] = self->base;
+      data[4] = self;
+      return nv_table_foreach_entry(self->base, nv_table_call_foreach, data);
+    }
+  return FALSE;
 }
 
 gboolean
@@ -627,6 +663,7 @@ nv_table_clear(NVTable *self)
   g_assert(self->ref_cnt == 1);
   self->used = 0;
   self->num_dyn_entries = 0;
+  self->base = NULL;
   memset(&self->static_entries[0], 0, self->num_static_entries * sizeof(self->static_entries[0]));
 }
 
@@ -640,6 +677,7 @@ nv_table_init(NVTable *self, gsize alloc_length, gint num_static_entries)
   self->num_static_entries = NV_TABLE_BOUND_NUM_STATIC(num_static_entries);
   self->ref_cnt = 1;
   self->borrowed = FALSE;
+  self->base = NULL;
   memset(&self->static_entries[0], 0, self->num_static_entries * sizeof(self->static_entries[0]));
 }
 
@@ -651,6 +689,7 @@ nv_table_new(gint num_static_entries, gint num_dyn_values, gint init_length)
 
   alloc_length = nv_table_get_alloc_size(num_static_entries, num_dyn_values, init_length);
   self = (NVTable *) g_malloc(alloc_length);
+  mem_account_add(MA_LOGMSG, alloc_length, 0);
 
   nv_table_init(self, alloc_length, num_static_entries);
   return self;
@@ -668,6 +707,9 @@ nv_table_init_borrowed(gpointer space, gsize space_len, gint num_static_entries)
   return self;
 }
 
+/* an overlay is flattened instead of being grown once its size reaches 1/N of the data stored in its base */
+#define NV_TABLE_OVERLAY_FLATTEN_RATIO 4
+
 /* returns TRUE if successfully realloced, FALSE means that we're unable to grow */
 gboolean
 nv_table_realloc(NVTable *self, NVTable **new)
@@ -682,9 +724,19 @@ nv_table_realloc(NVTable *self, NVTable **new)
   if (new_size == old_size)
     return FALSE;
 
+  if (self->base && ((gsize) self->size * NV_TABLE_OVERLAY_FLATTEN_RATIO) >= self->base->used)
+    {
+      /* the overlay has grown large enough to lose its advantage
+       * over a full copy, convert it to a standalone table */
+      *new = nv_table_flatten(self, 0);
+      nv_table_unref(self);
+      return TRUE;
+    }
+
   if (self->ref_cnt == 1 && !self->borrowed)
     {
       *new = self = g_realloc(self, new_size << NV_TABLE_SCALE);
+      mem_account_add(MA_LOGMSG, (new_size - old_size) << NV_TABLE_SCALE, 0);
 
       self->size = new_size;
       /* move the downwards growing region to the end of the new buffer */
@@ -695,6 +747,7 @@ nv_table_realloc(NVTable *self, NVTable **new)
   else
     {
       *new = g_malloc(new_size << NV_TABLE_SCALE);
+      mem_account_add(MA_LOGMSG, new_size << NV_TABLE_SCALE, 0);
 
       /* we only copy the header first */
       memcpy(*new, self, sizeof(NVTable) + self->num_static_entries * sizeof(self->static_entries[0]) + self->num_dyn_entries * sizeof(guint32));
@@ -722,6 +775,7 @@ nv_table_unref(NVTable *self)
 {
   if ((--self->ref_cnt == 0) && !self->borrowed)
     {
+      mem_account_add(MA_LOGMSG, -(gssize) nv_table_get_alloc_length(self), 0);
       g_free(self);
     }
 }
@@ -745,6 +799,7 @@ nv_table_clone(NVTable *self, gint additional_space)
     new_size = self->size + (NV_TABLE_BOUND(additional_space) >> NV_TABLE_SCALE);
 
   new = g_malloc(new_size << NV_TABLE_SCALE);
+  mem_account_add(MA_LOGMSG, new_size << NV_TABLE_SCALE, 0);
   memcpy(new, self, sizeof(NVTable) + self->num_static_entries * sizeof(self->static_entries[0]) + self->num_dyn_entries * sizeof(guint32));
   new->size = new_size;
   new->ref_cnt = 1;
@@ -755,3 +810,74 @@ nv_table_clone(NVTable *self, gint additional_space)
           self->used << NV_TABLE_SCALE);
   return new;
 }
+
+/**
+ * nv_table_new_overlay:
+ * @base: the table to be used as the read-only base of the overlay
+ * @additional_space: specifies how much space is needed in the overlay
+ *
+ * Creates an NVTable that records changes relative to @base without
+ * copying its contents. Overlays are not stacked, if @base is an
+ * overlay itself, a flattened copy is returned instead.
+ **/
+NVTable *
+nv_table_new_overlay(NVTable *base, gint additional_space)
+{
+  NVTable *self;
+
+  if (base->base)
+    return nv_table_flatten(base, additional_space);
+
+  self = nv_table_new(base->num_static_entries, 4, additional_space);
+  self->base = base;
+  return self;
+}
+
+static gboolean
+nv_table_flatten_entry(NVHandle handle, NVEntry *entry, gpointer user_data)
+{
+  NVTable *self = (NVTable *) ((gpointer *) user_data)[0];
+  NVTable **new = (NVTable **) ((gpointer *) user_data)[1];
+  const gchar *value;
+  gssize value_len;
+  gboolean new_entry;
+
+  /* indirect values are converted to direct ones, as their referenced
+   * value may be overwritten later in the same walk */
+  value = nv_table_resolve_entry(self, entry, &value_len);
+  while (!nv_table_add_value(*new, handle, nv_entry_get_name(entry), entry->name_len, value, value_len, &new_entry))
+    {
+      if (!nv_table_realloc(*new, new))
+        {
+          msg_error("Cannot store value while flattening NVTable overlay, maximum size has been reached",
+                    evt_tag_int("handle", handle),
+                    NULL);
+          break;
+        }
+    }
+  return FALSE;
+}
+
+/**
+ * nv_table_flatten:
+ * @self: payload to flatten
+ * @additional_space: specifies how much additional space is needed in
+ *                    the newly allocated table
+ *
+ * Returns a standalone copy of @self, merging the contents of an
+ * overlay with its base. For non-overlay tables it is equivalent to
+ * nv_table_clone().
+ **/
+NVTable *
+nv_table_flatten(NVTable *self, gint additional_space)
+{
+  NVTable *new;
+  gpointer data[2] = { self, &new };
+
+  if (!self->base)
+    return nv_table_clone(self, additional_space);
+
+  new = nv_table_clone(self->base, (self->used << NV_TABLE_SCALE) + self->num_dyn_entries * sizeof(guint32) + additional_space);
+  nv_table_foreach_entry(self, nv_table_flatten_entry, data);
+  return new;
+}
@@ -179,6 +179,21 @@ nv_entry_get_name(NVEntry *self)
  *
  *   - It is possible to clone an NVTable, which basically copies the
  *     underlying memory contents.
+ *
+ * Overlays
+ * ========
+ *   - an overlay is an NVTable that only stores the entries changed
+ *     relative to a read-only @base table, lookups that miss in the
+ *     overlay fall back to the base. It is used to make the first
+ *     modification of a cloned LogMessage cheap.
+ *
+ *   - the base is not reference counted by the overlay, its owner must
+ *     keep it alive and unchanged while the overlay exists (LogMessage
+ *     does this through its "original" reference).
+ *
+ *   - an overlay is flattened into a standalone NVTable once it would
+ *     grow beyond a fraction of its base, or explicitly via
+ *     nv_table_flatten().
  */
 struct _NVTable
 {
@@ -189,6 +204,8 @@ struct _NVTable
   guint8 num_static_entries;
   guint8 ref_cnt:7,
     borrowed:1; /* specifies if the memory used by NVTable was borrowed from the container struct */
+  /* read-only table this one is an overlay of, NULL for standalone tables */
+  NVTable *base;
 
   /* variable data, see memory layout in the comment above */
   union
@@ -217,6 +234,8 @@ NVTable *nv_table_new(gint num_static_values, gint num_dyn_values, gint init_len
 NVTable *nv_table_init_borrowed(gpointer space, gsize space_len, gint num_static_entries);
 gboolean nv_table_realloc(NVTable *self, NVTable **new);
 NVTable *nv_table_clone(NVTable *self, gint additional_space);
+NVTable *nv_table_new_overlay(NVTable *base, gint additional_space);
+NVTable *nv_table_flatten(NVTable *self, gint additional_space);
 NVTable *nv_table_ref(NVTable *self);
 void nv_table_unref(NVTable *self);
 
@@ -234,6 +253,19 @@ nv_table_get_alloc_size(gint num_static_entries, gint num_dyn_values, gint init_
   return size;
 }
 
+/* the number of bytes allocated for @self */
+static inline gsize
+nv_table_get_alloc_length(NVTable *self)
+{
+  return ((gsize) self->size) << NV_TABLE_SCALE;
+}
+
+static inline gboolean
+nv_table_is_overlay(NVTable *self)
+{
+  return self->base != NULL;
+}
+
 static inline gchar *
 nv_table_get_top(NVTable *self)
 {
@@ -243,6 +275,7 @@ nv_table_get_top(NVTable *self)
 /* private declarations for inline functions */
 NVEntry *nv_table_get_entry_slow(NVTable *self, NVHandle handle, guint32 **dyn_slot);
 const gchar *nv_table_resolve_indirect(NVTable *self, NVEntry *entry, gssize *len);
+const gchar *nv_table_get_base_value(NVTable *self, NVHandle handle, gssize *length);
 
 
 static inline NVEntry *
@@ -285,6 +318,8 @@ __nv_table_get_value(NVTable *self, NVHandle handle, guint16 num_static_entries,
   entry = nv_table_get_entry(self, handle, &dyn_slot);
   if (G_UNLIKELY(!entry))
     {
+      if (self->base)
+        return nv_table_get_base_value(self, handle, length);
       if (length)
         *length = 0;
       return null_string;
@@ -26,8 +26,10 @@
 #include "serialize.h"
 #include "messages.h"
 #include "mainloop.h"
+#include "memaccount.h"
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -48,8 +50,10 @@ typedef struct _PersistFileHeader
       guint32 flags;
       /* number of name-value keys in the file */
       guint32 key_count;
+      /* end of the allocated area, zero in files written by older versions */
+      guint32 used_size;
       /* space reserved for additional information in the header */
-      gchar __reserved1[52];
+      gchar __reserved1[48];
       /* initial key store where the first couple of NV keys are stored, sized to align the header to 4k boundary */
       gchar initial_key_store[4032];
     };
@@ -59,6 +63,8 @@ typedef struct _PersistFileHeader
 
 #define PERSIST_FILE_INITIAL_SIZE 16384
 #define PERSIST_STATE_KEY_BLOCK_SIZE 4096
+/* the file is rewritten at startup if the area not used by live entries exceeds this on top of the live size */
+#define PERSIST_STATE_COMPACT_SLACK PERSIST_FILE_INITIAL_SIZE
 
 /*
  * The syslog-ng persistent state is a set of name-value pairs,
@@ -116,6 +122,24 @@ typedef struct _PersistFileHeader
  * This way unused entries in the persist file are reaped when
  * syslog-ng restarts.
  *
+ * Journal mode:
+ * -------------
+ *
+ * Rewriting the file at every startup gets slow with many thousands of
+ * entries, therefore if the file was written by a version that records
+ * the end of the allocated area in the header (used_size), and most of
+ * it is still in use, the file is opened in place instead. In this
+ * mode the key store is indexed on load, new values and keys are
+ * appended just like before, and persist_state_commit() only clears
+ * the in_use bit of the entries that were not looked up, which are
+ * then dropped at the next compaction (e.g. rewrite).
+ *
+ * The key count is only incremented once the key record and its value
+ * have been written, so an interrupted update is simply ignored on the
+ * next load. The mapping is written back to disk by
+ * persist_state_flush(), which is called periodically by the main
+ * loop, see the persist_flush_freq() global option.
+ *
  * Trusts:
  * -------
  *
@@ -146,13 +170,32 @@ struct _PersistState
   PersistEntryHandle current_key_block;
   gint current_key_ofs;
   gint current_key_size;
+
+  /* the committed file is updated in place, see "Journal mode" above */
+  gboolean journal;
+  /* the original file size and header fields (big-endian) of the journal, used by persist_state_cancel() */
+  guint32 journal_size;
+  guint32 journal_key_count;
+  guint32 journal_used_size;
 };
 
 typedef struct _PersistEntry
 {
   PersistEntryHandle ofs;
+  /* looked up or allocated since the state was started */
+  gboolean used;
 } PersistEntry;
 
+/* the position where the next key is written in the key store */
+typedef struct _PersistKeyStorePos
+{
+  PersistEntryHandle block;
+  guint32 ofs;
+  guint32 size;
+} PersistKeyStorePos;
+
+typedef void (*PersistStateKeyFunc)(const gchar *name, PersistEntryHandle handle, gpointer value_header, gpointer user_data);
+
 /* everything is big-endian */
 typedef struct _PersistValueHeader
 {
@@ -164,6 +207,31 @@ typedef struct _PersistValueHeader
 
 /* lowest layer, "store" functions manage the file on disk */
 
+static gboolean
+persist_state_map_store(PersistState *self, guint32 size)
+{
+  self->current_size = size;
+  self->current_map = mmap(NULL, self->current_size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+  if (self->current_map == MAP_FAILED)
+    {
+      self->current_map = NULL;
+      return FALSE;
+    }
+  mem_account_alloc(MA_PERSIST, self->current_size);
+  return TRUE;
+}
+
+static void
+persist_state_unmap_store(PersistState *self)
+{
+  if (self->current_map)
+    {
+      munmap(self->current_map, self->current_size);
+      mem_account_free(MA_PERSIST, self->current_size);
+      self->current_map = NULL;
+    }
+}
+
 static gboolean
 persist_state_grow_store(PersistState *self, guint32 new_size)
 {
@@ -188,15 +256,9 @@ persist_state_grow_store(PersistState *self, guint32 new_size)
         goto exit;
       if (write(self->fd, &zero, 1) != 1)
         goto exit;
-      if (self->current_map)
-        munmap(self->current_map, self->current_size);
-      self->current_size = new_size;
-      self->current_map = mmap(NULL, self->current_size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
-      if (self->current_map == MAP_FAILED)
-        {
-          self->current_map = NULL;
-          goto exit;
-        }
+      persist_state_unmap_store(self);
+      if (!persist_state_map_store(self, new_size))
+        goto exit;
       self->header = (PersistFileHeader *) self->current_map;
       memcpy(&self->header->magic, "SLP4", 4);
     }
@@ -221,7 +283,100 @@ persist_state_create_store(PersistState *self)
   self->current_key_block = offsetof(PersistFileHeader, initial_key_store);
   self->current_key_ofs = 0;
   self->current_key_size = sizeof((((PersistFileHeader *) NULL))->initial_key_store);
-  return persist_state_grow_store(self, PERSIST_FILE_INITIAL_SIZE);
+  if (!persist_state_grow_store(self, PERSIST_FILE_INITIAL_SIZE))
+    return FALSE;
+  self->header->used_size = GUINT32_TO_BE(self->current_ofs);
+  return TRUE;
+}
+
+static gboolean persist_state_walk_keys(gpointer map, gint64 file_size, PersistStateKeyFunc func, gpointer user_data, PersistKeyStorePos *end);
+
+typedef struct _PersistStateIndex
+{
+  PersistState *self;
+  guint32 live_size;
+} PersistStateIndex;
+
+static void
+persist_state_index_entry(const gchar *name, PersistEntryHandle handle, gpointer value_header, gpointer user_data)
+{
+  PersistStateIndex *index = (PersistStateIndex *) user_data;
+  PersistValueHeader *header = (PersistValueHeader *) value_header;
+  PersistEntry *entry;
+
+  if (!header->in_use)
+    return;
+
+  entry = g_new(PersistEntry, 1);
+  entry->ofs = handle;
+  entry->used = FALSE;
+  g_hash_table_insert(index->self->keys, g_strdup(name), entry);
+
+  /* value with its header, rounded up as in persist_state_alloc_value(), plus the key record */
+  index->live_size += ((GUINT32_FROM_BE(header->size) + 7) & ~7) + sizeof(PersistValueHeader);
+  index->live_size += strlen(name) + 2 * sizeof(guint32);
+}
+
+/* opens the committed file in place, fails if it needs to be rewritten */
+static gboolean
+persist_state_open_store(PersistState *self)
+{
+  PersistFileHeader header;
+  PersistStateIndex index = { self, 0 };
+  PersistKeyStorePos end;
+  struct stat st;
+  guint32 used_size;
+
+  self->fd = open(self->commited_filename, O_RDWR);
+  if (self->fd < 0)
+    return FALSE;
+
+  if (fstat(self->fd, &st) < 0 ||
+      st.st_size < sizeof(PersistFileHeader) || st.st_size > G_MAXINT32 ||
+      pread(self->fd, &header, sizeof(header), 0) != sizeof(header))
+    goto error;
+
+  used_size = GUINT32_FROM_BE(header.used_size);
+  if (memcmp(header.magic, "SLP4", 4) != 0 || header.flags != 0 ||
+      used_size < sizeof(PersistFileHeader) || used_size > st.st_size)
+    goto error;
+
+  if (!persist_state_map_store(self, st.st_size))
+    goto error;
+  self->header = (PersistFileHeader *) self->current_map;
+
+  if (!persist_state_walk_keys(self->current_map, self->current_size, persist_state_index_entry, &index, &end))
+    goto error;
+
+  if (used_size - sizeof(PersistFileHeader) > 2 * (gint64) index.live_size + PERSIST_STATE_COMPACT_SLACK)
+    {
+      msg_verbose("Compacting persistent state file",
+                  evt_tag_str("filename", self->commited_filename),
+                  evt_tag_int("size", used_size),
+                  evt_tag_int("live_size", index.live_size),
+                  NULL);
+      goto error;
+    }
+
+  self->current_ofs = used_size;
+  self->current_key_block = end.block;
+  self->current_key_ofs = end.ofs;
+  self->current_key_size = end.size;
+
+  self->journal = TRUE;
+  self->journal_size = self->current_size;
+  self->journal_key_count = header.key_count;
+  self->journal_used_size = header.used_size;
+  return TRUE;
+
+ error:
+  g_hash_table_remove_all(self->keys);
+  persist_state_unmap_store(self);
+  self->header = NULL;
+  self->current_size = 0;
+  close(self->fd);
+  self->fd = -1;
+  return FALSE;
 }
 
 static gboolean
@@ -260,6 +415,7 @@ persist_state_alloc_value(PersistState *self, guint32 orig_size, gboolean in_use
   persist_state_unmap_entry(self, self->current_ofs);
 
   self->current_ofs += size + sizeof(PersistValueHeader);
+  self->header->used_size = GUINT32_TO_BE(self->current_ofs);
   return result;
 }
 
@@ -301,6 +457,7 @@ persist_state_lookup_key(PersistState *self, const gchar *key, PersistEntryHandl
   entry = g_hash_table_lookup(self->keys, key);
   if (entry)
     {
+      entry->used = TRUE;
       *handle = entry->ofs;
       return TRUE;
     }
@@ -323,6 +480,7 @@ persist_state_add_key(PersistState *self, const gchar *key, PersistEntryHandle h
 
   entry = g_new(PersistEntry, 1);
   entry->ofs = handle;
+  entry->used = TRUE;
   g_hash_table_insert(self->keys, g_strdup(key), entry);
 
   /* we try to insert the key into the current block first, then if it
@@ -448,16 +606,137 @@ persist_state_load_v23(PersistState *self, gint version, SerializeArchive *sa)
   return TRUE;
 }
 
+/*
+ * Iterate over the keys in a v4 persist file mapped at @map, calling
+ * @func for each key record in the order they were written. If @end
+ * is not NULL, it is set to the position where the next key record
+ * is to be stored. Returns FALSE if the file is found to be corrupt.
+ */
+static gboolean
+persist_state_walk_keys(gpointer map, gint64 file_size, PersistStateKeyFunc func, gpointer user_data, PersistKeyStorePos *end)
+{
+  PersistFileHeader *file_header = (PersistFileHeader *) map;
+  gpointer key_block;
+  guint32 key_size;
+  gint key_count, i;
+  SerializeArchive *sa;
+
+  key_block = ((gchar *) map) + offsetof(PersistFileHeader, initial_key_store);
+  key_size = sizeof((((PersistFileHeader *) NULL))->initial_key_store);
+
+  key_count = GUINT32_FROM_BE(file_header->key_count);
+  i = 0;
+  sa = serialize_buffer_archive_new(key_block, key_size);
+  while (i < key_count)
+    {
+      gchar *name;
+      guint32 entry_ofs, chain_ofs;
+
+      if (!serialize_read_cstring(sa, &name, NULL))
+        {
+          msg_error("Persistent file format error, unable to fetch key name",
+                    NULL);
+          goto error;
+        }
+      if (name[0])
+        {
+          PersistValueHeader *header;
+
+          if (!serialize_read_uint32(sa, &entry_ofs))
+            {
+              /* bad format */
+              g_free(name);
+              msg_error("Persistent file format error, unable to fetch key name",
+                        NULL);
+              goto error;
+            }
+          i++;
+
+          header = (PersistValueHeader *) ((gchar *) map + entry_ofs - sizeof(PersistValueHeader));
+          if (entry_ofs < sizeof(PersistFileHeader) || entry_ofs > file_size ||
+              (gint64) entry_ofs + GUINT32_FROM_BE(header->size) > file_size)
+            {
+              g_free(name);
+              msg_error("Persistent file format error, entry offset is out of bounds",
+                        NULL);
+              goto error;
+            }
+          func(name, entry_ofs, header, user_data);
+          g_free(name);
+        }
+      else
+        {
+          g_free(name);
+          if (!serialize_read_uint32(sa, &chain_ofs))
+            {
+              msg_error("Persistent file format error, unable to fetch chained key block offset",
+                        NULL);
+              goto error;
+            }
+
+          /* end of block, chain to the next one */
+          if (chain_ofs < sizeof(PersistFileHeader) || chain_ofs > file_size)
+            {
+              msg_error("Persistent file format error, key block chain offset is too large or zero",
+                        evt_tag_printf("key_block", "%08lx", (gulong) ((gchar *) key_block - (gchar *) map)),
+                        evt_tag_printf("key_size", "%d", key_size),
+                        evt_tag_int("ofs", chain_ofs),
+                        NULL);
+              goto error;
+            }
+          key_block = ((gchar *) map) + chain_ofs;
+          key_size = GUINT32_FROM_BE(*(guint32 *) (((gchar *) key_block) - sizeof(PersistValueHeader)));
+          if (chain_ofs + key_size > file_size)
+            {
+              msg_error("Persistent file format error, key block size is too large",
+                        evt_tag_int("key_size", key_size),
+                        NULL);
+              goto error;
+            }
+          serialize_archive_free(sa);
+          sa = serialize_buffer_archive_new(key_block, key_size);
+        }
+    }
+  if (end)
+    {
+      end->block = (gchar *) key_block - (gchar *) map;
+      end->ofs = serialize_buffer_archive_get_pos(sa);
+      end->size = key_size;
+    }
+  serialize_archive_free(sa);
+  return TRUE;
+
+ error:
+  serialize_archive_free(sa);
+  return FALSE;
+}
+
+static void
+persist_state_copy_entry(const gchar *name, PersistEntryHandle handle, gpointer value_header, gpointer user_data)
+{
+  PersistState *self = (PersistState *) user_data;
+  PersistValueHeader *header = (PersistValueHeader *) value_header;
+
+  if (header->in_use)
+    {
+      gpointer new_block;
+      PersistEntryHandle new_handle;
+
+      new_handle = persist_state_alloc_value(self, GUINT32_FROM_BE(header->size), FALSE, header->version);
+      new_block = persist_state_map_entry(self, new_handle);
+      memcpy(new_block, header + 1, GUINT32_FROM_BE(header->size));
+      persist_state_unmap_entry(self, new_handle);
+      /* add key to the current file */
+      persist_state_add_key(self, name, new_handle);
+    }
+}
+
 gboolean
 persist_state_load_v4(PersistState *self)
 {
   gint fd;
   gint64 file_size;
   gpointer map;
-  gpointer key_block;
-  guint32 key_size;
-  PersistFileHeader *header;
-  gint key_count, i;
 
   fd = open(self->commited_filename, O_RDONLY);
   if (fd < 0)
@@ -485,109 +764,9 @@ persist_state_load_v4(PersistState *self)
                 NULL);
       return FALSE;
     }
-  header = (PersistFileHeader *) map;
-
-  key_block = ((gchar *) map) + offsetof(PersistFileHeader, initial_key_store);
-  key_size = sizeof((((PersistFileHeader *) NULL))->initial_key_store);
-
-  key_count = GUINT32_FROM_BE(header->key_count);
-  i = 0;
-  while (i < key_count)
-    {
-      gchar *name;
-      guint32 entry_ofs, chain_ofs;
-      SerializeArchive *sa;
 
-      sa = serialize_buffer_archive_new(key_block, key_size);
-      while (i < key_count)
-        {
-          if (!serialize_read_cstring(sa, &name, NULL))
-            {
-              serialize_archive_free(sa);
-              msg_error("Persistent file format error, unable to fetch key name",
-                        NULL);
-              goto free_and_exit;
-            }
-          if (name[0])
-            {
-              if (serialize_read_uint32(sa, &entry_ofs))
-                {
-                  PersistValueHeader *header;
-                  i++;
-
-                  if (entry_ofs < sizeof(PersistFileHeader) || entry_ofs > file_size)
-                    {
-                      serialize_archive_free(sa);
-                      g_free(name);
-                      msg_error("Persistent file format error, entry offset is out of bounds",
-                                NULL);
-                      goto free_and_exit;
-                    }
-
-                  header = (PersistValueHeader *) ((gchar *) map + entry_ofs - sizeof(PersistValueHeader));
-                  if (header->in_use)
-                    {
-                      gpointer new_block;
-                      PersistEntryHandle new_handle;
-
-                      new_handle = persist_state_alloc_value(self, GUINT32_FROM_BE(header->size), FALSE, header->version);
-                      new_block = persist_state_map_entry(self, new_handle);
-                      memcpy(new_block, header + 1, GUINT32_FROM_BE(header->size));
-                      persist_state_unmap_entry(self, new_handle);
-                      /* add key to the current file */
-                      persist_state_add_key(self, name, new_handle);
-                    }
-                  g_free(name);
-                }
-              else
-                {
-                  /* bad format */
-                  serialize_archive_free(sa);
-                  g_free(name);
-                  msg_error("Persistent file format error, unable to fetch key name",
-                            NULL);
-                  goto free_and_exit;
-                }
-            }
-          else
-            {
-              g_free(name);
-              if (serialize_read_uint32(sa, &chain_ofs))
-                {
-                  /* end of block, chain to the next one */
-                  if (chain_ofs == 0 || chain_ofs > file_size)
-                    {
-                      msg_error("Persistent file format error, key block chain offset is too large or zero",
-                                evt_tag_printf("key_block", "%08lx", (gulong) ((gchar *) key_block - (gchar *) map)),
-                                evt_tag_printf("key_size", "%d", key_size),
-                                evt_tag_int("ofs", chain_ofs),
-                                NULL);
-                      serialize_archive_free(sa);
-                      goto free_and_exit;
-                    }
-                  key_block = ((gchar *) map) + chain_ofs;
-                  key_size = GUINT32_FROM_BE(*(guint32 *) (((gchar *) key_block) - sizeof(PersistValueHeader)));
-                  if (chain_ofs + key_size > file_size)
-                    {
-                      msg_error("Persistent file format error, key block size is too large",
-                                evt_tag_int("key_size", key_size),
-                                NULL);
-                      serialize_archive_free(sa);
-                      goto free_and_exit;
-                    }
-                  break;
-                }
-              else
-                {
-                  serialize_archive_free(sa);
-                  msg_error("Persistent file format error, unable to fetch chained key block offset",
-                            NULL);
-                  goto free_and_exit;
-                }
-            }
-        }
-    }
- free_and_exit:
+  /* entries found before a format error are kept */
+  persist_state_walk_keys(map, file_size, persist_state_copy_entry, self, NULL);
   munmap(map, file_size);
   return TRUE;
 }
@@ -801,6 +980,8 @@ persist_state_alloc_string(PersistState *self, const gchar *persist_name, const
 gboolean
 persist_state_start(PersistState *self)
 {
+  if (persist_state_open_store(self))
+    return TRUE;
   if (!persist_state_create_store(self))
     return FALSE;
   if (!persist_state_load(self))
@@ -818,11 +999,58 @@ persist_state_start(PersistState *self)
 gboolean
 persist_state_commit(PersistState *self)
 {
+  if (self->journal)
+    {
+      GHashTableIter iter;
+      PersistEntry *entry;
+
+      /* entries not used by the current configuration are dropped by the next compaction */
+      g_hash_table_iter_init(&iter, self->keys);
+      while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &entry))
+        {
+          PersistValueHeader *header;
+
+          if (entry->used)
+            continue;
+          header = (PersistValueHeader *) persist_state_map_entry(self, entry->ofs - sizeof(PersistValueHeader));
+          header->in_use = FALSE;
+          persist_state_unmap_entry(self, entry->ofs);
+        }
+      return persist_state_flush(self);
+    }
+
+  if (!persist_state_flush(self))
+    return FALSE;
   if (!persist_state_commit_store(self))
     return FALSE;
   return TRUE;
 }
 
+/*
+ * Write the changes of the persistent state to disk, so that it
+ * survives a system crash.
+ *
+ * Threading NOTE: this can be called from any kind of threads.
+ */
+gboolean
+persist_state_flush(PersistState *self)
+{
+  gboolean success = TRUE;
+
+  /* keeping an entry mapped prevents persist_state_grow_store() from remapping the file */
+  persist_state_map_entry(self, 0);
+  if (self->current_map && msync(self->current_map, self->current_size, MS_SYNC) < 0)
+    {
+      msg_error("Error flushing persistent state file",
+                evt_tag_str("filename", self->commited_filename),
+                evt_tag_errno("error", errno),
+                NULL);
+      success = FALSE;
+    }
+  persist_state_unmap_entry(self, 0);
+  return success;
+}
+
 /*
  * This routine should revert to the persist_state_new() state,
  * e.g. just like the PersistState object wasn't started yet.
@@ -831,16 +1059,38 @@ void
 persist_state_cancel(PersistState *self)
 {
   gchar *commited_filename, *temp_filename;
+  GMutex *mapped_lock;
+  GCond *mapped_release_cond;
 
-  close(self->fd);
-  munmap(self->current_map, self->current_size);
-  unlink(self->temp_filename);
+  if (self->journal)
+    {
+      /* drop the records appended since persist_state_start() */
+      self->header->key_count = self->journal_key_count;
+      self->header->used_size = self->journal_used_size;
+      persist_state_unmap_store(self);
+      if (ftruncate(self->fd, self->journal_size) < 0)
+        msg_error("Error truncating persistent state file",
+                  evt_tag_str("filename", self->commited_filename),
+                  evt_tag_errno("error", errno),
+                  NULL);
+      close(self->fd);
+    }
+  else
+    {
+      close(self->fd);
+      persist_state_unmap_store(self);
+      unlink(self->temp_filename);
+    }
   g_hash_table_destroy(self->keys);
   commited_filename = self->commited_filename;
   temp_filename = self->temp_filename;
+  mapped_lock = self->mapped_lock;
+  mapped_release_cond = self->mapped_release_cond;
   memset(self, 0, sizeof(*self));
   self->commited_filename = commited_filename;
   self->temp_filename = temp_filename;
+  self->mapped_lock = mapped_lock;
+  self->mapped_release_cond = mapped_release_cond;
   self->fd = -1;
   self->keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
   self->current_ofs = sizeof(PersistFileHeader);
@@ -854,6 +1104,7 @@ persist_state_new(const gchar *filename)
 
   self->commited_filename = g_strdup(filename);
   self->temp_filename = g_strdup_printf("%s-", self->commited_filename);
+  self->fd = -1;
   self->keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
   self->current_ofs = sizeof(PersistFileHeader);
   self->mapped_lock = g_mutex_new();
@@ -870,6 +1121,9 @@ persist_state_free(PersistState *self)
   g_mutex_unlock(self->mapped_lock);
   g_mutex_free(self->mapped_lock);
   g_cond_free(self->mapped_release_cond);
+  persist_state_unmap_store(self);
+  if (self->fd >= 0)
+    close(self->fd);
   g_free(self->temp_filename);
   g_free(self->commited_filename);
   g_hash_table_destroy(self->keys);
@@ -43,6 +43,7 @@ void persist_state_free_entry(PersistEntryHandle handle);
 
 gboolean persist_state_start(PersistState *self);
 gboolean persist_state_commit(PersistState *self);
+gboolean persist_state_flush(PersistState *self);
 void persist_state_cancel(PersistState *self);
 
 PersistState *persist_state_new(const gchar *filename);
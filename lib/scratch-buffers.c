@@ -25,6 +25,7 @@
 #include "tls-support.h"
 #include "scratch-buffers.h"
 #include "misc.h"
+#include "memaccount.h"
 
 TLS_BLOCK_START
 {
@@ -44,6 +45,8 @@ scratch_buffer_acquire(void)
     {
       sb = g_new(ScratchBuffer, 1);
       g_string_steal(sb_string(sb));
+      sb->accounted_len = sb_string(sb)->allocated_len;
+      mem_account_alloc(MA_TEMPLATE, sizeof(ScratchBuffer) + sb->accounted_len);
     }
   else
     g_string_set_size(sb_string(sb), 0);
@@ -53,6 +56,12 @@ scratch_buffer_acquire(void)
 void
 scratch_buffer_release(ScratchBuffer *sb)
 {
+  /* the buffer may have grown while in use, or its string stolen */
+  if (sb_string(sb)->allocated_len != sb->accounted_len)
+    {
+      mem_account_add(MA_TEMPLATE, (gssize) sb_string(sb)->allocated_len - (gssize) sb->accounted_len, 0);
+      sb->accounted_len = sb_string(sb)->allocated_len;
+    }
   g_trash_stack_push(&local_scratch_buffers, sb);
 }
 
@@ -63,6 +72,7 @@ scratch_buffers_free(void)
 
   while ((sb = g_trash_stack_pop(&local_scratch_buffers)) != NULL)
     {
+      mem_account_free(MA_TEMPLATE, sizeof(ScratchBuffer) + sb->accounted_len);
       g_free(sb_string(sb)->str);
       g_free(sb);
     }
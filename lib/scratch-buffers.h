@@ -31,6 +31,8 @@ typedef struct
 {
   GTrashStack stackp;
   GString s;
+  /* the allocated_len of s as reported to memory accounting */
+  gsize accounted_len;
 } ScratchBuffer;
 
 ScratchBuffer *scratch_buffer_acquire(void);
@@ -26,6 +26,8 @@
 #include "messages.h"
 #include "misc.h"
 #include "syslog-names.h"
+#include "timeutils.h"
+#include "tls-support.h"
 
 #include <string.h>
 
@@ -70,6 +72,10 @@
  * running) or the stats lock must be acquired using stats_lock() and
  * stats_unlock(). This API is used to allow batching multiple stats
  * operations under the protection of the same lock acquiral.
+ *
+ * Dynamic counters updated for each message (per-host, per-sender,
+ * per-program counters) are not registered/unregistered for every
+ * message, see stats_aggregate_dynamic_counter() below.
  */
 
 struct _StatsCounter
@@ -81,6 +87,8 @@ struct _StatsCounter
   gchar *instance;
   guint16 live_mask;
   guint16 dynamic:1;
+  /* destination latency, allocated on first registration */
+  StatsHistogram *latency;
 };
 
 /* Static counters for severities and facilities */
@@ -93,6 +101,8 @@ static StatsCounterItem *severity_counters[SEVERITY_MAX];
 static StatsCounterItem *facility_counters[FACILITY_MAX];
 
 static GHashTable *counter_hash;
+/* incremented whenever a counter is added to or removed from counter_hash, see StatsSubscription */
+static guint32 counter_hash_generation;
 GStaticMutex stats_mutex;
 gint current_stats_level;
 gboolean stats_locked;
@@ -121,9 +131,20 @@ stats_counter_free(gpointer p)
   
   g_free(sc->id);
   g_free(sc->instance);
+  g_free(sc->latency);
   g_free(sc);
 }
 
+static void
+stats_counter_set_live(StatsCounter *sc, StatsCounterType type)
+{
+  if ((sc->live_mask & (1 << type)) == 0)
+    {
+      sc->live_mask |= 1 << type;
+      counter_hash_generation++;
+    }
+}
+
 static StatsCounter *
 stats_add_counter(gint stats_level, gint source, const gchar *id, const gchar *instance, gboolean *new)
 {
@@ -153,6 +174,7 @@ stats_add_counter(gint stats_level, gint source, const gchar *id, const gchar *i
       sc->instance = g_strdup(instance);
       sc->ref_cnt = 1;
       g_hash_table_insert(counter_hash, sc, sc);
+      counter_hash_generation++;
       *new = TRUE;
     }
   else
@@ -200,7 +222,7 @@ stats_register_counter(gint stats_level, gint source, const gchar *id, const gch
     return;
 
   *counter = &sc->counters[type];
-  sc->live_mask |= 1 << type;
+  stats_counter_set_live(sc, type);
 }
 
 StatsCounter *
@@ -225,7 +247,7 @@ stats_register_dynamic_counter(gint stats_level, gint source, const gchar *id, c
 
   sc->dynamic = TRUE;
   *counter = &sc->counters[type];
-  sc->live_mask |= 1 << type;
+  stats_counter_set_live(sc, type);
   return sc;
 }
 
@@ -274,30 +296,37 @@ stats_register_associated_counter(StatsCounter *sc, StatsCounterType type, Stats
   g_assert(sc->dynamic);
 
   *counter = &sc->counters[type];
-  sc->live_mask |= 1 << type;
+  stats_counter_set_live(sc, type);
 }
 
-void
-stats_unregister_counter(gint source, const gchar *id, const gchar *instance, StatsCounterType type, StatsCounterItem **counter)
+static StatsCounter *
+stats_lookup_counter(gint source, const gchar *id, const gchar *instance)
 {
-  StatsCounter *sc;
   StatsCounter key;
-  
-  g_assert(stats_locked);
-
-  if (*counter == NULL)
-    return;
 
   if (!id)
     id = "";
   if (!instance)
     instance = "";
-  
+
   key.source = source;
   key.id = (gchar *) id;
   key.instance = (gchar *) instance;
 
-  sc = g_hash_table_lookup(counter_hash, &key);
+  return g_hash_table_lookup(counter_hash, &key);
+}
+
+void
+stats_unregister_counter(gint source, const gchar *id, const gchar *instance, StatsCounterType type, StatsCounterItem **counter)
+{
+  StatsCounter *sc;
+
+  g_assert(stats_locked);
+
+  if (*counter == NULL)
+    return;
+
+  sc = stats_lookup_counter(source, id, instance);
 
   g_assert(sc && (sc->live_mask & (1 << type)) && &sc->counters[type] == (*counter));
   
@@ -315,6 +344,130 @@ stats_unregister_dynamic_counter(StatsCounter *sc, StatsCounterType type, StatsC
   sc->ref_cnt--;
 }
 
+/**
+ * stats_register_histogram:
+ *
+ * Registers the latency histogram of a destination, the arguments are
+ * the same as in stats_register_counter(). Like counters, the
+ * histogram is shared by all users registering the same name.
+ **/
+void
+stats_register_histogram(gint stats_level, gint source, const gchar *id, const gchar *instance, StatsHistogram **histogram)
+{
+  StatsCounter *sc;
+  gboolean new;
+
+  g_assert(stats_locked);
+
+  *histogram = NULL;
+  sc = stats_add_counter(stats_level, source, id, instance, &new);
+  if (!sc)
+    return;
+
+  if (!sc->latency)
+    {
+      sc->latency = g_new0(StatsHistogram, 1);
+      sc->latency->window = cached_g_current_time_sec() / STATS_HISTOGRAM_WINDOW;
+      counter_hash_generation++;
+    }
+  *histogram = sc->latency;
+}
+
+void
+stats_unregister_histogram(gint source, const gchar *id, const gchar *instance, StatsHistogram **histogram)
+{
+  StatsCounter *sc;
+
+  g_assert(stats_locked);
+
+  if (*histogram == NULL)
+    return;
+
+  sc = stats_lookup_counter(source, id, instance);
+  g_assert(sc && sc->latency == *histogram);
+
+  *histogram = NULL;
+  sc->ref_cnt--;
+}
+
+/* record the time elapsed since the specified timestamp (e.g. the receipt of a message) */
+void
+stats_histogram_record_latency(StatsHistogram *self, time_t since_sec, guint32 since_usec)
+{
+  GTimeVal now;
+  glong latency;
+
+  if (!self)
+    return;
+
+  g_get_current_time(&now);
+  latency = (now.tv_sec - since_sec) * 1000 + ((glong) now.tv_usec - (glong) since_usec) / 1000;
+  stats_histogram_record(self, MAX(latency, 0), now.tv_sec);
+}
+
+/*
+ * Starts a new window if the current one is over, called both by the
+ * recording threads and by the readers, so that the histogram of an
+ * idle destination is cleared too. Only the thread that manages to
+ * update self->window clears the buckets, a value recorded into a
+ * window while it is being cleared may get lost.
+ */
+void
+stats_histogram_rotate(StatsHistogram *self, time_t now)
+{
+  gint window = now / STATS_HISTOGRAM_WINDOW;
+  gint old_window, current, next;
+
+  old_window = g_atomic_int_get(&self->window);
+  if (window == old_window ||
+      !g_atomic_int_compare_and_exchange(&self->window, old_window, window))
+    return;
+
+  current = g_atomic_int_get(&self->current);
+  next = !current;
+  memset(&self->windows[next], 0, sizeof(self->windows[next]));
+  /* nothing was rotated for a whole window, the current one is stale as well */
+  if (window - old_window > 1)
+    memset(&self->windows[current], 0, sizeof(self->windows[current]));
+  g_atomic_int_set(&self->current, next);
+}
+
+/* returns the upper bound of the bucket containing the given percentile */
+guint32
+stats_histogram_percentile(StatsHistogram *self, gint percent)
+{
+  gint64 total = 0, target, sum = 0;
+  gint buckets[STATS_HISTOGRAM_BUCKETS];
+  gint i, sub_mask = (1 << STATS_HISTOGRAM_SUB_BUCKET_BITS) - 1;
+
+  for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+    {
+      buckets[i] = g_atomic_int_get(&self->windows[0].buckets[i]) + g_atomic_int_get(&self->windows[1].buckets[i]);
+      total += (guint32) buckets[i];
+    }
+  if (total == 0)
+    return 0;
+
+  target = (total * percent + 99) / 100;
+  for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+    {
+      sum += (guint32) buckets[i];
+      if (sum >= target)
+        break;
+    }
+
+  if (i <= sub_mask)
+    return i;
+  /* the last value of the bucket, see stats_histogram_bucket() */
+  return ((((guint64) (sub_mask + 1) + (i & sub_mask) + 1) << ((i >> STATS_HISTOGRAM_SUB_BUCKET_BITS) - 1)) - 1);
+}
+
+guint32
+stats_histogram_max(StatsHistogram *self)
+{
+  return MAX(g_atomic_int_get(&self->windows[0].max), g_atomic_int_get(&self->windows[1].max));
+}
+
 static gboolean
 stats_counter_is_orphaned(gpointer key, gpointer value, gpointer user_data)
 {
@@ -328,7 +481,154 @@ stats_counter_is_orphaned(gpointer key, gpointer value, gpointer user_data)
 void
 stats_cleanup_orphans(void)
 {
-  g_hash_table_foreach_remove(counter_hash, stats_counter_is_orphaned, NULL);
+  if (g_hash_table_foreach_remove(counter_hash, stats_counter_is_orphaned, NULL) > 0)
+    counter_hash_generation++;
+}
+
+/*
+ * Per-thread aggregation of dynamic counters
+ *
+ * Dynamic counters are never freed once created (see
+ * stats_counter_is_orphaned), so a thread may keep pointers to them
+ * without holding the stats lock. Each thread caches the dynamic counters
+ * it has seen and accumulates the changes locally, these are added to the
+ * shared counters in batches: at the end of each I/O job, after
+ * STATS_DYNAMIC_FLUSH_BATCH updates or once a second, whichever comes
+ * first. The stats lock is only taken the first time a thread sees a
+ * given counter.
+ */
+
+#define STATS_DYNAMIC_FLUSH_BATCH 1024
+
+typedef struct _StatsDynamicCacheEntry
+{
+  StatsCounter *sc;
+  gint processed;
+  time_t stamp;
+} StatsDynamicCacheEntry;
+
+TLS_BLOCK_START
+{
+  /* StatsCounter -> StatsDynamicCacheEntry */
+  GHashTable *dynamic_cache;
+  /* entries with changes not yet added to the shared counters */
+  GPtrArray *dynamic_dirty;
+  gint dynamic_pending;
+  time_t dynamic_flushed;
+}
+TLS_BLOCK_END;
+
+#define dynamic_cache     __tls_deref(dynamic_cache)
+#define dynamic_dirty     __tls_deref(dynamic_dirty)
+#define dynamic_pending   __tls_deref(dynamic_pending)
+#define dynamic_flushed   __tls_deref(dynamic_flushed)
+
+/**
+ * stats_flush_thread_cache:
+ *
+ * Adds the dynamic counter changes accumulated by the current thread to
+ * the shared counters.
+ **/
+void
+stats_flush_thread_cache(void)
+{
+  gint i;
+
+  if (dynamic_pending == 0)
+    return;
+
+  for (i = 0; i < dynamic_dirty->len; i++)
+    {
+      StatsDynamicCacheEntry *entry = (StatsDynamicCacheEntry *) g_ptr_array_index(dynamic_dirty, i);
+
+      stats_counter_add(&entry->sc->counters[SC_TYPE_PROCESSED], entry->processed);
+      if (entry->stamp >= 0)
+        stats_counter_set(&entry->sc->counters[SC_TYPE_STAMP], entry->stamp);
+      entry->processed = 0;
+      entry->stamp = -1;
+    }
+  g_ptr_array_set_size(dynamic_dirty, 0);
+  dynamic_pending = 0;
+  dynamic_flushed = cached_g_current_time_sec();
+}
+
+void
+stats_destroy_thread_cache(void)
+{
+  if (!dynamic_cache)
+    return;
+
+  stats_flush_thread_cache();
+  g_hash_table_destroy(dynamic_cache);
+  g_ptr_array_free(dynamic_dirty, TRUE);
+  dynamic_cache = NULL;
+  dynamic_dirty = NULL;
+}
+
+/**
+ * stats_aggregate_dynamic_counter:
+ * @timestamp: if non-negative, an associated timestamp will be created and set
+ *
+ * Increments a dynamic counter, creating it if it doesn't exist yet. The
+ * change becomes visible when the thread cache is flushed. Unlike the rest
+ * of the registration API, the caller must not hold the stats lock.
+ **/
+void
+stats_aggregate_dynamic_counter(gint stats_level, gint source, const gchar *id, const gchar *instance, time_t timestamp)
+{
+  StatsDynamicCacheEntry *entry;
+  StatsCounter key;
+
+  if (!stats_check_level(stats_level))
+    return;
+
+  if (G_UNLIKELY(!dynamic_cache))
+    {
+      dynamic_cache = g_hash_table_new_full(stats_counter_hash, stats_counter_equal, NULL, g_free);
+      dynamic_dirty = g_ptr_array_new();
+      dynamic_flushed = cached_g_current_time_sec();
+    }
+
+  key.source = source;
+  key.id = (gchar *) (id ? id : "");
+  key.instance = (gchar *) (instance ? instance : "");
+
+  entry = g_hash_table_lookup(dynamic_cache, &key);
+  if (!entry)
+    {
+      StatsCounterItem *counter, *stamp;
+      StatsCounter *sc;
+      gboolean new;
+
+      stats_lock();
+      sc = stats_register_dynamic_counter(stats_level, source, id, instance, SC_TYPE_PROCESSED, &counter, &new);
+      if (sc && timestamp >= 0)
+        {
+          stats_register_associated_counter(sc, SC_TYPE_STAMP, &stamp);
+          stats_unregister_dynamic_counter(sc, SC_TYPE_STAMP, &stamp);
+        }
+      /* the counter stays around as it is dynamic */
+      stats_unregister_dynamic_counter(sc, SC_TYPE_PROCESSED, &counter);
+      stats_unlock();
+
+      if (!sc)
+        return;
+
+      entry = g_new0(StatsDynamicCacheEntry, 1);
+      entry->sc = sc;
+      entry->stamp = -1;
+      g_hash_table_insert(dynamic_cache, sc, entry);
+    }
+
+  if (entry->processed == 0 && entry->stamp < 0)
+    g_ptr_array_add(dynamic_dirty, entry);
+  entry->processed++;
+  if (timestamp >= 0)
+    entry->stamp = timestamp;
+
+  dynamic_pending++;
+  if (dynamic_pending >= STATS_DYNAMIC_FLUSH_BATCH || dynamic_flushed != cached_g_current_time_sec())
+    stats_flush_thread_cache();
 }
 
 void
@@ -352,8 +652,34 @@ const gchar *tag_names[SC_TYPE_MAX] =
   /* [SC_TYPE_STORED]   = */  "stored",
   /* [SC_TYPE_SUPPRESSED] = */ "suppressed",
   /* [SC_TYPE_STAMP] = */ "stamp",
+  /* [SC_TYPE_SUSPENDED] = */ "suspended",
+  /* [SC_TYPE_MEMORY] = */ "memory",
+  /* [SC_TYPE_OBJECTS] = */ "objects",
+};
+
+/* the values reported for latency histograms, in milliseconds */
+static const struct
+{
+  const gchar *name;
+  /* 0 stands for the maximum */
+  gint percent;
+} latency_types[] =
+{
+  { "latency_p50", 50 },
+  { "latency_p95", 95 },
+  { "latency_p99", 99 },
+  { "latency_max", 0 },
 };
 
+static guint32
+stats_histogram_get(StatsHistogram *histogram, gint percent)
+{
+  stats_histogram_rotate(histogram, cached_g_current_time_sec());
+  if (percent == 0)
+    return stats_histogram_max(histogram);
+  return stats_histogram_percentile(histogram, percent);
+}
+
 const gchar *source_names[SCS_MAX] =
 {
   "none",
@@ -430,6 +756,7 @@ stats_generate_log(void)
 {
   EVTREC *e;
   
+  stats_flush_thread_cache();
   e = msg_event_create(EVT_PRI_INFO, "Log statistics", NULL);
   g_hash_table_foreach(counter_hash, stats_format_log_counter, e);
   msg_event_send(e);
@@ -486,6 +813,23 @@ stats_format_csv_escapevar(const gchar *var)
   return escaped_result;
 }
 
+static const gchar *
+stats_format_source_name(StatsCounter *sc, gchar *buf, gsize buf_len)
+{
+  if ((sc->source & SCS_SOURCE_MASK) == SCS_GROUP)
+    {
+      if (sc->source & SCS_SOURCE)
+        return "source";
+      else if (sc->source & SCS_DESTINATION)
+        return "destination";
+      g_assert_not_reached();
+    }
+  g_snprintf(buf, buf_len, "%s%s",
+             (sc->source & SCS_SOURCE ? "src." : (sc->source & SCS_DESTINATION ? "dst." : "")),
+             source_names[sc->source & SCS_SOURCE_MASK]);
+  return buf;
+}
+
 static void
 stats_format_csv(gpointer key, gpointer value, gpointer user_data)
 {
@@ -511,27 +855,22 @@ stats_format_csv(gpointer key, gpointer value, gpointer user_data)
             state = 'o';
           else
             state = 'a';
-          if ((sc->source & SCS_SOURCE_MASK) == SCS_GROUP)
-            {
-              if (sc->source & SCS_SOURCE)
-                source_name = "source";
-              else if (sc->source & SCS_DESTINATION)
-                source_name = "destination";
-              else
-                g_assert_not_reached();
-            }
-          else
-            {
-              source_name = buf;
-              g_snprintf(buf, sizeof(buf), "%s%s", 
-                         (sc->source & SCS_SOURCE ? "src." : (sc->source & SCS_DESTINATION ? "dst." : "")),
-                         source_names[sc->source & SCS_SOURCE_MASK]);
-            }
+          source_name = stats_format_source_name(sc, buf, sizeof(buf));
           tag_name = stats_format_csv_escapevar(tag_names[type]);
           g_string_append_printf(csv, "%s;%s;%s;%c;%s;%u\n", source_name, s_id, s_instance, state, tag_name, stats_counter_get(&sc->counters[type]));
           g_free(tag_name);
         }
     }
+  if (sc->latency)
+    {
+      const gchar *source_name = stats_format_source_name(sc, buf, sizeof(buf));
+      gchar state = sc->ref_cnt == 0 ? 'o' : 'a';
+      gint i;
+
+      for (i = 0; i < G_N_ELEMENTS(latency_types); i++)
+        g_string_append_printf(csv, "%s;%s;%s;%c;%s;%u\n", source_name, s_id, s_instance, state, latency_types[i].name,
+                               stats_histogram_get(sc->latency, latency_types[i].percent));
+    }
     g_free(s_id);
     g_free(s_instance);
 }
@@ -542,11 +881,205 @@ stats_generate_csv(void)
 {
   GString *csv = g_string_sized_new(1024);
 
+  stats_flush_thread_cache();
   g_string_append_printf(csv, "%s;%s;%s;%s;%s;%s\n", "SourceName", "SourceId", "SourceInstance", "State", "Type", "Number");
   g_hash_table_foreach(counter_hash, stats_format_csv, csv);
   return g_string_free(csv, FALSE);
 }
 
+/*
+ * Stats subscriptions
+ *
+ * A subscription reports the counters that changed since the previous
+ * query, in the format "SourceName;SourceId;SourceInstance;Type;Number;Delta".
+ * Counters are reported with their full value as delta the first time.
+ * The latency percentiles of destinations are reported the same way,
+ * whenever they change.
+ *
+ * The counters matching the filter are collected into a flat array
+ * with their formatted and escaped names, which is only rebuilt when
+ * counters are registered or removed (as tracked by
+ * counter_hash_generation). A query therefore costs one comparison per
+ * matching counter plus formatting the ones that changed.
+ *
+ * Subscriptions can only be used from the main thread, as orphaned
+ * counters are freed there.
+ */
+
+typedef struct _StatsSubscriptionItem
+{
+  /* either a counter or a percentile of a latency histogram */
+  StatsCounterItem *counter;
+  StatsHistogram *histogram;
+  gint percent;
+  gchar *name;
+  guint32 last;
+  gboolean reported;
+} StatsSubscriptionItem;
+
+struct _StatsSubscription
+{
+  GPatternSpec *filter;
+  guint32 generation;
+  GArray *items;
+};
+
+static void
+stats_subscription_free_items(GArray *items)
+{
+  gint i;
+
+  for (i = 0; i < items->len; i++)
+    g_free(g_array_index(items, StatsSubscriptionItem, i).name);
+  g_array_free(items, TRUE);
+}
+
+static void
+stats_subscription_collect_counter(gpointer key, gpointer value, gpointer user_data)
+{
+  StatsSubscription *self = (StatsSubscription *) user_data;
+  StatsCounter *sc = (StatsCounter *) value;
+  StatsCounterType type;
+  gchar *s_id, *s_instance;
+  gchar buf[32];
+
+  if (self->filter && !g_pattern_match_string(self->filter, sc->id))
+    return;
+
+  s_id = stats_format_csv_escapevar(sc->id);
+  s_instance = stats_format_csv_escapevar(sc->instance);
+  for (type = 0; type < SC_TYPE_MAX; type++)
+    {
+      StatsSubscriptionItem item;
+
+      if (!(sc->live_mask & (1 << type)))
+        continue;
+
+      item.counter = &sc->counters[type];
+      item.histogram = NULL;
+      item.percent = 0;
+      item.name = g_strdup_printf("%s;%s;%s;%s", stats_format_source_name(sc, buf, sizeof(buf)), s_id, s_instance, tag_names[type]);
+      item.last = 0;
+      item.reported = FALSE;
+      g_array_append_val(self->items, item);
+    }
+  if (sc->latency)
+    {
+      gint i;
+
+      for (i = 0; i < G_N_ELEMENTS(latency_types); i++)
+        {
+          StatsSubscriptionItem item;
+
+          item.counter = NULL;
+          item.histogram = sc->latency;
+          item.percent = latency_types[i].percent;
+          item.name = g_strdup_printf("%s;%s;%s;%s", stats_format_source_name(sc, buf, sizeof(buf)), s_id, s_instance, latency_types[i].name);
+          item.last = 0;
+          item.reported = FALSE;
+          g_array_append_val(self->items, item);
+        }
+    }
+  g_free(s_id);
+  g_free(s_instance);
+}
+
+static void
+stats_subscription_rebuild(StatsSubscription *self)
+{
+  GArray *old_items = self->items;
+  GHashTable *reported;
+  gint i;
+
+  self->items = g_array_new(FALSE, FALSE, sizeof(StatsSubscriptionItem));
+  g_hash_table_foreach(counter_hash, stats_subscription_collect_counter, self);
+
+  /* keep reporting deltas for the counters already seen */
+  reported = g_hash_table_new(g_str_hash, g_str_equal);
+  for (i = 0; i < old_items->len; i++)
+    {
+      StatsSubscriptionItem *item = &g_array_index(old_items, StatsSubscriptionItem, i);
+
+      if (item->reported)
+        g_hash_table_insert(reported, item->name, item);
+    }
+  for (i = 0; i < self->items->len; i++)
+    {
+      StatsSubscriptionItem *item = &g_array_index(self->items, StatsSubscriptionItem, i);
+      StatsSubscriptionItem *old_item = g_hash_table_lookup(reported, item->name);
+
+      if (old_item)
+        {
+          item->last = old_item->last;
+          item->reported = TRUE;
+        }
+    }
+  g_hash_table_destroy(reported);
+  stats_subscription_free_items(old_items);
+  self->generation = counter_hash_generation;
+}
+
+/**
+ * stats_subscription_query:
+ * @self: subscription
+ * @result: the changed counters are appended here, one per line
+ *
+ * Returns the number of counters appended to @result.
+ **/
+gint
+stats_subscription_query(StatsSubscription *self, GString *result)
+{
+  gint i, changed = 0;
+
+  stats_flush_thread_cache();
+  stats_lock();
+  if (self->generation != counter_hash_generation)
+    stats_subscription_rebuild(self);
+
+  for (i = 0; i < self->items->len; i++)
+    {
+      StatsSubscriptionItem *item = &g_array_index(self->items, StatsSubscriptionItem, i);
+      guint32 value;
+
+      if (item->counter)
+        value = stats_counter_get(item->counter);
+      else
+        value = stats_histogram_get(item->histogram, item->percent);
+
+      if (item->reported && value == item->last)
+        continue;
+
+      g_string_append_printf(result, "%s;%u;%d\n", item->name, value, (gint) (value - item->last));
+      item->last = value;
+      item->reported = TRUE;
+      changed++;
+    }
+  stats_unlock();
+  return changed;
+}
+
+StatsSubscription *
+stats_subscription_new(const gchar *filter)
+{
+  StatsSubscription *self = g_new0(StatsSubscription, 1);
+
+  if (filter && filter[0])
+    self->filter = g_pattern_spec_new(filter);
+  self->items = g_array_new(FALSE, FALSE, sizeof(StatsSubscriptionItem));
+  /* force collecting the counters at the first query */
+  self->generation = counter_hash_generation - 1;
+  return self;
+}
+
+void
+stats_subscription_free(StatsSubscription *self)
+{
+  stats_subscription_free_items(self->items);
+  if (self->filter)
+    g_pattern_spec_free(self->filter);
+  g_free(self);
+}
+
 void
 stats_reinit(GlobalConfig *cfg)
 {
@@ -601,6 +1134,7 @@ stats_init(void)
 void
 stats_destroy(void)
 {
+  stats_destroy_thread_cache();
   g_hash_table_destroy(counter_hash);
   counter_hash = NULL;
   g_static_mutex_free(&stats_mutex);
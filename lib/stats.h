@@ -37,6 +37,9 @@ typedef enum
   SC_TYPE_STORED,    /* number of messages on disk */
   SC_TYPE_SUPPRESSED,/* number of messages suppressed */
   SC_TYPE_STAMP,     /* timestamp */
+  SC_TYPE_SUSPENDED, /* time spent suspended by flow-control, in milliseconds */
+  SC_TYPE_MEMORY,    /* live memory, in kilobytes */
+  SC_TYPE_OBJECTS,   /* number of live objects */
   SC_TYPE_MAX
 } StatsCounterType;
 
@@ -75,17 +78,51 @@ enum
 };
 
 typedef struct _StatsCounter StatsCounter;
+typedef struct _StatsSubscription StatsSubscription;
 typedef struct _StatsCounterItem
 {
   gint value;
 } StatsCounterItem;
 
+/*
+ * Latency histogram, values are in milliseconds. Buckets are
+ * logarithmic, each power of two is split into
+ * 1 << STATS_HISTOGRAM_SUB_BUCKET_BITS linear buckets, so the relative
+ * error of a reported percentile is at most 25%.
+ *
+ * Values are recorded into the current window, which is rotated every
+ * STATS_HISTOGRAM_WINDOW seconds, dropping the one before. Percentiles
+ * are computed over the current and the previous window, so they
+ * reflect the last one to two windows instead of all time.
+ */
+#define STATS_HISTOGRAM_SUB_BUCKET_BITS 2
+#define STATS_HISTOGRAM_BUCKETS ((32 - STATS_HISTOGRAM_SUB_BUCKET_BITS + 1) << STATS_HISTOGRAM_SUB_BUCKET_BITS)
+#define STATS_HISTOGRAM_WINDOW 60
+
+typedef struct _StatsHistogramWindow
+{
+  gint buckets[STATS_HISTOGRAM_BUCKETS];
+  gint max;
+} StatsHistogramWindow;
+
+typedef struct _StatsHistogram
+{
+  StatsHistogramWindow windows[2];
+  /* index of the current window */
+  gint current;
+  /* the start of the current window, in STATS_HISTOGRAM_WINDOW units */
+  gint window;
+} StatsHistogram;
+
 extern gint current_stats_level;
 extern GStaticMutex stats_mutex;
 extern gboolean stats_locked;
 
 void stats_generate_log(void);
 gchar *stats_generate_csv(void);
+StatsSubscription *stats_subscription_new(const gchar *filter);
+gint stats_subscription_query(StatsSubscription *self, GString *result);
+void stats_subscription_free(StatsSubscription *self);
 void stats_register_counter(gint level, gint source, const gchar *id, const gchar *instance, StatsCounterType type, StatsCounterItem **counter);
 StatsCounter *
 stats_register_dynamic_counter(gint stats_level, gint source, const gchar *id, const gchar *instance, StatsCounterType type, StatsCounterItem **counter, gboolean *new);
@@ -93,8 +130,14 @@ void stats_instant_inc_dynamic_counter(gint stats_level, gint source_mask, const
 void stats_register_associated_counter(StatsCounter *handle, StatsCounterType type, StatsCounterItem **counter);
 void stats_unregister_counter(gint source, const gchar *id, const gchar *instance, StatsCounterType type, StatsCounterItem **counter);
 void stats_unregister_dynamic_counter(StatsCounter *handle, StatsCounterType type, StatsCounterItem **counter);
+void stats_register_histogram(gint level, gint source, const gchar *id, const gchar *instance, StatsHistogram **histogram);
+void stats_unregister_histogram(gint source, const gchar *id, const gchar *instance, StatsHistogram **histogram);
 void stats_cleanup_orphans(void);
 
+void stats_aggregate_dynamic_counter(gint stats_level, gint source, const gchar *id, const gchar *instance, time_t timestamp);
+void stats_flush_thread_cache(void);
+void stats_destroy_thread_cache(void);
+
 void stats_counter_inc_pri(guint16 pri);
 
 void stats_reinit(GlobalConfig *cfg);
@@ -160,5 +203,46 @@ stats_counter_get(StatsCounterItem *counter)
     result = counter->value;
   return result;
 }
+
+void stats_histogram_rotate(StatsHistogram *self, time_t now);
+guint32 stats_histogram_percentile(StatsHistogram *self, gint percent);
+guint32 stats_histogram_max(StatsHistogram *self);
+void stats_histogram_record_latency(StatsHistogram *self, time_t since_sec, guint32 since_usec);
+
+static inline gint
+stats_histogram_bucket(guint32 value)
+{
+  gint msb, shift;
+
+  if (value < (1 << STATS_HISTOGRAM_SUB_BUCKET_BITS))
+    return value;
+
+  msb = g_bit_storage(value) - 1;
+  shift = msb - STATS_HISTOGRAM_SUB_BUCKET_BITS;
+  return ((shift + 1) << STATS_HISTOGRAM_SUB_BUCKET_BITS) + ((value >> shift) & ((1 << STATS_HISTOGRAM_SUB_BUCKET_BITS) - 1));
+}
+
+static inline void
+stats_histogram_record(StatsHistogram *self, guint32 value, time_t now)
+{
+  StatsHistogramWindow *window;
+  gint max;
+
+  if (!self)
+    return;
+
+  if (G_UNLIKELY(now / STATS_HISTOGRAM_WINDOW != g_atomic_int_get(&self->window)))
+    stats_histogram_rotate(self, now);
+
+  window = &self->windows[g_atomic_int_get(&self->current)];
+  if (value > G_MAXINT)
+    value = G_MAXINT;
+  g_atomic_int_inc(&window->buckets[stats_histogram_bucket(value)]);
+  do
+    {
+      max = g_atomic_int_get(&window->max);
+    }
+  while ((gint) value > max && !g_atomic_int_compare_and_exchange(&window->max, max, value));
+}
 #endif
 
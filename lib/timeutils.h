@@ -40,8 +40,6 @@ void invalidate_cached_time(void);
 void cached_g_current_time(GTimeVal *result);
 time_t cached_g_current_time_sec(void);
 
-gboolean check_nanosleep(void);
-
 int format_zone_info(gchar *buf, size_t buflen, long gmtoff);
 long get_local_timezone_ofs(time_t when);
 glong g_time_val_diff(GTimeVal *t1, GTimeVal *t2);
@@ -33,6 +33,9 @@
 #include <openssl/err.h>
 #include <openssl/rand.h>
 
+/* protects TLSContext->resume_session, the handshake runs in worker threads */
+static GStaticMutex tls_resume_session_lock = G_STATIC_MUTEX_INIT;
+
 gboolean
 tls_get_x509_digest(X509 *x, GString *hash_string)
 {
@@ -255,6 +258,43 @@ tls_session_free(TLSSession *self)
   g_free(self);
 }
 
+/*
+ * Called by libssl when a new session has been negotiated in client mode.
+ * The session is stored in the TLSContext so that the next connection
+ * (e.g. a reconnect after an error) can resume it instead of performing a
+ * full handshake.
+ */
+static int
+tls_context_new_session_callback(SSL *ssl, SSL_SESSION *ssl_session)
+{
+  TLSSession *session = SSL_get_app_data(ssl);
+  TLSContext *self = session->ctx;
+  SSL_SESSION *old_session;
+
+  g_static_mutex_lock(&tls_resume_session_lock);
+  old_session = self->resume_session;
+  self->resume_session = ssl_session;
+  g_static_mutex_unlock(&tls_resume_session_lock);
+
+  if (old_session)
+    SSL_SESSION_free(old_session);
+
+  /* we keep the reference libssl passed to us */
+  return 1;
+}
+
+static void
+tls_context_setup_resumption(TLSContext *self, SSL *ssl)
+{
+  g_static_mutex_lock(&tls_resume_session_lock);
+  if (self->resume_session)
+    {
+      SSL_set_session(ssl, self->resume_session);
+      msg_debug("Attempting to resume TLS session", NULL);
+    }
+  g_static_mutex_unlock(&tls_resume_session_lock);
+}
+
 static gboolean
 file_exists(const gchar *fname)
 {
@@ -337,12 +377,30 @@ tls_context_setup_session(TLSContext *self)
           if (!SSL_CTX_set_cipher_list(self->ssl_ctx, self->cipher_suite))
             goto error;
         }
+
+      /* session resumption: servers keep a session cache and issue
+       * session tickets (enabled by default in libssl), clients remember
+       * the last session via tls_context_new_session_callback() */
+      if (self->mode == TM_CLIENT)
+        {
+          SSL_CTX_set_session_cache_mode(self->ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+          SSL_CTX_sess_set_new_cb(self->ssl_ctx, tls_context_new_session_callback);
+        }
+      else
+        {
+          SSL_CTX_set_session_cache_mode(self->ssl_ctx, SSL_SESS_CACHE_SERVER);
+          if (!SSL_CTX_set_session_id_context(self->ssl_ctx, (const guchar *) "syslog-ng", 9))
+            goto error;
+        }
     }
 
   ssl = SSL_new(self->ssl_ctx);
 
   if (self->mode == TM_CLIENT)
-    SSL_set_connect_state(ssl);
+    {
+      SSL_set_connect_state(ssl);
+      tls_context_setup_resumption(self, ssl);
+    }
   else
     SSL_set_accept_state(ssl);
 
@@ -377,6 +435,8 @@ tls_context_new(TLSMode mode)
 void
 tls_context_free(TLSContext *self)
 {
+  if (self->resume_session)
+    SSL_SESSION_free(self->resume_session);
   SSL_CTX_free(self->ssl_ctx);
   g_list_foreach(self->trusted_fingerpint_list, (GFunc) g_free, NULL);
   g_list_foreach(self->trusted_dn_list, (GFunc) g_free, NULL);
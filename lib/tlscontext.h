@@ -73,6 +73,9 @@ struct _TLSContext
   SSL_CTX *ssl_ctx;
   GList *trusted_fingerpint_list;
   GList *trusted_dn_list;
+  /* the last session negotiated in client mode, offered for resumption
+   * when a new connection is established */
+  SSL_SESSION *resume_session;
 };
 
 
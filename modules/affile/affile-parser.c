@@ -37,7 +37,11 @@ static CfgLexerKeyword affile_keywords[] = {
   { "fsync",              KW_FSYNC },
   { "remove_if_older",    KW_OVERWRITE_IF_OLDER, 0, KWS_OBSOLETE, "overwrite_if_older" },
   { "overwrite_if_older", KW_OVERWRITE_IF_OLDER },
+  { "rotate_size",        KW_ROTATE_SIZE },
+  { "rotate_interval",    KW_ROTATE_INTERVAL },
+  { "rotate_compress",    KW_ROTATE_COMPRESS },
   { "follow_freq",        KW_FOLLOW_FREQ,  },
+  { "max_files",          KW_MAX_FILES },
 
   { NULL }
 };
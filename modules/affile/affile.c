@@ -28,6 +28,8 @@
 #include "gprocess.h"
 #include "stats.h"
 #include "mainloop.h"
+#include "tls-support.h"
+#include "apphook.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -38,6 +40,10 @@
 #include <time.h>
 #include <stdlib.h>
 
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 static gboolean
 affile_open_file(gchar *name, gint flags,
                  gint uid, gint gid, gint mode,
@@ -128,26 +134,26 @@ affile_sd_open_file(AFFileSourceDriver *self, gchar *name, gint *fd)
 }
 
 static inline gchar *
-affile_sd_format_persist_name(AFFileSourceDriver *self)
+affile_sd_format_persist_name(const gchar *filename)
 {
   static gchar persist_name[1024];
   
-  g_snprintf(persist_name, sizeof(persist_name), "affile_sd_curpos(%s)", self->filename->str);
+  g_snprintf(persist_name, sizeof(persist_name), "affile_sd_curpos(%s)", filename);
   return persist_name;
 }
  
 static void
-affile_sd_recover_state(LogPipe *s, GlobalConfig *cfg, LogProto *proto)
+affile_sd_recover_state(LogPipe *s, GlobalConfig *cfg, LogProto *proto, const gchar *filename)
 {
   AFFileSourceDriver *self = (AFFileSourceDriver *) s;
 
   if ((self->flags & AFFILE_PIPE) || self->reader_options.follow_freq <= 0)
     return;
 
-  if (!log_proto_restart_with_state(proto, cfg->state, affile_sd_format_persist_name(self)))
+  if (!log_proto_restart_with_state(proto, cfg->state, affile_sd_format_persist_name(filename)))
     {
       msg_error("Error converting persistent state from on-disk format, losing file position information",
-                evt_tag_str("filename", self->filename->str),
+                evt_tag_str("filename", filename),
                 NULL);
       return;
     }
@@ -221,7 +227,7 @@ affile_sd_notify(LogPipe *s, LogPipe *sender, gint notify_code, gpointer user_da
                 self->reader = NULL;
                 close(fd);
               }
-            affile_sd_recover_state(s, cfg, proto);
+            affile_sd_recover_state(s, cfg, proto, self->filename->str);
           }
         else
           {
@@ -234,6 +240,486 @@ affile_sd_notify(LogPipe *s, LogPipe *sender, gint notify_code, gpointer user_da
     }
 }
 
+/*
+ * Wildcard file sources
+ * =====================
+ *
+ * If the basename of the file source contains wildcard characters, all
+ * matching files in the (literal) directory part are followed.  Every
+ * file is represented by an AFFileSourceFile instance, which acts as the
+ * control pipe of its LogReader and sets FILE_NAME before passing the
+ * messages on to the driver.
+ *
+ * To scale to thousands of files without keeping a file descriptor open
+ * for each, at most max_files readers are open at the same time. Changes
+ * in the directory are reported by a FileMonitor (or found by rescanning
+ * the directory every follow_freq if change notifications are not
+ * available), which puts the changed file on the pending queue. Pending
+ * files get a reader as soon as a slot is free; readers that have reached
+ * EOF are closed in favour of pending files, so files with unread data are
+ * always preferred over idle ones. The read position of each file is kept
+ * in the persistent state, so reopening a file continues where it was left.
+ *
+ * Everything here runs in the main thread.
+ */
+typedef struct _AFFileSourceFile
+{
+  LogPipe super;
+  AFFileSourceDriver *owner;
+  gchar *filename;
+  gchar *basename;
+  LogPipe *reader;
+  /* size/inode as seen the last time the directory was scanned */
+  off_t size;
+  ino_t inode;
+  gboolean pending, eof, deleted;
+} AFFileSourceFile;
+
+static inline gboolean
+affile_sd_is_wildcard(AFFileSourceDriver *self)
+{
+  return self->wildcard_pattern != NULL;
+}
+
+static void
+affile_sd_wildcard_schedule(AFFileSourceDriver *self)
+{
+  if (!iv_task_registered(&self->wildcard_schedule))
+    iv_task_register(&self->wildcard_schedule);
+}
+
+static gboolean
+affile_sf_open(AFFileSourceFile *self)
+{
+  AFFileSourceDriver *owner = self->owner;
+  GlobalConfig *cfg = log_pipe_get_config(&owner->super.super.super);
+  LogTransport *transport;
+  LogProto *proto;
+  gint fd;
+
+  if (!affile_sd_open_file(owner, self->filename, &fd))
+    {
+      if (errno == ENOENT)
+        msg_verbose("Wildcard file source file removed before it could be opened",
+                    evt_tag_str("filename", self->filename),
+                    NULL);
+      else
+        msg_error("Error opening file for reading",
+                  evt_tag_str("filename", self->filename),
+                  evt_tag_errno(EVT_TAG_OSERROR, errno),
+                  NULL);
+      return FALSE;
+    }
+
+  transport = log_transport_plain_new(fd, 0);
+  transport->timeout = 10;
+
+  proto = affile_sd_construct_proto(owner, transport);
+  self->reader = log_reader_new(proto);
+
+  /* all files share the counters of the driver, we don't want thousands of
+   * stats entries */
+  log_reader_set_options(self->reader, &self->super, &owner->reader_options, 1, SCS_FILE, owner->super.super.id, owner->filename->str);
+  log_reader_set_follow_filename(self->reader, self->filename);
+  log_reader_set_immediate_check(self->reader);
+
+  log_pipe_append(self->reader, &self->super);
+  if (!log_pipe_init(self->reader, cfg))
+    {
+      msg_error("Error initializing log_reader, closing fd",
+                evt_tag_int("fd", fd),
+                NULL);
+      log_pipe_unref(self->reader);
+      self->reader = NULL;
+      close(fd);
+      return FALSE;
+    }
+  affile_sd_recover_state(&owner->super.super.super, cfg, proto, self->filename);
+
+  self->eof = FALSE;
+  g_queue_push_tail(owner->wildcard_open, self);
+  msg_trace("Wildcard file source file opened",
+            evt_tag_str("filename", self->filename),
+            evt_tag_int("open_files", g_queue_get_length(owner->wildcard_open)),
+            NULL);
+  return TRUE;
+}
+
+static void
+affile_sf_close(AFFileSourceFile *self)
+{
+  if (!self->reader)
+    return;
+
+  log_pipe_deinit(self->reader);
+  log_pipe_unref(self->reader);
+  self->reader = NULL;
+  g_queue_remove(self->owner->wildcard_open, self);
+}
+
+static void
+affile_sf_mark_pending(AFFileSourceFile *self)
+{
+  if (self->pending || self->reader)
+    return;
+
+  self->pending = TRUE;
+  g_queue_push_tail(self->owner->wildcard_pending, self);
+  affile_sd_wildcard_schedule(self->owner);
+}
+
+static void
+affile_sf_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  AFFileSourceFile *self = (AFFileSourceFile *) s;
+  static NVHandle filename_handle = 0;
+
+  if (!filename_handle)
+    filename_handle = log_msg_get_value_handle("FILE_NAME");
+
+  log_msg_set_value(msg, filename_handle, self->filename, -1);
+  log_pipe_forward_msg(s, msg, path_options);
+}
+
+/* NOTE: runs in the main thread */
+static void
+affile_sf_notify(LogPipe *s, LogPipe *sender, gint notify_code, gpointer user_data)
+{
+  AFFileSourceFile *self = (AFFileSourceFile *) s;
+  struct stat st;
+
+  switch (notify_code)
+    {
+    case NC_FILE_EOF:
+      /* the reader is closed from the scheduler task if the file is gone
+       * or its slot is needed by another file */
+      self->eof = TRUE;
+      if (stat(self->filename, &st) < 0)
+        self->deleted = TRUE;
+      if (self->deleted || !g_queue_is_empty(self->owner->wildcard_pending))
+        affile_sd_wildcard_schedule(self->owner);
+      break;
+    case NC_FILE_MOVED:
+      msg_verbose("Follow-mode file source moved, tracking of the new file is started",
+                  evt_tag_str("filename", self->filename),
+                  NULL);
+      /* the scheduler drops the file if it cannot be opened again */
+      affile_sf_close(self);
+      affile_sf_mark_pending(self);
+      break;
+    case NC_CLOSE:
+    case NC_READ_ERROR:
+      affile_sf_close(self);
+      affile_sd_wildcard_schedule(self->owner);
+      break;
+    default:
+      break;
+    }
+}
+
+static void
+affile_sf_free(LogPipe *s)
+{
+  AFFileSourceFile *self = (AFFileSourceFile *) s;
+
+  g_assert(!self->reader);
+  g_free(self->filename);
+  g_free(self->basename);
+  log_pipe_free_method(s);
+}
+
+static AFFileSourceFile *
+affile_sf_new(AFFileSourceDriver *owner, const gchar *basename)
+{
+  AFFileSourceFile *self = g_new0(AFFileSourceFile, 1);
+
+  log_pipe_init_instance(&self->super);
+  self->super.queue = affile_sf_queue;
+  self->super.notify = affile_sf_notify;
+  self->super.free_fn = affile_sf_free;
+  self->owner = owner;
+  self->basename = g_strdup(basename);
+  self->filename = g_build_filename(owner->wildcard_dir, basename, NULL);
+  log_pipe_append(&self->super, &owner->super.super.super);
+  return self;
+}
+
+/* drops a file that is not open anymore */
+static void
+affile_sd_wildcard_remove_file(AFFileSourceDriver *self, AFFileSourceFile *file)
+{
+  g_assert(!file->reader);
+
+  if (file->pending)
+    g_queue_remove(self->wildcard_pending, file);
+  g_hash_table_remove(self->wildcard_files, file->basename);
+}
+
+/*
+ * Checks a directory entry. If rescan is TRUE, it was found by scanning
+ * the directory, and it is only considered pending if it has changed since
+ * the last scan, otherwise we've got a change notification for it.
+ */
+static void
+affile_sd_wildcard_check_file(AFFileSourceDriver *self, const gchar *name, gboolean rescan)
+{
+  AFFileSourceFile *file;
+  gchar *filename;
+  struct stat st;
+  gboolean exists;
+
+  if (!g_pattern_match_string(self->wildcard_pattern, name))
+    return;
+
+  file = g_hash_table_lookup(self->wildcard_files, name);
+  if (file && file->reader && !rescan)
+    {
+      /* the reader is informed by its own monitor, just make sure it is not
+       * closed in favour of other files, it might have new data */
+      file->eof = FALSE;
+      return;
+    }
+
+  filename = g_build_filename(self->wildcard_dir, name, NULL);
+  exists = stat(filename, &st) >= 0 && S_ISREG(st.st_mode);
+  g_free(filename);
+
+  if (!exists)
+    {
+      if (!file)
+        return;
+      if (file->reader)
+        {
+          /* closed once the reader reaches EOF */
+          file->deleted = TRUE;
+          affile_sd_wildcard_schedule(self);
+        }
+      else
+        {
+          affile_sd_wildcard_remove_file(self, file);
+        }
+      return;
+    }
+
+  if (!file)
+    {
+      file = affile_sf_new(self, name);
+      g_hash_table_insert(self->wildcard_files, file->basename, file);
+    }
+  else if (rescan && file->size == st.st_size && file->inode == st.st_ino)
+    {
+      return;
+    }
+  file->size = st.st_size;
+  file->inode = st.st_ino;
+  file->deleted = FALSE;
+
+  if (file->reader)
+    file->eof = FALSE;
+  else
+    affile_sf_mark_pending(file);
+}
+
+static void
+affile_sd_wildcard_rescan(AFFileSourceDriver *self)
+{
+  GDir *dir;
+  GError *error = NULL;
+  const gchar *name;
+  GHashTableIter iter;
+  GHashTable *seen;
+  AFFileSourceFile *file;
+
+  dir = g_dir_open(self->wildcard_dir, 0, &error);
+  if (!dir)
+    {
+      msg_error("Error opening directory of wildcard file source",
+                evt_tag_str("filename", self->filename->str),
+                evt_tag_str("error", error->message),
+                NULL);
+      g_clear_error(&error);
+      return;
+    }
+
+  seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+  while ((name = g_dir_read_name(dir)))
+    {
+      affile_sd_wildcard_check_file(self, name, TRUE);
+      file = g_hash_table_lookup(self->wildcard_files, name);
+      if (file)
+        g_hash_table_insert(seen, file, file);
+    }
+  g_dir_close(dir);
+
+  /* files that have disappeared since the last scan */
+  g_hash_table_iter_init(&iter, self->wildcard_files);
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &file))
+    {
+      if (g_hash_table_lookup(seen, file))
+        continue;
+
+      if (file->reader)
+        {
+          file->deleted = TRUE;
+          affile_sd_wildcard_schedule(self);
+          continue;
+        }
+      if (file->pending)
+        g_queue_remove(self->wildcard_pending, file);
+      g_hash_table_iter_remove(&iter);
+    }
+  g_hash_table_destroy(seen);
+}
+
+static void
+affile_sd_wildcard_arm_rescan_timer(AFFileSourceDriver *self)
+{
+  if (iv_timer_registered(&self->wildcard_rescan_timer))
+    return;
+
+  iv_validate_now();
+  self->wildcard_rescan_timer.expires = iv_now;
+  timespec_add_msec(&self->wildcard_rescan_timer.expires, self->reader_options.follow_freq);
+  iv_timer_register(&self->wildcard_rescan_timer);
+}
+
+/* polling fallback, used while the directory cannot be monitored */
+static void
+affile_sd_wildcard_rescan_timer_elapsed(gpointer s)
+{
+  AFFileSourceDriver *self = (AFFileSourceDriver *) s;
+
+  affile_sd_wildcard_rescan(self);
+  if (!file_monitor_start(self->wildcard_monitor))
+    affile_sd_wildcard_arm_rescan_timer(self);
+}
+
+/* FileMonitor callback, name is NULL if the whole directory needs to be checked */
+static void
+affile_sd_wildcard_dir_changed(const gchar *name, gpointer s)
+{
+  AFFileSourceDriver *self = (AFFileSourceDriver *) s;
+
+  if (name)
+    {
+      affile_sd_wildcard_check_file(self, name, FALSE);
+      return;
+    }
+
+  affile_sd_wildcard_rescan(self);
+  if (!file_monitor_is_active(self->wildcard_monitor))
+    affile_sd_wildcard_arm_rescan_timer(self);
+}
+
+static void
+affile_sd_wildcard_schedule_files(gpointer s)
+{
+  AFFileSourceDriver *self = (AFFileSourceDriver *) s;
+  AFFileSourceFile *file;
+  GList *l, *next;
+
+  /* close readers sitting at EOF if their file is gone, or if there are
+   * more files waiting than free slots */
+  for (l = self->wildcard_open->head; l; l = next)
+    {
+      file = (AFFileSourceFile *) l->data;
+      next = l->next;
+
+      if (!file->eof || !log_reader_is_idle(file->reader))
+        continue;
+
+      if (file->deleted)
+        {
+          affile_sf_close(file);
+          affile_sd_wildcard_remove_file(self, file);
+        }
+      else if ((gint) g_queue_get_length(self->wildcard_pending) > self->max_files - (gint) g_queue_get_length(self->wildcard_open))
+        {
+          affile_sf_close(file);
+        }
+    }
+
+  while ((gint) g_queue_get_length(self->wildcard_open) < self->max_files &&
+         (file = g_queue_pop_head(self->wildcard_pending)))
+    {
+      file->pending = FALSE;
+      if (!affile_sf_open(file))
+        affile_sd_wildcard_remove_file(self, file);
+    }
+}
+
+static gboolean
+affile_sd_wildcard_init(AFFileSourceDriver *self)
+{
+  if (strpbrk(self->wildcard_dir, "*?"))
+    {
+      msg_error("Wildcard characters are only supported in the filename part of file sources",
+                evt_tag_str("filename", self->filename->str),
+                NULL);
+      return FALSE;
+    }
+  if (self->reader_options.follow_freq <= 0)
+    {
+      msg_error("Wildcard file sources require follow_freq() to be set",
+                evt_tag_str("filename", self->filename->str),
+                NULL);
+      return FALSE;
+    }
+
+  self->wildcard_files = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) log_pipe_unref);
+  self->wildcard_pending = g_queue_new();
+  self->wildcard_open = g_queue_new();
+
+  IV_TASK_INIT(&self->wildcard_schedule);
+  self->wildcard_schedule.cookie = self;
+  self->wildcard_schedule.handler = affile_sd_wildcard_schedule_files;
+
+  IV_TIMER_INIT(&self->wildcard_rescan_timer);
+  self->wildcard_rescan_timer.cookie = self;
+  self->wildcard_rescan_timer.handler = affile_sd_wildcard_rescan_timer_elapsed;
+
+  /* start monitoring before the initial scan, so that no change is lost in between */
+  self->wildcard_monitor = file_monitor_new_directory(self->wildcard_dir, affile_sd_wildcard_dir_changed, self);
+  if (!file_monitor_start(self->wildcard_monitor))
+    affile_sd_wildcard_arm_rescan_timer(self);
+
+  affile_sd_wildcard_rescan(self);
+  return TRUE;
+}
+
+static void
+affile_sd_wildcard_deinit(AFFileSourceDriver *self)
+{
+  AFFileSourceFile *file;
+
+  if (!self->wildcard_files)
+    return;
+
+  if (iv_task_registered(&self->wildcard_schedule))
+    iv_task_unregister(&self->wildcard_schedule);
+  if (iv_timer_registered(&self->wildcard_rescan_timer))
+    iv_timer_unregister(&self->wildcard_rescan_timer);
+
+  file_monitor_free(self->wildcard_monitor);
+  self->wildcard_monitor = NULL;
+
+  while ((file = g_queue_peek_head(self->wildcard_open)))
+    affile_sf_close(file);
+  g_queue_free(self->wildcard_open);
+  g_queue_free(self->wildcard_pending);
+  g_hash_table_destroy(self->wildcard_files);
+  self->wildcard_open = self->wildcard_pending = NULL;
+  self->wildcard_files = NULL;
+}
+
+void
+affile_sd_set_max_files(LogDriver *s, gint max_files)
+{
+  AFFileSourceDriver *self = (AFFileSourceDriver *) s;
+
+  self->max_files = MAX(max_files, 1);
+}
+
 static void
 affile_sd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
 {
@@ -243,7 +729,9 @@ affile_sd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options,
   if (!filename_handle)
     filename_handle = log_msg_get_value_handle("FILE_NAME");
   
-  log_msg_set_value(msg, filename_handle, self->filename->str, self->filename->len);
+  /* set by AFFileSourceFile for wildcard sources */
+  if (!affile_sd_is_wildcard(self))
+    log_msg_set_value(msg, filename_handle, self->filename->str, self->filename->len);
 
   log_pipe_forward_msg(s, msg, path_options);
 }
@@ -261,6 +749,9 @@ affile_sd_init(LogPipe *s)
 
   log_reader_options_init(&self->reader_options, cfg, self->super.super.group);
 
+  if (affile_sd_is_wildcard(self))
+    return affile_sd_wildcard_init(self);
+
   file_opened = affile_sd_open_file(self, self->filename->str, &fd);
   if (!file_opened && self->reader_options.follow_freq > 0)
     {
@@ -302,7 +793,7 @@ affile_sd_init(LogPipe *s)
           close(fd);
           return FALSE;
         }
-      affile_sd_recover_state(s, cfg, proto);
+      affile_sd_recover_state(s, cfg, proto, self->filename->str);
     }
   else
     {
@@ -327,6 +818,7 @@ affile_sd_deinit(LogPipe *s)
       log_pipe_unref(self->reader);
       self->reader = NULL;
     }
+  affile_sd_wildcard_deinit(self);
 
   if (!log_src_driver_deinit_method(s))
     return FALSE;
@@ -341,6 +833,10 @@ affile_sd_free(LogPipe *s)
 
   g_string_free(self->filename, TRUE);
   g_assert(!self->reader);
+  g_assert(!self->wildcard_files);
+  g_free(self->wildcard_dir);
+  if (self->wildcard_pattern)
+    g_pattern_spec_free(self->wildcard_pattern);
 
   log_reader_options_destroy(&self->reader_options);
 
@@ -363,6 +859,16 @@ affile_sd_new(gchar *filename, guint32 flags)
   log_reader_options_defaults(&self->reader_options);
   self->reader_options.parse_options.flags |= LP_LOCAL;
 
+  if ((self->flags & AFFILE_PIPE) == 0 && strpbrk(filename, "*?"))
+    {
+      gchar *basename = g_path_get_basename(filename);
+
+      self->wildcard_dir = g_path_get_dirname(filename);
+      self->wildcard_pattern = g_pattern_spec_new(basename);
+      self->max_files = AFFILE_DEFAULT_MAX_FILES;
+      g_free(basename);
+    }
+
   if ((self->flags & AFFILE_PIPE))
     {
       static gboolean warned = FALSE;
@@ -434,10 +940,14 @@ affile_sd_new(gchar *filename, guint32 flags)
  *   - queue runs in the thread of the source thread that generated the message
  *   - if the message is to be written to a not-yet-opened file, a new gets
  *     opened and stored in the writer_hash hashtable (initiated from queue,
- *     but performed in the main thread, but more on that later)
+ *     but performed asynchronously in the main thread, the messages are
+ *     kept in pending_opens until the file is open)
  *   - currently opened destination files are checked regularly and closed
  *     if they are idle for a given amount of time (time_reap) (this is done
  *     in the main thread)
+ *   - if rotation is enabled, files are checked regularly in the main
+ *     thread, the rotation itself (renaming, reopening and compressing)
+ *     is done in a background thread
  *
  * Some of these operations have to be performed in the main thread, others
  * are done in the queue call.
@@ -454,11 +964,26 @@ affile_sd_new(gchar *filename, guint32 flags)
  *    - looked up in _queue() (in the source thread)
  *    - cleaned up in reap callback (in the main thread)
  *
- * writer_hash is locked (currently a simple mutex) using
- * AFFileDestDriver->lock.  The "queue" method cannot hold the lock while
- * forwarding it to the next pipe, thus a reference is taken under the
- * protection of the lock, keeping a the next pipe alive, even if that would
- * go away in a parallel reaper process.
+ * writer_hash (and single_writer) is looked up without locking. Both are
+ * only changed in the main thread.  single_writer is replaced atomically,
+ * writer_hash is changed in place with writer_hash_updating set: source
+ * threads seeing that flag treat the lookup as a miss and retry with
+ * AFFileDestDriver->lock held, while the main thread waits for the
+ * lockless readers that came earlier before touching the table, a poor
+ * man's RCU, see affile_dd_writers_read_lock().  The "queue" method takes
+ * a reference to the writer while in the read-side section, keeping the
+ * next pipe alive while it forwards the message, even if that would go
+ * away in a parallel reaper process.
+ *
+ * In addition, each thread remembers the writer it used last (without a
+ * reference), which is valid as long as writer_generation doesn't change.
+ * writer_generation is changed whenever a writer is removed.
+ *
+ * AFFileDestDriver->lock protects pending_opens and open_requests, and
+ * serializes changes of writer_hash with source threads finding out that a
+ * file is not open yet.  The main thread is never called synchronously
+ * with the lock held, open requests are picked up through the
+ * open_requested event, which is posted after the lock is released.
  */
 
 struct _AFFileDestWriter
@@ -472,9 +997,43 @@ struct _AFFileDestWriter
   time_t last_open_stamp;
   time_t time_reopen;
   struct iv_timer reap_timer;
-  gboolean reopen_pending, queue_pending;
+  /* rotation, see affile_dw_rotate() */
+  time_t rotate_stamp;
+  struct iv_timer rotate_timer;
+  GCond *rotate_finished;
+  gboolean reopen_pending, queue_pending, rotate_pending;
 };
 
+typedef struct _AFFileDestPendingMessage
+{
+  LogMessage *msg;
+  LogPathOptions path_options;
+} AFFileDestPendingMessage;
+
+/* a file being opened in the main thread and the messages waiting for it */
+typedef struct _AFFileDestPendingOpen
+{
+  gchar *filename;
+  GQueue *messages;
+} AFFileDestPendingOpen;
+
+TLS_BLOCK_START
+{
+  /* the writer last used by this thread, not referenced */
+  AFFileDestDriver *cached_writer_owner;
+  gint cached_writer_generation;
+  AFFileDestWriter *cached_writer;
+}
+TLS_BLOCK_END;
+
+#define cached_writer_owner       __tls_deref(cached_writer_owner)
+#define cached_writer_generation  __tls_deref(cached_writer_generation)
+#define cached_writer             __tls_deref(cached_writer)
+
+/* generations are unique across drivers, so a cached writer of a freed
+ * driver is never mistaken for one of a new driver at the same address */
+static gint affile_dd_writer_generations;
+
 static gchar *
 affile_dw_format_persist_name(AFFileDestWriter *self)
 {
@@ -487,6 +1046,7 @@ affile_dw_format_persist_name(AFFileDestWriter *self)
 }
 
 static void affile_dd_reap_writer(AFFileDestDriver *self, AFFileDestWriter *dw);
+static void affile_dd_process_open_requests(gpointer s);
 
 static void
 affile_dw_arm_reaper(AFFileDestWriter *self)
@@ -498,6 +1058,32 @@ affile_dw_arm_reaper(AFFileDestWriter *self)
   iv_timer_register(&self->reap_timer);
 }
 
+static void
+affile_dw_arm_rotate_timer(AFFileDestWriter *self)
+{
+  iv_validate_now();
+  self->rotate_timer.expires = iv_now;
+  timespec_add_msec(&self->rotate_timer.expires, AFFILE_ROTATE_CHECK_FREQ);
+  iv_timer_register(&self->rotate_timer);
+}
+
+/* called in the main thread whenever the file has been (re)opened */
+static void
+affile_dw_arm_timers(AFFileDestWriter *self)
+{
+  /* reopened from another thread, but deinitialized since */
+  if (!(self->super.flags & PIF_INITIALIZED))
+    return;
+
+  if (!iv_timer_registered(&self->reap_timer))
+    affile_dw_arm_reaper(self);
+
+  self->rotate_stamp = cached_g_current_time_sec();
+  if ((self->owner->rotate_size > 0 || self->owner->rotate_interval > 0) &&
+      !iv_timer_registered(&self->rotate_timer))
+    affile_dw_arm_rotate_timer(self);
+}
+
 static void
 affile_dw_reap(gpointer s)
 {
@@ -508,6 +1094,7 @@ affile_dw_reap(gpointer s)
   g_static_mutex_lock(&self->lock);
   if (!log_writer_has_pending_writes((LogWriter *) self->writer) &&
       !self->queue_pending &&
+      !self->rotate_pending &&
       (cached_g_current_time_sec() - self->last_msg_stamp) >= self->owner->time_reap)
     {
       g_static_mutex_unlock(&self->lock);
@@ -519,61 +1106,292 @@ affile_dw_reap(gpointer s)
     }
   else
     {
-      g_static_mutex_unlock(&self->lock);
-      affile_dw_arm_reaper(self);
+      g_static_mutex_unlock(&self->lock);
+      affile_dw_arm_reaper(self);
+    }
+}
+
+static gboolean
+affile_dw_reopen(AFFileDestWriter *self)
+{
+  int fd, flags;
+  struct stat st;
+
+  self->last_open_stamp = self->last_msg_stamp;
+  if (self->owner->overwrite_if_older > 0 && 
+      stat(self->filename, &st) == 0 &&
+      st.st_mtime < time(NULL) - self->owner->overwrite_if_older)
+    {
+      msg_info("Destination file is older than overwrite_if_older(), overwriting",
+                 evt_tag_str("filename", self->filename),
+                 evt_tag_int("overwrite_if_older", self->owner->overwrite_if_older),
+                 NULL);
+      unlink(self->filename);
+    }
+
+  if (self->owner->flags & AFFILE_PIPE)
+    flags = O_RDWR | O_NOCTTY | O_NONBLOCK | O_LARGEFILE;
+  else
+    flags = O_WRONLY | O_CREAT | O_NOCTTY | O_NONBLOCK | O_LARGEFILE;
+
+
+  if (affile_open_file(self->filename, flags,
+                       self->owner->file_uid, self->owner->file_gid, self->owner->file_perm, 
+                       self->owner->dir_uid, self->owner->dir_gid, self->owner->dir_perm, 
+                       !!(self->owner->flags & AFFILE_CREATE_DIRS), FALSE, !!(self->owner->flags & AFFILE_PIPE), &fd))
+    {
+      guint write_flags;
+      
+      write_flags =
+        ((self->owner->flags & AFFILE_PIPE) ? LTF_PIPE : LTF_APPEND) |
+        ((self->owner->flags & AFFILE_FSYNC) ? LTF_FSYNC : 0);
+      log_writer_reopen(self->writer,
+                        self->owner->flags & AFFILE_PIPE
+                        ? log_proto_text_client_new(log_transport_plain_new(fd, write_flags))
+                        : log_proto_file_writer_new(log_transport_plain_new(fd, write_flags), self->owner->writer_options.flush_lines));
+
+      main_loop_call((void * (*)(void *)) affile_dw_arm_timers, self, TRUE);
+    }
+  else
+    {
+      msg_error("Error opening file for writing",
+                evt_tag_str("filename", self->filename),
+                evt_tag_errno(EVT_TAG_OSERROR, errno),
+                NULL);
+      return self->owner->super.super.optional;
+    }
+  return TRUE;
+}
+
+/*
+ * File rotation
+ * =============
+ *
+ * If rotate_size() or rotate_interval() is set, the file is renamed once
+ * it grows over the given size or has been open for the given time, and a
+ * new file is opened in its place. Only the affected writer is reopened.
+ *
+ * The check is done in the main thread from rotate_timer, but renaming,
+ * reopening and compressing the rotated file are performed by a
+ * background thread, so that a large file doesn't stall the main loop.
+ * Reopening the LogWriter from a non-main thread returns only when the
+ * writer has switched to the new file, so the rotated file is not written
+ * anymore by the time it gets compressed.
+ *
+ * The rotation thread calls back into the main thread while reopening, so
+ * affile_dw_deinit() waits for a pending rotation by running those calls
+ * itself, see affile_dw_wait_rotate(). As no writer is deinitialized with
+ * a rotation in progress, the rotation thread doesn't need a reference to
+ * the writer. The thread pool is freed at shutdown.
+ */
+
+static GThreadPool *affile_rotate_pool;
+
+static void
+affile_rotate_pool_free(gint type, gpointer user_data)
+{
+  g_thread_pool_free(affile_rotate_pool, FALSE, TRUE);
+  affile_rotate_pool = NULL;
+}
+
+static gchar *
+affile_dw_format_rotated_name(AFFileDestWriter *self)
+{
+  gchar stamp[32];
+  gchar *name;
+  time_t now = time(NULL);
+  struct tm tm;
+  gint seq = 0;
+
+  localtime_r(&now, &tm);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+  name = g_strdup_printf("%s.%s", self->filename, stamp);
+  while (1)
+    {
+      gchar *gz_name = g_strdup_printf("%s.gz", name);
+      gboolean exists;
+
+      exists = access(name, F_OK) == 0 || access(gz_name, F_OK) == 0;
+      g_free(gz_name);
+      if (!exists)
+        break;
+
+      /* rotated more than once within a second */
+      g_free(name);
+      name = g_strdup_printf("%s.%s.%d", self->filename, stamp, ++seq);
+    }
+  return name;
+}
+
+#if HAVE_ZLIB
+
+static void
+affile_compress_file(const gchar *filename)
+{
+  gchar *gz_name = g_strdup_printf("%s.gz", filename);
+  gchar buf[65536];
+  gssize len = 0;
+  gint fd, gz_fd = -1;
+  gzFile gz = NULL;
+  gboolean success = FALSE;
+
+  fd = open(filename, O_RDONLY | O_NOCTTY | O_LARGEFILE);
+  if (fd >= 0)
+    gz_fd = open(gz_name, O_WRONLY | O_CREAT | O_EXCL | O_NOCTTY | O_LARGEFILE, 0600);
+  if (gz_fd >= 0)
+    {
+      struct stat st;
+
+      /* keep the permissions of the original file */
+      if (fstat(fd, &st) == 0)
+        set_permissions_fd(gz_fd, st.st_uid, st.st_gid, st.st_mode & 07777);
+      gz = gzdopen(gz_fd, "wb");
+    }
+
+  if (gz)
+    {
+      while ((len = read(fd, buf, sizeof(buf))) > 0)
+        {
+          if (gzwrite(gz, buf, len) != len)
+            break;
+        }
+      success = len == 0;
+      if (gzclose(gz) != Z_OK)
+        success = FALSE;
+    }
+  else if (gz_fd >= 0)
+    {
+      close(gz_fd);
+    }
+
+  if (success)
+    {
+      unlink(filename);
+    }
+  else
+    {
+      msg_error("Error compressing rotated destination file",
+                evt_tag_str("filename", filename),
+                evt_tag_errno(EVT_TAG_OSERROR, errno),
+                NULL);
+      if (gz_fd >= 0)
+        unlink(gz_name);
+    }
+  if (fd >= 0)
+    close(fd);
+  g_free(gz_name);
+}
+
+#else
+
+static void
+affile_compress_file(const gchar *filename)
+{
+  msg_warning("WARNING: syslog-ng was compiled without zlib support, rotated files are not compressed",
+              evt_tag_str("filename", filename),
+              NULL);
+}
+
+#endif
+
+/* runs in the rotation thread */
+static void
+affile_dw_rotate(gpointer data, gpointer user_data)
+{
+  AFFileDestWriter *self = (AFFileDestWriter *) data;
+  gchar *rotated_name;
+  gboolean compress;
+
+  rotated_name = affile_dw_format_rotated_name(self);
+  if (rename(self->filename, rotated_name) < 0)
+    {
+      msg_error("Error rotating destination file",
+                evt_tag_str("filename", self->filename),
+                evt_tag_str("rotated_filename", rotated_name),
+                evt_tag_errno(EVT_TAG_OSERROR, errno),
+                NULL);
+      g_free(rotated_name);
+      rotated_name = NULL;
+    }
+  else
+    {
+      msg_verbose("Destination file rotated",
+                  evt_tag_str("filename", self->filename),
+                  evt_tag_str("rotated_filename", rotated_name),
+                  NULL);
     }
+
+  g_static_mutex_lock(&self->lock);
+  self->reopen_pending = TRUE;
+  g_static_mutex_unlock(&self->lock);
+
+  affile_dw_reopen(self);
+
+  compress = rotated_name && self->owner->rotate_compress;
+
+  /* @self may be deinitialized and freed as soon as the lock is released */
+  g_static_mutex_lock(&self->lock);
+  self->reopen_pending = FALSE;
+  self->rotate_pending = FALSE;
+  g_cond_signal(self->rotate_finished);
+  g_static_mutex_unlock(&self->lock);
+
+  if (compress)
+    affile_compress_file(rotated_name);
+  g_free(rotated_name);
 }
 
-static gboolean
-affile_dw_reopen(AFFileDestWriter *self)
+/* called from deinit, in the main thread */
+static void
+affile_dw_wait_rotate(AFFileDestWriter *self)
 {
-  int fd, flags;
-  struct stat st;
-
-  self->last_open_stamp = self->last_msg_stamp;
-  if (self->owner->overwrite_if_older > 0 && 
-      stat(self->filename, &st) == 0 &&
-      st.st_mtime < time(NULL) - self->owner->overwrite_if_older)
+  g_static_mutex_lock(&self->lock);
+  while (self->rotate_pending)
     {
-      msg_info("Destination file is older than overwrite_if_older(), overwriting",
-                 evt_tag_str("filename", self->filename),
-                 evt_tag_int("overwrite_if_older", self->owner->overwrite_if_older),
-                 NULL);
-      unlink(self->filename);
+      GTimeVal deadline;
+
+      g_static_mutex_unlock(&self->lock);
+      main_loop_call_pending();
+      g_static_mutex_lock(&self->lock);
+      if (!self->rotate_pending)
+        break;
+
+      /* wake up regularly to serve the calls of the rotation thread */
+      g_get_current_time(&deadline);
+      g_time_val_add(&deadline, 10000);
+      g_cond_timed_wait(self->rotate_finished, g_static_mutex_get_mutex(&self->lock), &deadline);
     }
+  g_static_mutex_unlock(&self->lock);
+}
 
-  if (self->owner->flags & AFFILE_PIPE)
-    flags = O_RDWR | O_NOCTTY | O_NONBLOCK | O_LARGEFILE;
-  else
-    flags = O_WRONLY | O_CREAT | O_NOCTTY | O_NONBLOCK | O_LARGEFILE;
+static void
+affile_dw_check_rotate(gpointer s)
+{
+  AFFileDestWriter *self = (AFFileDestWriter *) s;
+  AFFileDestDriver *owner = self->owner;
+  struct stat st;
 
+  main_loop_assert_main_thread();
 
-  if (affile_open_file(self->filename, flags,
-                       self->owner->file_uid, self->owner->file_gid, self->owner->file_perm, 
-                       self->owner->dir_uid, self->owner->dir_gid, self->owner->dir_perm, 
-                       !!(self->owner->flags & AFFILE_CREATE_DIRS), FALSE, !!(self->owner->flags & AFFILE_PIPE), &fd))
+  if (!self->rotate_pending && log_writer_opened((LogWriter *) self->writer) &&
+      ((owner->rotate_interval > 0 && cached_g_current_time_sec() - self->rotate_stamp >= owner->rotate_interval) ||
+       (owner->rotate_size > 0 && stat(self->filename, &st) == 0 && st.st_size >= owner->rotate_size)))
     {
-      guint write_flags;
-      
-      write_flags =
-        ((self->owner->flags & AFFILE_PIPE) ? LTF_PIPE : LTF_APPEND) |
-        ((self->owner->flags & AFFILE_FSYNC) ? LTF_FSYNC : 0);
-      log_writer_reopen(self->writer,
-                        self->owner->flags & AFFILE_PIPE
-                        ? log_proto_text_client_new(log_transport_plain_new(fd, write_flags))
-                        : log_proto_file_writer_new(log_transport_plain_new(fd, write_flags), self->owner->writer_options.flush_lines));
+      if (!affile_rotate_pool)
+        {
+          affile_rotate_pool = g_thread_pool_new(affile_dw_rotate, NULL, 1, FALSE, NULL);
+          register_application_hook(AH_SHUTDOWN, affile_rotate_pool_free, NULL);
+        }
 
-      main_loop_call((void * (*)(void *)) affile_dw_arm_reaper, self, TRUE);
-    }
-  else
-    {
-      msg_error("Error opening file for writing",
-                evt_tag_str("filename", self->filename),
-                evt_tag_errno(EVT_TAG_OSERROR, errno),
-                NULL);
-      return self->owner->super.super.optional;
+      /* the timer is armed again when the new file is opened */
+      g_static_mutex_lock(&self->lock);
+      self->rotate_pending = TRUE;
+      g_static_mutex_unlock(&self->lock);
+      g_thread_pool_push(affile_rotate_pool, self, NULL);
+      return;
     }
-  return TRUE;
+  affile_dw_arm_rotate_timer(self);
 }
 
 static gboolean
@@ -599,7 +1417,9 @@ affile_dw_init(LogPipe *s)
 
       self->writer = log_writer_new(flags);
     }
-  log_writer_set_options((LogWriter *) self->writer, s, &self->owner->writer_options, 1,
+  /* the driver is the control pipe, so that the writer's time is charged
+   * to the destination when profiling, see log_pipe_profile_end() */
+  log_writer_set_options((LogWriter *) self->writer, &self->owner->super.super.super, &self->owner->writer_options, 1,
                          self->owner->flags & AFFILE_PIPE ? SCS_PIPE : SCS_FILE,
                          self->owner->super.super.id, self->filename);
   log_writer_set_queue(self->writer, log_dest_driver_acquire_queue(&self->owner->super, affile_dw_format_persist_name(self)));
@@ -622,6 +1442,7 @@ affile_dw_deinit(LogPipe *s)
   AFFileDestWriter *self = (AFFileDestWriter *) s;
 
   main_loop_assert_main_thread();
+  affile_dw_wait_rotate(self);
   if (self->writer)
     {
       log_pipe_deinit(self->writer);
@@ -631,6 +1452,8 @@ affile_dw_deinit(LogPipe *s)
 
   if (iv_timer_registered(&self->reap_timer))
     iv_timer_unregister(&self->reap_timer);
+  if (iv_timer_registered(&self->rotate_timer))
+    iv_timer_unregister(&self->rotate_timer);
   return TRUE;
 }
 
@@ -673,7 +1496,7 @@ affile_dw_set_owner(AFFileDestWriter *self, AFFileDestDriver *owner)
   log_pipe_ref(&owner->super.super.super);
   self->owner = owner;
   if (self->writer)
-    log_writer_set_options((LogWriter *) self->writer, &self->super, &owner->writer_options, 1, SCS_FILE, self->owner->super.super.id, self->filename);
+    log_writer_set_options((LogWriter *) self->writer, &owner->super.super.super, &owner->writer_options, 1, SCS_FILE, self->owner->super.super.id, self->filename);
   
 }
 
@@ -685,6 +1508,7 @@ affile_dw_free(LogPipe *s)
   log_pipe_unref(self->writer);
   self->writer = NULL;
   g_free(self->filename);
+  g_cond_free(self->rotate_finished);
   log_pipe_unref(&self->owner->super.super.super);
   log_pipe_free_method(s);
 }
@@ -708,6 +1532,11 @@ affile_dw_new(AFFileDestDriver *owner, const gchar *filename)
   self->reap_timer.cookie = self;
   self->reap_timer.handler = affile_dw_reap;
 
+  IV_TIMER_INIT(&self->rotate_timer);
+  self->rotate_timer.cookie = self;
+  self->rotate_timer.handler = affile_dw_check_rotate;
+  self->rotate_finished = g_cond_new();
+
   /* we have to take care about freeing filename later. 
      This avoids a move of the filename. */
   self->filename = g_strdup(filename);
@@ -816,6 +1645,30 @@ affile_dd_set_fsync(LogDriver *s, gboolean fsync)
     self->flags &= ~AFFILE_FSYNC;
 }
 
+void
+affile_dd_set_rotate_size(LogDriver *s, gint64 rotate_size)
+{
+  AFFileDestDriver *self = (AFFileDestDriver *) s;
+
+  self->rotate_size = rotate_size;
+}
+
+void
+affile_dd_set_rotate_interval(LogDriver *s, gint rotate_interval)
+{
+  AFFileDestDriver *self = (AFFileDestDriver *) s;
+
+  self->rotate_interval = rotate_interval;
+}
+
+void
+affile_dd_set_rotate_compress(LogDriver *s, gboolean rotate_compress)
+{
+  AFFileDestDriver *self = (AFFileDestDriver *) s;
+
+  self->rotate_compress = rotate_compress;
+}
+
 void
 affile_dd_set_local_time_zone(LogDriver *s, const gchar *local_time_zone)
 {
@@ -833,6 +1686,87 @@ affile_dd_format_persist_name(AFFileDestDriver *self)
   return persist_name;
 }
 
+/*
+ * Read-side section for writer_hash/single_writer, these run in the source
+ * threads and never block. The returned epoch has to be passed to
+ * affile_dd_writers_read_unlock().
+ */
+static inline gint
+affile_dd_writers_read_lock(AFFileDestDriver *self)
+{
+  gint epoch;
+
+  while (1)
+    {
+      epoch = g_atomic_int_get(&self->writer_epoch) & 1;
+      g_atomic_int_inc(&self->writer_readers[epoch]);
+
+      /* if the epoch was flipped in the meantime, the main thread may
+       * not wait for us, retry with the new one */
+      if ((g_atomic_int_get(&self->writer_epoch) & 1) == epoch)
+        return epoch;
+      g_atomic_int_add(&self->writer_readers[epoch], -1);
+    }
+}
+
+static inline void
+affile_dd_writers_read_unlock(AFFileDestDriver *self, gint epoch)
+{
+  g_atomic_int_add(&self->writer_readers[epoch], -1);
+}
+
+/*
+ * Waits until all threads that might have seen the previously published
+ * writer_hash/single_writer have left their read-side section. Read-side
+ * sections are short and non-blocking, so this is a brief spin.
+ */
+static void
+affile_dd_writers_synchronize(AFFileDestDriver *self)
+{
+  gint epoch;
+
+  main_loop_assert_main_thread();
+  epoch = g_atomic_int_get(&self->writer_epoch) & 1;
+  g_atomic_int_inc(&self->writer_epoch);
+  while (g_atomic_int_get(&self->writer_readers[epoch]) > 0)
+    g_thread_yield();
+}
+
+static void
+affile_dd_invalidate_cached_writers(AFFileDestDriver *self)
+{
+  g_atomic_int_set(&self->writer_generation, g_atomic_int_exchange_and_add(&affile_dd_writer_generations, 1) + 1);
+}
+
+/*
+ * Adds @dw to writer_hash if @add is TRUE, removes it otherwise.  The
+ * table is changed in place, the caller holds self->lock, so that source
+ * threads missing the lockless lookup wait for us.
+ */
+static void
+affile_dd_update_writer_hash(AFFileDestDriver *self, AFFileDestWriter *dw, gboolean add)
+{
+  main_loop_assert_main_thread();
+
+  /* keep lockless readers away while the table is changed */
+  g_atomic_int_set(&self->writer_hash_updating, TRUE);
+  affile_dd_writers_synchronize(self);
+
+  if (add)
+    {
+      if (!self->writer_hash)
+        self->writer_hash = g_hash_table_new(g_str_hash, g_str_equal);
+      g_hash_table_insert(self->writer_hash, dw->filename, dw);
+    }
+  else
+    {
+      g_hash_table_remove(self->writer_hash, dw->filename);
+      affile_dd_invalidate_cached_writers(self);
+    }
+
+  g_atomic_int_set(&self->writer_hash_updating, FALSE);
+}
+
 static void
 affile_dd_reap_writer(AFFileDestDriver *self, AFFileDestWriter *dw)
 {
@@ -840,17 +1774,17 @@ affile_dd_reap_writer(AFFileDestDriver *self, AFFileDestWriter *dw)
   
   if ((self->flags & AFFILE_NO_EXPAND) == 0)
     {
-      g_static_mutex_lock(&self->lock);
       /* remove from hash table */
-      g_hash_table_remove(self->writer_hash, dw->filename);
+      g_static_mutex_lock(&self->lock);
+      affile_dd_update_writer_hash(self, dw, FALSE);
       g_static_mutex_unlock(&self->lock);
     }
   else
     {
-      g_static_mutex_lock(&self->lock);
       g_assert(dw == self->single_writer);
-      self->single_writer = NULL;
-      g_static_mutex_unlock(&self->lock);
+      g_atomic_pointer_set(&self->single_writer, NULL);
+      affile_dd_invalidate_cached_writers(self);
+      affile_dd_writers_synchronize(self);
     }
 
   log_pipe_deinit(&dw->super);
@@ -922,7 +1856,7 @@ affile_dd_init(LogPipe *s)
           log_pipe_init(&self->single_writer->super, cfg);
         }
     }
-  
+  iv_event_register(&self->open_requested);
   
   return TRUE;
 }
@@ -979,6 +1913,13 @@ affile_dd_deinit(LogPipe *s)
 {
   AFFileDestDriver *self = (AFFileDestDriver *) s;
   GlobalConfig *cfg = log_pipe_get_config(s);
+
+  /* open the files that messages are still waiting for, so that those
+   * messages are handed over with the writers */
+  affile_dd_process_open_requests(self);
+  iv_event_unregister(&self->open_requested);
+
+  affile_dd_invalidate_cached_writers(self);
   /* NOTE: we free all AFFileDestWriter instances here as otherwise we'd
    * have circular references between AFFileDestDriver and file writers */
   if (self->single_writer)
@@ -1005,150 +1946,263 @@ affile_dd_deinit(LogPipe *s)
 }
 
 /*
- * This function is ran in the main thread whenever a writer is not yet
- * instantiated.  Returns a reference to the newly constructed LogPipe
- * instance where the caller needs to forward its message.
+ * This function is ran in the main thread whenever the single writer (e.g.
+ * the filename is not a template) is not yet instantiated.  Returns a
+ * reference to the newly constructed LogPipe instance where the caller
+ * needs to forward its message.
  */
 static LogPipe *
-affile_dd_open_writer(gpointer args[])
+affile_dd_open_single_writer(AFFileDestDriver *self)
 {
-  AFFileDestDriver *self = args[0];
   GlobalConfig *cfg = log_pipe_get_config(&self->super.super.super);
   AFFileDestWriter *next;
 
   main_loop_assert_main_thread();
-  if (self->flags & AFFILE_NO_EXPAND)
+  if (!self->single_writer)
     {
-      if (!self->single_writer)
-	{
-	  next = affile_dw_new(self, self->filename_template->template);
-          if (next && log_pipe_init(&next->super, cfg))
-	    {
-	      log_pipe_ref(&next->super);
-	      g_static_mutex_lock(&self->lock);
-	      self->single_writer = next;
-	      g_static_mutex_unlock(&self->lock);
-	    }
-	  else
-	    {
-	      log_pipe_unref(&next->super);
-	      next = NULL;
-	    }
-	}
-      else
+      next = affile_dw_new(self, self->filename_template->template);
+      if (next && log_pipe_init(&next->super, cfg))
         {
-          next = self->single_writer;
           log_pipe_ref(&next->super);
+          g_atomic_pointer_set(&self->single_writer, next);
+        }
+      else
+        {
+          log_pipe_unref(&next->super);
+          next = NULL;
         }
     }
   else
     {
-      GString *filename = args[1];
+      next = self->single_writer;
+      log_pipe_ref(&next->super);
+    }
 
-      /* hash table construction is serialized, as we only do that in the main thread. */
-      if (!self->writer_hash)
-        self->writer_hash = g_hash_table_new(g_str_hash, g_str_equal);
+  if (next)
+    {
+      next->queue_pending = TRUE;
+      /* we're returning a reference */
+      return &next->super;
+    }
+  return NULL;
+}
+
+static void
+affile_dd_queue_to_writer(AFFileDestWriter *next, LogMessage *msg, const LogPathOptions *path_options)
+{
+  log_msg_add_ack(msg, path_options);
+  log_pipe_queue(&next->super, log_msg_ref(msg), path_options);
+  next->queue_pending = FALSE;
+  log_pipe_unref(&next->super);
+}
 
-      /* we don't need to lock the hashtable as it is only written in
-       * the main thread, which we're running right now.  lookups in
-       * other threads must be locked. writers must be locked even in
-       * this thread to exclude lookups in other threads.  */
+/*
+ * Looks up the writer for @filename (NULL for single_writer) without
+ * locking. Returns a reference, or NULL if the file is not open yet (or
+ * writer_hash is being changed). Runs in the source threads.
+ */
+static AFFileDestWriter *
+affile_dd_lookup_writer(AFFileDestDriver *self, const gchar *filename)
+{
+  AFFileDestWriter *next = NULL;
+  GHashTable *writer_hash;
+  gint epoch, generation;
 
-      next = g_hash_table_lookup(self->writer_hash, filename->str);
-      if (!next)
-	{
-	  next = affile_dw_new(self, filename->str);
-          if (!log_pipe_init(&next->super, cfg))
-	    {
-	      log_pipe_unref(&next->super);
-	      next = NULL;
-	    }
-	  else
-	    {
-	      log_pipe_ref(&next->super);
-	      g_static_mutex_lock(&self->lock);
-              g_hash_table_insert(self->writer_hash, next->filename, next);
-              g_static_mutex_unlock(&self->lock);
-            }
+  epoch = affile_dd_writers_read_lock(self);
+  if (!filename)
+    {
+      next = g_atomic_pointer_get(&self->single_writer);
+    }
+  else if (!g_atomic_int_get(&self->writer_hash_updating))
+    {
+      /* writer_hash is not being changed, otherwise the caller retries
+       * with self->lock held */
+      generation = g_atomic_int_get(&self->writer_generation);
+      if (cached_writer_owner == self && cached_writer_generation == generation &&
+          strcmp(cached_writer->filename, filename) == 0)
+        {
+          next = cached_writer;
         }
       else
         {
-          log_pipe_ref(&next->super);
+          writer_hash = g_atomic_pointer_get(&self->writer_hash);
+          if (writer_hash)
+            next = g_hash_table_lookup(writer_hash, filename);
+          if (next)
+            {
+              cached_writer_owner = self;
+              cached_writer_generation = generation;
+              cached_writer = next;
+            }
         }
     }
-
   if (next)
     {
+      log_pipe_ref(&next->super);
       next->queue_pending = TRUE;
-      /* we're returning a reference */
-      return &next->super;
     }
-  return NULL;
+  affile_dd_writers_read_unlock(self, epoch);
+  return next;
 }
 
 static void
-affile_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+affile_dd_pending_open_free(AFFileDestPendingOpen *pending)
 {
-  AFFileDestDriver *self = (AFFileDestDriver *) s;
-  AFFileDestWriter *next;
-  gpointer args[2] = { self, NULL };
+  g_assert(g_queue_is_empty(pending->messages));
+  g_queue_free(pending->messages);
+  g_free(pending->filename);
+  g_free(pending);
+}
 
-  if (self->flags & AFFILE_NO_EXPAND)
-    {
-      /* no need to lock the check below, the worst case that happens is
-       * that we go to the mainloop to return the same information, but this
-       * is not fast path anyway */
+/*
+ * Opens a writer for a templated filename, runs in the main thread as
+ * requested by affile_dd_queue(). The messages that arrived for the file
+ * in the meantime are queued before the writer is published, so that
+ * ordering is kept with messages that find the writer in writer_hash.
+ */
+static void
+affile_dd_open_writer(AFFileDestDriver *self, AFFileDestPendingOpen *pending)
+{
+  GlobalConfig *cfg = log_pipe_get_config(&self->super.super.super);
+  AFFileDestWriter *next = NULL;
+  AFFileDestPendingMessage *pm;
+  gboolean publish = FALSE;
 
-      g_static_mutex_lock(&self->lock);
-      if (!self->single_writer)
+  main_loop_assert_main_thread();
+
+  /* we don't need to lock the hashtable for reading as it is only
+   * written in the main thread, which we're running right now. */
+  if (self->writer_hash)
+    next = g_hash_table_lookup(self->writer_hash, pending->filename);
+  if (!next)
+    {
+      next = affile_dw_new(self, pending->filename);
+      if (!log_pipe_init(&next->super, cfg))
         {
-          g_static_mutex_unlock(&self->lock);
-          next = main_loop_call((void *(*)(void *)) affile_dd_open_writer, args, TRUE);
+          log_pipe_unref(&next->super);
+          next = NULL;
         }
       else
         {
-          /* we need to lock single_writer in order to get a reference and
-           * make sure it is not a stale pointer by the time we ref it */
-          next = self->single_writer;
-          next->queue_pending = TRUE;
+          publish = TRUE;
+        }
+    }
+
+  g_static_mutex_lock(&self->lock);
+  g_hash_table_remove(self->pending_opens, pending->filename);
+  while ((pm = g_queue_pop_head(pending->messages)))
+    {
+      if (next)
+        {
           log_pipe_ref(&next->super);
-          g_static_mutex_unlock(&self->lock);
+          next->queue_pending = TRUE;
+          affile_dd_queue_to_writer(next, pm->msg, &pm->path_options);
         }
+      /* drop the reference and the ack we took in affile_dd_queue() */
+      log_msg_drop(pm->msg, &pm->path_options);
+      g_free(pm);
+    }
+  if (publish)
+    affile_dd_update_writer_hash(self, next, TRUE);
+  g_static_mutex_unlock(&self->lock);
+
+  affile_dd_pending_open_free(pending);
+}
+
+/*
+ * Opens the files requested by the source threads, this is the handler
+ * of the open_requested event, and also called in deinit, so that no
+ * message waiting for a file is lost.
+ */
+static void
+affile_dd_process_open_requests(gpointer s)
+{
+  AFFileDestDriver *self = (AFFileDestDriver *) s;
+  AFFileDestPendingOpen *pending;
+
+  g_static_mutex_lock(&self->lock);
+  while ((pending = g_queue_pop_head(self->open_requests)))
+    {
+      g_static_mutex_unlock(&self->lock);
+      affile_dd_open_writer(self, pending);
+      g_static_mutex_lock(&self->lock);
+    }
+  g_static_mutex_unlock(&self->lock);
+}
+
+/*
+ * Queues @msg until the writer for @filename is opened in the main thread,
+ * the caller holds self->lock. Returns TRUE if a new open request was
+ * added, in which case the caller has to post open_requested once the
+ * lock is released.
+ */
+static gboolean
+affile_dd_queue_pending(AFFileDestDriver *self, const gchar *filename, LogMessage *msg, const LogPathOptions *path_options)
+{
+  AFFileDestPendingOpen *pending;
+  AFFileDestPendingMessage *pm;
+  gboolean new_request = FALSE;
+
+  pending = g_hash_table_lookup(self->pending_opens, filename);
+  if (!pending)
+    {
+      pending = g_new0(AFFileDestPendingOpen, 1);
+      pending->filename = g_strdup(filename);
+      pending->messages = g_queue_new();
+      g_hash_table_insert(self->pending_opens, pending->filename, pending);
+      g_queue_push_tail(self->open_requests, pending);
+      new_request = TRUE;
+    }
+
+  pm = g_new0(AFFileDestPendingMessage, 1);
+  pm->msg = log_msg_ref(msg);
+  pm->path_options = *path_options;
+  pm->path_options.matched = NULL;
+  log_msg_add_ack(msg, path_options);
+  g_queue_push_tail(pending->messages, pm);
+
+  return new_request;
+}
+
+static void
+affile_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  AFFileDestDriver *self = (AFFileDestDriver *) s;
+  AFFileDestWriter *next;
+
+  if (self->flags & AFFILE_NO_EXPAND)
+    {
+      next = affile_dd_lookup_writer(self, NULL);
+      if (!next)
+        next = (AFFileDestWriter *) main_loop_call((void *(*)(void *)) affile_dd_open_single_writer, self, TRUE);
     }
   else
     {
       GString *filename;
+      gboolean new_request = FALSE;
 
       filename = g_string_sized_new(32);
       log_template_format(self->filename_template, msg, &self->template_fname_options, LTZ_LOCAL, 0, NULL, filename);
 
-      g_static_mutex_lock(&self->lock);
-      if (self->writer_hash)
-        next = g_hash_table_lookup(self->writer_hash, filename->str);
-      else
-        next = NULL;
-
-      if (next)
+      next = affile_dd_lookup_writer(self, filename->str);
+      if (!next)
         {
-          log_pipe_ref(&next->super);
-          next->queue_pending = TRUE;
+          /* not open yet, the main thread opens it while we continue
+           * with other messages. Check again with the lock held, the
+           * writer may have been published in the meantime. */
+          g_static_mutex_lock(&self->lock);
+          next = affile_dd_lookup_writer(self, filename->str);
+          if (!next)
+            new_request = affile_dd_queue_pending(self, filename->str, msg, path_options);
           g_static_mutex_unlock(&self->lock);
+
+          if (new_request)
+            iv_event_post(&self->open_requested);
         }
-      else
-	{
-	  g_static_mutex_unlock(&self->lock);
-	  args[1] = filename;
-	  next = main_loop_call((void *(*)(void *)) affile_dd_open_writer, args, TRUE);
-	}
       g_string_free(filename, TRUE);
     }
   if (next)
-    {
-      log_msg_add_ack(msg, path_options);
-      log_pipe_queue(&next->super, log_msg_ref(msg), path_options);
-      next->queue_pending = FALSE;
-      log_pipe_unref(&next->super);
-    }
+    affile_dd_queue_to_writer(next, msg, path_options);
 
   log_dest_driver_queue_method(s, msg, path_options, user_data);
 }
@@ -1161,6 +2215,11 @@ affile_dd_free(LogPipe *s)
   /* NOTE: this must be NULL as deinit has freed it, otherwise we'd have circular references */
   g_assert(self->single_writer == NULL && self->writer_hash == NULL);
 
+  /* NOTE: deinit has processed all open requests */
+  g_assert(g_queue_is_empty(self->open_requests));
+  g_hash_table_destroy(self->pending_opens);
+  g_queue_free(self->open_requests);
+
   log_template_options_destroy(&self->template_fname_options);
   log_template_unref(self->filename_template);
   log_writer_options_destroy(&self->writer_options);
@@ -1192,5 +2251,11 @@ affile_dd_new(gchar *filename, guint32 flags)
   self->time_reap = -1;
   log_template_options_defaults(&self->template_fname_options);
   g_static_mutex_init(&self->lock);
+  self->pending_opens = g_hash_table_new(g_str_hash, g_str_equal);
+  self->open_requests = g_queue_new();
+  IV_EVENT_INIT(&self->open_requested);
+  self->open_requested.cookie = self;
+  self->open_requested.handler = affile_dd_process_open_requests;
+  affile_dd_invalidate_cached_writers(self);
   return &self->super.super;
 }
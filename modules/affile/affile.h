@@ -27,6 +27,9 @@
 #include "driver.h"
 #include "logreader.h"
 #include "logwriter.h"
+#include "filemonitor.h"
+
+#include <iv.h>
 
 #define AFFILE_PIPE        0x00000001
 #define AFFILE_NO_EXPAND   0x00000002
@@ -35,6 +38,11 @@
 #define AFFILE_FSYNC       0x00000010
 #define AFFILE_PRIVILEGED  0x00000020
 
+#define AFFILE_DEFAULT_MAX_FILES 100
+
+/* how often files are checked for rotation, in milliseconds */
+#define AFFILE_ROTATE_CHECK_FREQ 1000
+
 typedef struct _AFFileSourceDriver
 {
   LogSrcDriver super;
@@ -44,9 +52,22 @@ typedef struct _AFFileSourceDriver
   LogReaderOptions reader_options;
   guint32 flags;
   /* state information to follow a set of files using a wildcard expression */
+  gchar *wildcard_dir;
+  GPatternSpec *wildcard_pattern;
+  /* basename -> AFFileSourceFile */
+  GHashTable *wildcard_files;
+  /* files with possibly unread data, waiting for a free reader slot */
+  GQueue *wildcard_pending;
+  /* files that currently have an open reader */
+  GQueue *wildcard_open;
+  gint max_files;
+  FileMonitor *wildcard_monitor;
+  struct iv_task wildcard_schedule;
+  struct iv_timer wildcard_rescan_timer;
 } AFFileSourceDriver;
 
 LogDriver *affile_sd_new(gchar *filename, guint32 flags);
+void affile_sd_set_max_files(LogDriver *s, gint max_files);
 void affile_sd_set_recursion(LogDriver *s, const gint recursion);
 void affile_sd_set_pri_level(LogDriver *s, const gint16 severity);
 void affile_sd_set_pri_facility(LogDriver *s, const gint16 facility);
@@ -71,10 +92,23 @@ typedef struct _AFFileDestDriver
   TimeZoneInfo *local_time_zone_info;
   LogWriterOptions writer_options;
   GHashTable *writer_hash;
+  /* filename -> AFFileDestPendingOpen, files being opened in the main thread */
+  GHashTable *pending_opens;
+  /* AFFileDestPendingOpen instances not yet picked up by the main thread */
+  GQueue *open_requests;
+  struct iv_event open_requested;
+  /* lockless writer lookup, see the threading notes in affile.c */
+  gint writer_epoch;
+  gint writer_readers[2];
+  gint writer_generation;
+  gint writer_hash_updating;
     
   gint overwrite_if_older;
   gboolean use_time_recvd;
   gint time_reap;
+  gint64 rotate_size;
+  gint rotate_interval;
+  gboolean rotate_compress;
 } AFFileDestDriver;
 
 LogDriver *affile_dd_new(gchar *filename, guint32 flags);
@@ -90,6 +124,9 @@ void affile_dd_set_dir_perm(LogDriver *s, gint dir_perm);
 void affile_dd_set_create_dirs(LogDriver *s, gboolean create_dirs);
 void affile_dd_set_fsync(LogDriver *s, gboolean enable);
 void affile_dd_set_overwrite_if_older(LogDriver *s, gint overwrite_if_older);
+void affile_dd_set_rotate_size(LogDriver *s, gint64 rotate_size);
+void affile_dd_set_rotate_interval(LogDriver *s, gint rotate_interval);
+void affile_dd_set_rotate_compress(LogDriver *s, gboolean rotate_compress);
 void affile_dd_set_local_time_zone(LogDriver *s, const gchar *local_time_zone);
 
 #endif
@@ -59,6 +59,8 @@ typedef struct
 
   StatsCounterItem *dropped_messages;
   StatsCounterItem *stored_messages;
+  StatsCounterItem *memory_usage;
+  StatsHistogram *latency;
 
   time_t last_msg_stamp;
 
@@ -259,6 +261,7 @@ afmongodb_worker_insert (MongoDBDestDriver *self)
   guint8 *oid;
   LogMessage *msg;
   LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  guint64 profile_start;
 
   afmongodb_dd_connect(self, TRUE);
 
@@ -271,6 +274,8 @@ afmongodb_worker_insert (MongoDBDestDriver *self)
 
   msg_set_context(msg);
 
+  /* formatting and inserting is charged to the destination, see log_pipe_profile_begin() */
+  profile_start = log_pipe_profile_begin();
   bson_reset (self->bson_sel);
   bson_reset (self->bson_upd);
   bson_reset (self->bson_set);
@@ -300,12 +305,14 @@ afmongodb_worker_insert (MongoDBDestDriver *self)
     }
 
   mongo_wire_packet_free (p);
+  log_pipe_profile_end(&self->super.super.super, profile_start);
 
   msg_set_context(NULL);
 
   if (success)
     {
       stats_counter_inc(self->stored_messages);
+      stats_histogram_record_latency(self->latency, msg->timestamps[LM_TS_RECVD].tv_sec, msg->timestamps[LM_TS_RECVD].tv_usec);
       step_sequence_number(&self->seq_num);
       log_msg_ack(msg, &path_options);
       log_msg_unref(msg);
@@ -448,9 +455,16 @@ afmongodb_dd_init(LogPipe *s)
   stats_register_counter(0, SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
 			 afmongodb_dd_format_stats_instance(self),
 			 SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_register_counter(0, SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
+			 afmongodb_dd_format_stats_instance(self),
+			 SC_TYPE_MEMORY, &self->memory_usage);
+  stats_register_histogram(0, SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
+			   afmongodb_dd_format_stats_instance(self),
+			   &self->latency);
   stats_unlock();
 
   log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages);
+  log_queue_set_memory_counter(self->queue, self->memory_usage);
   afmongodb_dd_start_thread(self);
 
   return TRUE;
@@ -464,6 +478,7 @@ afmongodb_dd_deinit(LogPipe *s)
   afmongodb_dd_stop_thread(self);
 
   log_queue_set_counters(self->queue, NULL, NULL);
+  log_queue_set_memory_counter(self->queue, NULL);
   stats_lock();
   stats_unregister_counter(SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
 			   afmongodb_dd_format_stats_instance(self),
@@ -471,6 +486,12 @@ afmongodb_dd_deinit(LogPipe *s)
   stats_unregister_counter(SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
 			   afmongodb_dd_format_stats_instance(self),
 			   SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_unregister_counter(SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
+			   afmongodb_dd_format_stats_instance(self),
+			   SC_TYPE_MEMORY, &self->memory_usage);
+  stats_unregister_histogram(SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
+			     afmongodb_dd_format_stats_instance(self),
+			     &self->latency);
   stats_unlock();
   if (!log_dest_driver_deinit_method(s))
     return FALSE;
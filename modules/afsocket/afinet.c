@@ -526,14 +526,12 @@ afinet_dd_apply_transport(AFSocketDestDriver *s)
 }
 
 static gboolean
-afinet_dd_setup_socket(AFSocketDestDriver *s, gint fd)
+afinet_dd_setup_socket(AFSocketDestDriver *s, AFSocketDestConnection *conn, gint fd)
 {
-  AFInetDestDriver *self = (AFInetDestDriver *) s;
-
-  if (!resolve_hostname(&self->super.dest_addr, self->super.hostname))
+  if (!resolve_hostname(&conn->dest_addr, conn->hostname))
     return FALSE;
 
-  return afinet_setup_socket(fd, self->super.dest_addr, (InetSocketOptions *) s->sock_options_ptr, AFSOCKET_DIR_SEND);
+  return afinet_setup_socket(fd, conn->dest_addr, (InetSocketOptions *) s->sock_options_ptr, AFSOCKET_DIR_SEND);
 }
 
 static gboolean
@@ -570,7 +568,7 @@ afinet_dd_init(LogPipe *s)
 
 #if ENABLE_SPOOF_SOURCE
 static gboolean
-afinet_dd_construct_ipv4_packet(AFInetDestDriver *self, LogMessage *msg, GString *msg_line)
+afinet_dd_construct_ipv4_packet(AFInetDestDriver *self, AFSocketDestConnection *conn, LogMessage *msg, GString *msg_line)
 {
   libnet_ptag_t ip, udp;
   struct sockaddr_in *src, *dst;
@@ -579,9 +577,7 @@ afinet_dd_construct_ipv4_packet(AFInetDestDriver *self, LogMessage *msg, GString
     return FALSE;
 
   src = (struct sockaddr_in *) &msg->saddr->sa;
-  dst = (struct sockaddr_in *) &self->super.dest_addr->sa;
-
-  libnet_clear_packet(self->lnet_ctx);
+  dst = (struct sockaddr_in *) &conn->dest_addr->sa;
 
   udp = libnet_build_udp(ntohs(src->sin_port),
                          ntohs(dst->sin_port),
@@ -590,9 +586,10 @@ afinet_dd_construct_ipv4_packet(AFInetDestDriver *self, LogMessage *msg, GString
                          (guchar *) msg_line->str,
                          msg_line->len,
                          self->lnet_ctx,
-                         0);
+                         self->lnet_udp_tag);
   if (udp == -1)
     return FALSE;
+  self->lnet_udp_tag = udp;
 
   ip = libnet_build_ipv4(LIBNET_IPV4_H + msg_line->len + LIBNET_UDP_H,
                          IPTOS_LOWDELAY,         /* IP tos */
@@ -606,16 +603,17 @@ afinet_dd_construct_ipv4_packet(AFInetDestDriver *self, LogMessage *msg, GString
                          NULL,                   /* payload (none) */
                          0,                      /* payload length */
                          self->lnet_ctx,
-                         0);
+                         self->lnet_ip_tag);
   if (ip == -1)
     return FALSE;
+  self->lnet_ip_tag = ip;
 
   return TRUE;
 }
 
 #if ENABLE_IPV6
 static gboolean
-afinet_dd_construct_ipv6_packet(AFInetDestDriver *self, LogMessage *msg, GString *msg_line)
+afinet_dd_construct_ipv6_packet(AFInetDestDriver *self, AFSocketDestConnection *conn, LogMessage *msg, GString *msg_line)
 {
   libnet_ptag_t ip, udp;
   struct sockaddr_in *src4;
@@ -642,9 +640,7 @@ afinet_dd_construct_ipv6_packet(AFInetDestDriver *self, LogMessage *msg, GString
       break;
     }
 
-  dst = (struct sockaddr_in6 *) &self->super.dest_addr->sa;
-
-  libnet_clear_packet(self->lnet_ctx);
+  dst = (struct sockaddr_in6 *) &conn->dest_addr->sa;
 
   udp = libnet_build_udp(ntohs(src.sin6_port),
                          ntohs(dst->sin6_port),
@@ -653,9 +649,10 @@ afinet_dd_construct_ipv6_packet(AFInetDestDriver *self, LogMessage *msg, GString
                          (guchar *) msg_line->str,
                          msg_line->len,
                          self->lnet_ctx,
-                         0);
+                         self->lnet_udp_tag);
   if (udp == -1)
     return FALSE;
+  self->lnet_udp_tag = udp;
 
   /* There seems to be a bug in libnet 1.1.2 that is triggered when
    * checksumming UDP6 packets. This is a workaround below. */
@@ -671,10 +668,11 @@ afinet_dd_construct_ipv6_packet(AFInetDestDriver *self, LogMessage *msg, GString
                          ln_src, ln_dst,
                          NULL, 0,                /* payload and its length */
                          self->lnet_ctx,
-                         0);
+                         self->lnet_ip_tag);
 
   if (ip == -1)
     return FALSE;
+  self->lnet_ip_tag = ip;
 
   return TRUE;
 }
@@ -687,29 +685,36 @@ afinet_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options,
 {
 #if ENABLE_SPOOF_SOURCE
   AFInetDestDriver *self = (AFInetDestDriver *) s;
+  AFSocketDestConnection *conn = NULL;
 
   /* NOTE: this code should probably become a LogTransport instance so that
    * spoofed packets are also going through the LogWriter queue */
 
-  if (self->spoof_source && self->lnet_ctx && msg->saddr && (msg->saddr->sa.sa_family == AF_INET || msg->saddr->sa.sa_family == AF_INET6) && log_writer_opened((LogWriter *) self->super.writer))
+  if (self->spoof_source && self->lnet_ctx && msg->saddr && (msg->saddr->sa.sa_family == AF_INET || msg->saddr->sa.sa_family == AF_INET6))
+    conn = afsocket_dd_select_connection(&self->super, msg);
+
+  if (conn && log_writer_opened((LogWriter *) conn->writer))
     {
       gboolean success = FALSE;
 
       g_assert((self->super.flags & AFSOCKET_DGRAM) != 0);
 
+      /* NOTE: the headers built by the previous message are updated in
+       * place instead of being rebuilt, see lnet_udp_tag/lnet_ip_tag */
+
       g_static_mutex_lock(&self->lnet_lock);
       if (!self->lnet_buffer)
         self->lnet_buffer = g_string_sized_new(256);
-      log_writer_format_log((LogWriter *) self->super.writer, msg, self->lnet_buffer);
+      log_writer_format_log((LogWriter *) conn->writer, msg, self->lnet_buffer);
 
-      switch (self->super.dest_addr->sa.sa_family)
+      switch (conn->dest_addr->sa.sa_family)
         {
         case AF_INET:
-          success = afinet_dd_construct_ipv4_packet(self, msg, self->lnet_buffer);
+          success = afinet_dd_construct_ipv4_packet(self, conn, msg, self->lnet_buffer);
           break;
 #if ENABLE_IPV6
         case AF_INET6:
-          success = afinet_dd_construct_ipv6_packet(self, msg, self->lnet_buffer);
+          success = afinet_dd_construct_ipv6_packet(self, conn, msg, self->lnet_buffer);
           break;
 #endif
         default:
@@ -733,6 +738,12 @@ afinet_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options,
                         NULL);
             }
         }
+      else
+        {
+          /* start over with a clean packet */
+          libnet_clear_packet(self->lnet_ctx);
+          self->lnet_udp_tag = self->lnet_ip_tag = 0;
+        }
       g_static_mutex_unlock(&self->lnet_lock);
     }
 #endif
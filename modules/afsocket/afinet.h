@@ -70,6 +70,9 @@ typedef struct _AFInetDestDriver
   libnet_t *lnet_ctx;
   GStaticMutex lnet_lock;
   GString *lnet_buffer;
+  /* the packet built in lnet_ctx is reused for each message, these refer
+   * to its headers, 0 if they have not been built yet */
+  libnet_ptag_t lnet_udp_tag, lnet_ip_tag;
 #endif
   /* character as it can contain a service name from /etc/services */
   gchar *bind_port;
@@ -68,6 +68,10 @@ static CfgLexerKeyword afsocket_keywords[] = {
   { "transport",          KW_TRANSPORT },
   { "max_connections",    KW_MAX_CONNECTIONS },
   { "keep_alive",         KW_KEEP_ALIVE },
+  { "servers",            KW_SERVERS },
+  { "workers",            KW_WORKERS },
+  { "balance",            KW_BALANCE },
+  { "balance_key",        KW_BALANCE_KEY },
   { NULL }
 };
 
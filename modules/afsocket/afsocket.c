@@ -33,6 +33,7 @@
 #include "gsocket.h"
 #include "stats.h"
 #include "mainloop.h"
+#include "scratch-buffers.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -50,6 +51,8 @@ int allow_severity = 0;
 int deny_severity = 0;
 #endif
 
+/* the number of bytes batched into a single write() on stream destinations */
+#define AFSOCKET_DEST_RECORD_SIZE 65536
 
 
 typedef struct _AFSocketSourceConnection
@@ -379,10 +382,17 @@ afsocket_sd_set_keep_alive(LogDriver *s, gint enable)
 {
   AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
 
+  /* without keep-alive, reload is expected to close the connections */
   if (enable)
-    self->flags |= AFSOCKET_KEEP_ALIVE;
+    {
+      self->flags |= AFSOCKET_KEEP_ALIVE;
+      s->super.flags |= PIF_KEEP_ON_RELOAD;
+    }
   else
-    self->flags &= ~AFSOCKET_KEEP_ALIVE;
+    {
+      self->flags &= ~AFSOCKET_KEEP_ALIVE;
+      s->super.flags &= ~PIF_KEEP_ON_RELOAD;
+    }
 }
 
 void
@@ -795,6 +805,7 @@ void
 afsocket_sd_init_instance(AFSocketSourceDriver *self, SocketOptions *sock_options, gint family, guint32 flags)
 {
   log_src_driver_init_instance(&self->super);
+  self->super.super.super.flags |= PIF_KEEP_ON_RELOAD;
 
   self->super.super.super.init = afsocket_sd_init;
   self->super.super.super.deinit = afsocket_sd_deinit;
@@ -866,22 +877,71 @@ afsocket_dd_set_keep_alive(LogDriver *s, gint enable)
 {
   AFSocketDestDriver *self = (AFSocketDestDriver *) s;
 
+  /* without keep-alive, reload is expected to close the connections */
   if (enable)
-    self->flags |= AFSOCKET_KEEP_ALIVE;
+    {
+      self->flags |= AFSOCKET_KEEP_ALIVE;
+      s->super.flags |= PIF_KEEP_ON_RELOAD;
+    }
   else
-    self->flags &= ~AFSOCKET_KEEP_ALIVE;
+    {
+      self->flags &= ~AFSOCKET_KEEP_ALIVE;
+      s->super.flags &= ~PIF_KEEP_ON_RELOAD;
+    }
+}
+
+
+void
+afsocket_dd_set_workers(LogDriver *s, gint workers)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  self->workers = MAX(workers, 1);
 }
 
+void
+afsocket_dd_set_servers(LogDriver *s, GList *servers)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  string_list_free(self->servers);
+  self->servers = servers;
+}
+
+gboolean
+afsocket_dd_set_balance(LogDriver *s, const gchar *balance)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  if (strcasecmp(balance, "round-robin") == 0 || strcasecmp(balance, "round_robin") == 0)
+    self->balance = AFSOCKET_BALANCE_ROUND_ROBIN;
+  else if (strcasecmp(balance, "hash") == 0)
+    self->balance = AFSOCKET_BALANCE_HASH;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+void
+afsocket_dd_set_balance_key(LogDriver *s, const gchar *balance_key)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  if (!self->balance_key)
+    self->balance_key = log_template_new(configuration, NULL);
+  log_template_compile(self->balance_key, balance_key, NULL);
+  self->balance = AFSOCKET_BALANCE_HASH;
+}
 
 static gchar *
-afsocket_dd_format_persist_name(AFSocketDestDriver *self, gboolean qfile)
+afsocket_dd_format_persist_name(AFSocketDestConnection *conn, gboolean qfile)
 {
   static gchar persist_name[128];
 
   g_snprintf(persist_name, sizeof(persist_name),
              qfile ? "afsocket_dd_qfile(%s,%s)" : "afsocket_dd_connection(%s,%s)",
-             !!(self->flags & AFSOCKET_STREAM) ? "stream" : "dgram",
-             self->dest_name);
+             !!(conn->owner->flags & AFSOCKET_STREAM) ? "stream" : "dgram",
+             conn->dest_name);
   return persist_name;
 }
 
@@ -919,17 +979,17 @@ afsocket_dd_stats_source(AFSocketDestDriver *self)
 }
 
 static gchar *
-afsocket_dd_stats_instance(AFSocketDestDriver *self)
+afsocket_dd_stats_instance(AFSocketDestConnection *conn)
 {
-  if ((self->flags & AFSOCKET_SYSLOG_PROTOCOL) == 0)
+  if ((conn->owner->flags & AFSOCKET_SYSLOG_PROTOCOL) == 0)
     {
-      return self->dest_name;
+      return conn->dest_name;
     }
   else
     {
       static gchar buf[256];
 
-      g_snprintf(buf, sizeof(buf), "%s,%s", self->transport, self->dest_name);
+      g_snprintf(buf, sizeof(buf), "%s,%s", conn->owner->transport, conn->dest_name);
       return buf;
     }
 }
@@ -938,77 +998,78 @@ afsocket_dd_stats_instance(AFSocketDestDriver *self)
 static gint
 afsocket_dd_tls_verify_callback(gint ok, X509_STORE_CTX *ctx, gpointer user_data)
 {
-  AFSocketDestDriver *self = (AFSocketDestDriver *) user_data;
+  AFSocketDestConnection *conn = (AFSocketDestConnection *) user_data;
 
-  if (ok && ctx->current_cert == ctx->cert && self->hostname && (self->tls_context->verify_mode & TVM_TRUSTED))
+  if (ok && ctx->current_cert == ctx->cert && conn->hostname && (conn->owner->tls_context->verify_mode & TVM_TRUSTED))
     {
-      ok = tls_verify_certificate_name(ctx->cert, self->hostname);
+      ok = tls_verify_certificate_name(ctx->cert, conn->hostname);
     }
 
   return ok;
 }
 #endif
 
-static gboolean afsocket_dd_connected(AFSocketDestDriver *self);
-static void afsocket_dd_reconnect(AFSocketDestDriver *self);
+static gboolean afsocket_dd_connected(AFSocketDestConnection *conn);
+static void afsocket_dd_reconnect(AFSocketDestConnection *conn);
 
 static void
-afsocket_dd_init_watches(AFSocketDestDriver *self)
+afsocket_dd_init_watches(AFSocketDestConnection *conn)
 {
-  IV_FD_INIT(&self->connect_fd);
-  self->connect_fd.cookie = self;
-  self->connect_fd.handler_out = (void (*)(void *)) afsocket_dd_connected;
+  IV_FD_INIT(&conn->connect_fd);
+  conn->connect_fd.cookie = conn;
+  conn->connect_fd.handler_out = (void (*)(void *)) afsocket_dd_connected;
 
-  IV_TIMER_INIT(&self->reconnect_timer);
-  self->reconnect_timer.cookie = self;
-  self->reconnect_timer.handler = (void (*)(void *)) afsocket_dd_reconnect;
+  IV_TIMER_INIT(&conn->reconnect_timer);
+  conn->reconnect_timer.cookie = conn;
+  conn->reconnect_timer.handler = (void (*)(void *)) afsocket_dd_reconnect;
 }
 
 static void
-afsocket_dd_start_watches(AFSocketDestDriver *self)
+afsocket_dd_start_watches(AFSocketDestConnection *conn)
 {
   main_loop_assert_main_thread();
 
-  self->connect_fd.fd = self->fd;
-  iv_fd_register(&self->connect_fd);
+  conn->connect_fd.fd = conn->fd;
+  iv_fd_register(&conn->connect_fd);
 }
 
 static void
-afsocket_dd_stop_watches(AFSocketDestDriver *self)
+afsocket_dd_stop_watches(AFSocketDestConnection *conn)
 {
   main_loop_assert_main_thread();
 
-  if (iv_fd_registered(&self->connect_fd))
+  if (iv_fd_registered(&conn->connect_fd))
     {
-      iv_fd_unregister(&self->connect_fd);
+      iv_fd_unregister(&conn->connect_fd);
 
       /* need to close the fd in this case as it wasn't established yet */
       msg_verbose("Closing connecting fd",
-                  evt_tag_int("fd", self->fd),
+                  evt_tag_int("fd", conn->fd),
                   NULL);
-      close(self->fd);
+      close(conn->fd);
     }
-  if (iv_timer_registered(&self->reconnect_timer))
-    iv_timer_unregister(&self->reconnect_timer);
+  if (iv_timer_registered(&conn->reconnect_timer))
+    iv_timer_unregister(&conn->reconnect_timer);
 }
 
 static void
-afsocket_dd_start_reconnect_timer(AFSocketDestDriver *self)
+afsocket_dd_start_reconnect_timer(AFSocketDestConnection *conn)
 {
   main_loop_assert_main_thread();
 
-  if (iv_timer_registered(&self->reconnect_timer))
-    iv_timer_unregister(&self->reconnect_timer);
+  if (iv_timer_registered(&conn->reconnect_timer))
+    iv_timer_unregister(&conn->reconnect_timer);
   iv_validate_now();
 
-  self->reconnect_timer.expires = iv_now;
-  timespec_add_msec(&self->reconnect_timer.expires, self->time_reopen * 1000);
-  iv_timer_register(&self->reconnect_timer);
+  conn->reconnect_timer.expires = iv_now;
+  timespec_add_msec(&conn->reconnect_timer.expires, conn->owner->time_reopen * 1000);
+  iv_timer_register(&conn->reconnect_timer);
 }
 
 static gboolean
-afsocket_dd_connected(AFSocketDestDriver *self)
+afsocket_dd_connected(AFSocketDestConnection *conn)
 {
+  AFSocketDestDriver *self = conn->owner;
   gchar buf1[256], buf2[256];
   int error = 0;
   socklen_t errorlen = sizeof(error);
@@ -1018,17 +1079,17 @@ afsocket_dd_connected(AFSocketDestDriver *self)
 
   main_loop_assert_main_thread();
 
-  if (iv_fd_registered(&self->connect_fd))
-    iv_fd_unregister(&self->connect_fd);
+  if (iv_fd_registered(&conn->connect_fd))
+    iv_fd_unregister(&conn->connect_fd);
 
   if (self->flags & AFSOCKET_STREAM)
     {
       transport_flags |= LTF_SHUTDOWN;
-      if (getsockopt(self->fd, SOL_SOCKET, SO_ERROR, &error, &errorlen) == -1)
+      if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &errorlen) == -1)
         {
           msg_error("getsockopt(SOL_SOCKET, SO_ERROR) failed for connecting socket",
-                    evt_tag_int("fd", self->fd),
-                    evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
+                    evt_tag_int("fd", conn->fd),
+                    evt_tag_str("server", g_sockaddr_format(conn->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
                     evt_tag_errno(EVT_TAG_OSERROR, errno),
                     evt_tag_int("time_reopen", self->time_reopen),
                     NULL);
@@ -1037,8 +1098,8 @@ afsocket_dd_connected(AFSocketDestDriver *self)
       if (error)
         {
           msg_error("Syslog connection failed",
-                    evt_tag_int("fd", self->fd),
-                    evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
+                    evt_tag_int("fd", conn->fd),
+                    evt_tag_str("server", g_sockaddr_format(conn->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
                     evt_tag_errno(EVT_TAG_OSERROR, error),
                     evt_tag_int("time_reopen", self->time_reopen),
                     NULL);
@@ -1046,8 +1107,8 @@ afsocket_dd_connected(AFSocketDestDriver *self)
         }
     }
   msg_notice("Syslog connection established",
-              evt_tag_int("fd", self->fd),
-              evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
+              evt_tag_int("fd", conn->fd),
+              evt_tag_str("server", g_sockaddr_format(conn->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
               evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf1, sizeof(buf1), GSA_FULL)),
               NULL);
 
@@ -1063,37 +1124,56 @@ afsocket_dd_connected(AFSocketDestDriver *self)
           goto error_reconnect;
         }
 
-      tls_session_set_verify(tls_session, afsocket_dd_tls_verify_callback, self, NULL);
-      transport = log_transport_tls_new(tls_session, self->fd, transport_flags);
+      tls_session_set_verify(tls_session, afsocket_dd_tls_verify_callback, conn, NULL);
+      transport = log_transport_tls_new(tls_session, conn->fd, transport_flags);
     }
   else
 #endif
-    transport = log_transport_plain_new(self->fd, transport_flags);
+    transport = log_transport_plain_new(conn->fd, transport_flags);
 
   if (self->flags & AFSOCKET_SYSLOG_PROTOCOL)
     {
       if (self->flags & AFSOCKET_STREAM)
         proto = log_proto_framed_client_new(transport);
       else
-        proto = log_proto_text_client_new(transport);
+        proto = log_proto_dgram_client_new(transport, self->writer_options.flush_lines);
+    }
+  else if (self->flags & AFSOCKET_DGRAM)
+    {
+      proto = log_proto_dgram_client_new(transport, self->writer_options.flush_lines);
     }
   else
     {
       proto = log_proto_text_client_new(transport);
     }
 
-  log_writer_reopen(self->writer, proto);
+  /* batch messages into a single write on stream sockets. With TLS,
+   * chunks are limited to the size of a TLS record so that each write
+   * produces a single full record. */
+  if (self->flags & AFSOCKET_STREAM)
+    {
+#if ENABLE_SSL
+      if (self->tls_context)
+        log_proto_text_client_set_record_size(proto, SSL3_RT_MAX_PLAIN_LENGTH, self->writer_options.flush_lines);
+      else
+#endif
+        log_proto_text_client_set_record_size(proto, AFSOCKET_DEST_RECORD_SIZE, self->writer_options.flush_lines);
+    }
+
+  log_writer_reopen(conn->writer, proto);
+  conn->up = TRUE;
   return TRUE;
  error_reconnect:
-  close(self->fd);
-  self->fd = -1;
-  afsocket_dd_start_reconnect_timer(self);
+  close(conn->fd);
+  conn->fd = -1;
+  afsocket_dd_start_reconnect_timer(conn);
   return FALSE;
 }
 
 static gboolean
-afsocket_dd_start_connect(AFSocketDestDriver *self)
+afsocket_dd_start_connect(AFSocketDestConnection *conn)
 {
+  AFSocketDestDriver *self = conn->owner;
   int sock, rc;
   gchar buf1[MAX_SOCKADDR_STRING], buf2[MAX_SOCKADDR_STRING];
 
@@ -1103,33 +1183,33 @@ afsocket_dd_start_connect(AFSocketDestDriver *self)
       return FALSE;
     }
 
-  if (self->setup_socket && !self->setup_socket(self, sock))
+  if (self->setup_socket && !self->setup_socket(self, conn, sock))
     {
       close(sock);
       return FALSE;
     }
 
-  g_assert(self->dest_addr);
+  g_assert(conn->dest_addr);
 
-  rc = g_connect(sock, self->dest_addr);
+  rc = g_connect(sock, conn->dest_addr);
   if (rc == G_IO_STATUS_NORMAL)
     {
-      self->fd = sock;
-      afsocket_dd_connected(self);
+      conn->fd = sock;
+      afsocket_dd_connected(conn);
     }
   else if (rc == G_IO_STATUS_ERROR && errno == EINPROGRESS)
     {
       /* we must wait until connect succeeds */
 
-      self->fd = sock;
-      afsocket_dd_start_watches(self);
+      conn->fd = sock;
+      afsocket_dd_start_watches(conn);
     }
   else
     {
       /* error establishing connection */
       msg_error("Connection failed",
                 evt_tag_int("fd", sock),
-                evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
+                evt_tag_str("server", g_sockaddr_format(conn->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
                 evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf1, sizeof(buf1), GSA_FULL)),
                 evt_tag_errno(EVT_TAG_OSERROR, errno),
                 NULL);
@@ -1141,22 +1221,203 @@ afsocket_dd_start_connect(AFSocketDestDriver *self)
 }
 
 static void
-afsocket_dd_reconnect(AFSocketDestDriver *self)
+afsocket_dd_reconnect(AFSocketDestConnection *conn)
 {
-  if (!afsocket_dd_start_connect(self))
+  if (!afsocket_dd_start_connect(conn))
     {
       msg_error("Initiating connection failed, reconnecting",
-                evt_tag_int("time_reopen", self->time_reopen),
+                evt_tag_str("server", conn->dest_name),
+                evt_tag_int("time_reopen", conn->owner->time_reopen),
                 NULL);
-      afsocket_dd_start_reconnect_timer(self);
+      afsocket_dd_start_reconnect_timer(conn);
+    }
+}
+
+/*
+ * Selects the connection @msg is to be sent to.  Messages are distributed
+ * between the connections that are up, either round-robin or based on
+ * the hash of the balance_key() template, so that messages with the
+ * same key end up at the same connection (and keep their order) as long
+ * as the set of available connections doesn't change.  A failed
+ * connection is left out until it is reestablished after time_reopen().
+ * If none of the connections is up, the messages are distributed among
+ * all of them, and are kept in their queues until they reconnect.
+ *
+ * NOTE: this runs in the worker threads, conn->up is changed by the main
+ * thread, a slightly out of date value only affects the distribution.
+ */
+AFSocketDestConnection *
+afsocket_dd_select_connection(AFSocketDestDriver *self, LogMessage *msg)
+{
+  AFSocketDestConnection *conn;
+  guint up_count = 0;
+  guint n, i;
+
+  if (self->connections->len == 1)
+    return g_ptr_array_index(self->connections, 0);
+
+  for (i = 0; i < self->connections->len; i++)
+    {
+      conn = g_ptr_array_index(self->connections, i);
+      if (conn->up)
+        up_count++;
+    }
+
+  if (self->balance == AFSOCKET_BALANCE_HASH)
+    {
+      ScratchBuffer *sb = scratch_buffer_acquire();
+
+      log_template_format(self->balance_key, msg, &self->writer_options.template_options, LTZ_SEND, 0, NULL, sb_string(sb));
+      n = g_str_hash(sb_string(sb)->str);
+      scratch_buffer_release(sb);
+    }
+  else
+    {
+      n = (guint) g_atomic_int_exchange_and_add(&self->balance_counter, 1);
+    }
+
+  if (up_count == 0)
+    return g_ptr_array_index(self->connections, n % self->connections->len);
+
+  n %= up_count;
+  for (i = 0; i < self->connections->len; i++)
+    {
+      conn = g_ptr_array_index(self->connections, i);
+      if (conn->up && n-- == 0)
+        return conn;
+    }
+
+  /* the set of available connections changed in the meanwhile */
+  return g_ptr_array_index(self->connections, 0);
+}
+
+typedef struct _AFSocketDestBalancer
+{
+  LogPipe super;
+  AFSocketDestDriver *owner;
+} AFSocketDestBalancer;
+
+static void
+afsocket_dd_balancer_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  AFSocketDestBalancer *self = (AFSocketDestBalancer *) s;
+  AFSocketDestConnection *conn;
+
+  conn = afsocket_dd_select_connection(self->owner, msg);
+  log_pipe_queue(conn->writer, msg, path_options);
+}
+
+static LogPipe *
+afsocket_dd_balancer_new(AFSocketDestDriver *owner)
+{
+  AFSocketDestBalancer *self = g_new0(AFSocketDestBalancer, 1);
+
+  log_pipe_init_instance(&self->super);
+  self->super.queue = afsocket_dd_balancer_queue;
+  self->owner = owner;
+  return &self->super;
+}
+
+static gchar *
+afsocket_dd_format_dest_name(AFSocketDestDriver *self, const gchar *hostname)
+{
+  gint port = 0;
+
+  if (g_sockaddr_inet_check(self->dest_addr))
+    port = g_sockaddr_inet_get_port(self->dest_addr);
+#if ENABLE_IPV6
+  else if (g_sockaddr_inet6_check(self->dest_addr))
+    port = g_sockaddr_inet6_get_port(self->dest_addr);
+#endif
+  return g_strdup_printf("%s:%d", hostname, port);
+}
+
+static AFSocketDestConnection *
+afsocket_dd_connection_new(AFSocketDestDriver *owner, const gchar *hostname, const gchar *dest_name)
+{
+  AFSocketDestConnection *conn = g_new0(AFSocketDestConnection, 1);
+
+  conn->owner = owner;
+  conn->hostname = g_strdup(hostname);
+  conn->dest_name = g_strdup(dest_name);
+  /* the address is resolved by setup_socket() using hostname */
+  conn->dest_addr = g_sockaddr_new(&owner->dest_addr->sa, owner->dest_addr->salen);
+  conn->fd = -1;
+  afsocket_dd_init_watches(conn);
+  return conn;
+}
+
+/*
+ * Adds the connections to a single server, one for each worker. Each of
+ * them has its own writer and queue, and they are flushed by separate
+ * I/O jobs, so formatting and sending is spread over several threads.
+ * The first one uses the same name (and thus persist and stats names)
+ * as a destination without workers.
+ */
+static void
+afsocket_dd_add_connections(AFSocketDestDriver *self, const gchar *hostname, const gchar *dest_name)
+{
+  gint worker;
+
+  g_ptr_array_add(self->connections, afsocket_dd_connection_new(self, hostname, dest_name));
+  for (worker = 1; worker < self->workers; worker++)
+    {
+      gchar *worker_dest_name = g_strdup_printf("%s#%d", dest_name, worker);
+
+      g_ptr_array_add(self->connections, afsocket_dd_connection_new(self, hostname, worker_dest_name));
+      g_free(worker_dest_name);
     }
 }
 
+static void
+afsocket_dd_connection_free(AFSocketDestConnection *conn)
+{
+  log_pipe_unref(conn->writer);
+  g_sockaddr_unref(conn->dest_addr);
+  g_free(conn->hostname);
+  g_free(conn->dest_name);
+  g_free(conn);
+}
+
+static void
+afsocket_dd_connection_init(AFSocketDestConnection *conn)
+{
+  AFSocketDestDriver *self = conn->owner;
+  GlobalConfig *cfg = log_pipe_get_config(&self->super.super.super);
+
+  conn->writer = cfg_persist_config_fetch(cfg, afsocket_dd_format_persist_name(conn, FALSE));
+  if (!conn->writer)
+    {
+      /* NOTE: we open our writer with no fd, so we can send messages down there
+       * even while the connection is not established */
+
+      conn->writer = log_writer_new(LW_FORMAT_PROTO |
+#if ENABLE_SSL
+                                    (((self->flags & AFSOCKET_STREAM) && !self->tls_context) ? LW_DETECT_EOF : 0) |
+#else
+                                    ((self->flags & AFSOCKET_STREAM) ? LW_DETECT_EOF : 0) |
+#endif
+                                    (self->flags & AFSOCKET_SYSLOG_PROTOCOL ? LW_SYSLOG_PROTOCOL : 0));
+
+    }
+  log_writer_set_options((LogWriter *) conn->writer, &self->super.super.super, &self->writer_options, 0, afsocket_dd_stats_source(self), self->super.super.id, afsocket_dd_stats_instance(conn));
+  log_writer_set_queue(conn->writer, log_dest_driver_acquire_queue(&self->super, afsocket_dd_format_persist_name(conn, TRUE)));
+
+  log_pipe_init(conn->writer, NULL);
+
+  /* a writer kept alive across reloads is still connected */
+  conn->up = log_writer_opened((LogWriter *) conn->writer);
+  if (!conn->up)
+    afsocket_dd_reconnect(conn);
+}
+
 gboolean
 afsocket_dd_init(LogPipe *s)
 {
   AFSocketDestDriver *self = (AFSocketDestDriver *) s;
   GlobalConfig *cfg = log_pipe_get_config(s);
+  GList *l;
+  guint i;
 
   if (!log_dest_driver_init_method(s))
     return FALSE;
@@ -1176,29 +1437,30 @@ afsocket_dd_init(LogPipe *s)
     }
 
   log_writer_options_init(&self->writer_options, cfg, 0);
-  self->writer = cfg_persist_config_fetch(cfg, afsocket_dd_format_persist_name(self, FALSE));
-  if (!self->writer)
+  if (self->balance == AFSOCKET_BALANCE_HASH && !self->balance_key)
     {
-      /* NOTE: we open our writer with no fd, so we can send messages down there
-       * even while the connection is not established */
+      /* keep the messages of a host together by default */
+      self->balance_key = log_template_new(cfg, NULL);
+      log_template_compile(self->balance_key, "$HOST", NULL);
+    }
 
-      self->writer = log_writer_new(LW_FORMAT_PROTO |
-#if ENABLE_SSL
-                                    (((self->flags & AFSOCKET_STREAM) && !self->tls_context) ? LW_DETECT_EOF : 0) |
-#else
-                                    ((self->flags & AFSOCKET_STREAM) ? LW_DETECT_EOF : 0) |
-#endif
-                                    (self->flags & AFSOCKET_SYSLOG_PROTOCOL ? LW_SYSLOG_PROTOCOL : 0));
+  self->connections = g_ptr_array_new();
+  afsocket_dd_add_connections(self, self->hostname, self->dest_name);
+  for (l = self->servers; l; l = l->next)
+    {
+      gchar *dest_name = afsocket_dd_format_dest_name(self, (gchar *) l->data);
 
+      afsocket_dd_add_connections(self, (gchar *) l->data, dest_name);
+      g_free(dest_name);
     }
-  log_writer_set_options((LogWriter *) self->writer, &self->super.super.super, &self->writer_options, 0, afsocket_dd_stats_source(self), self->super.super.id, afsocket_dd_stats_instance(self));
-  log_writer_set_queue(self->writer, log_dest_driver_acquire_queue(&self->super, afsocket_dd_format_persist_name(self, TRUE)));
 
-  log_pipe_init(self->writer, NULL);
-  log_pipe_append(&self->super.super.super, self->writer);
+  for (i = 0; i < self->connections->len; i++)
+    afsocket_dd_connection_init(g_ptr_array_index(self->connections, i));
 
-  if (!log_writer_opened((LogWriter *) self->writer))
-    afsocket_dd_reconnect(self);
+  if (self->connections->len == 1)
+    log_pipe_append(&self->super.super.super, ((AFSocketDestConnection *) g_ptr_array_index(self->connections, 0))->writer);
+  else
+    log_pipe_append(&self->super.super.super, self->balancer);
   return TRUE;
 }
 
@@ -1207,17 +1469,30 @@ afsocket_dd_deinit(LogPipe *s)
 {
   AFSocketDestDriver *self = (AFSocketDestDriver *) s;
   GlobalConfig *cfg = log_pipe_get_config(s);
+  guint i;
+
+  for (i = 0; self->connections && i < self->connections->len; i++)
+    {
+      AFSocketDestConnection *conn = g_ptr_array_index(self->connections, i);
 
-  afsocket_dd_stop_watches(self);
+      afsocket_dd_stop_watches(conn);
 
-  if (self->writer)
-    log_pipe_deinit(self->writer);
+      if (conn->writer)
+        log_pipe_deinit(conn->writer);
 
-  if (self->flags & AFSOCKET_KEEP_ALIVE)
+      if (self->flags & AFSOCKET_KEEP_ALIVE)
+        {
+          cfg_persist_config_add(cfg, afsocket_dd_format_persist_name(conn, FALSE), conn->writer, (GDestroyNotify) log_pipe_unref, FALSE);
+          conn->writer = NULL;
+        }
+      afsocket_dd_connection_free(conn);
+    }
+  if (self->connections)
     {
-      cfg_persist_config_add(cfg, afsocket_dd_format_persist_name(self, FALSE), self->writer, (GDestroyNotify) log_pipe_unref, FALSE);
-      self->writer = NULL;
+      g_ptr_array_free(self->connections, TRUE);
+      self->connections = NULL;
     }
+  log_pipe_append(&self->super.super.super, NULL);
 
   if (!log_dest_driver_deinit_method(s))
     return FALSE;
@@ -1225,30 +1500,98 @@ afsocket_dd_deinit(LogPipe *s)
   return TRUE;
 }
 
+/*
+ * Moves the messages queued for a failed connection back to the
+ * balancer, so that they are delivered by the connections that are
+ * still up instead of waiting for time_reopen().  If no other
+ * connection is available, they are kept where they are.
+ *
+ * NOTE: runs in the main thread once the writer of @conn has been
+ * stopped, thus nothing consumes its queue in the meanwhile.
+ */
+static void
+afsocket_dd_redistribute_queue(AFSocketDestConnection *conn)
+{
+  AFSocketDestDriver *self = conn->owner;
+  LogQueue *queue;
+  gint count = 0;
+  guint i;
+
+  main_loop_assert_main_thread();
+
+  if (log_writer_opened((LogWriter *) conn->writer))
+    return;
+
+  for (i = 0; i < self->connections->len; i++)
+    {
+      if (((AFSocketDestConnection *) g_ptr_array_index(self->connections, i))->up)
+        break;
+    }
+  if (i == self->connections->len)
+    return;
+
+  queue = log_writer_get_queue(conn->writer);
+  while (TRUE)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg;
+
+      if (!log_queue_pop_head(queue, &msg, &path_options, FALSE, TRUE))
+        break;
+
+      log_pipe_queue(afsocket_dd_select_connection(self, msg)->writer, msg, &path_options);
+      count++;
+    }
+  log_queue_unref(queue);
+
+  if (count)
+    msg_notice("Moved queued messages of a broken connection to the remaining servers",
+               evt_tag_str("server", conn->dest_name),
+               evt_tag_int("count", count),
+               NULL);
+}
+
 static void
 afsocket_dd_notify(LogPipe *s, LogPipe *sender, gint notify_code, gpointer user_data)
 {
   AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+  AFSocketDestConnection *conn = NULL;
   gchar buf[MAX_SOCKADDR_STRING];
+  guint i;
+
+  /* user_data is the writer of the connection */
+  for (i = 0; self->connections && i < self->connections->len; i++)
+    {
+      conn = g_ptr_array_index(self->connections, i);
+      if (conn->writer == (LogPipe *) user_data)
+        break;
+      conn = NULL;
+    }
+  if (!conn)
+    return;
 
   switch (notify_code)
     {
     case NC_CLOSE:
     case NC_WRITE_ERROR:
-      log_writer_reopen(self->writer, NULL);
+      /* leave it out of the distribution until it is reconnected */
+      conn->up = FALSE;
+      log_writer_reopen(conn->writer, NULL);
 
       msg_notice("Syslog connection broken",
-                 evt_tag_int("fd", self->fd),
-                 evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf, sizeof(buf), GSA_FULL)),
+                 evt_tag_int("fd", conn->fd),
+                 evt_tag_str("server", g_sockaddr_format(conn->dest_addr, buf, sizeof(buf), GSA_FULL)),
                  evt_tag_int("time_reopen", self->time_reopen),
                  NULL);
-      afsocket_dd_start_reconnect_timer(self);
+      afsocket_dd_start_reconnect_timer(conn);
+      if (self->connections->len > 1)
+        afsocket_dd_redistribute_queue(conn);
       break;
     }
 }
 
 static gboolean
-afsocket_dd_setup_socket(AFSocketDestDriver *self, gint fd)
+afsocket_dd_setup_socket(AFSocketDestDriver *self, AFSocketDestConnection *conn, gint fd)
 {
   return afsocket_setup_socket(fd, self->sock_options_ptr, AFSOCKET_DIR_SEND);
 }
@@ -1261,7 +1604,9 @@ afsocket_dd_free(LogPipe *s)
   log_writer_options_destroy(&self->writer_options);
   g_sockaddr_unref(self->bind_addr);
   g_sockaddr_unref(self->dest_addr);
-  log_pipe_unref(self->writer);
+  log_pipe_unref(self->balancer);
+  log_template_unref(self->balance_key);
+  string_list_free(self->servers);
   g_free(self->hostname);
   g_free(self->dest_name);
   g_free(self->transport);
@@ -1272,6 +1617,7 @@ void
 afsocket_dd_init_instance(AFSocketDestDriver *self, SocketOptions *sock_options, gint family, const gchar *hostname, guint32 flags)
 {
   log_dest_driver_init_instance(&self->super);
+  self->super.super.super.flags |= PIF_KEEP_ON_RELOAD;
 
   log_writer_options_defaults(&self->writer_options);
   self->super.super.super.init = afsocket_dd_init;
@@ -1284,8 +1630,8 @@ afsocket_dd_init_instance(AFSocketDestDriver *self, SocketOptions *sock_options,
   self->sock_options_ptr = sock_options;
   self->address_family = family;
   self->flags = flags  | AFSOCKET_KEEP_ALIVE;
+  self->workers = 1;
+  self->balancer = afsocket_dd_balancer_new(self);
 
   self->hostname = g_strdup(hostname);
-
-  afsocket_dd_init_watches(self);
 }
@@ -133,12 +133,32 @@ gboolean afsocket_sd_deinit(LogPipe *s);
 void afsocket_sd_init_instance(AFSocketSourceDriver *self, SocketOptions *sock_options, gint family, guint32 flags);
 void afsocket_sd_free(LogPipe *self);
 
+typedef enum
+{
+  AFSOCKET_BALANCE_ROUND_ROBIN,
+  AFSOCKET_BALANCE_HASH,
+} AFSocketBalanceMode;
+
+/* a connection to one of the servers of an AFSocketDestDriver */
+typedef struct _AFSocketDestConnection
+{
+  AFSocketDestDriver *owner;
+  gchar *hostname;
+  GSockAddr *dest_addr;
+  gchar *dest_name;
+  gint fd;
+  LogPipe *writer;
+  /* set while the connection is established, messages are only
+   * distributed to connections that are up */
+  gboolean up;
+  struct iv_fd connect_fd;
+  struct iv_timer reconnect_timer;
+} AFSocketDestConnection;
+
 struct _AFSocketDestDriver
 {
   LogDestDriver super;
   guint32 flags;
-  gint fd;
-  LogPipe *writer;
   LogWriterOptions writer_options;
 #if ENABLE_SSL
   TLSContext *tls_context;
@@ -150,10 +170,19 @@ struct _AFSocketDestDriver
   GSockAddr *dest_addr;
   gchar *dest_name;
   gint time_reopen;
-  struct iv_fd connect_fd;
-  struct iv_timer reconnect_timer;
   SocketOptions *sock_options_ptr;
 
+  /* additional servers, messages are distributed between the
+   * connections to hostname and these, see afsocket_dd_select_connection() */
+  GList *servers;
+  /* number of connections to each server */
+  gint workers;
+  AFSocketBalanceMode balance;
+  LogTemplate *balance_key;
+  gint balance_counter;
+  GPtrArray *connections;
+  LogPipe *balancer;
+
   /*
    * Apply transport options, set up bind_addr/dest_addr based on the
    * information processed during parse time. This used to be
@@ -169,7 +198,7 @@ struct _AFSocketDestDriver
   /* once the socket is opened, set up socket related options (IP_TTL,
      IP_TOS, SO_RCVBUF etc) */
 
-  gboolean (*setup_socket)(AFSocketDestDriver *s, gint fd);
+  gboolean (*setup_socket)(AFSocketDestDriver *s, AFSocketDestConnection *conn, gint fd);
 };
 
 
@@ -187,6 +216,11 @@ afsocket_dd_apply_transport(AFSocketDestDriver *s)
 
 void afsocket_dd_set_transport(LogDriver *s, const gchar *transport);
 void afsocket_dd_set_keep_alive(LogDriver *self, gint enable);
+void afsocket_dd_set_workers(LogDriver *s, gint workers);
+void afsocket_dd_set_servers(LogDriver *s, GList *servers);
+gboolean afsocket_dd_set_balance(LogDriver *s, const gchar *balance);
+void afsocket_dd_set_balance_key(LogDriver *s, const gchar *balance_key);
+AFSocketDestConnection *afsocket_dd_select_connection(AFSocketDestDriver *self, LogMessage *msg);
 void afsocket_dd_init_instance(AFSocketDestDriver *self, SocketOptions *sock_options, gint family, const gchar *hostname, guint32 flags);
 gboolean afsocket_dd_init(LogPipe *s);
 void afsocket_dd_free(LogPipe *s);
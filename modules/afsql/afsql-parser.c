@@ -57,6 +57,7 @@ static CfgLexerKeyword afsql_keywords[] = {
   { "flags",              KW_FLAGS },
 
   { "dbd_option",         KW_DBD_OPTION },
+  { "connections",        KW_CONNECTIONS },
   { NULL }
 };
 
@@ -26,6 +26,7 @@
 #if ENABLE_SQL
 
 #include "logqueue.h"
+#include "logqueue-multi.h"
 #include "templates.h"
 #include "messages.h"
 #include "misc.h"
@@ -61,21 +62,59 @@ typedef struct _AFSqlField
   LogTemplate *value;
 } AFSqlField;
 
+typedef struct _AFSqlDestDriver AFSqlDestDriver;
+
+/**
+ * AFSqlDestConnection:
+ *
+ * A database connection of an SQL destination, with its own database
+ * thread. The connections of a destination share its queue, each of them
+ * consumes it through its own LogQueue instance and runs its own
+ * transactions, thus inserts are performed in parallel.
+ **/
+typedef struct _AFSqlDestConnection
+{
+  AFSqlDestDriver *owner;
+  gint id;
+  /* shared by the main/db thread, protected by owner->db_thread_mutex */
+  GThread *db_thread;
+  GCond *db_thread_wakeup_cond;
+  gboolean db_thread_suspended;
+  GTimeVal db_thread_suspend_target;
+  LogQueue *queue;
+  /* used exclusively by the db thread */
+  gint32 seq_num;
+  LogMessage *pending_msg;
+  gboolean pending_msg_ack_needed;
+  dbi_conn dbi_ctx;
+  GHashTable *validated_tables;
+  guint32 failed_message_counter;
+  gint flush_lines_queued;
+  /* the table we inserted into the last time, and the beginning of the
+   * INSERT statement for it, valid as long as the connection is open */
+  GString *last_table;
+  GString *insert_prefix;
+  /* formatting buffers, reused between messages */
+  GString *table;
+  GString *value;
+  GString *query_string;
+} AFSqlDestConnection;
+
 /**
  * AFSqlDestDriver:
  *
  * This structure encapsulates an SQL destination driver. SQL insert
- * statements are generated from a separate thread because of the blocking
- * nature of the DBI API. It is ensured that while the thread is running,
+ * statements are generated from separate threads because of the blocking
+ * nature of the DBI API. It is ensured that while the threads are running,
  * the reference count to the driver structure is increased, thus the db
- * thread can read any of the fields in this structure. To do anything more
+ * threads can read any of the fields in this structure. To do anything more
  * than simple reading out a value, some kind of locking mechanism shall be
  * used.
  **/
-typedef struct _AFSqlDestDriver
+struct _AFSqlDestDriver
 {
   LogDestDriver super;
-  /* read by the db thread */
+  /* read by the db threads */
   gchar *type;
   gchar *host;
   gchar *port;
@@ -102,26 +141,22 @@ typedef struct _AFSqlDestDriver
 
   StatsCounterItem *dropped_messages;
   StatsCounterItem *stored_messages;
+  StatsCounterItem *memory_usage;
+  StatsHistogram *latency;
 
   GHashTable *dbd_options;
   GHashTable *dbd_options_numeric;
 
-  /* shared by the main/db thread */
-  GThread *db_thread;
+  /* shared by the main/db threads */
   GMutex *db_thread_mutex;
-  GCond *db_thread_wakeup_cond;
   gboolean db_thread_terminate;
-  gboolean db_thread_suspended;
-  GTimeVal db_thread_suspend_target;
   LogQueue *queue;
-  /* used exclusively by the db thread */
-  gint32 seq_num;
-  LogMessage *pending_msg;
-  gboolean pending_msg_ack_needed;
-  dbi_conn dbi_ctx;
-  GHashTable *validated_tables;
-  guint32 failed_message_counter;
-} AFSqlDestDriver;
+  /* serializes table creation between the connections */
+  GMutex *db_ddl_mutex;
+
+  gint num_connections;
+  AFSqlDestConnection *connections;
+};
 
 static gboolean dbi_initialized = FALSE;
 static const char *s_oracle = "oracle";
@@ -327,6 +362,14 @@ afsql_dd_set_flags(LogDriver *s, gint flags)
   self->flags = flags;
 }
 
+void
+afsql_dd_set_connections(LogDriver *s, gint num_connections)
+{
+  AFSqlDestDriver *self = (AFSqlDestDriver *) s;
+
+  self->num_connections = MAX(num_connections, 1);
+}
+
 /**
  * afsql_dd_run_query:
  *
@@ -335,22 +378,23 @@ afsql_dd_set_flags(LogDriver *s, gint flags)
  * NOTE: This function can only be called from the database thread.
  **/
 static gboolean
-afsql_dd_run_query(AFSqlDestDriver *self, const gchar *query, gboolean silent, dbi_result *result)
+afsql_dd_run_query(AFSqlDestConnection *conn, const gchar *query, gboolean silent, dbi_result *result)
 {
+  AFSqlDestDriver *self = conn->owner;
   dbi_result db_res;
 
   msg_debug("Running SQL query",
             evt_tag_str("query", query),
             NULL);
 
-  db_res = dbi_conn_query(self->dbi_ctx, query);
+  db_res = dbi_conn_query(conn->dbi_ctx, query);
   if (!db_res)
     {
       const gchar *dbi_error;
 
       if (!silent)
         {
-          dbi_conn_error(self->dbi_ctx, &dbi_error);
+          dbi_conn_error(conn->dbi_ctx, &dbi_error);
           msg_error("Error running SQL query",
                     evt_tag_str("type", self->type),
                     evt_tag_str("host", self->host),
@@ -397,8 +441,9 @@ afsql_dd_check_sql_identifier(gchar *token, gboolean sanitize)
  * NOTE: This function can only be called from the database thread.
  **/
 static gboolean
-afsql_dd_create_index(AFSqlDestDriver *self, gchar *table, gchar *column)
+afsql_dd_create_index(AFSqlDestConnection *conn, gchar *table, gchar *column)
 {
+  AFSqlDestDriver *self = conn->owner;
   GString *query_string;
   gboolean success = TRUE;
 
@@ -437,7 +482,7 @@ afsql_dd_create_index(AFSqlDestDriver *self, gchar *table, gchar *column)
   else
     g_string_printf(query_string, "CREATE INDEX %s_%s_idx ON %s (%s)",
                     table, column, table, column);
-  if (!afsql_dd_run_query(self, query_string->str, FALSE, NULL))
+  if (!afsql_dd_run_query(conn, query_string->str, FALSE, NULL))
     {
       msg_error("Error adding missing index",
                 evt_tag_str("table", table),
@@ -459,8 +504,9 @@ afsql_dd_create_index(AFSqlDestDriver *self, gchar *table, gchar *column)
  * NOTE: This function can only be called from the database thread.
  **/
 static gboolean
-afsql_dd_validate_table(AFSqlDestDriver *self, gchar *table)
+afsql_dd_validate_table(AFSqlDestConnection *conn, gchar *table)
 {
+  AFSqlDestDriver *self = conn->owner;
   GString *query_string;
   dbi_result db_res;
   gboolean success = FALSE;
@@ -471,12 +517,15 @@ afsql_dd_validate_table(AFSqlDestDriver *self, gchar *table)
 
   afsql_dd_check_sql_identifier(table, TRUE);
 
-  if (g_hash_table_lookup(self->validated_tables, table))
+  if (g_hash_table_lookup(conn->validated_tables, table))
     return TRUE;
 
+  /* the other connections of this destination may be validating the same
+   * table, don't let them race each other creating/altering it */
+  g_mutex_lock(self->db_ddl_mutex);
   query_string = g_string_sized_new(32);
   g_string_printf(query_string, "SELECT * FROM %s WHERE 0=1", table);
-  if (afsql_dd_run_query(self, query_string->str, TRUE, &db_res))
+  if (afsql_dd_run_query(conn, query_string->str, TRUE, &db_res))
     {
 
       /* table exists, check structure */
@@ -488,7 +537,7 @@ afsql_dd_validate_table(AFSqlDestDriver *self, gchar *table)
               GList *l;
               /* field does not exist, add this column */
               g_string_printf(query_string, "ALTER TABLE %s ADD %s %s", table, self->fields[i].name, self->fields[i].type);
-              if (!afsql_dd_run_query(self, query_string->str, FALSE, NULL))
+              if (!afsql_dd_run_query(conn, query_string->str, FALSE, NULL))
                 {
                   msg_error("Error adding missing column, giving up",
                             evt_tag_str("table", table),
@@ -502,7 +551,7 @@ afsql_dd_validate_table(AFSqlDestDriver *self, gchar *table)
                   if (strcmp((gchar *) l->data, self->fields[i].name) == 0)
                     {
                       /* this is an indexed column, create index */
-                      afsql_dd_create_index(self, table, self->fields[i].name);
+                      afsql_dd_create_index(conn, table, self->fields[i].name);
                     }
                 }
             }
@@ -521,14 +570,14 @@ afsql_dd_validate_table(AFSqlDestDriver *self, gchar *table)
             g_string_append(query_string, ", ");
         }
       g_string_append(query_string, ")");
-      if (afsql_dd_run_query(self, query_string->str, FALSE, NULL))
+      if (afsql_dd_run_query(conn, query_string->str, FALSE, NULL))
         {
           GList *l;
 
           success = TRUE;
           for (l = self->indexes; l; l = l->next)
             {
-              afsql_dd_create_index(self, table, (gchar *) l->data);
+              afsql_dd_create_index(conn, table, (gchar *) l->data);
             }
         }
       else
@@ -541,9 +590,10 @@ afsql_dd_validate_table(AFSqlDestDriver *self, gchar *table)
   if (success)
     {
       /* we have successfully created/altered the destination table, record this information */
-      g_hash_table_insert(self->validated_tables, g_strdup(table), GUINT_TO_POINTER(TRUE));
+      g_hash_table_insert(conn->validated_tables, g_strdup(table), GUINT_TO_POINTER(TRUE));
     }
   g_string_free(query_string, TRUE);
+  g_mutex_unlock(self->db_ddl_mutex);
   return success;
 }
 
@@ -555,8 +605,9 @@ afsql_dd_validate_table(AFSqlDestDriver *self, gchar *table)
  * NOTE: This function can only be called from the database thread.
  **/
 static gboolean
-afsql_dd_begin_txn(AFSqlDestDriver *self)
+afsql_dd_begin_txn(AFSqlDestConnection *conn)
 {
+  AFSqlDestDriver *self = conn->owner;
   gboolean success = TRUE;
   const char *s_begin = "BEGIN";
   if (!strcmp(self->type, s_freetds))
@@ -568,7 +619,7 @@ afsql_dd_begin_txn(AFSqlDestDriver *self)
   if (strcmp(self->type, s_oracle) != 0)
     {
       /* oracle db has no BEGIN TRANSACTION command, it implicitly starts one, after every commit. */
-      success = afsql_dd_run_query(self, s_begin, FALSE, NULL);
+      success = afsql_dd_run_query(conn, s_begin, FALSE, NULL);
     }
   return success;
 }
@@ -581,26 +632,27 @@ afsql_dd_begin_txn(AFSqlDestDriver *self)
  * NOTE: This function can only be called from the database thread.
  **/
 static gboolean
-afsql_dd_commit_txn(AFSqlDestDriver *self, gboolean lock)
+afsql_dd_commit_txn(AFSqlDestConnection *conn, gboolean lock)
 {
+  AFSqlDestDriver *self = conn->owner;
   gboolean success;
 
-  success = afsql_dd_run_query(self, "COMMIT", FALSE, NULL);
+  success = afsql_dd_run_query(conn, "COMMIT", FALSE, NULL);
   if (lock)
     g_mutex_lock(self->db_thread_mutex);
   if (success)
     {
-      log_queue_ack_backlog(self->queue, self->flush_lines_queued);
+      log_queue_ack_backlog(conn->queue, conn->flush_lines_queued);
     }
   else
     {
       msg_notice("SQL transaction commit failed, rewinding backlog and starting again",
                  NULL);
-      log_queue_rewind_backlog(self->queue);
+      log_queue_rewind_backlog(conn->queue);
     }
   if (lock)
     g_mutex_unlock(self->db_thread_mutex);
-  self->flush_lines_queued = 0;
+  conn->flush_lines_queued = 0;
   return success;
 }
 
@@ -612,19 +664,131 @@ afsql_dd_commit_txn(AFSqlDestDriver *self, gboolean lock)
  * only!
  **/
 static void
-afsql_dd_suspend(AFSqlDestDriver *self)
+afsql_dd_suspend(AFSqlDestConnection *conn)
 {
-  self->db_thread_suspended = TRUE;
-  g_get_current_time(&self->db_thread_suspend_target);
-  g_time_val_add(&self->db_thread_suspend_target, self->time_reopen * 1000 * 1000); /* the timeout expects microseconds */
+  AFSqlDestDriver *self = conn->owner;
+
+  conn->db_thread_suspended = TRUE;
+  g_get_current_time(&conn->db_thread_suspend_target);
+  g_time_val_add(&conn->db_thread_suspend_target, self->time_reopen * 1000 * 1000); /* the timeout expects microseconds */
 }
 
 static void
-afsql_dd_disconnect(AFSqlDestDriver *self)
+afsql_dd_disconnect(AFSqlDestConnection *conn)
 {
-  dbi_conn_close(self->dbi_ctx);
-  self->dbi_ctx = NULL;
-  g_hash_table_remove_all(self->validated_tables);
+  dbi_conn_close(conn->dbi_ctx);
+  conn->dbi_ctx = NULL;
+  g_hash_table_remove_all(conn->validated_tables);
+  g_string_truncate(conn->insert_prefix, 0);
+}
+
+/**
+ * afsql_dd_prepare_insert:
+ *
+ * Make sure that @table is validated and put the beginning of the INSERT
+ * statement for it (up to the list of values) in conn->insert_prefix.
+ * Both are cached for the table we inserted into the last time, so
+ * that the usual case, when messages go to the same table, costs only a
+ * string comparison.
+ *
+ * NOTE: This function can only be called from the database thread.
+ **/
+static gboolean
+afsql_dd_prepare_insert(AFSqlDestConnection *conn, GString *table)
+{
+  AFSqlDestDriver *self = conn->owner;
+  gint i;
+
+  if (conn->insert_prefix->len > 0 && strcmp(conn->last_table->str, table->str) == 0)
+    return TRUE;
+
+  /* validation may sanitize the table name in place */
+  g_string_assign(conn->last_table, table->str);
+  if (!afsql_dd_validate_table(conn, table->str))
+    {
+      g_string_truncate(conn->insert_prefix, 0);
+      return FALSE;
+    }
+
+  g_string_printf(conn->insert_prefix, "INSERT INTO %s (", table->str);
+  for (i = 0; i < self->fields_len; i++)
+    {
+      g_string_append(conn->insert_prefix, self->fields[i].name);
+      if (i != self->fields_len - 1)
+        g_string_append(conn->insert_prefix, ", ");
+    }
+  g_string_append(conn->insert_prefix, ") VALUES (");
+  return TRUE;
+}
+
+/**
+ * afsql_dd_return_in_flight:
+ *
+ * Put the messages that this connection has not finished with back to
+ * the queue: the pending message, the uncommitted part of the
+ * transaction and the rest of its local batch. They get to the front of
+ * the shared pool and the other connections of the same destination are
+ * woken up to insert them while this one is suspended.
+ *
+ * NOTE: This function can only be called from the database thread.
+ **/
+static void
+afsql_dd_return_in_flight(AFSqlDestConnection *conn)
+{
+  AFSqlDestDriver *self = conn->owner;
+
+  g_mutex_lock(self->db_thread_mutex);
+  log_queue_reset_parallel_push(conn->queue);
+  if (conn->pending_msg)
+    {
+      if (self->flags & AFSQL_DDF_EXPLICIT_COMMITS)
+        {
+          /* the message is on our backlog too, it is rewound below */
+          log_msg_unref(conn->pending_msg);
+        }
+      else
+        {
+          LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+
+          path_options.ack_needed = conn->pending_msg_ack_needed;
+          log_queue_push_head(conn->queue, conn->pending_msg, &path_options);
+        }
+      conn->pending_msg = NULL;
+      conn->failed_message_counter = 0;
+    }
+  if (self->flags & AFSQL_DDF_EXPLICIT_COMMITS)
+    {
+      if (conn->flush_lines_queued > 0)
+        conn->flush_lines_queued = 0;
+    }
+  g_mutex_unlock(self->db_thread_mutex);
+
+  /* this rewinds our backlog and wakes up the other connections, whose
+   * notify callbacks take db_thread_mutex */
+  log_queue_multi_consumer_release(conn->queue);
+}
+
+/*
+ * Fetch the next message into conn->pending_msg, if there's one. The
+ * length of the queue is only an estimate (e.g. the messages we could
+ * steal from the other connections may be gone by the time we get
+ * there), so we try this before going to sleep.
+ *
+ * NOTE: called from the database thread, with db_thread_mutex held.
+ */
+static gboolean
+afsql_dd_fetch_pending(AFSqlDestConnection *conn)
+{
+  AFSqlDestDriver *self = conn->owner;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+
+  if (!log_queue_pop_head(conn->queue, &conn->pending_msg, &path_options, (self->flags & AFSQL_DDF_EXPLICIT_COMMITS), FALSE))
+    {
+      conn->pending_msg = NULL;
+      return FALSE;
+    }
+  conn->pending_msg_ack_needed = path_options.ack_needed;
+  return TRUE;
 }
 
 static void
@@ -649,43 +813,45 @@ afsql_dd_set_dbd_opt_numeric(gpointer key, gpointer value, gpointer user_data)
  * this destination suspended for time_reopen() time.
  **/
 static gboolean
-afsql_dd_insert_db(AFSqlDestDriver *self)
+afsql_dd_insert_db(AFSqlDestConnection *conn)
 {
-  GString *table, *query_string, *value;
+  AFSqlDestDriver *self = conn->owner;
+  GString *query_string = conn->query_string, *value = conn->value;
   LogMessage *msg;
   gboolean success;
   gint i;
   LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  guint64 profile_start;
 
-  if (!self->dbi_ctx)
+  if (!conn->dbi_ctx)
     {
-      self->dbi_ctx = dbi_conn_new(self->type);
-      if (self->dbi_ctx)
+      conn->dbi_ctx = dbi_conn_new(self->type);
+      if (conn->dbi_ctx)
         {
-          dbi_conn_set_option(self->dbi_ctx, "host", self->host);
+          dbi_conn_set_option(conn->dbi_ctx, "host", self->host);
           if (strcmp(self->type, "mysql"))
-            dbi_conn_set_option(self->dbi_ctx, "port", self->port);
+            dbi_conn_set_option(conn->dbi_ctx, "port", self->port);
           else
-            dbi_conn_set_option_numeric(self->dbi_ctx, "port", atoi(self->port));
-          dbi_conn_set_option(self->dbi_ctx, "username", self->user);
-          dbi_conn_set_option(self->dbi_ctx, "password", self->password);
-          dbi_conn_set_option(self->dbi_ctx, "dbname", self->database);
-          dbi_conn_set_option(self->dbi_ctx, "encoding", self->encoding);
-          dbi_conn_set_option(self->dbi_ctx, "auto-commit", self->flags & AFSQL_DDF_EXPLICIT_COMMITS ? "false" : "true");
+            dbi_conn_set_option_numeric(conn->dbi_ctx, "port", atoi(self->port));
+          dbi_conn_set_option(conn->dbi_ctx, "username", self->user);
+          dbi_conn_set_option(conn->dbi_ctx, "password", self->password);
+          dbi_conn_set_option(conn->dbi_ctx, "dbname", self->database);
+          dbi_conn_set_option(conn->dbi_ctx, "encoding", self->encoding);
+          dbi_conn_set_option(conn->dbi_ctx, "auto-commit", self->flags & AFSQL_DDF_EXPLICIT_COMMITS ? "false" : "true");
 
           /* database specific hacks */
-          dbi_conn_set_option(self->dbi_ctx, "sqlite_dbdir", "");
-          dbi_conn_set_option(self->dbi_ctx, "sqlite3_dbdir", "");
+          dbi_conn_set_option(conn->dbi_ctx, "sqlite_dbdir", "");
+          dbi_conn_set_option(conn->dbi_ctx, "sqlite3_dbdir", "");
 
           /* Set user-specified options */
-          g_hash_table_foreach(self->dbd_options, afsql_dd_set_dbd_opt, self->dbi_ctx);
-          g_hash_table_foreach(self->dbd_options_numeric, afsql_dd_set_dbd_opt_numeric, self->dbi_ctx);
+          g_hash_table_foreach(self->dbd_options, afsql_dd_set_dbd_opt, conn->dbi_ctx);
+          g_hash_table_foreach(self->dbd_options_numeric, afsql_dd_set_dbd_opt_numeric, conn->dbi_ctx);
 
-          if (dbi_conn_connect(self->dbi_ctx) < 0)
+          if (dbi_conn_connect(conn->dbi_ctx) < 0)
             {
               const gchar *dbi_error;
 
-              dbi_conn_error(self->dbi_ctx, &dbi_error);
+              dbi_conn_error(conn->dbi_ctx, &dbi_error);
 
               msg_error("Error establishing SQL connection",
                         evt_tag_str("type", self->type),
@@ -712,7 +878,7 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
 
           for (l = self->session_statements; l; l = l->next)
             {
-              if (!afsql_dd_run_query(self, (gchar *) l->data, FALSE, NULL))
+              if (!afsql_dd_run_query(conn, (gchar *) l->data, FALSE, NULL))
                 {
                   msg_error("Error executing SQL connection statement",
                             evt_tag_str("statement", (gchar *) l->data),
@@ -725,17 +891,17 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
 
   /* connection established, try to insert a message */
 
-  if (self->pending_msg)
+  if (conn->pending_msg)
     {
-      msg = self->pending_msg;
-      path_options.ack_needed = self->pending_msg_ack_needed;
-      self->pending_msg = NULL;
+      msg = conn->pending_msg;
+      path_options.ack_needed = conn->pending_msg_ack_needed;
+      conn->pending_msg = NULL;
     }
   else
     {
       g_mutex_lock(self->db_thread_mutex);
-      log_queue_reset_parallel_push(self->queue);
-      success = log_queue_pop_head(self->queue, &msg, &path_options, (self->flags & AFSQL_DDF_EXPLICIT_COMMITS), FALSE);
+      log_queue_reset_parallel_push(conn->queue);
+      success = log_queue_pop_head(conn->queue, &msg, &path_options, (self->flags & AFSQL_DDF_EXPLICIT_COMMITS), FALSE);
       g_mutex_unlock(self->db_thread_mutex);
       if (!success)
         return TRUE;
@@ -743,13 +909,11 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
 
   msg_set_context(msg);
 
-  table = g_string_sized_new(32);
-  value = g_string_sized_new(256);
-  query_string = g_string_sized_new(512);
-
-  log_template_format(self->table, msg, &self->template_options, LTZ_LOCAL, 0, NULL, table);
+  /* formatting and inserting is charged to the destination, see log_pipe_profile_begin() */
+  profile_start = log_pipe_profile_begin();
+  log_template_format(self->table, msg, &self->template_options, LTZ_LOCAL, 0, NULL, conn->table);
 
-  if (!afsql_dd_validate_table(self, table->str))
+  if (!afsql_dd_prepare_insert(conn, conn->table))
     {
       /* If validate table is FALSE then close the connection and wait time_reopen time (next call) */
       msg_error("Error checking table, disconnecting from database, trying again shortly",
@@ -759,15 +923,7 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
       goto error;
     }
 
-  g_string_printf(query_string, "INSERT INTO %s (", table->str);
-  for (i = 0; i < self->fields_len; i++)
-    {
-      g_string_append(query_string, self->fields[i].name);
-      if (i != self->fields_len - 1)
-        g_string_append(query_string, ", ");
-    }
-  g_string_append(query_string, ") VALUES (");
-
+  g_string_assign(query_string, conn->insert_prefix->str);
   for (i = 0; i < self->fields_len; i++)
     {
       gchar *quoted;
@@ -779,7 +935,7 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
         }
       else
         {
-          log_template_format(self->fields[i].value, msg, &self->template_options, LTZ_SEND, self->seq_num, NULL, value);
+          log_template_format(self->fields[i].value, msg, &self->template_options, LTZ_SEND, conn->seq_num, NULL, value);
 
           if (self->null_value && strcmp(self->null_value, value->str) == 0)
             {
@@ -787,7 +943,7 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
             }
           else
             {
-              dbi_conn_quote_string_copy(self->dbi_ctx, value->str, &quoted);
+              dbi_conn_quote_string_copy(conn->dbi_ctx, value->str, &quoted);
               if (quoted)
                 {
                   g_string_append(query_string, quoted);
@@ -807,52 +963,50 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
 
   /* we have the INSERT statement ready in query_string */
 
-  if (self->flush_lines_queued == 0 && !afsql_dd_begin_txn(self))
+  if (conn->flush_lines_queued == 0 && !afsql_dd_begin_txn(conn))
     return FALSE;
 
   success = TRUE;
-  if (!afsql_dd_run_query(self, query_string->str, FALSE, NULL))
+  if (!afsql_dd_run_query(conn, query_string->str, FALSE, NULL))
     {
       /* error running INSERT on an already validated table, too bad. Try to reconnect. Maybe that helps. */
       success = FALSE;
     }
 
-  if (success && self->flush_lines_queued != -1)
+  if (success && conn->flush_lines_queued != -1)
     {
-      self->flush_lines_queued++;
+      conn->flush_lines_queued++;
 
-      if (self->flush_lines && self->flush_lines_queued == self->flush_lines && !afsql_dd_commit_txn(self, TRUE))
+      if (self->flush_lines && conn->flush_lines_queued == self->flush_lines && !afsql_dd_commit_txn(conn, TRUE))
         return FALSE;
     }
  error:
-  g_string_free(table, TRUE);
-  g_string_free(value, TRUE);
-  g_string_free(query_string, TRUE);
-
+  log_pipe_profile_end(&self->super.super.super, profile_start);
   msg_set_context(NULL);
 
   if (success)
     {
+      stats_histogram_record_latency(self->latency, msg->timestamps[LM_TS_RECVD].tv_sec, msg->timestamps[LM_TS_RECVD].tv_usec);
       /* we only ACK if each INSERT is a separate transaction */
       if ((self->flags & AFSQL_DDF_EXPLICIT_COMMITS) == 0)
         log_msg_ack(msg, &path_options);
       log_msg_unref(msg);
-      step_sequence_number(&self->seq_num);
-      self->failed_message_counter = 0;
+      step_sequence_number(&conn->seq_num);
+      conn->failed_message_counter = 0;
     }
   else
     {
-      if (self->failed_message_counter < self->num_retries - 1)
+      if (conn->failed_message_counter < self->num_retries - 1)
         {
-          self->pending_msg = msg;
-          self->pending_msg_ack_needed = path_options.ack_needed;
+          conn->pending_msg = msg;
+          conn->pending_msg_ack_needed = path_options.ack_needed;
 
           /* database connection status sanity check after failed query */
-          if (dbi_conn_ping(self->dbi_ctx) != 1)
+          if (dbi_conn_ping(conn->dbi_ctx) != 1)
             {
               const gchar *dbi_error;
 
-              dbi_conn_error(self->dbi_ctx, &dbi_error);
+              dbi_conn_error(conn->dbi_ctx, &dbi_error);
               msg_error("Error, no SQL connection after failed query attempt",
                         evt_tag_str("type", self->type),
                         evt_tag_str("host", self->host),
@@ -864,7 +1018,7 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
               return FALSE;
             }
 
-          self->failed_message_counter++;
+          conn->failed_message_counter++;
         }
       else
         {
@@ -873,7 +1027,7 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
                     NULL);
           stats_counter_inc(self->dropped_messages);
           log_msg_drop(msg, &path_options);
-          self->failed_message_counter = 0;
+          conn->failed_message_counter = 0;
           success = TRUE;
         }
     }
@@ -881,6 +1035,18 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
 }
 
 
+static void
+afsql_dd_queue_notify(gpointer user_data)
+{
+  AFSqlDestConnection *conn = (AFSqlDestConnection *) user_data;
+  AFSqlDestDriver *self = conn->owner;
+
+  g_mutex_lock(self->db_thread_mutex);
+  g_cond_signal(conn->db_thread_wakeup_cond);
+  log_queue_reset_parallel_push(conn->queue);
+  g_mutex_unlock(self->db_thread_mutex);
+}
+
 /**
  * afsql_dd_database_thread:
  *
@@ -889,50 +1055,56 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
 static gpointer
 afsql_dd_database_thread(gpointer arg)
 {
-  AFSqlDestDriver *self = (AFSqlDestDriver *) arg;
+  AFSqlDestConnection *conn = (AFSqlDestConnection *) arg;
+  AFSqlDestDriver *self = conn->owner;
 
   msg_verbose("Database thread started",
               evt_tag_str("driver", self->super.super.id),
+              evt_tag_int("connection", conn->id),
               NULL);
   while (!self->db_thread_terminate)
     {
       g_mutex_lock(self->db_thread_mutex);
-      if (self->db_thread_suspended)
+      if (conn->db_thread_suspended)
         {
           /* we got suspended, probably because of a connection error,
            * during this time we only get wakeups if we need to be
            * terminated. */
           if (!self->db_thread_terminate)
-            g_cond_timed_wait(self->db_thread_wakeup_cond, self->db_thread_mutex, &self->db_thread_suspend_target);
-          self->db_thread_suspended = FALSE;
+            g_cond_timed_wait(conn->db_thread_wakeup_cond, self->db_thread_mutex, &conn->db_thread_suspend_target);
+          conn->db_thread_suspended = FALSE;
           g_mutex_unlock(self->db_thread_mutex);
 
           /* we loop back to check if the thread was requested to terminate */
         }
-      else if (!self->pending_msg && log_queue_get_length(self->queue) == 0)
+      else if (!conn->pending_msg && log_queue_get_length(conn->queue) == 0 && !afsql_dd_fetch_pending(conn))
         {
-          /* we have nothing to INSERT into the database, let's wait we get some new stuff */
+          /* we have nothing to INSERT into the database, let's wait we get
+           * some new stuff, either from the sources or given back by
+           * another connection */
+          log_queue_set_parallel_push(conn->queue, 1, afsql_dd_queue_notify, conn, NULL);
 
-          if (self->flush_lines_queued > 0 && self->flush_timeout > 0)
+          if (conn->flush_lines_queued > 0 && self->flush_timeout > 0)
             {
               GTimeVal flush_target;
 
               g_get_current_time(&flush_target);
               g_time_val_add(&flush_target, self->flush_timeout * 1000);
-              if (!self->db_thread_terminate && !g_cond_timed_wait(self->db_thread_wakeup_cond, self->db_thread_mutex, &flush_target))
+              if (!self->db_thread_terminate && !g_cond_timed_wait(conn->db_thread_wakeup_cond, self->db_thread_mutex, &flush_target))
                 {
                   /* timeout elapsed */
-                  if (!afsql_dd_commit_txn(self, FALSE))
+                  if (!afsql_dd_commit_txn(conn, FALSE))
                     {
-                      afsql_dd_disconnect(self);
-                      afsql_dd_suspend(self);
+                      afsql_dd_disconnect(conn);
+                      afsql_dd_suspend(conn);
+                      g_mutex_unlock(self->db_thread_mutex);
                       continue;
                     }
                 }
             }
           else if (!self->db_thread_terminate)
             {
-              g_cond_wait(self->db_thread_wakeup_cond, self->db_thread_mutex);
+              g_cond_wait(conn->db_thread_wakeup_cond, self->db_thread_mutex);
             }
           g_mutex_unlock(self->db_thread_mutex);
 
@@ -944,48 +1116,74 @@ afsql_dd_database_thread(gpointer arg)
       if (self->db_thread_terminate)
         break;
 
-      if (!afsql_dd_insert_db(self))
+      if (!afsql_dd_insert_db(conn))
         {
-          afsql_dd_disconnect(self);
-          afsql_dd_suspend(self);
+          afsql_dd_return_in_flight(conn);
+          afsql_dd_disconnect(conn);
+          afsql_dd_suspend(conn);
         }
     }
-  if (self->flush_lines_queued > 0)
+  if (conn->flush_lines_queued > 0)
     {
       /* we can't do anything with the return value here. if commit isn't
        * successful, we get our backlog back, but we have no chance
        * submitting that back to the SQL engine.
        */
 
-      afsql_dd_commit_txn(self, TRUE);
+      afsql_dd_commit_txn(conn, TRUE);
     }
+  /* keep the message we were unable to insert in the queue, so that it
+   * survives a reload */
+  afsql_dd_return_in_flight(conn);
 
-  afsql_dd_disconnect(self);
+  afsql_dd_disconnect(conn);
 
   msg_verbose("Database thread finished",
               evt_tag_str("driver", self->super.super.id),
+              evt_tag_int("connection", conn->id),
               NULL);
   return NULL;
 }
 
 static void
-afsql_dd_start_thread(AFSqlDestDriver *self)
+afsql_dd_start_threads(AFSqlDestDriver *self)
 {
-  self->db_thread_wakeup_cond = g_cond_new();
+  gint i;
+
   self->db_thread_mutex = g_mutex_new();
-  self->db_thread = create_worker_thread(afsql_dd_database_thread, self, TRUE, NULL);
+  self->db_ddl_mutex = g_mutex_new();
+  self->db_thread_terminate = FALSE;
+  for (i = 0; i < self->num_connections; i++)
+    {
+      AFSqlDestConnection *conn = &self->connections[i];
+
+      conn->db_thread_wakeup_cond = g_cond_new();
+      conn->db_thread = create_worker_thread(afsql_dd_database_thread, conn, TRUE, NULL);
+    }
 }
 
 static void
-afsql_dd_stop_thread(AFSqlDestDriver *self)
+afsql_dd_stop_threads(AFSqlDestDriver *self)
 {
+  gint i;
+
   g_mutex_lock(self->db_thread_mutex);
   self->db_thread_terminate = TRUE;
-  g_cond_signal(self->db_thread_wakeup_cond);
+  for (i = 0; i < self->num_connections; i++)
+    g_cond_signal(self->connections[i].db_thread_wakeup_cond);
   g_mutex_unlock(self->db_thread_mutex);
-  g_thread_join(self->db_thread);
+
+  for (i = 0; i < self->num_connections; i++)
+    {
+      AFSqlDestConnection *conn = &self->connections[i];
+
+      g_thread_join(conn->db_thread);
+      conn->db_thread = NULL;
+      g_cond_free(conn->db_thread_wakeup_cond);
+      conn->db_thread_wakeup_cond = NULL;
+    }
   g_mutex_free(self->db_thread_mutex);
-  g_cond_free(self->db_thread_wakeup_cond);
+  g_mutex_free(self->db_ddl_mutex);
 }
 
 static gchar *
@@ -1011,6 +1209,81 @@ afsql_dd_format_persist_name(AFSqlDestDriver *self)
 }
 
 
+/* returns a reference */
+static LogQueue *
+afsql_dd_acquire_queue(LogDestDriver *s, gchar *persist_name, gpointer user_data)
+{
+  AFSqlDestDriver *self = (AFSqlDestDriver *) s;
+  GlobalConfig *cfg = log_pipe_get_config(&s->super.super);
+  LogQueue *queue, *old_queue;
+
+  old_queue = cfg_persist_config_fetch(cfg, persist_name);
+  if (old_queue && log_queue_is_multi(old_queue) && log_queue_multi_get_num_consumers(old_queue) == self->num_connections)
+    return old_queue;
+
+  queue = log_queue_multi_new(self->super.log_fifo_size < 0 ? cfg->log_fifo_size : self->super.log_fifo_size, persist_name, self->num_connections);
+  log_queue_set_throttle(queue, self->super.throttle);
+  if (old_queue)
+    {
+      LogMessage *msg;
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+
+      /* the number of connections has changed, move the messages of the
+       * previous configuration over */
+      while (log_queue_pop_head(old_queue, &msg, &path_options, FALSE, TRUE))
+        log_queue_push_tail(queue, msg, &path_options);
+      log_queue_unref(old_queue);
+    }
+  return queue;
+}
+
+static void
+afsql_dd_init_connections(AFSqlDestDriver *self)
+{
+  gint i;
+
+  self->connections = g_new0(AFSqlDestConnection, self->num_connections);
+  for (i = 0; i < self->num_connections; i++)
+    {
+      AFSqlDestConnection *conn = &self->connections[i];
+
+      conn->owner = self;
+      conn->id = i;
+      conn->queue = log_queue_multi_get_consumer(self->queue, i);
+      conn->flush_lines_queued = self->flush_lines_queued;
+      conn->validated_tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+      conn->last_table = g_string_sized_new(32);
+      conn->insert_prefix = g_string_sized_new(128);
+      conn->table = g_string_sized_new(32);
+      conn->value = g_string_sized_new(256);
+      conn->query_string = g_string_sized_new(512);
+      init_sequence_number(&conn->seq_num);
+    }
+}
+
+static void
+afsql_dd_free_connections(AFSqlDestDriver *self)
+{
+  gint i;
+
+  for (i = 0; i < self->num_connections && self->connections; i++)
+    {
+      AFSqlDestConnection *conn = &self->connections[i];
+
+      if (conn->pending_msg)
+        log_msg_unref(conn->pending_msg);
+      log_queue_unref(conn->queue);
+      g_hash_table_destroy(conn->validated_tables);
+      g_string_free(conn->last_table, TRUE);
+      g_string_free(conn->insert_prefix, TRUE);
+      g_string_free(conn->table, TRUE);
+      g_string_free(conn->value, TRUE);
+      g_string_free(conn->query_string, TRUE);
+    }
+  g_free(self->connections);
+  self->connections = NULL;
+}
+
 static gboolean
 afsql_dd_init(LogPipe *s)
 {
@@ -1032,10 +1305,13 @@ afsql_dd_init(LogPipe *s)
   stats_lock();
   stats_register_counter(0, SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
   stats_register_counter(0, SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_register_counter(0, SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_MEMORY, &self->memory_usage);
+  stats_register_histogram(0, SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), &self->latency);
   stats_unlock();
 
   self->queue = log_dest_driver_acquire_queue(&self->super, afsql_dd_format_persist_name(self));
   log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages);
+  log_queue_set_memory_counter(self->queue, self->memory_usage);
   if (!self->fields)
     {
       GList *col, *value;
@@ -1139,7 +1415,11 @@ afsql_dd_init(LogPipe *s)
         }
     }
 
-  afsql_dd_start_thread(self);
+  /* connections take a transaction worth of messages at once */
+  if (self->flush_lines > 0)
+    log_queue_multi_set_local_batch(self->queue, self->flush_lines);
+  afsql_dd_init_connections(self);
+  afsql_dd_start_threads(self);
   return TRUE;
 
  error:
@@ -1147,6 +1427,8 @@ afsql_dd_init(LogPipe *s)
   stats_lock();
   stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
   stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_MEMORY, &self->memory_usage);
+  stats_unregister_histogram(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), &self->latency);
   stats_unlock();
 
   return FALSE;
@@ -1157,13 +1439,17 @@ afsql_dd_deinit(LogPipe *s)
 {
   AFSqlDestDriver *self = (AFSqlDestDriver *) s;
 
-  afsql_dd_stop_thread(self);
+  afsql_dd_stop_threads(self);
+  afsql_dd_free_connections(self);
 
   log_queue_set_counters(self->queue, NULL, NULL);
+  log_queue_set_memory_counter(self->queue, NULL);
 
   stats_lock();
   stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
   stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_MEMORY, &self->memory_usage);
+  stats_unregister_histogram(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), &self->latency);
   stats_unlock();
 
   if (!log_dest_driver_deinit_method(s))
@@ -1172,31 +1458,28 @@ afsql_dd_deinit(LogPipe *s)
   return TRUE;
 }
 
-static void
-afsql_dd_queue_notify(gpointer user_data)
-{
-  AFSqlDestDriver *self = (AFSqlDestDriver *) user_data;
-  g_mutex_lock(self->db_thread_mutex);
-  g_cond_signal(self->db_thread_wakeup_cond);
-  log_queue_reset_parallel_push(self->queue);
-  g_mutex_unlock(self->db_thread_mutex);
-}
-
 static void
 afsql_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
 {
   AFSqlDestDriver *self = (AFSqlDestDriver *) s;
-  gboolean queue_was_empty;
   LogPathOptions local_options;
+  gint i;
 
   if (!path_options->flow_control_requested)
     path_options = log_msg_break_ack(msg, path_options, &local_options);
 
   g_mutex_lock(self->db_thread_mutex);
-  queue_was_empty = log_queue_get_length(self->queue) == 0;
-  if (queue_was_empty && !self->db_thread_suspended)
+  for (i = 0; i < self->num_connections; i++)
     {
-      log_queue_set_parallel_push(self->queue, 1, afsql_dd_queue_notify, self, NULL);
+      AFSqlDestConnection *conn = &self->connections[i];
+      gboolean queue_was_empty;
+
+      /* wake up the connections that are idle */
+      queue_was_empty = log_queue_get_length(conn->queue) == 0;
+      if (queue_was_empty && !conn->db_thread_suspended)
+        {
+          log_queue_set_parallel_push(conn->queue, 1, afsql_dd_queue_notify, conn, NULL);
+        }
     }
   g_mutex_unlock(self->db_thread_mutex);
   log_msg_add_ack(msg, path_options);
@@ -1211,8 +1494,7 @@ afsql_dd_free(LogPipe *s)
   gint i;
 
   log_template_options_destroy(&self->template_options);
-  if (self->pending_msg)
-    log_msg_unref(self->pending_msg);
+  afsql_dd_free_connections(self);
   if (self->queue)
     log_queue_unref(self->queue);
   for (i = 0; i < self->fields_len; i++)
@@ -1236,7 +1518,6 @@ afsql_dd_free(LogPipe *s)
   string_list_free(self->indexes);
   string_list_free(self->values);
   log_template_unref(self->table);
-  g_hash_table_destroy(self->validated_tables);
   g_hash_table_destroy(self->dbd_options);
   g_hash_table_destroy(self->dbd_options_numeric);
   if(self->session_statements)
@@ -1250,10 +1531,12 @@ afsql_dd_new(void)
   AFSqlDestDriver *self = g_new0(AFSqlDestDriver, 1);
 
   log_dest_driver_init_instance(&self->super);
+  self->super.super.super.flags |= PIF_KEEP_ON_RELOAD;
   self->super.super.super.init = afsql_dd_init;
   self->super.super.super.deinit = afsql_dd_deinit;
   self->super.super.super.queue = afsql_dd_queue;
   self->super.super.super.free_fn = afsql_dd_free;
+  self->super.acquire_queue = afsql_dd_acquire_queue;
 
   self->type = g_strdup("mysql");
   self->host = g_strdup("");
@@ -1265,20 +1548,18 @@ afsql_dd_new(void)
 
   self->table = log_template_new(configuration, NULL);
   log_template_compile(self->table, "messages", NULL);
-  self->failed_message_counter = 0;
 
   self->flush_lines = -1;
   self->flush_timeout = -1;
   self->flush_lines_queued = -1;
   self->session_statements = NULL;
   self->num_retries = MAX_FAILED_ATTEMPTS;
+  self->num_connections = 1;
 
-  self->validated_tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
   self->dbd_options = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
   self->dbd_options_numeric = g_hash_table_new_full(g_str_hash, g_int_equal, g_free, NULL);
 
   log_template_options_defaults(&self->template_options);
-  init_sequence_number(&self->seq_num);
   return &self->super.super;
 }
 
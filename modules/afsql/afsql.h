@@ -53,6 +53,7 @@ void afsql_dd_set_flush_lines(LogDriver *s, gint flush_lines);
 void afsql_dd_set_flush_timeout(LogDriver *s, gint flush_timeout);
 void afsql_dd_set_session_statements(LogDriver *s, GList *session_statements);
 void afsql_dd_set_flags(LogDriver *s, gint flags);
+void afsql_dd_set_connections(LogDriver *s, gint num_connections);
 LogDriver *afsql_dd_new();
 gint afsql_dd_lookup_flag(const gchar *flag);
 void afsql_dd_set_retries(LogDriver *s, gint num_retries);
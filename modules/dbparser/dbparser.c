@@ -42,14 +42,36 @@ struct _LogDBParser
   GStaticMutex lock;
   struct iv_timer tick;
   PatternDB *db;
+  /* database loaded in advance by pre_init(), picked up by init() */
+  PatternDB *prepared_db;
   gchar *db_file;
   time_t db_file_last_check;
+  dev_t db_file_dev;
   ino_t db_file_inode;
   time_t db_file_mtime;
   gboolean db_file_reloading;
   LogDBParserInjectMode inject_mode;
 };
 
+/* the database is persisted over reloads along with the stamps of the
+ * file it was loaded from, so that an unchanged file is not loaded
+ * again and the correlation contexts are kept */
+typedef struct _LogDBParserState
+{
+  PatternDB *db;
+  dev_t db_file_dev;
+  ino_t db_file_inode;
+  time_t db_file_mtime;
+} LogDBParserState;
+
+static void
+log_db_parser_state_free(LogDBParserState *state)
+{
+  if (state->db)
+    pattern_db_free(state->db);
+  g_free(state);
+}
+
 static void
 log_db_parser_emit(LogMessage *msg, gboolean synthetic, gpointer user_data)
 {
@@ -87,11 +109,12 @@ log_db_parser_reload_database(LogDBParser *self)
                 NULL);
       return;
     }
-  if ((self->db_file_inode == st.st_ino && self->db_file_mtime == st.st_mtime))
+  if (self->db_file_dev == st.st_dev && self->db_file_inode == st.st_ino && self->db_file_mtime == st.st_mtime)
     {
       return;
     }
 
+  self->db_file_dev = st.st_dev;
   self->db_file_inode = st.st_ino;
   self->db_file_mtime = st.st_mtime;
 
@@ -130,38 +153,81 @@ log_db_parser_format_persist_name(LogDBParser *self)
   return persist_name;
 }
 
+/* runs in a startup thread, see the comment at LogPipe->pre_init */
 static gboolean
-log_db_parser_init(LogPipe *s)
+log_db_parser_pre_init(LogPipe *s)
 {
   LogDBParser *self = (LogDBParser *) s;
   GlobalConfig *cfg = log_pipe_get_config(s);
+  LogDBParserState *state;
+  struct stat st;
 
-  self->db = cfg_persist_config_fetch(cfg, log_db_parser_format_persist_name(self));
-  if (self->db)
+  /* stat errors are reported by init() */
+  if (stat(self->db_file, &st) < 0)
+    return TRUE;
+
+  state = cfg_persist_config_peek(cfg, log_db_parser_format_persist_name(self));
+  if (state && state->db &&
+      state->db_file_dev == st.st_dev && state->db_file_inode == st.st_ino && state->db_file_mtime == st.st_mtime)
     {
-      struct stat st;
+      /* unchanged since the last load, init() takes over the persisted database */
+      return TRUE;
+    }
+
+  self->db = pattern_db_new();
+  self->db_file_dev = 0;
+  self->db_file_inode = 0;
+  self->db_file_mtime = 0;
+  log_db_parser_reload_database(self);
+  self->prepared_db = self->db;
+  self->db = NULL;
+  return TRUE;
+}
+
+static gboolean
+log_db_parser_init(LogPipe *s)
+{
+  LogDBParser *self = (LogDBParser *) s;
+  GlobalConfig *cfg = log_pipe_get_config(s);
+  LogDBParserState *state;
 
-      if (stat(self->db_file, &st) < 0)
+  state = cfg_persist_config_fetch(cfg, log_db_parser_format_persist_name(self));
+  if (state && state->db)
+    {
+      self->db = state->db;
+      state->db = NULL;
+      if (self->prepared_db)
         {
-          msg_error("Error stating pattern database file, no automatic reload will be performed",
-                    evt_tag_str("error", g_strerror(errno)),
-                    NULL);
+          /* the file has changed and was loaded by pre_init(), keep the
+           * correlation state of the persisted database with the new rules */
+          pattern_db_take_ruleset(self->db, self->prepared_db);
+          self->prepared_db = NULL;
         }
-      else if (self->db_file_inode != st.st_ino || self->db_file_mtime != st.st_mtime)
+      else
         {
-          self->db = pattern_db_new();
+          self->db_file_dev = state->db_file_dev;
+          self->db_file_inode = state->db_file_inode;
+          self->db_file_mtime = state->db_file_mtime;
           log_db_parser_reload_database(self);
-          self->db_file_inode = st.st_ino;
-          self->db_file_mtime = st.st_mtime;
         }
     }
+  else if (self->prepared_db)
+    {
+      self->db = self->prepared_db;
+      self->prepared_db = NULL;
+    }
   else
     {
       self->db = pattern_db_new();
+      self->db_file_dev = 0;
+      self->db_file_inode = 0;
+      self->db_file_mtime = 0;
       log_db_parser_reload_database(self);
     }
-  if (self->db)
-    pattern_db_set_emit_func(self->db, log_db_parser_emit, self);
+  if (state)
+    log_db_parser_state_free(state);
+
+  pattern_db_set_emit_func(self->db, log_db_parser_emit, self);
   iv_validate_now();
   IV_TIMER_INIT(&self->tick);
   self->tick.cookie = self;
@@ -170,7 +236,7 @@ log_db_parser_init(LogPipe *s)
   self->tick.expires.tv_sec++;
   self->tick.expires.tv_nsec = 0;
   iv_timer_register(&self->tick);
-  return self->db != NULL;
+  return TRUE;
 }
 
 static gboolean
@@ -178,13 +244,19 @@ log_db_parser_deinit(LogPipe *s)
 {
   LogDBParser *self = (LogDBParser *) s;
   GlobalConfig *cfg = log_pipe_get_config(s);
+  LogDBParserState *state;
 
   if (iv_timer_registered(&self->tick))
     {
       iv_timer_unregister(&self->tick);
     }
 
-  cfg_persist_config_add(cfg, log_db_parser_format_persist_name(self), self->db, (GDestroyNotify) pattern_db_free, FALSE);
+  state = g_new0(LogDBParserState, 1);
+  state->db = self->db;
+  state->db_file_dev = self->db_file_dev;
+  state->db_file_inode = self->db_file_inode;
+  state->db_file_mtime = self->db_file_mtime;
+  cfg_persist_config_add(cfg, log_db_parser_format_persist_name(self), state, (GDestroyNotify) log_db_parser_state_free, FALSE);
   self->db = NULL;
   return TRUE;
 }
@@ -269,6 +341,8 @@ log_db_parser_free(LogPipe *s)
 
   if (self->db)
     pattern_db_free(self->db);
+  if (self->prepared_db)
+    pattern_db_free(self->prepared_db);
 
   if (self->db_file)
     g_free(self->db_file);
@@ -284,6 +358,7 @@ log_db_parser_new(void)
   self->super.super.free_fn = log_db_parser_free;
   self->super.super.init = log_db_parser_init;
   self->super.super.deinit = log_db_parser_deinit;
+  self->super.super.pre_init = log_db_parser_pre_init;
   self->super.super.clone = log_db_parser_clone;
   self->super.process = log_db_parser_process;
   self->db_file = g_strdup(PATH_PATTERNDB_FILE);
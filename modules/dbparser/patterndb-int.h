@@ -76,6 +76,8 @@ typedef struct _PDBContext
   /* messages belonging to this context */
   GPtrArray *messages;
   gint ref_cnt;
+  /* the memory accounted to this context, see pdb_context_add_message() */
+  gsize mem_size;
 } PDBContext;
 
 /* This class encapsulates a rate-limit state stored in
@@ -27,6 +27,7 @@
 #include "templates.h"
 #include "compat.h"
 #include "misc.h"
+#include "memaccount.h"
 #include "filter-expr-parser.h"
 #include "patterndb-int.h"
 
@@ -98,9 +99,22 @@ pdb_context_new(PatternDB *db, PDBStateKey *key)
   if (self->key.host)
     self->key.host = g_strdup(self->key.host);
   self->ref_cnt = 1;
+  self->mem_size = sizeof(*self);
+  mem_account_alloc(MA_CORRELATION, self->mem_size);
   return self;
 }
 
+/* the context holds a reference to @msg until it expires */
+static void
+pdb_context_add_message(PDBContext *self, LogMessage *msg)
+{
+  gsize size = log_msg_get_size(msg) + sizeof(gpointer);
+
+  g_ptr_array_add(self->messages, log_msg_ref(msg));
+  self->mem_size += size;
+  mem_account_add(MA_CORRELATION, size, 0);
+}
+
 PDBContext *
 pdb_context_ref(PDBContext *self)
 {
@@ -130,6 +144,7 @@ pdb_context_unref(PDBContext *self)
       if (self->key.pid)
         g_free((gchar *) self->key.pid);
       g_free(self->key.session_id);
+      mem_account_free(MA_CORRELATION, self->mem_size);
       g_free(self);
     }
 }
@@ -1431,6 +1446,22 @@ pattern_db_reload_ruleset(PatternDB *self, GlobalConfig *cfg, const gchar *pdb_f
     }
 }
 
+/*
+ * Moves the ruleset loaded into @other over to @self, keeping the
+ * correlation state of @self. @other is freed.
+ */
+void
+pattern_db_take_ruleset(PatternDB *self, PatternDB *other)
+{
+  g_static_rw_lock_writer_lock(&self->lock);
+  if (self->ruleset)
+    pdb_rule_set_free(self->ruleset);
+  self->ruleset = other->ruleset;
+  other->ruleset = NULL;
+  g_static_rw_lock_writer_unlock(&self->lock);
+  pattern_db_free(other);
+}
+
 void
 pattern_db_expire_state(PatternDB *self)
 {
@@ -1523,7 +1554,7 @@ pattern_db_process(PatternDB *self, LogMessage *msg)
             }
 
           msg->flags |= LF_STATE_REFERENCED;
-          g_ptr_array_add(context->messages, log_msg_ref(msg));
+          pdb_context_add_message(context, msg);
 
           if (context->timer)
             {
@@ -37,6 +37,7 @@ void pattern_db_set_emit_func(PatternDB *self, PatternDBEmitFunc emit_func, gpoi
 const gchar *pattern_db_get_ruleset_version(PatternDB *self);
 const gchar *pattern_db_get_ruleset_pub_date(PatternDB *self);
 gboolean pattern_db_reload_ruleset(PatternDB *self, GlobalConfig *cfg, const gchar *pdb_file);
+void pattern_db_take_ruleset(PatternDB *self, PatternDB *other);
 
 void pattern_db_timer_tick(PatternDB *self);
 gboolean pattern_db_process(PatternDB *self, LogMessage *msg);
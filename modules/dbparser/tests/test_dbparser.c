@@ -0,0 +1,185 @@
+#include "apphook.h"
+#include "logmsg.h"
+#include "messages.h"
+#include "cfg.h"
+#include "plugin.h"
+#include "dbparser.h"
+#include "patterndb.h"
+
+#include <iv.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+gboolean fail = FALSE;
+
+#define test_fail(fmt, args...) \
+do {\
+  printf(fmt, ##args); \
+  fail = TRUE; \
+} while (0);
+
+/* the closing message refers to the opening one through the
+ * correlation context, @2 is only there if the context survived */
+gchar *pdb_context_skeleton = "<patterndb version='3' pub_date='2010-02-22'>\
+ <ruleset name='testset' id='1'>\
+  <patterns>\
+    <pattern>prog1</pattern>\
+  </patterns>\
+  <rule provider='test' id='11' class='system' context-scope='global' context-id='session' context-timeout='60'>\
+   <patterns>\
+    <pattern>session opened</pattern>\
+    <pattern>session closed</pattern>\
+   </patterns>\
+   <actions>\
+     <action condition='\"${MESSAGE}\" == \"session closed\"' trigger='match'>\
+       <message>\
+         <value name='MESSAGE'>closed after ${MESSAGE}@2</value>\
+       </message>\
+     </action>\
+   </actions>\
+  </rule>\
+ </ruleset>\
+</patterndb>";
+
+gchar *filename;
+GPtrArray *messages;
+
+static void
+capture_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  g_ptr_array_add(messages, log_msg_ref(msg));
+  log_msg_ack(msg, path_options);
+  log_msg_unref(msg);
+}
+
+static LogPipe *
+create_capture_pipe(void)
+{
+  LogPipe *capture = g_new0(LogPipe, 1);
+
+  log_pipe_init_instance(capture);
+  capture->queue = capture_queue;
+  log_pipe_init(capture, configuration);
+  return capture;
+}
+
+/* starts a parser the way cfg_tree_start() does */
+static LogPipe *
+start_parser(LogPipe *capture)
+{
+  LogParser *parser = log_db_parser_new();
+  LogPipe *pipe = &parser->super;
+
+  log_db_parser_set_db_file((LogDBParser *) parser, filename);
+  pipe->pipe_next = capture;
+  pipe->cfg = configuration;
+  if (!pipe->pre_init(pipe))
+    test_fail("pre_init() of db-parser failed\n");
+  if (!log_pipe_init(pipe, configuration))
+    test_fail("init() of db-parser failed\n");
+  return pipe;
+}
+
+static void
+stop_parser(LogPipe *pipe)
+{
+  log_pipe_deinit(pipe);
+  log_pipe_unref(pipe);
+}
+
+static void
+process_message(LogPipe *pipe, const gchar *message)
+{
+  LogMessage *msg = log_msg_new_empty();
+
+  log_msg_set_value(msg, LM_V_MESSAGE, message, -1);
+  log_msg_set_value(msg, LM_V_PROGRAM, "prog1", -1);
+  log_parser_process((LogParser *) pipe, msg, message);
+  log_msg_unref(msg);
+}
+
+static void
+clean_messages(void)
+{
+  g_ptr_array_foreach(messages, (GFunc) log_msg_unref, NULL);
+  g_ptr_array_set_size(messages, 0);
+}
+
+static void
+test_context_survives_reload(gboolean touch_file)
+{
+  LogPipe *capture = create_capture_pipe();
+  LogPipe *pipe;
+  const gchar *value;
+
+  g_file_open_tmp("patterndbXXXXXX.xml", &filename, NULL);
+  g_file_set_contents(filename, pdb_context_skeleton, strlen(pdb_context_skeleton), NULL);
+
+  pipe = start_parser(capture);
+  process_message(pipe, "session opened");
+  stop_parser(pipe);
+
+  if (touch_file)
+    {
+      struct stat st;
+      struct utimbuf ut;
+
+      stat(filename, &st);
+      ut.actime = ut.modtime = st.st_mtime + 10;
+      utime(filename, &ut);
+    }
+
+  pipe = start_parser(capture);
+  process_message(pipe, "session closed");
+
+  if (messages->len != 1)
+    {
+      test_fail("Expected exactly one synthetic message after reload, touch_file='%d', num='%d'\n", touch_file, messages->len);
+    }
+  else
+    {
+      value = log_msg_get_value(g_ptr_array_index(messages, 0), LM_V_MESSAGE, NULL);
+      if (strcmp(value, "closed after session opened") != 0)
+        test_fail("Correlation context lost over reload, touch_file='%d', message='%s'\n", touch_file, value);
+    }
+
+  stop_parser(pipe);
+  clean_messages();
+  persist_config_free(configuration->persist);
+  configuration->persist = persist_config_new();
+
+  log_pipe_deinit(capture);
+  log_pipe_unref(capture);
+  g_unlink(filename);
+  g_free(filename);
+  filename = NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  app_startup();
+  msg_init(TRUE);
+  iv_init();
+
+  configuration = cfg_new(0x0303);
+  configuration->persist = persist_config_new();
+  plugin_load_module("syslogformat", configuration, NULL);
+  pattern_db_global_init();
+
+  messages = g_ptr_array_new();
+
+  test_context_survives_reload(FALSE);
+  test_context_survives_reload(TRUE);
+
+  g_ptr_array_free(messages, TRUE);
+  persist_config_free(configuration->persist);
+  configuration->persist = NULL;
+
+  app_shutdown();
+  return (fail ? 1 : 0);
+}
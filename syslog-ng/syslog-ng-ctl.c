@@ -161,12 +161,56 @@ static GOptionEntry verbose_options[] =
   { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL }
 };
 
+static gint stats_subscribe = 0;
+static gchar *stats_filter = NULL;
+
+static GOptionEntry stats_options[] =
+{
+  { "subscribe", 's', 0, G_OPTION_ARG_INT, &stats_subscribe,
+    "print the changed counters periodically", "<seconds>" },
+  { "filter", 'f', 0, G_OPTION_ARG_STRING, &stats_filter,
+    "only print counters with a matching id (with --subscribe)", "<pattern>" },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL }
+};
+
 static gint
 slng_stats(int argc, char *argv[], const gchar *mode)
 {
   GString *rsp = NULL;
+  gchar buff[256];
+
+  if (stats_subscribe <= 0)
+    {
+      if (!(slng_send_cmd("STATS\n") && ((rsp = slng_read_response()) != NULL)))
+        return 1;
+
+      printf("%s\n", rsp->str);
 
-  if (!(slng_send_cmd("STATS\n") && ((rsp = slng_read_response()) != NULL)))
+      g_string_free(rsp, TRUE);
+
+      return 0;
+    }
+
+  snprintf(buff, sizeof(buff), "STATS SUBSCRIBE %d%s%s\n", stats_subscribe, stats_filter ? " " : "", stats_filter ? stats_filter : "");
+  if (!slng_send_cmd(buff))
+    return 1;
+
+  /* runs until syslog-ng closes the connection or we get interrupted */
+  while ((rsp = slng_read_response()) != NULL)
+    {
+      printf("%s\n", rsp->str);
+      fflush(stdout);
+      g_string_free(rsp, TRUE);
+    }
+  return 1;
+}
+
+static gint
+slng_reload(int argc, char *argv[], const gchar *mode)
+{
+  GString *rsp = NULL;
+
+  if (!(slng_send_cmd("RELOAD\n") && ((rsp = slng_read_response()) != NULL)))
     return 1;
 
   printf("%s\n", rsp->str);
@@ -176,12 +220,35 @@ slng_stats(int argc, char *argv[], const gchar *mode)
   return 0;
 }
 
+static gboolean profile_start = FALSE;
+static gboolean profile_stop = FALSE;
+static gint profile_top = 20;
+
+static GOptionEntry profile_options[] =
+{
+  { "start", 0, 0, G_OPTION_ARG_NONE, &profile_start,
+    "clear the collected times and start profiling", NULL },
+  { "stop", 0, 0, G_OPTION_ARG_NONE, &profile_stop,
+    "stop profiling", NULL },
+  { "top", 'n', 0, G_OPTION_ARG_INT, &profile_top,
+    "number of configuration objects to show", "<n>" },
+  { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL }
+};
+
 static gint
-slng_reload(int argc, char *argv[], const gchar *mode)
+slng_profile(int argc, char *argv[], const gchar *mode)
 {
   GString *rsp = NULL;
+  gchar buff[256];
 
-  if (!(slng_send_cmd("RELOAD\n") && ((rsp = slng_read_response()) != NULL)))
+  if (profile_start)
+    snprintf(buff, sizeof(buff), "PROFILE START\n");
+  else if (profile_stop)
+    snprintf(buff, sizeof(buff), "PROFILE STOP\n");
+  else
+    snprintf(buff, sizeof(buff), "PROFILE SHOW %d\n", profile_top);
+
+  if (!(slng_send_cmd(buff) && ((rsp = slng_read_response()) != NULL)))
     return 1;
 
   printf("%s\n", rsp->str);
@@ -225,8 +292,9 @@ static struct
   gint (*main)(gint argc, gchar *argv[], const gchar *mode);
 } modes[] =
 {
-  { "stats", NULL, "Dump syslog-ng statistics", slng_stats },
+  { "stats", stats_options, "Dump syslog-ng statistics", slng_stats },
   { "reload", NULL, "Reload syslog-ng", slng_reload },
+  { "profile", profile_options, "Show the time spent in each configuration object", slng_profile },
   { "verbose", verbose_options, "Enable/query verbose messages", slng_verbose },
   { "debug", verbose_options, "Enable/query debug messages", slng_verbose },
   { "trace", verbose_options, "Enable/query trace messages", slng_verbose },
@@ -88,6 +88,21 @@ def flush_files(settle_time=3):
     time.sleep(2)
     messagegen.need_to_flush = False
 
+def reload_syslogng(settle_time=2):
+    global syslogng_pid
+
+    if syslogng_pid == 0:
+        return True
+
+    try:
+        print_user("Sending syslog-ng the HUP signal to reload its configuration (pid: %d)" % syslogng_pid)
+        os.kill(syslogng_pid, signal.SIGHUP)
+    except OSError:
+        print_user("Error sending HUP signal to syslog-ng")
+        raise
+    time.sleep(settle_time)
+    return True
+
 
 def readpidfile(pidfile):
     f = open(pidfile, 'r')
@@ -61,10 +61,11 @@ l625DLckaYmOPTh0ECFKzhaPF+/LNmzD36ToOAeuNjfbUjiUVGfntr2mc4E8mUFyo+TskrkSfw==
 import test_file_source
 import test_filters
 import test_input_drivers
+import test_output_drivers
 import test_performance
 import test_sql
 
-tests = (test_input_drivers, test_sql, test_file_source, test_filters, test_performance)
+tests = (test_input_drivers, test_output_drivers, test_sql, test_file_source, test_filters, test_performance)
 
 init_env()
 seed_rnd()
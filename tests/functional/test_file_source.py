@@ -9,10 +9,13 @@ options { ts_format(iso); chain_hostnames(no); keep_hostname(yes); threaded(yes)
 
 source s_int { internal(); };
 source s_wildcard { file("wildcard/*.log"); };
+source s_wildcard_many { file("wildcard/*.many" max-files(10)); };
 
 destination d_wildcard { file("test-wildcard.log"); logstore("test-wildcard.lgs"); };
+destination d_wildcard_many { file("test-wildcard-many.log"); };
 
 log { source(s_wildcard); destination(d_wildcard); };
+log { source(s_wildcard_many); destination(d_wildcard_many); };
 
 """ % locals()
 
@@ -44,3 +47,18 @@ def test_wildcard_files():
     if not check_file_expected('test-wildcard', expected, settle_time=12):
         return False
     return True
+
+def test_wildcard_many_files():
+    if not wildcard_file_source_supported:
+        print_user("Not testing a Premium version, skipping wild card source tests")
+        return True
+    expected = []
+
+    # much more files than max-files(), all in the same directory
+    for ndx in range(0, 200):
+        s = FileSender('wildcard/%d.many' % ndx, repeat=5)
+        expected.extend(s.sendMessages('wildcardmany%d' % ndx))
+
+    if not check_file_expected('test-wildcard-many', expected, settle_time=30):
+        return False
+    return True
@@ -0,0 +1,159 @@
+from globals import *
+from log import *
+from messagegen import *
+from messagecheck import *
+from control import flush_files, reload_syslogng
+import re, os, glob, gzip
+from StringIO import StringIO
+
+config = """@version: 3.3
+
+options { ts_format(iso); chain_hostnames(no); keep_hostname(yes); threaded(yes); };
+
+source s_int { internal(); };
+source s_balance { unix-stream("log-balance" flags(expect-hostname)); };
+source s_failover { unix-stream("log-failover" flags(expect-hostname)); };
+
+# the servers the messages are distributed to, each of them stores what it received separately
+source s_server1 { tcp(ip("127.0.0.1") port(%(port_number)d)); };
+source s_server2 { tcp(ip("127.0.0.2") port(%(port_number)d)); };
+source s_failover_servers { tcp(ip("127.0.0.2") port(%(ssl_port_number)d)); };
+
+# test hash based load balancing, the messages of the same key go to the same server
+parser p_balance { csv-parser(columns("BALANCE.KEY", "BALANCE.SESSION", "BALANCE.REST") delimiters(" /") flags(greedy)); };
+destination d_balance { tcp("127.0.0.1" port(%(port_number)d) servers("127.0.0.2") balance_key("${BALANCE.KEY}")); };
+destination d_balance_out1 { file("test-balance-1.log"); };
+destination d_balance_out2 { file("test-balance-2.log"); };
+
+log { source(s_balance); parser(p_balance); destination(d_balance); };
+log { source(s_server1); destination(d_balance_out1); };
+log { source(s_server2); destination(d_balance_out2); };
+
+# test failover, nothing listens on 127.0.0.3
+destination d_failover { tcp("127.0.0.3" port(%(ssl_port_number)d) servers("127.0.0.2") balance("round-robin")); };
+destination d_failover_out { file("test-failover.log"); logstore("test-failover.lgs"); };
+
+log { source(s_failover); destination(d_failover); };
+log { source(s_failover_servers); destination(d_failover_out); };
+
+# test that an unchanged tcp() destination keeps its connection over reload
+source s_reload { unix-stream("log-reload" flags(expect-hostname)); };
+source s_reload_server { tcp(ip("127.0.0.1") port(%(port_number_syslog)d)); };
+destination d_reload { tcp("127.0.0.1" port(%(port_number_syslog)d)); };
+destination d_reload_out { file("test-reload.log"); };
+destination d_reload_accepted { file("test-reload-accepted.log"); };
+filter f_reload_accepted { message("Syslog connection accepted") and message("%(port_number_syslog)d"); };
+
+log { source(s_reload); destination(d_reload); };
+log { source(s_reload_server); destination(d_reload_out); };
+log { source(s_int); filter(f_reload_accepted); destination(d_reload_accepted); };
+
+# test that files are rotated and compressed, also across reloads
+source s_rotate { unix-stream("log-rotate" flags(expect-hostname)); };
+destination d_rotate { file("test-rotate.log" rotate_size(16384) rotate_compress(yes)); };
+
+log { source(s_rotate); destination(d_rotate); };
+""" % locals()
+
+balance_keys = ['balance%d' % i for i in range(16)]
+balance_files = ('test-balance-1', 'test-balance-2')
+
+def read_balance_keys(fname):
+    f = file_reader(fname)
+    if not f:
+        return None
+    keys = {}
+    for line in f.readlines():
+        m = re.search(" (balance\d+) \d+/\d+", line)
+        if m:
+            keys[m.group(1)] = keys.get(m.group(1), 0) + 1
+    return keys
+
+def test_balance():
+    expected = []
+    for key in balance_keys:
+        s = SocketSender(AF_UNIX, 'log-balance', dgram=0, repeat=20)
+        expected.extend(s.sendMessages(key))
+    flush_files(3)
+
+    server_of_key = {}
+    for fname in balance_files:
+        keys = read_balance_keys(fname)
+        if not keys:
+            print_user("no messages were delivered to this server, file=%s" % fname)
+            return False
+        for key in keys.keys():
+            if server_of_key.has_key(key):
+                print_user("messages of the same key were delivered to more than one server, key=%s, files=%s,%s" % (key, server_of_key[key], fname))
+                return False
+            server_of_key[key] = fname
+
+    # each server has received every message of its keys, in order
+    for fname in balance_files:
+        if not check_file_expected(fname, [e for e in expected if server_of_key.get(e[0]) == fname], settle_time=1):
+            return False
+
+    for key in balance_keys:
+        if not server_of_key.has_key(key):
+            print_user("messages of this key were not delivered, key=%s" % key)
+            return False
+    return True
+
+def test_failover():
+    s = SocketSender(AF_UNIX, 'log-failover', dgram=0, repeat=100)
+    expected = s.sendMessages('failover')
+    return check_file_expected('test-failover', expected, settle_time=3)
+
+def test_reload_kept_destination():
+    s = SocketSender(AF_UNIX, 'log-reload', dgram=0, repeat=100)
+    expected = s.sendMessages('reload-before')
+    time.sleep(2)
+
+    # the configuration didn't change, the destination keeps its connection
+    reload_syslogng()
+
+    s = SocketSender(AF_UNIX, 'log-reload', dgram=0, repeat=100)
+    expected.extend(s.sendMessages('reload-after'))
+    if not check_file_expected('test-reload', expected, settle_time=3):
+        return False
+
+    f = file_reader('test-reload-accepted')
+    accepted = f and len(f.readlines()) or 0
+    if accepted != 1:
+        print_user("tcp() destination reconnected over reload, connections=%d" % accepted)
+        return False
+    return True
+
+def read_rotated_files(fname):
+    # the rotated files in the order they were rotated, then the current one
+    rotated = [name[:-3] for name in glob.glob(fname + '.log.*.gz')]
+    rotated.sort()
+    contents = StringIO()
+    for name in rotated:
+        f = gzip.open(name + '.gz', 'r')
+        contents.write(f.read())
+        f.close()
+    f = file_reader(fname)
+    if f:
+        contents.write(f.read())
+        f.close()
+    contents.seek(0)
+    return (len(rotated), contents)
+
+def test_rotate():
+    for name in glob.glob('test-rotate.log.*'):
+        os.unlink(name)
+
+    expected = []
+    for i in range(5):
+        s = SocketSender(AF_UNIX, 'log-rotate', dgram=0, repeat=500)
+        expected.extend(s.sendMessages('rotate'))
+        # rotation is checked every second, reload while it may be running
+        reload_syslogng(settle_time=1)
+    flush_files(3)
+
+    (num_rotated, contents) = read_rotated_files('test-rotate')
+    if num_rotated == 0:
+        print_user("destination file was not rotated")
+        return False
+    return check_contents(contents, expected, syslog_prefix, 0)
@@ -74,3 +74,36 @@ def test_sql():
     stop_syslogng()
     time.sleep(5)
     return check_sql_expected("%s/test-sql.db" % current_dir, "logs", expected, settle_time=5, syslog_prefix="Sep  7 10:43:21 bzorp prog 12345")
+
+def sql_row_count(dbname, tablename):
+    out = os.popen("""echo "select count(*) from %s;" | sqlite3 %s""" % (tablename, dbname), "r").read()
+    try:
+        return int(out.strip())
+    except ValueError:
+        return 0
+
+def test_sql_insert_rate():
+
+    dbname = "%s/test-sql.db" % current_dir
+    rows_before = sql_row_count(dbname, "logs")
+
+    print_user("Starting loggen for 5 seconds")
+    start = time.time()
+    os.popen("../loggen/loggen -r 1000000 -Q -i -S -s 160 -I 5 127.0.0.1 %d 2>&1 |tail -n +1" % port_number, 'r').read()
+
+    # wait until the destination catches up with its queue
+    rows = rows_before
+    settled = 0
+    while settled < 3 and time.time() - start < 60:
+        time.sleep(1)
+        current = sql_row_count(dbname, "logs")
+        if current == rows:
+            settled += 1
+        else:
+            settled = 0
+        rows = current
+    elapsed = time.time() - start - settled
+
+    inserted = rows - rows_before
+    print_user("SQL insert rate: %.2f rows/sec (%d rows in %.2f seconds)" % (inserted / elapsed, inserted, elapsed))
+    return inserted > 0
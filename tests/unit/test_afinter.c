@@ -0,0 +1,168 @@
+#include "afinter.h"
+#include "apphook.h"
+#include "logmsg.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_PRODUCERS 4
+#define MESSAGES_PER_PRODUCER 20000
+/* the number of messages popped at once, like afinter_source_post() does */
+#define POP_BATCH 256
+
+gboolean fail = FALSE;
+
+#define test_fail(fmt, args...) \
+do {\
+ printf(fmt, ##args); \
+ fail = TRUE; \
+} while (0);
+
+static StatsCounterItem *dropped;
+static volatile gint producers_running;
+
+static LogMessage *
+create_message(gint producer, gint seq)
+{
+  LogMessage *msg = log_msg_new_empty();
+  gchar buf[32];
+
+  g_snprintf(buf, sizeof(buf), "%d", producer);
+  log_msg_set_value(msg, LM_V_PID, buf, -1);
+  g_snprintf(buf, sizeof(buf), "%d", seq);
+  log_msg_set_value(msg, LM_V_MESSAGE, buf, -1);
+  return msg;
+}
+
+static gint
+get_message_field(LogMessage *msg, NVHandle handle)
+{
+  return atoi(log_msg_get_value(msg, handle, NULL));
+}
+
+static gpointer
+produce_messages(gpointer user_data)
+{
+  gint producer = GPOINTER_TO_INT(user_data);
+  gint i;
+
+  for (i = 0; i < MESSAGES_PER_PRODUCER; i++)
+    afinter_message_posted(create_message(producer, i));
+  g_atomic_int_add(&producers_running, -1);
+  return NULL;
+}
+
+static void
+start_producers(GThread **threads)
+{
+  gint i;
+
+  producers_running = NUM_PRODUCERS;
+  for (i = 0; i < NUM_PRODUCERS; i++)
+    threads[i] = g_thread_create(produce_messages, GINT_TO_POINTER(i), TRUE, NULL);
+}
+
+static void
+join_producers(GThread **threads)
+{
+  gint i;
+
+  for (i = 0; i < NUM_PRODUCERS; i++)
+    g_thread_join(threads[i]);
+}
+
+/* drains the queue, checking that the messages of each producer arrive in order */
+static gint
+pop_messages(gint *last_seq, gint limit)
+{
+  LogMessage *msg;
+  gint count = 0;
+
+  while (count < limit && (msg = afinter_message_pop()))
+    {
+      gint producer = get_message_field(msg, LM_V_PID);
+      gint seq = get_message_field(msg, LM_V_MESSAGE);
+
+      if (producer < 0 || producer >= NUM_PRODUCERS || seq <= last_seq[producer])
+        test_fail("internal message out of order, producer=%d, seq=%d, last_seq=%d\n",
+                  producer, seq, producer >= 0 && producer < NUM_PRODUCERS ? last_seq[producer] : -1);
+      else
+        last_seq[producer] = seq;
+      log_msg_unref(msg);
+      count++;
+    }
+  return count;
+}
+
+static void
+test_overflow(void)
+{
+  GThread *threads[NUM_PRODUCERS];
+  gint last_seq[NUM_PRODUCERS] = { -1, -1, -1, -1 };
+  gint total = NUM_PRODUCERS * MESSAGES_PER_PRODUCER;
+  gint dropped_before = stats_counter_get(dropped);
+  gint popped;
+
+  /* nobody drains the queue, it holds exactly INTERNAL_MSG_QUEUE_SIZE messages */
+  start_producers(threads);
+  join_producers(threads);
+
+  popped = pop_messages(last_seq, total);
+  if (popped != INTERNAL_MSG_QUEUE_SIZE)
+    test_fail("internal queue didn't fill up completely, popped=%d\n", popped);
+  if (stats_counter_get(dropped) - dropped_before != total - INTERNAL_MSG_QUEUE_SIZE)
+    test_fail("internal queue drop counter mismatch, dropped=%d, expected=%d\n",
+              stats_counter_get(dropped) - dropped_before, total - INTERNAL_MSG_QUEUE_SIZE);
+}
+
+static void
+test_concurrent_batches(void)
+{
+  GThread *threads[NUM_PRODUCERS];
+  gint last_seq[NUM_PRODUCERS] = { -1, -1, -1, -1 };
+  gint total = NUM_PRODUCERS * MESSAGES_PER_PRODUCER;
+  gint dropped_before = stats_counter_get(dropped);
+  gint popped = 0;
+  gint n;
+
+  /* drain in batches while the producers are running */
+  start_producers(threads);
+  while (g_atomic_int_get(&producers_running) > 0)
+    {
+      n = pop_messages(last_seq, POP_BATCH);
+      if (n == 0)
+        g_thread_yield();
+      popped += n;
+    }
+  join_producers(threads);
+  popped += pop_messages(last_seq, total);
+
+  if (popped + (gint) (stats_counter_get(dropped) - dropped_before) != total)
+    test_fail("internal messages were lost, popped=%d, dropped=%d, total=%d\n",
+              popped, stats_counter_get(dropped) - dropped_before, total);
+  if (afinter_message_pop() != NULL)
+    test_fail("internal queue is not empty after draining\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  app_startup();
+  /* registers the drop counter */
+  app_post_config_loaded();
+
+  stats_lock();
+  stats_register_counter(0, SCS_GLOBAL, "internal_queue", NULL, SC_TYPE_DROPPED, &dropped);
+  stats_unlock();
+
+  test_overflow();
+  test_concurrent_batches();
+
+  stats_lock();
+  stats_unregister_counter(SCS_GLOBAL, "internal_queue", NULL, SC_TYPE_DROPPED, &dropped);
+  stats_unlock();
+  app_shutdown();
+  return fail ? 1 : 0;
+}
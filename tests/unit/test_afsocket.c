@@ -0,0 +1,171 @@
+#include "syslog-ng.h"
+#include "logmsg.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "afsocket/afsocket.h"
+#include "afsocket/afinet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_CONNECTIONS 3
+
+gboolean fail = FALSE;
+
+#define test_fail(fmt, args...) \
+do {\
+ printf(fmt, ##args); \
+ fail = TRUE; \
+} while (0);
+
+static AFSocketDestDriver *
+create_driver(const gchar *balance)
+{
+  AFSocketDestDriver *self;
+  gint i;
+
+  self = (AFSocketDestDriver *) afinet_dd_new(AF_INET, "127.0.0.1", 514, AFSOCKET_STREAM);
+  if (balance)
+    afsocket_dd_set_balance_key(&self->super.super, balance);
+
+  /* the connections are normally set up by init(), only the fields
+   * used by afsocket_dd_select_connection() are filled here */
+  self->connections = g_ptr_array_new();
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    {
+      AFSocketDestConnection *conn = g_new0(AFSocketDestConnection, 1);
+
+      conn->owner = self;
+      conn->up = TRUE;
+      g_ptr_array_add(self->connections, conn);
+    }
+  return self;
+}
+
+static void
+free_driver(AFSocketDestDriver *self)
+{
+  gint i;
+
+  for (i = 0; i < self->connections->len; i++)
+    g_free(g_ptr_array_index(self->connections, i));
+  g_ptr_array_free(self->connections, TRUE);
+  self->connections = NULL;
+  log_pipe_unref(&self->super.super.super);
+}
+
+static AFSocketDestConnection *
+get_connection(AFSocketDestDriver *self, gint index)
+{
+  return g_ptr_array_index(self->connections, index);
+}
+
+static gint
+select_connection(AFSocketDestDriver *self, const gchar *host)
+{
+  LogMessage *msg = log_msg_new_empty();
+  AFSocketDestConnection *conn;
+  gint i;
+
+  log_msg_set_value(msg, LM_V_HOST, host, -1);
+  conn = afsocket_dd_select_connection(self, msg);
+  log_msg_unref(msg);
+
+  for (i = 0; i < self->connections->len; i++)
+    {
+      if (get_connection(self, i) == conn)
+        return i;
+    }
+  test_fail("selected connection is not part of the destination, host=%s\n", host);
+  return -1;
+}
+
+static void
+test_round_robin(void)
+{
+  AFSocketDestDriver *self = create_driver(NULL);
+  gint hits[NUM_CONNECTIONS] = { 0 };
+  gint i;
+
+  for (i = 0; i < NUM_CONNECTIONS * 10; i++)
+    hits[select_connection(self, "host")]++;
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    {
+      if (hits[i] != 10)
+        test_fail("round-robin distribution is uneven, connection=%d, hits=%d\n", i, hits[i]);
+    }
+
+  /* a failed connection is skipped */
+  get_connection(self, 1)->up = FALSE;
+  memset(hits, 0, sizeof(hits));
+  for (i = 0; i < 20; i++)
+    hits[select_connection(self, "host")]++;
+  if (hits[1] != 0 || hits[0] != 10 || hits[2] != 10)
+    test_fail("round-robin doesn't skip a failed connection, hits=%d,%d,%d\n", hits[0], hits[1], hits[2]);
+
+  /* without any available connections, all of them get messages */
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    get_connection(self, i)->up = FALSE;
+  memset(hits, 0, sizeof(hits));
+  for (i = 0; i < NUM_CONNECTIONS * 10; i++)
+    hits[select_connection(self, "host")]++;
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    {
+      if (hits[i] != 10)
+        test_fail("round-robin distribution is uneven without available connections, connection=%d, hits=%d\n", i, hits[i]);
+    }
+  free_driver(self);
+}
+
+static void
+test_hash(void)
+{
+  AFSocketDestDriver *self = create_driver("$HOST");
+  gint hits[NUM_CONNECTIONS] = { 0 };
+  gchar host[32];
+  gint i, first, selected;
+
+  for (i = 0; i < 100; i++)
+    {
+      g_snprintf(host, sizeof(host), "host%d", i);
+      first = select_connection(self, host);
+      hits[first]++;
+      selected = select_connection(self, host);
+      if (first != selected)
+        test_fail("hash balancing is not stable, host=%s, first=%d, selected=%d\n", host, first, selected);
+    }
+  for (i = 0; i < NUM_CONNECTIONS; i++)
+    {
+      if (hits[i] == 0)
+        test_fail("hash balancing left a connection unused, connection=%d\n", i);
+    }
+
+  /* the keys of a failed connection are moved to the others */
+  get_connection(self, 0)->up = FALSE;
+  for (i = 0; i < 100; i++)
+    {
+      g_snprintf(host, sizeof(host), "host%d", i);
+      first = select_connection(self, host);
+      if (first == 0)
+        test_fail("hash balancing selected a failed connection, host=%s\n", host);
+      selected = select_connection(self, host);
+      if (first != selected)
+        test_fail("hash balancing is not stable after a failure, host=%s, first=%d, selected=%d\n", host, first, selected);
+    }
+  free_driver(self);
+}
+
+int
+main(int argc, char *argv[])
+{
+  app_startup();
+  configuration = cfg_new(0x0302);
+
+  test_round_robin();
+  test_hash();
+
+  cfg_free(configuration);
+  app_shutdown();
+  return fail ? 1 : 0;
+}
@@ -1,4 +1,5 @@
 #include "dnscache.h"
+#include "dnsresolver.h"
 #include "apphook.h"
 #include "timeutils.h"
 
@@ -15,10 +16,9 @@ void
 test_expiration(void)
 {
   gint i;
-  const gchar *hn = NULL;
+  gchar hn[256];
   gboolean positive;
 
-  dns_cache_init();
   dns_cache_set_params(50000, 3, 1, NULL);
 
   for (i = 0; i < 10000; i++)
@@ -32,9 +32,8 @@ test_expiration(void)
     {
       guint32 ni = htonl(i);
 
-      hn = NULL;
       positive = FALSE;
-      if (!dns_cache_lookup(AF_INET, (void *) &ni, &hn, &positive))
+      if (!dns_cache_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive))
         {
           fprintf(stderr, "hmmm cache forgot the cache entry too early, i=%d, hn=%s\n", i, hn);
           exit(1);
@@ -51,7 +50,7 @@ test_expiration(void)
             }
           else
             {
-              if (positive || hn != NULL)
+              if (positive || hn[0] != 0)
                 {
                   fprintf(stderr, "hmm, cache returned a positive match, where a negative match was expected, i=%d, hn=%s\n", i, hn);
                   exit(1);
@@ -69,11 +68,10 @@ test_expiration(void)
     {
       guint32 ni = htonl(i);
 
-      hn = NULL;
       positive = FALSE;
       if (i < 5000)
         {
-          if (!dns_cache_lookup(AF_INET, (void *) &ni, &hn, &positive) || !positive)
+          if (!dns_cache_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive) || !positive)
             {
               fprintf(stderr, "hmmm cache forgot positive entries too early, i=%d\n", i);
               exit(1);
@@ -81,7 +79,7 @@ test_expiration(void)
         }
       else
         {
-          if (dns_cache_lookup(AF_INET, (void *) &ni, &hn, &positive) || positive)
+          if (dns_cache_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive) || positive)
             {
               fprintf(stderr, "hmmm cache didn't forget negative entries in time, i=%d\n", i);
               exit(1);
@@ -98,9 +96,8 @@ test_expiration(void)
     {
       guint32 ni = htonl(i);
 
-      hn = NULL;
       positive = FALSE;
-      if (dns_cache_lookup(AF_INET, (void *) &ni, &hn, &positive))
+      if (dns_cache_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive))
         {
           fprintf(stderr, "hmmm cache did not forget an expired entry, i=%d\n", i);
           exit(1);
@@ -112,11 +109,10 @@ void
 test_dns_cache_benchmark(void)
 {
   GTimeVal start, end;
-  const gchar *hn;
+  gchar hn[256];
   gboolean positive;
   gint i;
 
-  dns_cache_init();
   dns_cache_set_params(50000, 600, 300, NULL);
 
   for (i = 0; i < 10000; i++)
@@ -132,8 +128,7 @@ test_dns_cache_benchmark(void)
     {
       guint32 ni = htonl(i % 10000);
 
-      hn = NULL;
-      if (!dns_cache_lookup(AF_INET, (void *) &ni, &hn, &positive))
+      if (!dns_cache_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive))
         {
           fprintf(stderr, "hmm, dns cache entries expired during benchmarking, this is unexpected\n, i=%d", i);
         }
@@ -161,6 +156,141 @@ test_inet_ntop_benchmark(void)
   printf("inet_ntop speed: %12.3f iters/sec\n", i * 1e6 / g_time_val_diff(&end, &start));
 }
 
+static gpointer
+store_thread(gpointer user_data)
+{
+  gint i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      guint32 ni = htonl(100000 + i);
+
+      dns_cache_store(FALSE, AF_INET, (void *) &ni, "shared", TRUE);
+    }
+  return NULL;
+}
+
+void
+test_shared_between_threads(void)
+{
+  GThread *thread;
+  gchar hn[256];
+  gboolean positive;
+  gint i;
+
+  dns_cache_set_params(50000, 600, 300, NULL);
+
+  /* entries stored by one thread are served to the others */
+  thread = g_thread_create(store_thread, NULL, TRUE, NULL);
+  g_thread_join(thread);
+
+  for (i = 0; i < 1000; i++)
+    {
+      guint32 ni = htonl(100000 + i);
+
+      if (!dns_cache_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive) || !positive || strcmp(hn, "shared") != 0)
+        {
+          fprintf(stderr, "hmm, cache entry stored by another thread was not found, i=%d\n", i);
+          exit(1);
+        }
+    }
+}
+
+static gint resolve_count;
+
+static gboolean
+stub_resolve(gint family, void *addr, gchar *hostname, gsize hostname_len)
+{
+  guint32 ni = *(guint32 *) addr;
+
+  g_atomic_int_inc(&resolve_count);
+  g_usleep(100000);
+  if (ntohl(ni) % 2)
+    return FALSE;
+  g_strlcpy(hostname, "hostname", hostname_len);
+  return TRUE;
+}
+
+void
+test_async_resolver(void)
+{
+  gchar hn[256];
+  gboolean positive;
+  gint i;
+  guint32 ni;
+
+  dns_resolver_set_resolve_func(stub_resolve);
+  dns_resolver_set_params(2, 0, 1007, 600, 300);
+
+  /* the lookup is in progress, repeated misses must not start new ones */
+  ni = htonl(2);
+  for (i = 0; i < 1000; i++)
+    {
+      if (dns_resolver_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive))
+        {
+          fprintf(stderr, "hmm, async resolver returned a result before the lookup could finish, i=%d\n", i);
+          exit(1);
+        }
+    }
+
+  /* waiting for the result, for a positive and a negative lookup */
+  dns_resolver_set_params(2, 5000, 1007, 600, 300);
+  if (!dns_resolver_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive) || !positive || strcmp(hn, "hostname") != 0)
+    {
+      fprintf(stderr, "hmm, async resolver didn't return the positive result\n");
+      exit(1);
+    }
+
+  ni = htonl(3);
+  for (i = 0; i < 2; i++)
+    {
+      if (!dns_resolver_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive) || positive)
+        {
+          fprintf(stderr, "hmm, async resolver didn't return the negative result, i=%d\n", i);
+          exit(1);
+        }
+    }
+
+  if (g_atomic_int_get(&resolve_count) != 2)
+    {
+      fprintf(stderr, "hmm, async resolver resolved the same addresses more than once, count=%d\n", resolve_count);
+      exit(1);
+    }
+
+  /* once the table is full, resolved positive entries are evicted, but
+   * the negative ones are kept until they expire */
+  dns_resolver_set_params(2, 5000, 2, 600, 300);
+  ni = htonl(4);
+  dns_resolver_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive);
+  ni = htonl(6);
+  dns_resolver_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive);
+  ni = htonl(3);
+  if (!dns_resolver_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive) || positive)
+    {
+      fprintf(stderr, "hmm, async resolver didn't return the negative result after eviction\n");
+      exit(1);
+    }
+  if (g_atomic_int_get(&resolve_count) != 4)
+    {
+      fprintf(stderr, "hmm, async resolver evicted a negative result, count=%d\n", resolve_count);
+      exit(1);
+    }
+
+  /* lookups still queued are dropped at shutdown */
+  dns_resolver_set_params(2, 0, 1007, 600, 300);
+  for (i = 0; i < 100; i++)
+    {
+      ni = htonl(1000 + i);
+      dns_resolver_lookup(AF_INET, (void *) &ni, hn, sizeof(hn), &positive);
+    }
+  dns_resolver_destroy();
+  if (g_atomic_int_get(&resolve_count) >= 4 + 100)
+    {
+      fprintf(stderr, "hmm, async resolver performed queued lookups at shutdown, count=%d\n", resolve_count);
+      exit(1);
+    }
+}
+
 int
 main()
 {
@@ -169,6 +299,8 @@ main()
   test_expiration();
   test_dns_cache_benchmark();
   test_inet_ntop_benchmark();
+  test_shared_between_threads();
+  test_async_resolver();
 
   app_shutdown();
   return 0;
@@ -0,0 +1,359 @@
+#include "filemonitor.h"
+#include "apphook.h"
+#include "timeutils.h"
+
+#include <iv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+gboolean fail = FALSE;
+
+#define test_fail(fmt, args...) \
+do {\
+ printf(fmt, ##args); \
+ fail = TRUE; \
+} while (0);
+
+static gchar test_dir[] = "/tmp/test_filemonitor.XXXXXX";
+
+typedef struct _TestMonitor
+{
+  FileMonitor *monitor;
+  gint calls;
+  gchar *last_name;
+  /* freed by the callback of this monitor */
+  struct _TestMonitor *victim;
+} TestMonitor;
+
+static void
+free_test_monitor(TestMonitor *self)
+{
+  if (self->monitor)
+    file_monitor_free(self->monitor);
+  self->monitor = NULL;
+}
+
+static void
+file_changed(gpointer user_data)
+{
+  TestMonitor *self = (TestMonitor *) user_data;
+
+  self->calls++;
+  if (self->victim)
+    {
+      free_test_monitor(self->victim);
+      self->victim = NULL;
+    }
+}
+
+static void
+directory_changed(const gchar *name, gpointer user_data)
+{
+  TestMonitor *self = (TestMonitor *) user_data;
+
+  self->calls++;
+  g_free(self->last_name);
+  self->last_name = g_strdup(name);
+}
+
+static void
+quit_loop(gpointer user_data)
+{
+  iv_quit();
+}
+
+/* runs the main loop for a while, so that inotify events are processed */
+static void
+run_loop(glong msec)
+{
+  struct iv_timer timer;
+
+  IV_TIMER_INIT(&timer);
+  timer.handler = quit_loop;
+  iv_validate_now();
+  timer.expires = iv_now;
+  timespec_add_msec(&timer.expires, msec);
+  iv_timer_register(&timer);
+  iv_main();
+}
+
+static gint
+count_inotify_instances(void)
+{
+  DIR *dir = opendir("/proc/self/fd");
+  struct dirent *entry;
+  gchar path[256], target[256];
+  gint count = 0;
+  gssize len;
+
+  if (!dir)
+    return 0;
+  while ((entry = readdir(dir)))
+    {
+      g_snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+      len = readlink(path, target, sizeof(target) - 1);
+      if (len < 0)
+        continue;
+      target[len] = 0;
+      if (strstr(target, "inotify"))
+        count++;
+    }
+  closedir(dir);
+  return count;
+}
+
+/* counts the watches of all inotify instances, through their fdinfo */
+static gint
+count_inotify_watches(void)
+{
+  DIR *dir = opendir("/proc/self/fd");
+  struct dirent *entry;
+  gchar path[256], target[256], line[512];
+  gint count = 0;
+  gssize len;
+  FILE *f;
+
+  if (!dir)
+    return 0;
+  while ((entry = readdir(dir)))
+    {
+      g_snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+      len = readlink(path, target, sizeof(target) - 1);
+      if (len < 0)
+        continue;
+      target[len] = 0;
+      if (!strstr(target, "inotify"))
+        continue;
+
+      g_snprintf(path, sizeof(path), "/proc/self/fdinfo/%s", entry->d_name);
+      f = fopen(path, "r");
+      if (!f)
+        continue;
+      while (fgets(line, sizeof(line), f))
+        {
+          if (strncmp(line, "inotify wd:", 11) == 0)
+            count++;
+        }
+      fclose(f);
+    }
+  closedir(dir);
+  return count;
+}
+
+static void
+write_file(const gchar *filename, const gchar *content)
+{
+  gint fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0600);
+
+  if (fd < 0 || write(fd, content, strlen(content)) < 0)
+    test_fail("error writing test file, filename=%s\n", filename);
+  if (fd >= 0)
+    close(fd);
+}
+
+static void
+test_file_and_directory_monitors(void)
+{
+  TestMonitor a = { 0 }, b = { 0 }, dir = { 0 };
+  gchar *a_name = g_build_filename(test_dir, "a.log", NULL);
+  gchar *b_name = g_build_filename(test_dir, "b.log", NULL);
+
+  a.monitor = file_monitor_new(a_name, file_changed, &a);
+  b.monitor = file_monitor_new(b_name, file_changed, &b);
+  dir.monitor = file_monitor_new_directory(test_dir, directory_changed, &dir);
+  if (!file_monitor_start(a.monitor) || !file_monitor_start(b.monitor) || !file_monitor_start(dir.monitor))
+    {
+      test_fail("error starting file monitors, is inotify available?\n");
+      return;
+    }
+
+  write_file(a_name, "foo\n");
+  run_loop(200);
+
+  if (a.calls == 0)
+    test_fail("file monitor was not notified about its file\n");
+  if (b.calls != 0)
+    test_fail("file monitor was notified about a different file, calls=%d\n", b.calls);
+  if (dir.calls == 0 || !dir.last_name || strcmp(dir.last_name, "a.log") != 0)
+    test_fail("directory monitor was not notified about the changed entry, calls=%d, name=%s\n",
+              dir.calls, dir.last_name ? dir.last_name : "(null)");
+
+  free_test_monitor(&a);
+  free_test_monitor(&b);
+  free_test_monitor(&dir);
+  if (count_inotify_instances() != 0)
+    test_fail("inotify instance is kept open without any monitors\n");
+
+  unlink(a_name);
+  g_free(a_name);
+  g_free(b_name);
+  g_free(dir.last_name);
+}
+
+static void
+test_directory_removed(void)
+{
+  TestMonitor a = { 0 };
+  gchar *subdir = g_build_filename(test_dir, "subdir", NULL);
+  gchar *a_name = g_build_filename(subdir, "a.log", NULL);
+
+  mkdir(subdir, 0700);
+  a.monitor = file_monitor_new(a_name, file_changed, &a);
+  if (!file_monitor_start(a.monitor))
+    {
+      test_fail("error starting file monitor, is inotify available?\n");
+      return;
+    }
+
+  rmdir(subdir);
+  run_loop(200);
+
+  if (a.calls == 0)
+    test_fail("file monitor was not notified about the removal of its directory\n");
+  if (file_monitor_is_active(a.monitor))
+    test_fail("file monitor is still active after its directory was removed\n");
+  if (count_inotify_instances() != 0)
+    test_fail("inotify instance is kept open after the last watch was removed by the kernel\n");
+
+  free_test_monitor(&a);
+  g_free(a_name);
+  g_free(subdir);
+}
+
+#define MANY_FILES 1000
+
+static void
+test_many_files(void)
+{
+  TestMonitor *monitors = g_new0(TestMonitor, MANY_FILES);
+  gchar *filename, *written = NULL;
+  gint i;
+
+  for (i = 0; i < MANY_FILES; i++)
+    {
+      filename = g_strdup_printf("%s/many%d.log", test_dir, i);
+      monitors[i].monitor = file_monitor_new(filename, file_changed, &monitors[i]);
+      if (!file_monitor_start(monitors[i].monitor))
+        {
+          test_fail("error starting file monitor, is inotify available? filename=%s\n", filename);
+          g_free(filename);
+          goto exit;
+        }
+      if (i == MANY_FILES / 2)
+        written = filename;
+      else
+        g_free(filename);
+    }
+
+  if (count_inotify_watches() != 1)
+    test_fail("monitors of the same directory don't share a single watch, watches=%d\n", count_inotify_watches());
+
+  write_file(written, "foo\n");
+  run_loop(200);
+
+  for (i = 0; i < MANY_FILES; i++)
+    {
+      if (i == MANY_FILES / 2 && monitors[i].calls == 0)
+        test_fail("file monitor was not notified about its file, index=%d\n", i);
+      else if (i != MANY_FILES / 2 && monitors[i].calls != 0)
+        test_fail("file monitor was notified about a different file, index=%d, calls=%d\n", i, monitors[i].calls);
+    }
+
+  /* the watch is kept until its last user is stopped */
+  for (i = 0; i < MANY_FILES - 1; i++)
+    free_test_monitor(&monitors[i]);
+  if (count_inotify_watches() != 1)
+    test_fail("directory watch was removed while still in use, watches=%d\n", count_inotify_watches());
+
+ exit:
+  for (i = 0; i < MANY_FILES; i++)
+    free_test_monitor(&monitors[i]);
+  if (count_inotify_instances() != 0)
+    test_fail("inotify instance is kept open without any monitors\n");
+
+  if (written)
+    unlink(written);
+  g_free(written);
+  g_free(monitors);
+}
+
+static gint
+get_max_queued_events(void)
+{
+  FILE *f = fopen("/proc/sys/fs/inotify/max_queued_events", "r");
+  gint value = 16384;
+
+  if (f)
+    {
+      if (fscanf(f, "%d", &value) != 1)
+        value = 16384;
+      fclose(f);
+    }
+  return value;
+}
+
+static void
+test_overflow(void)
+{
+  TestMonitor a = { 0 }, b = { 0 };
+  gchar *watched = g_build_filename(test_dir, "watched.log", NULL);
+  gchar *other[2];
+  gint i, max_events;
+
+  other[0] = g_build_filename(test_dir, "x.log", NULL);
+  other[1] = g_build_filename(test_dir, "y.log", NULL);
+
+  /* a is notified first, and frees b from its callback */
+  b.monitor = file_monitor_new(watched, file_changed, &b);
+  a.monitor = file_monitor_new(watched, file_changed, &a);
+  a.victim = &b;
+  if (!file_monitor_start(b.monitor) || !file_monitor_start(a.monitor))
+    {
+      test_fail("error starting file monitors, is inotify available?\n");
+      return;
+    }
+
+  /* alternate between two files, so that the kernel can't merge the events */
+  max_events = get_max_queued_events();
+  for (i = 0; i < max_events + 16; i++)
+    write_file(other[i % 2], "x");
+  run_loop(500);
+
+  if (a.calls != 1)
+    test_fail("file monitor was not notified about the overflow, calls=%d\n", a.calls);
+  if (b.monitor || b.calls != 0)
+    test_fail("file monitor freed by another callback was notified, calls=%d\n", b.calls);
+
+  free_test_monitor(&a);
+  unlink(other[0]);
+  unlink(other[1]);
+  g_free(other[0]);
+  g_free(other[1]);
+  g_free(watched);
+}
+
+int
+main(int argc, char *argv[])
+{
+  app_startup();
+
+  if (!mkdtemp(test_dir))
+    {
+      fprintf(stderr, "error creating temporary directory\n");
+      return 1;
+    }
+
+  test_file_and_directory_monitors();
+  test_directory_removed();
+  test_many_files();
+  test_overflow();
+
+  rmdir(test_dir);
+  app_shutdown();
+  return fail ? 1 : 0;
+}
@@ -1,5 +1,6 @@
 #include "logqueue.h"
 #include "logqueue-fifo.h"
+#include "logqueue-multi.h"
 #include "logpipe.h"
 #include "apphook.h"
 #include "plugin.h"
@@ -118,6 +119,137 @@ testcase_zero_diskbuf_alternating_send_acks()
   log_queue_unref(q);
 }
 
+gint
+drain_messages(LogQueue *q, gboolean use_app_acks)
+{
+  LogMessage *msg;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gint n = 0;
+
+  while (log_queue_pop_head(q, &msg, &path_options, use_app_acks, FALSE))
+    {
+      log_msg_ack(msg, &path_options);
+      log_msg_unref(msg);
+      n++;
+    }
+  return n;
+}
+
+void
+testcase_multi_consumers_steal_and_rewind()
+{
+  LogQueue *q, *c0, *c1;
+  gint drained0, drained1;
+
+  q = log_queue_multi_new(OVERFLOW_SIZE, NULL, 2);
+  log_queue_multi_set_local_batch(q, 16);
+  c0 = log_queue_multi_get_consumer(q, 0);
+  c1 = log_queue_multi_get_consumer(q, 1);
+
+  fed_messages = 0;
+  acked_messages = 0;
+  feed_some_messages(&q, 100, TRUE);
+
+  /* the first consumer takes a local batch, sends a couple of messages
+   * and then rewinds them, they must end up in its local batch again */
+  send_some_messages(c0, 10, TRUE);
+  rewind_messages(c0);
+  if (log_queue_get_length(q) != 100)
+    {
+      fprintf(stderr, "rewound messages are missing from the queue: length=%d\n", (gint) log_queue_get_length(q));
+      exit(1);
+    }
+
+  /* the second consumer depletes the shared pool and steals from the first one */
+  drained1 = drain_messages(c1, TRUE);
+  drained0 = drain_messages(c0, TRUE);
+  if (drained0 + drained1 != fed_messages || drained1 <= fed_messages - 16)
+    {
+      fprintf(stderr, "work-stealing didn't distribute messages properly: fed_messages=%d, drained0=%d, drained1=%d\n", fed_messages, drained0, drained1);
+      exit(1);
+    }
+
+  /* acks are tracked per consumer */
+  app_ack_some_messages(c1, drained1);
+  if (acked_messages != drained1)
+    {
+      fprintf(stderr, "backlog of a consumer acked messages of another one: acked_messages=%d, drained1=%d\n", acked_messages, drained1);
+      exit(1);
+    }
+  app_ack_some_messages(c0, drained0);
+  if (fed_messages != acked_messages)
+    {
+      fprintf(stderr, "did not receive enough acknowledgements: fed_messages=%d, acked_messages=%d\n", fed_messages, acked_messages);
+      exit(1);
+    }
+
+  log_queue_unref(c0);
+  log_queue_unref(c1);
+  log_queue_unref(q);
+}
+
+gint notified_consumers = 0;
+
+void
+test_notify(gpointer user_data)
+{
+  notified_consumers++;
+}
+
+void
+testcase_multi_consumers_failover()
+{
+  LogQueue *q, *c0, *c1;
+  gint drained1;
+
+  q = log_queue_multi_new(OVERFLOW_SIZE, NULL, 2);
+  log_queue_multi_set_local_batch(q, 16);
+  c0 = log_queue_multi_get_consumer(q, 0);
+  c1 = log_queue_multi_get_consumer(q, 1);
+
+  fed_messages = 0;
+  acked_messages = 0;
+  notified_consumers = 0;
+  feed_some_messages(&q, 16, TRUE);
+
+  /* the first consumer takes all messages, the pool is empty, but the
+   * second one could steal half of what is left */
+  send_some_messages(c0, 1, TRUE);
+  if (log_queue_get_length(c1) != 7)
+    {
+      fprintf(stderr, "stealable messages are not counted for an idle consumer: length=%d\n", (gint) log_queue_get_length(c1));
+      exit(1);
+    }
+
+  /* the first consumer fails, everything it had goes back to the pool,
+   * including its backlog, and the idle consumer is woken up */
+  log_queue_set_parallel_push(c1, 1, test_notify, NULL, NULL);
+  log_queue_multi_consumer_release(c0);
+  if (notified_consumers != 1)
+    {
+      fprintf(stderr, "idle consumer was not woken up by the failing one: notified_consumers=%d\n", notified_consumers);
+      exit(1);
+    }
+  if (log_queue_get_length(c0) != fed_messages || log_queue_get_length(c1) != fed_messages)
+    {
+      fprintf(stderr, "released messages are not in the shared pool: length0=%d, length1=%d\n",
+              (gint) log_queue_get_length(c0), (gint) log_queue_get_length(c1));
+      exit(1);
+    }
+
+  drained1 = drain_messages(c1, TRUE);
+  app_ack_some_messages(c1, drained1);
+  if (drained1 != fed_messages || fed_messages != acked_messages)
+    {
+      fprintf(stderr, "messages of the failing consumer were not taken over: fed_messages=%d, drained1=%d, acked_messages=%d\n", fed_messages, drained1, acked_messages);
+      exit(1);
+    }
+
+  log_queue_unref(c0);
+  log_queue_unref(c1);
+  log_queue_unref(q);
+}
+
 #define FEEDERS 1
 #define MESSAGES_PER_FEEDER 50000
 #define MESSAGES_SUM (FEEDERS * MESSAGES_PER_FEEDER)
@@ -313,5 +445,9 @@ main()
   fprintf(stderr,"Start testcase_zero_diskbuf_and_normal_acks\n");
   testcase_zero_diskbuf_and_normal_acks();
 #endif
+  fprintf(stderr,"Start testcase_multi_consumers_steal_and_rewind\n");
+  testcase_multi_consumers_steal_and_rewind();
+  fprintf(stderr,"Start testcase_multi_consumers_failover\n");
+  testcase_multi_consumers_failover();
   return 0;
 }
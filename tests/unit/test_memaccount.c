@@ -0,0 +1,136 @@
+#include "apphook.h"
+#include "memaccount.h"
+#include "logmsg.h"
+#include "cfg.h"
+#include "plugin.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+gboolean fail = FALSE;
+
+#define test_fail(fmt, args...) \
+do {\
+ printf(fmt, ##args); \
+ fail = TRUE; \
+} while (0);
+
+static void
+assert_usage(MemAccountCategory category, gint64 expected_bytes, gint64 expected_objects, const gchar *what)
+{
+  gint64 bytes = mem_account_get_bytes(category);
+  gint64 objects = mem_account_get_objects(category);
+
+  if (bytes != expected_bytes || objects != expected_objects)
+    test_fail("memory accounting mismatch (%s), category=%s, bytes=%" G_GINT64_FORMAT ", expected_bytes=%" G_GINT64_FORMAT ", objects=%" G_GINT64_FORMAT ", expected_objects=%" G_GINT64_FORMAT "\n",
+              what, mem_account_get_category_name(category), bytes, expected_bytes, objects, expected_objects);
+}
+
+void
+test_thread_deltas(void)
+{
+  gint64 bytes, objects;
+
+  mem_account_flush_thread();
+  bytes = mem_account_get_bytes(MA_DNS_CACHE);
+  objects = mem_account_get_objects(MA_DNS_CACHE);
+
+  /* small changes are kept in the thread until flushed */
+  mem_account_alloc(MA_DNS_CACHE, 100);
+  assert_usage(MA_DNS_CACHE, bytes, objects, "pending");
+  mem_account_flush_thread();
+  assert_usage(MA_DNS_CACHE, bytes + 100, objects + 1, "flushed");
+
+  /* large ones are added right away */
+  mem_account_alloc(MA_DNS_CACHE, MEM_ACCOUNT_FLUSH_BYTES + 1);
+  assert_usage(MA_DNS_CACHE, bytes + 100 + MEM_ACCOUNT_FLUSH_BYTES + 1, objects + 2, "large");
+
+  mem_account_free(MA_DNS_CACHE, MEM_ACCOUNT_FLUSH_BYTES + 1);
+  mem_account_free(MA_DNS_CACHE, 100);
+  mem_account_flush_thread();
+  assert_usage(MA_DNS_CACHE, bytes, objects, "freed");
+}
+
+void
+test_logmsg(void)
+{
+  LogMessage *msg;
+  gchar value[4096];
+  gint64 bytes, objects;
+
+  mem_account_flush_thread();
+  bytes = mem_account_get_bytes(MA_LOGMSG);
+  objects = mem_account_get_objects(MA_LOGMSG);
+
+  msg = log_msg_new_empty();
+  /* grow the payload beyond its initial allocation */
+  memset(value, 'x', sizeof(value));
+  log_msg_set_value(msg, LM_V_MESSAGE, value, sizeof(value));
+  mem_account_flush_thread();
+
+  if (mem_account_get_bytes(MA_LOGMSG) < bytes + (gint64) log_msg_get_size(msg))
+    test_fail("memory accounting mismatch, message not accounted, bytes=%" G_GINT64_FORMAT ", size=%" G_GSIZE_FORMAT "\n",
+              mem_account_get_bytes(MA_LOGMSG) - bytes, log_msg_get_size(msg));
+  if (mem_account_get_objects(MA_LOGMSG) != objects + 1)
+    test_fail("memory accounting mismatch, objects=%" G_GINT64_FORMAT "\n", mem_account_get_objects(MA_LOGMSG) - objects);
+
+  log_msg_unref(msg);
+  mem_account_flush_thread();
+  assert_usage(MA_LOGMSG, bytes, objects, "logmsg freed");
+}
+
+void
+test_large_logmsg(void)
+{
+  MsgFormatOptions parse_options;
+  LogMessage *msg;
+  gchar *raw;
+  gsize raw_len = 300 * 1024;
+  gint64 bytes, objects;
+
+  configuration = cfg_new(0x0302);
+  plugin_load_module("syslogformat", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  raw = g_malloc(raw_len + 1);
+  memset(raw, 'x', raw_len);
+  memcpy(raw, "<5>", 3);
+  raw[raw_len] = 0;
+
+  mem_account_flush_thread();
+  bytes = mem_account_get_bytes(MA_LOGMSG);
+  objects = mem_account_get_objects(MA_LOGMSG);
+
+  /* the initial payload is as large as an NVTable can get */
+  msg = log_msg_new(raw, raw_len, NULL, &parse_options);
+  mem_account_flush_thread();
+
+  if (log_msg_get_size(msg) < NVTABLE_MAX_BYTES)
+    test_fail("large message size mismatch, size=%" G_GSIZE_FORMAT ", expected at least %d\n",
+              log_msg_get_size(msg), NVTABLE_MAX_BYTES);
+  if (mem_account_get_bytes(MA_LOGMSG) < bytes + (gint64) log_msg_get_size(msg))
+    test_fail("memory accounting mismatch, large message not accounted, bytes=%" G_GINT64_FORMAT ", size=%" G_GSIZE_FORMAT "\n",
+              mem_account_get_bytes(MA_LOGMSG) - bytes, log_msg_get_size(msg));
+
+  log_msg_unref(msg);
+  mem_account_flush_thread();
+  assert_usage(MA_LOGMSG, bytes, objects, "large logmsg freed");
+
+  g_free(raw);
+  msg_format_options_destroy(&parse_options);
+  cfg_free(configuration);
+  configuration = NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  app_startup();
+  test_thread_deltas();
+  test_logmsg();
+  test_large_logmsg();
+  app_shutdown();
+  return fail ? 1 : 0;
+}
@@ -729,6 +729,83 @@ test_nvtable_lookup()
     }
 }
 
+/*
+ * - NVTable overlays
+ *   - values not present in the overlay are looked up in the base
+ *   - values set in the overlay shadow those in the base, including zero-length ones
+ *   - new_entry is only set for values that are present in neither
+ *   - references to base values are stored as copies
+ *   - flattening merges the overlay and the base
+ */
+static gboolean
+test_nvtable_overlay_count(NVHandle handle, const gchar *name, const gchar *value, gssize value_len, gpointer user_data)
+{
+  (*(gint *) user_data)++;
+  return FALSE;
+}
+
+void
+test_nvtable_overlay(void)
+{
+  NVTable *base, *tab, *flat;
+  gchar value[1024];
+  gboolean success, new_entry;
+  gint i, count = 0;
+
+  for (i = 0; i < sizeof(value); i++)
+    value[i] = 'A' + (i % 26);
+
+  fprintf(stderr, "Testing overlays\n");
+
+  base = nv_table_new(STATIC_VALUES, STATIC_VALUES, 1024);
+  success = nv_table_add_value(base, STATIC_HANDLE, STATIC_NAME, 4, value, 128, NULL);
+  TEST_ASSERT(success == TRUE);
+  success = nv_table_add_value(base, DYN_HANDLE, DYN_NAME, strlen(DYN_NAME), value, 64, NULL);
+  TEST_ASSERT(success == TRUE);
+  success = nv_table_add_value(base, DYN_HANDLE + 1, "VAL18", 5, value, 32, NULL);
+  TEST_ASSERT(success == TRUE);
+
+  tab = nv_table_new_overlay(base, 64);
+  TEST_ASSERT(nv_table_is_overlay(tab));
+  TEST_NVTABLE_ASSERT(tab, STATIC_HANDLE, value, 128);
+  TEST_NVTABLE_ASSERT(tab, DYN_HANDLE, value, 64);
+
+  success = nv_table_add_value(tab, STATIC_HANDLE, STATIC_NAME, 4, value + 32, 32, &new_entry);
+  TEST_ASSERT(success == TRUE && new_entry == FALSE);
+  success = nv_table_add_value(tab, DYN_HANDLE, DYN_NAME, strlen(DYN_NAME), "", 0, NULL);
+  TEST_ASSERT(success == TRUE);
+  success = nv_table_add_value(tab, DYN_HANDLE + 2, "VAL19", 5, value, 16, &new_entry);
+  TEST_ASSERT(success == TRUE && new_entry == TRUE);
+  success = nv_table_add_value_indirect(tab, DYN_HANDLE + 3, "VAL20", 5, DYN_HANDLE + 1, 0, 1, 8, NULL);
+  TEST_ASSERT(success == TRUE);
+
+  TEST_NVTABLE_ASSERT(tab, STATIC_HANDLE, value + 32, 32);
+  TEST_NVTABLE_ASSERT(tab, DYN_HANDLE, "", 0);
+  TEST_NVTABLE_ASSERT(tab, DYN_HANDLE + 1, value, 32);
+  TEST_NVTABLE_ASSERT(tab, DYN_HANDLE + 2, value, 16);
+  TEST_NVTABLE_ASSERT(tab, DYN_HANDLE + 3, value + 1, 8);
+
+  /* the base is left intact */
+  TEST_NVTABLE_ASSERT(base, STATIC_HANDLE, value, 128);
+  TEST_NVTABLE_ASSERT(base, DYN_HANDLE, value, 64);
+  TEST_NVTABLE_ASSERT(base, DYN_HANDLE + 2, "", 0);
+
+  nv_table_foreach(tab, logmsg_registry, test_nvtable_overlay_count, &count);
+  TEST_ASSERT(count == 5);
+
+  flat = nv_table_flatten(tab, 0);
+  TEST_ASSERT(!nv_table_is_overlay(flat));
+  TEST_NVTABLE_ASSERT(flat, STATIC_HANDLE, value + 32, 32);
+  TEST_NVTABLE_ASSERT(flat, DYN_HANDLE, "", 0);
+  TEST_NVTABLE_ASSERT(flat, DYN_HANDLE + 1, value, 32);
+  TEST_NVTABLE_ASSERT(flat, DYN_HANDLE + 2, value, 16);
+  TEST_NVTABLE_ASSERT(flat, DYN_HANDLE + 3, value + 1, 8);
+
+  nv_table_unref(flat);
+  nv_table_unref(tab);
+  nv_table_unref(base);
+}
+
 void
 test_nvtable(void)
 {
@@ -736,6 +813,7 @@ test_nvtable(void)
   test_nvtable_indirect();
   test_nvtable_others();
   test_nvtable_lookup();
+  test_nvtable_overlay();
 }
 
 int
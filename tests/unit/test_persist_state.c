@@ -102,6 +102,100 @@ test_values(void)
   persist_state_free(state);
 }
 
+static PersistState *
+test_journal_open(void)
+{
+  PersistState *state;
+
+  state = persist_state_new("test_journal.persist");
+  if (!persist_state_start(state))
+    {
+      fprintf(stderr, "Error starting persist_state object\n");
+      exit(1);
+    }
+  return state;
+}
+
+static gboolean
+test_journal_has_key(PersistState *state, const gchar *key)
+{
+  gsize size;
+  guint8 version;
+
+  return persist_state_lookup_entry(state, key, &size, &version) != 0;
+}
+
+void
+test_journal(void)
+{
+  PersistState *state;
+  gint i;
+
+  unlink("test_journal.persist");
+  state = test_journal_open();
+  for (i = 0; i < 100; i++)
+    {
+      gchar buf[16];
+
+      g_snprintf(buf, sizeof(buf), "key%d", i);
+      if (!persist_state_alloc_entry(state, buf, 16))
+        {
+          fprintf(stderr, "Error allocating value in the persist file: %s\n", buf);
+          exit(1);
+        }
+    }
+  persist_state_commit(state);
+  persist_state_free(state);
+
+  /* reopened in place: only the entries looked up are kept */
+  state = test_journal_open();
+  for (i = 0; i < 100; i += 2)
+    {
+      gchar buf[16];
+
+      g_snprintf(buf, sizeof(buf), "key%d", i);
+      if (!test_journal_has_key(state, buf))
+        {
+          fprintf(stderr, "Error retrieving value from the journal: %s\n", buf);
+          exit(1);
+        }
+    }
+  persist_state_alloc_string(state, "appended", "value", -1);
+  persist_state_commit(state);
+  persist_state_free(state);
+
+  state = test_journal_open();
+  for (i = 0; i < 100; i++)
+    {
+      gchar buf[16];
+
+      g_snprintf(buf, sizeof(buf), "key%d", i);
+      if (test_journal_has_key(state, buf) != (i % 2 == 0))
+        {
+          fprintf(stderr, "Unused entry was not dropped or used entry was lost: %s\n", buf);
+          exit(1);
+        }
+    }
+  if (!test_journal_has_key(state, "appended"))
+    {
+      fprintf(stderr, "Error retrieving appended value from the journal\n");
+      exit(1);
+    }
+
+  /* cancel reverts the entries appended since start */
+  persist_state_alloc_string(state, "cancelled", "value", -1);
+  persist_state_cancel(state);
+  persist_state_free(state);
+
+  state = test_journal_open();
+  if (test_journal_has_key(state, "cancelled") || !test_journal_has_key(state, "appended"))
+    {
+      fprintf(stderr, "persist_state_cancel() did not revert the journal\n");
+      exit(1);
+    }
+  persist_state_free(state);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -110,5 +204,6 @@ main(int argc, char *argv[])
 #endif
   app_startup();
   test_values();
+  test_journal();
   return 0;
 }
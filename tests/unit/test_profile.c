@@ -0,0 +1,177 @@
+#include "apphook.h"
+#include "logpipe.h"
+#include "logmsg.h"
+#include "cfg.h"
+#include "cfg-tree.h"
+#include "control.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+gboolean fail = FALSE;
+
+#define test_fail(fmt, args...) \
+do {\
+ printf(fmt, ##args); \
+ fail = TRUE; \
+} while (0);
+
+typedef void (*TestQueueFunc)(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data);
+
+static void
+sleeping_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  g_usleep(GPOINTER_TO_INT(user_data));
+  log_pipe_forward_msg(s, msg, path_options);
+}
+
+static void
+dropping_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  g_usleep(GPOINTER_TO_INT(user_data));
+  log_msg_unref(msg);
+}
+
+/* creates a pipe the way cfg_tree_compile() would, with a rule named
+ * @name if it is not NULL */
+static LogPipe *
+create_pipe(const gchar *name, gint line, TestQueueFunc queue, gint sleep_usec)
+{
+  LogPipe *pipe = log_pipe_new();
+
+  pipe->queue = queue;
+  pipe->queue_data = GINT_TO_POINTER(sleep_usec);
+  if (name)
+    {
+      LogExprNode *node = log_expr_node_new(ENL_SINGLE, ENC_FILTER, name, NULL, 0, NULL);
+
+      node->filename = g_strdup("test.conf");
+      node->line = line;
+      node->column = 1;
+      pipe->expr_node = node;
+      g_ptr_array_add(configuration->tree.rules, node);
+    }
+  log_pipe_init(pipe, configuration);
+  g_ptr_array_add(configuration->tree.initialized_pipes, pipe);
+  return pipe;
+}
+
+static void
+send_messages(LogPipe *pipe, gint num)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gint i;
+
+  path_options.ack_needed = FALSE;
+  for (i = 0; i < num; i++)
+    log_pipe_queue(pipe, log_msg_new_empty(), &path_options);
+}
+
+static void
+assert_reply(const gchar *command, const gchar *expected_prefix)
+{
+  gchar *reply = control_process_profile(configuration, command);
+
+  if (strncmp(reply, expected_prefix, strlen(expected_prefix)) != 0)
+    test_fail("unexpected PROFILE reply, command='%s', reply='%s', expected_prefix='%s'\n", command, reply, expected_prefix);
+  g_free(reply);
+}
+
+static gint
+count_lines(const gchar *text)
+{
+  gint lines = 0;
+
+  for (; *text; text++)
+    if (*text == '\n')
+      lines++;
+  return lines;
+}
+
+void
+test_profile(void)
+{
+  LogPipe *p1, *p2, *p3, *p4;
+  guint64 ticks, start;
+  gchar *reply;
+
+  /* p2 has no rule, its time is charged to p1 */
+  p1 = create_pipe("f_cheap", 10, sleeping_queue, 2000);
+  p2 = create_pipe(NULL, 0, NULL, 0);
+  p3 = create_pipe("d_expensive", 20, dropping_queue, 10000);
+  p4 = create_pipe("d_threaded", 30, dropping_queue, 0);
+  log_pipe_append(p1, p2);
+  log_pipe_append(p2, p3);
+
+  /* nothing is measured unless started */
+  send_messages(p1, 1);
+  start = log_pipe_profile_begin();
+  log_pipe_profile_end(p4, start);
+  if (p1->profile_calls || p3->profile_calls || p4->profile_ticks)
+    test_fail("profile collected while not started\n");
+
+  assert_reply("PROFILE START", "OK");
+  send_messages(p1, 5);
+
+  if (p1->profile_calls != 5 || p2->profile_calls != 0 || p3->profile_calls != 5)
+    test_fail("profile calls mismatch, p1=%u, p2=%u, p3=%u\n", p1->profile_calls, p2->profile_calls, p3->profile_calls);
+  /* without subtracting p3's time p1 would be the more expensive one */
+  if (p1->profile_ticks == 0 || p1->profile_ticks >= p3->profile_ticks)
+    test_fail("profile self time mismatch, p1=%" G_GUINT64_FORMAT ", p3=%" G_GUINT64_FORMAT "\n", p1->profile_ticks, p3->profile_ticks);
+
+  /* work done on behalf of a pipe, outside of its queue method */
+  start = log_pipe_profile_begin();
+  g_usleep(1000);
+  log_pipe_profile_end(p4, start);
+  if (p4->profile_ticks == 0 || p4->profile_calls != 0)
+    test_fail("profile end mismatch, ticks=%" G_GUINT64_FORMAT ", calls=%u\n", p4->profile_ticks, p4->profile_calls);
+
+  assert_reply("PROFILE STOP", "OK");
+  ticks = p1->profile_ticks;
+  send_messages(p1, 1);
+  if (p1->profile_ticks != ticks || p1->profile_calls != 5)
+    test_fail("profile collected after stop\n");
+
+  /* pipes without calls are not listed, the most expensive comes first */
+  reply = control_process_profile(configuration, "PROFILE SHOW");
+  if (count_lines(reply) != 3 || !strstr(reply, "\nd_expensive;test.conf:20:1;5;") || strstr(reply, "d_threaded"))
+    test_fail("unexpected PROFILE SHOW reply, reply='%s'\n", reply);
+  else if (strstr(reply, "f_cheap") < strstr(reply, "d_expensive"))
+    test_fail("PROFILE SHOW is not ordered by time, reply='%s'\n", reply);
+  g_free(reply);
+
+  reply = control_process_profile(configuration, "PROFILE SHOW 1");
+  if (count_lines(reply) != 2 || !strstr(reply, "\nd_expensive;"))
+    test_fail("unexpected PROFILE SHOW 1 reply, reply='%s'\n", reply);
+  g_free(reply);
+
+  assert_reply("PROFILE", "Invalid arguments");
+  assert_reply("PROFILE FOO", "Invalid arguments");
+  assert_reply("PROFILE SHOW 0", "Invalid arguments");
+  assert_reply("PROFILE SHOW 1x", "Invalid arguments");
+
+  /* START clears the previous measurements */
+  assert_reply("PROFILE START", "OK");
+  if (p1->profile_calls || p1->profile_ticks || p3->profile_calls || p4->profile_ticks)
+    test_fail("profile not reset on start\n");
+  assert_reply("PROFILE STOP", "OK");
+
+  log_pipe_deinit(p1);
+  log_pipe_deinit(p2);
+  log_pipe_deinit(p3);
+  log_pipe_deinit(p4);
+}
+
+int
+main(int argc, char *argv[])
+{
+  app_startup();
+  configuration = cfg_new(0x0303);
+
+  test_profile();
+
+  cfg_free(configuration);
+  app_shutdown();
+  return fail ? 1 : 0;
+}
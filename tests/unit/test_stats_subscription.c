@@ -0,0 +1,189 @@
+#include "apphook.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+gboolean fail = FALSE;
+
+#define test_fail(fmt, args...) \
+do {\
+ printf(fmt, ##args); \
+ fail = TRUE; \
+} while (0);
+
+static void
+assert_query(StatsSubscription *sub, gint expected_changes, const gchar *expected)
+{
+  GString *result = g_string_sized_new(128);
+  gint changes;
+
+  changes = stats_subscription_query(sub, result);
+  /* a NULL @expected only checks the number of changes, as the order of counters is undefined */
+  if (changes != expected_changes || (expected && strcmp(result->str, expected) != 0))
+    test_fail("stats subscription mismatch, changes=%d, expected_changes=%d, result='%s', expected='%s'\n",
+              changes, expected_changes, result->str, expected ? : "");
+  g_string_free(result, TRUE);
+}
+
+void
+test_subscription(void)
+{
+  StatsSubscription *all, *filtered;
+  StatsCounterItem *src_counter, *dst_counter, *dst_dropped;
+
+  stats_lock();
+  stats_register_counter(0, SCS_SOURCE | SCS_GROUP, "s_net", NULL, SC_TYPE_PROCESSED, &src_counter);
+  stats_register_counter(0, SCS_DESTINATION | SCS_GROUP, "d_file", NULL, SC_TYPE_PROCESSED, &dst_counter);
+  stats_unlock();
+
+  filtered = stats_subscription_new("s_*");
+  all = stats_subscription_new(NULL);
+
+  stats_counter_add(src_counter, 5);
+  /* the first query reports every matching counter */
+  assert_query(filtered, 1, "source;s_net;;processed;5;5\n");
+  assert_query(filtered, 0, "");
+
+  stats_counter_inc(src_counter);
+  stats_counter_inc(src_counter);
+  assert_query(filtered, 1, "source;s_net;;processed;7;2\n");
+
+  assert_query(all, 2, NULL);
+  /* only the counter that changed is reported */
+  stats_counter_inc(dst_counter);
+  assert_query(all, 1, "destination;d_file;;processed;1;1\n");
+
+  /* newly registered counters are picked up */
+  stats_lock();
+  stats_register_counter(0, SCS_DESTINATION | SCS_GROUP, "d_file", NULL, SC_TYPE_DROPPED, &dst_dropped);
+  stats_unlock();
+  stats_counter_add(dst_dropped, 3);
+  assert_query(all, 1, "destination;d_file;;dropped;3;3\n");
+  assert_query(filtered, 0, "");
+
+  stats_subscription_free(all);
+  stats_subscription_free(filtered);
+
+  stats_lock();
+  stats_unregister_counter(SCS_SOURCE | SCS_GROUP, "s_net", NULL, SC_TYPE_PROCESSED, &src_counter);
+  stats_unregister_counter(SCS_DESTINATION | SCS_GROUP, "d_file", NULL, SC_TYPE_PROCESSED, &dst_counter);
+  stats_unregister_counter(SCS_DESTINATION | SCS_GROUP, "d_file", NULL, SC_TYPE_DROPPED, &dst_dropped);
+  stats_unlock();
+}
+
+static void
+assert_percentile(StatsHistogram *histogram, gint percent, guint32 expected)
+{
+  guint32 value = stats_histogram_percentile(histogram, percent);
+
+  if (value != expected)
+    test_fail("histogram percentile mismatch, percent=%d, value=%u, expected=%u\n", percent, value, expected);
+}
+
+void
+test_histogram(void)
+{
+  StatsHistogram *histogram;
+  time_t now = time(NULL);
+  gchar *csv;
+  gint i;
+
+  stats_lock();
+  stats_register_histogram(0, SCS_DESTINATION | SCS_FILE, "d_file", "/var/log/messages", &histogram);
+  stats_unlock();
+
+  assert_percentile(histogram, 50, 0);
+
+  /* 1..3 are exact, 100 falls into the [96, 111] bucket */
+  for (i = 0; i < 90; i++)
+    stats_histogram_record(histogram, 3, now);
+  for (i = 0; i < 10; i++)
+    stats_histogram_record(histogram, 100, now);
+
+  assert_percentile(histogram, 50, 3);
+  assert_percentile(histogram, 90, 3);
+  assert_percentile(histogram, 95, 111);
+  assert_percentile(histogram, 100, 111);
+  if (stats_histogram_max(histogram) != 100)
+    test_fail("histogram max mismatch, max=%u\n", stats_histogram_max(histogram));
+
+  csv = stats_generate_csv();
+  if (!strstr(csv, "dst.file;d_file;/var/log/messages;a;latency_p95;111\n"))
+    test_fail("latency percentiles missing from the CSV output: %s\n", csv);
+  g_free(csv);
+
+  /* the previous window is still counted after a rotation */
+  now += STATS_HISTOGRAM_WINDOW;
+  stats_histogram_record(histogram, 1000, now);
+  assert_percentile(histogram, 50, 3);
+  assert_percentile(histogram, 100, 1023);
+  if (stats_histogram_max(histogram) != 1000)
+    test_fail("histogram max mismatch after rotation, max=%u\n", stats_histogram_max(histogram));
+
+  /* the window before it is dropped */
+  now += STATS_HISTOGRAM_WINDOW;
+  stats_histogram_rotate(histogram, now);
+  assert_percentile(histogram, 50, 1023);
+  if (stats_histogram_max(histogram) != 1000)
+    test_fail("histogram max mismatch after the second rotation, max=%u\n", stats_histogram_max(histogram));
+
+  /* an idle histogram is cleared completely */
+  now += 2 * STATS_HISTOGRAM_WINDOW;
+  stats_histogram_rotate(histogram, now);
+  assert_percentile(histogram, 50, 0);
+  if (stats_histogram_max(histogram) != 0)
+    test_fail("histogram max mismatch when idle, max=%u\n", stats_histogram_max(histogram));
+
+  stats_lock();
+  stats_unregister_histogram(SCS_DESTINATION | SCS_FILE, "d_file", "/var/log/messages", &histogram);
+  stats_unlock();
+}
+
+void
+test_subscription_latency(void)
+{
+  StatsSubscription *sub;
+  StatsHistogram *histogram;
+  time_t now = time(NULL);
+
+  stats_lock();
+  stats_register_histogram(0, SCS_DESTINATION | SCS_GROUP, "d_latency", NULL, &histogram);
+  stats_unlock();
+
+  sub = stats_subscription_new("d_latency");
+
+  stats_histogram_record(histogram, 3, now);
+  assert_query(sub, 4,
+               "destination;d_latency;;latency_p50;3;3\n"
+               "destination;d_latency;;latency_p95;3;3\n"
+               "destination;d_latency;;latency_p99;3;3\n"
+               "destination;d_latency;;latency_max;3;3\n");
+  assert_query(sub, 0, "");
+
+  stats_histogram_record(histogram, 100, now);
+  /* the median stays the same, it is not reported */
+  assert_query(sub, 3,
+               "destination;d_latency;;latency_p95;111;108\n"
+               "destination;d_latency;;latency_p99;111;108\n"
+               "destination;d_latency;;latency_max;100;97\n");
+
+  stats_subscription_free(sub);
+
+  stats_lock();
+  stats_unregister_histogram(SCS_DESTINATION | SCS_GROUP, "d_latency", NULL, &histogram);
+  stats_unlock();
+}
+
+int
+main(int argc, char *argv[])
+{
+  app_startup();
+  test_subscription();
+  test_histogram();
+  test_subscription_latency();
+  app_shutdown();
+  return fail ? 1 : 0;
+}